@@ -0,0 +1,377 @@
+#include "AovExpression.h"
+#include <algorithm>
+#include <cmath>
+#include "Image.h"
+#include "TaskScheduler.h"
+#include "Trace.h"
+
+
+// Recursive descent over the text, emitting the program as it goes.
+class AovParser {
+    public:
+        AovParser(const QString& text, const OIIO::ImageSpec& spec, AovExpression& expression):
+            text(text), spec(spec), expression(expression) {}
+
+        bool parse(QString& error) {
+            bool parsed = this->sum();
+            this->skipSpace();
+            if (parsed && this->position < this->text.size()) {
+                parsed = this->fail(QString("Unexpected '%1'").arg(this->text[this->position]));
+            }
+            if (parsed && this->expression.program.empty()) {
+                parsed = this->fail("Empty expression");
+            }
+            error = this->error;
+            return parsed;
+        }
+
+    private:
+        using Op = AovExpression::Op;
+        const QString& text;
+        const OIIO::ImageSpec& spec;
+        AovExpression& expression;
+        int position = 0;
+        int depth = 0;
+        QString error;
+
+        bool fail(const QString& message) {
+            if (this->error.isEmpty()) {
+                this->error = message;
+            }
+            return false;
+        }
+
+
+        void skipSpace() {
+            while (this->position < this->text.size() && this->text[this->position].isSpace()) {
+                this->position++;
+            }
+        }
+
+
+        bool accept(QChar c) {
+            this->skipSpace();
+            if (this->position < this->text.size() && this->text[this->position] == c) {
+                this->position++;
+                return true;
+            }
+            return false;
+        }
+
+
+        // Loads and constants push a value, operators take two and leave one.
+        bool push(Op op, int input = 0, float value = 0.0f) {
+            if (op == Op::Load || op == Op::Constant) {
+                this->depth++;
+            } else if (op != Op::Negate && op != Op::Abs) {
+                this->depth--;
+            }
+            if (this->depth > AovExpression::max_depth) {
+                return this->fail("Expression nests too deep");
+            }
+            this->expression.program.push_back({op, input, value});
+            return true;
+        }
+
+
+        bool sum() {
+            if (!this->product()) {
+                return false;
+            }
+            while (true) {
+                if (this->accept('+')) {
+                    if (!this->product() || !this->push(Op::Add)) {
+                        return false;
+                    }
+                } else if (this->accept('-')) {
+                    if (!this->product() || !this->push(Op::Subtract)) {
+                        return false;
+                    }
+                } else {
+                    return true;
+                }
+            }
+        }
+
+
+        bool product() {
+            if (!this->unary()) {
+                return false;
+            }
+            while (true) {
+                if (this->accept('*')) {
+                    if (!this->unary() || !this->push(Op::Multiply)) {
+                        return false;
+                    }
+                } else if (this->accept('/')) {
+                    if (!this->unary() || !this->push(Op::Divide)) {
+                        return false;
+                    }
+                } else {
+                    return true;
+                }
+            }
+        }
+
+
+        bool unary() {
+            if (this->accept('-')) {
+                return this->unary() && this->push(Op::Negate);
+            }
+            return this->primary();
+        }
+
+
+        bool primary() {
+            if (this->accept('(')) {
+                return this->sum() && (this->accept(')') || this->fail("Missing ')'"));
+            }
+
+            this->skipSpace();
+            if (this->position >= this->text.size()) {
+                return this->fail("Unexpected end of expression");
+            }
+
+            const QChar c = this->text[this->position];
+            if (c.isDigit() || c == '.') {
+                return this->number();
+            }
+            if (c == '"') {
+                int end = this->text.indexOf('"', this->position + 1);
+                if (end == -1) {
+                    return this->fail("Missing '\"'");
+                }
+                QString name = this->text.mid(this->position + 1, end - this->position - 1);
+                this->position = end + 1;
+                return this->load(name);
+            }
+            if (!c.isLetter() && c != '_') {
+                return this->fail(QString("Unexpected '%1'").arg(c));
+            }
+
+            int start = this->position;
+            while (this->position < this->text.size() && (this->text[this->position].isLetterOrNumber()
+                   || this->text[this->position] == '_' || this->text[this->position] == '.')) {
+                this->position++;
+            }
+            QString name = this->text.mid(start, this->position - start);
+
+            if (this->accept('(')) {
+                return this->function(name);
+            }
+            return this->load(name);
+        }
+
+
+        bool function(const QString& name) {
+            if (name == "abs") {
+                return this->sum() && (this->accept(')') || this->fail("Missing ')'")) && this->push(Op::Abs);
+            }
+            if (name != "min" && name != "max") {
+                return this->fail("Unknown function: " + name);
+            }
+            if (!this->sum() || !(this->accept(',') || this->fail("min and max take two values")) || !this->sum()
+                || !(this->accept(')') || this->fail("Missing ')'"))) {
+                return false;
+            }
+            return this->push(name == "min" ? Op::Min : Op::Max);
+        }
+
+
+        bool number() {
+            int start = this->position;
+            while (this->position < this->text.size() && (this->text[this->position].isDigit()
+                   || this->text[this->position] == '.')) {
+                this->position++;
+            }
+            if (this->position < this->text.size() && this->text[this->position].toLower() == 'e') {
+                int exponent = this->position + 1;
+                if (exponent < this->text.size() && (this->text[exponent] == '+' || this->text[exponent] == '-')) {
+                    exponent++;
+                }
+                if (exponent < this->text.size() && this->text[exponent].isDigit()) {
+                    this->position = exponent;
+                    while (this->position < this->text.size() && this->text[this->position].isDigit()) {
+                        this->position++;
+                    }
+                }
+            }
+
+            bool ok = false;
+            float value = this->text.mid(start, this->position - start).toFloat(&ok);
+            if (!ok) {
+                return this->fail("Invalid number: " + this->text.mid(start, this->position - start));
+            }
+            return this->push(Op::Constant, 0, value);
+        }
+
+
+        // A layer, or a single channel by its full name.
+        bool load(const QString& name) {
+            std::vector<int> indices;
+            std::vector<std::string> names;
+            Image::findLayerChannels(this->spec, name, indices, names);
+
+            AovExpression::Input input;
+            if (!indices.empty()) {
+                for (int lane = 0; lane < 3; ++lane) {
+                    input.channels[lane] = indices[indices.size() >= 3 ? lane : 0];
+                }
+                if (this->expression.alpha_channel == -1 && indices.size() >= 4) {
+                    this->expression.alpha_channel = indices[3];
+                }
+            } else {
+                auto found = std::find(this->spec.channelnames.begin(), this->spec.channelnames.end(), name.toStdString());
+                if (found == this->spec.channelnames.end()) {
+                    return this->fail("Unknown layer or channel: " + name);
+                }
+                std::fill_n(input.channels, 3, int(found - this->spec.channelnames.begin()));
+            }
+
+            this->expression.inputs.push_back(input);
+            return this->push(Op::Load, int(this->expression.inputs.size()) - 1);
+        }
+};
+
+
+namespace {
+    template<typename F>
+    inline void combine(float* a, const float* b, int count, F f) {
+        for (int i = 0; i < count; ++i) {
+            a[i] = f(a[i], b[i]);
+        }
+    }
+}
+
+
+AovExpression AovExpression::compile(const QString& text, const OIIO::ImageSpec& spec, QString* error) {
+    AovExpression expression;
+    QString message;
+
+    AovParser parser(text, spec, expression);
+    if (!parser.parse(message)) {
+        expression = AovExpression();
+    }
+
+    if (error) {
+        *error = message;
+    }
+    return expression;
+}
+
+
+bool AovExpression::isValid() const {
+    return !this->program.empty();
+}
+
+
+void AovExpression::evaluate(const float* pixels, const OIIO::ImageSpec& spec, const OIIO::ROI& roi,
+                             float* destination) const {
+    EXRAY_TRACE_SCOPE("expression");
+    if (!this->isValid()) {
+        return;
+    }
+
+    TaskScheduler::parallelFor(roi.ybegin, roi.yend, [&](int64_t y) {
+        this->evaluateRow(pixels, spec, int(y), roi.xbegin, roi.xend,
+                          destination + size_t(y - roi.ybegin) * roi.width() * 4);
+    });
+}
+
+
+void AovExpression::evaluateRow(const float* pixels, const OIIO::ImageSpec& spec, int y, int xbegin, int xend,
+                                float* destination) const {
+    if (!this->isValid()) {
+        return;
+    }
+
+    const int width = xend - xbegin;
+    const int channels = spec.nchannels;
+
+    // Every level of the stack holds the three color lanes of one block.
+    alignas(64) float stack[max_depth][3][block_size];
+    const float* row = pixels + (size_t(y) * spec.width + xbegin) * channels;
+
+    for (int x = 0; x < width; x += block_size) {
+        const int count = std::min(block_size, width - x);
+        const float* source = row + size_t(x) * channels;
+        int top = -1;
+
+        for (const Instruction& instruction: this->program) {
+            switch (instruction.op) {
+                case Op::Load: {
+                    top++;
+                    const Input& input = this->inputs[instruction.input];
+                    for (int lane = 0; lane < 3; ++lane) {
+                        const int channel = input.channels[lane];
+                        float* value = stack[top][lane];
+                        for (int i = 0; i < count; ++i) {
+                            value[i] = source[size_t(i) * channels + channel];
+                        }
+                    }
+                    break;
+                }
+                case Op::Constant:
+                    top++;
+                    for (int lane = 0; lane < 3; ++lane) {
+                        std::fill_n(stack[top][lane], count, instruction.value);
+                    }
+                    break;
+                case Op::Negate:
+                    for (int lane = 0; lane < 3; ++lane) {
+                        float* value = stack[top][lane];
+                        for (int i = 0; i < count; ++i) {
+                            value[i] = -value[i];
+                        }
+                    }
+                    break;
+                case Op::Abs:
+                    for (int lane = 0; lane < 3; ++lane) {
+                        float* value = stack[top][lane];
+                        for (int i = 0; i < count; ++i) {
+                            value[i] = std::fabs(value[i]);
+                        }
+                    }
+                    break;
+                default:
+                    top--;
+                    for (int lane = 0; lane < 3; ++lane) {
+                        float* a = stack[top][lane];
+                        const float* b = stack[top + 1][lane];
+                        switch (instruction.op) {
+                            case Op::Add:
+                                combine(a, b, count, [](float l, float r) { return l + r; });
+                                break;
+                            case Op::Subtract:
+                                combine(a, b, count, [](float l, float r) { return l - r; });
+                                break;
+                            case Op::Multiply:
+                                combine(a, b, count, [](float l, float r) { return l * r; });
+                                break;
+                            case Op::Divide:
+                                combine(a, b, count, [](float l, float r) { return l / r; });
+                                break;
+                            case Op::Min:
+                                combine(a, b, count, [](float l, float r) { return r < l ? r : l; });
+                                break;
+                            case Op::Max:
+                                combine(a, b, count, [](float l, float r) { return l < r ? r : l; });
+                                break;
+                            default:
+                                break;
+                        }
+                    }
+                    break;
+            }
+        }
+
+        // Back to interleaved RGBA.
+        float* pixel = destination + size_t(x) * 4;
+        for (int i = 0; i < count; ++i) {
+            pixel[i * 4 + 0] = stack[0][0][i];
+            pixel[i * 4 + 1] = stack[0][1][i];
+            pixel[i * 4 + 2] = stack[0][2][i];
+            pixel[i * 4 + 3] = this->alpha_channel >= 0 ? source[size_t(i) * channels + this->alpha_channel] : 1.0f;
+        }
+    }
+}
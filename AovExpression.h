@@ -0,0 +1,49 @@
+#ifndef AOVEXPRESSION_H
+#define AOVEXPRESSION_H
+
+#include <QString>
+#include <vector>
+#include <OpenImageIO/imageio.h>
+
+/*
+ * Arithmetic over the layers and channels of a file, to show passes recombined without writing
+ * them out, like diffuse_direct + diffuse_indirect or specular * mask.
+ *
+ * Names are layers or full channel names, "quoted" when they have other characters than letters,
+ * digits, _ and dots. There's + - * /, parentheses, numbers and min(a, b), max(a, b), abs(a).
+ * Layers bring their first three channels, single channels count for all three. Alpha is taken
+ * from the first layer that has one.
+ *
+ * An expression compiles to a small stack program that runs on blocks of a row at a time, every
+ * step a plain loop over the block the compiler vectorizes. Rows go in parallel and write the
+ * result straight into the output, so there are no full frame intermediates.
+ */
+class AovExpression {
+    public:
+        static constexpr int block_size = 128;
+        static constexpr int max_depth = 16;
+        static AovExpression compile(const QString& text, const OIIO::ImageSpec& spec, QString* error = nullptr);
+        bool isValid() const;
+        // RGBA of a rectangle of the interleaved pixels of the whole file, rows of roi.width().
+        void evaluate(const float* pixels, const OIIO::ImageSpec& spec, const OIIO::ROI& roi, float* destination) const;
+        // One row of it on the calling thread.
+        void evaluateRow(const float* pixels, const OIIO::ImageSpec& spec, int y, int xbegin, int xend,
+                         float* destination) const;
+
+    private:
+        enum class Op { Load, Constant, Add, Subtract, Multiply, Divide, Negate, Min, Max, Abs };
+        struct Instruction {
+            Op op;
+            int input = 0;
+            float value = 0.0f;
+        };
+        struct Input {
+            int channels[3];
+        };
+        std::vector<Instruction> program;
+        std::vector<Input> inputs;
+        int alpha_channel = -1;
+        friend class AovParser;
+};
+
+#endif //AOVEXPRESSION_H
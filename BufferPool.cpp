@@ -0,0 +1,206 @@
+#include "BufferPool.h"
+#include <algorithm>
+#include <bit>
+#include <cstdlib>
+#include <cstring>
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+
+BufferPool& BufferPool::instance() {
+    // Never destroyed, buffers in static caches still come back after main().
+    static BufferPool* pool = new BufferPool();
+    return *pool;
+}
+
+
+BufferPool::BufferPool() {
+    this->budget_bytes = default_budget_mb << 20;
+
+    if (const char* budget = std::getenv("EXRAY_POOL_MB")) {
+        this->budget_bytes = size_t(std::strtoull(budget, nullptr, 10)) << 20;
+    }
+    const char* huge = std::getenv("EXRAY_HUGE_PAGES");
+    this->huge_pages = huge && std::strcmp(huge, "0") != 0;
+}
+
+
+size_t BufferPool::sizeClass(size_t bytes) {
+    bytes = std::max<size_t>(bytes, 1);
+    if (bytes < min_pooled_bytes) {
+        return (bytes + alignment - 1) / alignment * alignment;
+    }
+
+    // A quarter of a power of two apart, at most a quarter more than asked for.
+    const size_t step = std::bit_floor(bytes) / 4;
+    return (bytes + step - 1) / step * step;
+}
+
+
+void* BufferPool::allocate(size_t bytes) {
+    const size_t size = sizeClass(bytes);
+    if (size < min_pooled_bytes) {
+        return ::operator new(size, std::align_val_t(alignment));
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->counts.outstanding_bytes += size;
+
+        // The one given back last, it's the likeliest to still be in memory.
+        auto found = std::find_if(this->idle.rbegin(), this->idle.rend(), [size](const Idle& buffer) {
+            return buffer.bytes == size;
+        });
+        if (found != this->idle.rend()) {
+            void* pointer = found->pointer;
+            this->idle.erase(std::next(found).base());
+            this->counts.pooled_bytes -= size;
+            this->counts.reuses++;
+            return pointer;
+        }
+        this->counts.allocations++;
+    }
+
+    // Nothing of the size is idle, what is would be in the way.
+    void* pointer = this->allocateNew(size);
+    if (!pointer) {
+        this->trim();
+        pointer = this->allocateNew(size);
+    }
+    if (!pointer) {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->counts.outstanding_bytes -= size;
+        throw std::bad_alloc();
+    }
+    return pointer;
+}
+
+
+void BufferPool::release(void* pointer, size_t bytes) {
+    if (!pointer) {
+        return;
+    }
+
+    const size_t size = sizeClass(bytes);
+    if (size < min_pooled_bytes) {
+        ::operator delete(pointer, std::align_val_t(alignment));
+        return;
+    }
+
+    // The oldest idle ones make room, this one goes too when it's bigger than the budget.
+    std::vector<Idle> freed;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->counts.outstanding_bytes -= size;
+
+        if (size > this->budget_bytes) {
+            freed.push_back({pointer, size});
+        } else {
+            while (this->counts.pooled_bytes + size > this->budget_bytes) {
+                freed.push_back(this->idle.front());
+                this->counts.pooled_bytes -= this->idle.front().bytes;
+                this->idle.erase(this->idle.begin());
+            }
+            this->idle.push_back({pointer, size});
+            this->counts.pooled_bytes += size;
+        }
+    }
+
+    for (const Idle& buffer: freed) {
+        this->freeBuffer(buffer.pointer, buffer.bytes);
+    }
+}
+
+
+QImage BufferPool::image(int width, int height, QImage::Format format) {
+    if (width <= 0 || height <= 0) {
+        return QImage();
+    }
+
+    // The size goes in front of the pixels, the cleanup function only gets a pointer.
+    const int depth = QImage::toPixelFormat(format).bitsPerPixel();
+    const qsizetype bytes_per_line = (qsizetype(width) * depth + 31) / 32 * 4;
+    const size_t bytes = alignment + size_t(bytes_per_line) * height;
+    uchar* block = static_cast<uchar*>(this->allocate(bytes));
+    std::memcpy(block, &bytes, sizeof(bytes));
+
+    return QImage(block + alignment, width, height, bytes_per_line, format, &BufferPool::releaseImage, block);
+}
+
+
+void BufferPool::releaseImage(void* info) {
+    size_t bytes;
+    std::memcpy(&bytes, info, sizeof(bytes));
+    instance().release(info, bytes);
+}
+
+
+void BufferPool::setBudget(size_t bytes) {
+    std::vector<Idle> freed;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->budget_bytes = bytes;
+        while (this->counts.pooled_bytes > this->budget_bytes) {
+            freed.push_back(this->idle.front());
+            this->counts.pooled_bytes -= this->idle.front().bytes;
+            this->idle.erase(this->idle.begin());
+        }
+    }
+
+    for (const Idle& buffer: freed) {
+        this->freeBuffer(buffer.pointer, buffer.bytes);
+    }
+}
+
+
+size_t BufferPool::budget() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->budget_bytes;
+}
+
+
+void BufferPool::trim() {
+    std::vector<Idle> freed;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        freed.swap(this->idle);
+        this->counts.pooled_bytes = 0;
+    }
+
+    for (const Idle& buffer: freed) {
+        this->freeBuffer(buffer.pointer, buffer.bytes);
+    }
+}
+
+
+BufferPool::Stats BufferPool::stats() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->counts;
+}
+
+
+void* BufferPool::allocateNew(size_t bytes) {
+#ifdef __linux__
+    if (this->huge_pages && bytes >= huge_page_bytes) {
+        const size_t rounded = (bytes + huge_page_bytes - 1) / huge_page_bytes * huge_page_bytes;
+        void* pointer = ::operator new(rounded, std::align_val_t(huge_page_bytes), std::nothrow);
+        if (pointer) {
+            madvise(pointer, rounded, MADV_HUGEPAGE);
+        }
+        return pointer;
+    }
+#endif
+    return ::operator new(bytes, std::align_val_t(alignment), std::nothrow);
+}
+
+
+void BufferPool::freeBuffer(void* pointer, size_t bytes) {
+#ifdef __linux__
+    if (this->huge_pages && bytes >= huge_page_bytes) {
+        ::operator delete(pointer, std::align_val_t(huge_page_bytes));
+        return;
+    }
+#endif
+    ::operator delete(pointer, std::align_val_t(alignment));
+}
@@ -0,0 +1,108 @@
+#ifndef BUFFERPOOL_H
+#define BUFFERPOOL_H
+
+#include <QImage>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/*
+ * Frame sized buffers handed out again instead of going back to the system.
+ *
+ * Every layer switch wants the same few full frame buffers, the scene and display values and the 8
+ * bit image, and a file switch a decode buffer. From the system each is fresh pages, faulted in and
+ * zeroed by the kernel, and std::vector zeroes them once more. Here buffers of min_pooled_bytes and
+ * up are rounded up to a size class, four to every power of two, and go back to the pool when
+ * they're freed, for the next one of the class. Every buffer is aligned to alignment bytes, and a
+ * FloatBuffer leaves new values as they are, whoever asks for one writes all of it anyway.
+ *
+ * Idle buffers are kept within default_budget_mb unless EXRAY_POOL_MB says otherwise, the ones
+ * idle longest make room first. With EXRAY_HUGE_PAGES set, buffers of a huge page and up are
+ * aligned to one and the kernel is asked to back them with huge pages, for fewer faults and TLB
+ * misses.
+ */
+class BufferPool {
+    public:
+        static constexpr size_t alignment = 64;
+        static constexpr size_t min_pooled_bytes = 256 * 1024;
+        static constexpr size_t huge_page_bytes = 2 * 1024 * 1024;
+        static constexpr size_t default_budget_mb = 1024;
+        struct Stats {
+            // Pooled sizes only, small buffers come and go as they are.
+            size_t outstanding_bytes = 0;
+            size_t pooled_bytes = 0;
+            int64_t allocations = 0;
+            int64_t reuses = 0;
+        };
+        // For std containers, all of them share the one pool.
+        template<typename T>
+        struct Allocator {
+            using value_type = T;
+
+            Allocator() = default;
+
+            template<typename U>
+            Allocator(const Allocator<U>&) {
+            }
+
+            T* allocate(size_t count) {
+                return static_cast<T*>(BufferPool::instance().allocate(count * sizeof(T)));
+            }
+
+            void deallocate(T* pointer, size_t count) {
+                BufferPool::instance().release(pointer, count * sizeof(T));
+            }
+
+            // Not zeroed, only what's given a value gets one.
+            template<typename U>
+            void construct(U* pointer) noexcept(std::is_nothrow_default_constructible_v<U>) {
+                ::new(static_cast<void*>(pointer)) U;
+            }
+
+            template<typename U, typename... Args>
+            void construct(U* pointer, Args&&... args) {
+                ::new(static_cast<void*>(pointer)) U(std::forward<Args>(args)...);
+            }
+
+            template<typename U>
+            bool operator==(const Allocator<U>&) const {
+                return true;
+            }
+        };
+        static BufferPool& instance();
+        void* allocate(size_t bytes);
+        void release(void* pointer, size_t bytes);
+        // An image on a pooled buffer, it goes back when the last copy of the image does.
+        QImage image(int width, int height, QImage::Format format);
+        void setBudget(size_t bytes);
+        size_t budget();
+        // Lets go of every idle buffer.
+        void trim();
+        Stats stats();
+        static size_t sizeClass(size_t bytes);
+
+    private:
+        struct Idle {
+            void* pointer;
+            size_t bytes;
+        };
+        BufferPool();
+        std::mutex mutex;
+        // Oldest given back first.
+        std::vector<Idle> idle;
+        size_t budget_bytes = 0;
+        bool huge_pages = false;
+        Stats counts;
+        void* allocateNew(size_t bytes);
+        void freeBuffer(void* pointer, size_t bytes);
+        static void releaseImage(void* info);
+};
+
+// Decoded pixels and display values, from the pool and not zeroed.
+using FloatBuffer = std::vector<float, BufferPool::Allocator<float>>;
+
+#endif //BUFFERPOOL_H
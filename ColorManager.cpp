@@ -1,4 +1,7 @@
 #include "ColorManager.h"
+#include <algorithm>
+#include <atomic>
+#include "TaskScheduler.h"
 
 
 ColorManager::ColorManager() {
@@ -22,6 +25,97 @@ QMap<QString, QList<QString>> ColorManager::getTransforms() {
 }
 
 
+OCIO::ConstCPUProcessorRcPtr ColorManager::getProcessor(const QString& inputColorSpace, const QString& outputColorSpace) {
+    QString key = inputColorSpace + "\n" + outputColorSpace;
+
+    QMutexLocker locker(&this->processors_mutex);
+    auto it = this->processors.constFind(key);
+    if (it != this->processors.constEnd()) {
+        return it.value();
+    }
+
+    // Create the color transform
+    OCIO::ConstColorSpaceRcPtr inputCS = this->config->getColorSpace(inputColorSpace.toStdString().c_str());
+    OCIO::ConstColorSpaceRcPtr outputCS = this->config->getColorSpace(outputColorSpace.toStdString().c_str());
+
+    if (!inputCS) {
+        qDebug() << "Error: Input colorspace" << inputColorSpace << "not found in config";
+        return nullptr;
+    }
+
+    if (!outputCS) {
+        qDebug() << "Error: Output colorspace" << outputColorSpace << "not found in config";
+        return nullptr;
+    }
+
+    // Create the processor
+    OCIO::ConstProcessorRcPtr processor = this->config->getProcessor(inputCS, outputCS);
+    if (!processor) {
+        qDebug() << "Error: Could not create processor from" << inputColorSpace << "to" << outputColorSpace;
+        return nullptr;
+    }
+
+    // Get the CPU processor for actual transformation
+    OCIO::ConstCPUProcessorRcPtr cpuProcessor = processor->getDefaultCPUProcessor();
+    if (!cpuProcessor) {
+        qDebug() << "Error: Could not create CPU processor";
+        return nullptr;
+    }
+
+    this->processors.insert(key, cpuProcessor);
+    return cpuProcessor;
+}
+
+
+QList<QPair<QString, QString>> ColorManager::getDisplayViews() {
+    QList<QPair<QString, QString>> displayViews;
+
+    for (int i = 0; i < this->config->getNumDisplays(); ++i) {
+        const char *display = this->config->getDisplay(i);
+        for (int v = 0; v < this->config->getNumViews(display); ++v) {
+            displayViews.append(QPair<QString, QString>(display, this->config->getView(display, v)));
+        }
+    }
+
+    return displayViews;
+}
+
+
+OCIO::ConstCPUProcessorRcPtr ColorManager::getDisplayViewProcessor(const QString& inputColorSpace, const QString& display,
+                                                                   const QString& view) {
+    // Three parts, it can't be mistaken for a pair of color spaces.
+    QString key = inputColorSpace + "\n" + display + "\n" + view;
+
+    QMutexLocker locker(&this->processors_mutex);
+    auto it = this->processors.constFind(key);
+    if (it != this->processors.constEnd()) {
+        return it.value();
+    }
+
+    OCIO::ConstCPUProcessorRcPtr cpuProcessor;
+    try {
+        OCIO::ConstProcessorRcPtr processor = this->config->getProcessor(inputColorSpace.toStdString().c_str(),
+                                                                         display.toStdString().c_str(),
+                                                                         view.toStdString().c_str(),
+                                                                         OCIO::TRANSFORM_DIR_FORWARD);
+        if (processor) {
+            cpuProcessor = processor->getDefaultCPUProcessor();
+        }
+    } catch (const OCIO::Exception& e) {
+        qDebug() << "OCIO Error for display" << display << "view" << view << ":" << e.what();
+        return nullptr;
+    }
+
+    if (!cpuProcessor) {
+        qDebug() << "Error: Could not create processor from" << inputColorSpace << "to" << display << "/" << view;
+        return nullptr;
+    }
+
+    this->processors.insert(key, cpuProcessor);
+    return cpuProcessor;
+}
+
+
 Image::ChannelData ColorManager::transform(const Image::ChannelData& inputData, const QString& inputColorSpace, const QString& outputColorSpace) {
 
     Image::ChannelData result = inputData; // Copy input data structure
@@ -38,62 +132,33 @@ Image::ChannelData ColorManager::transform(const Image::ChannelData& inputData,
     }
 
     try {
-        // Create the color transform
-        OCIO::ConstColorSpaceRcPtr inputCS = this->config->getColorSpace(inputColorSpace.toStdString().c_str());
-        OCIO::ConstColorSpaceRcPtr outputCS = this->config->getColorSpace(outputColorSpace.toStdString().c_str());
-
-        if (!inputCS) {
-            qDebug() << "Error: Input colorspace" << inputColorSpace << "not found in config";
-            return result;
-        }
-
-        if (!outputCS) {
-            qDebug() << "Error: Output colorspace" << outputColorSpace << "not found in config";
-            return result;
-        }
-
-        // Create the processor
-        OCIO::ConstProcessorRcPtr processor = this->config->getProcessor(inputCS, outputCS);
-        if (!processor) {
-            qDebug() << "Error: Could not create processor from" << inputColorSpace << "to" << outputColorSpace;
-            return result;
-        }
-
-        // Get the CPU processor for actual transformation
-        OCIO::ConstCPUProcessorRcPtr cpuProcessor = processor->getDefaultCPUProcessor();
+        // Get the cached processor for this pair of color spaces
+        OCIO::ConstCPUProcessorRcPtr cpuProcessor = this->getProcessor(inputColorSpace, outputColorSpace);
         if (!cpuProcessor) {
-            qDebug() << "Error: Could not create CPU processor";
             return result;
         }
 
         // Copy the input data to result for transformation
         result.data = inputData.data;
 
-        // Determine the number of pixels
-        int numPixels = inputData.width * inputData.height;
-
-        // OpenColorIO applies transformation per pixel, so we need to loop
-        if (inputData.channels == 3) {
-            // RGB data - transform each pixel
-            for (int i = 0; i < numPixels; ++i) {
-                float* pixelPtr = &result.data[i * 3];
-                cpuProcessor->applyRGB(pixelPtr);
-            }
-        }
-        else if (inputData.channels >= 4) {
-            // RGBA data - transform each pixel
-            for (int i = 0; i < numPixels; ++i) {
-                float* pixelPtr = &result.data[i * inputData.channels];
-                cpuProcessor->applyRGBA(pixelPtr);
+        // Bands of rows in parallel, OCIO applies each band in one call. The processor is shared
+        // between threads, applying it doesn't change it. Anything after alpha is skipped over.
+        const int channels = inputData.channels;
+        const int bands = (inputData.height + transform_band_rows - 1) / transform_band_rows;
+        std::atomic<bool> failed = false;
+        TaskScheduler::parallelFor(0, bands, [&](int64_t band) {
+            const int first = int(band) * transform_band_rows;
+            const int rows = std::min(transform_band_rows, inputData.height - first);
+            if (!apply(cpuProcessor, result.data.data() + size_t(first) * inputData.width * channels, inputData.width,
+                       rows, channels)) {
+                failed = true;
             }
-        }
-        else {
-            qDebug() << "Error: Unsupported number of channels:" << inputData.channels;
+        });
+
+        if (failed) {
             return inputData; // Return original data unchanged
         }
 
-        qDebug() << "Successfully transformed" << numPixels << "pixels from" << inputColorSpace << "to" << outputColorSpace;
-
     } catch (const OCIO::Exception& e) {
         qDebug() << "OCIO Error during transformation:" << e.what();
         return inputData; // Return original data unchanged
@@ -106,6 +171,20 @@ Image::ChannelData ColorManager::transform(const Image::ChannelData& inputData,
 }
 
 
+bool ColorManager::apply(const OCIO::ConstCPUProcessorRcPtr& processor, float* pixels, int width, int rows, int channels) {
+    const ptrdiff_t pixelBytes = ptrdiff_t(channels) * sizeof(float);
+    OCIO::PackedImageDesc image(pixels, width, rows, channels == 3 ? 3 : 4, OCIO::BIT_DEPTH_F32, sizeof(float),
+                                pixelBytes, pixelBytes * width);
+    try {
+        processor->apply(image);
+    } catch (const OCIO::Exception& e) {
+        qDebug() << "OCIO Error during transformation:" << e.what();
+        return false;
+    }
+    return true;
+}
+
+
 ColorManager::~ColorManager() {
 
 }
\ No newline at end of file
@@ -3,6 +3,8 @@
 
 #include <QObject>
 #include <QDebug>
+#include <QHash>
+#include <QMutex>
 #include <OpenColorIO/OpenColorIO.h>
 #include "Image.h"
 
@@ -12,11 +14,25 @@ class ColorManager : public QObject {
     Q_OBJECT
 
 public:
+    // Rows per band of the parallel transform.
+    static constexpr int transform_band_rows = 32;
     explicit ColorManager();
     ~ColorManager();
     OCIO::ConstConfigRcPtr config;
     QMap<QString, QList<QString>> getTransforms();
+    OCIO::ConstCPUProcessorRcPtr getProcessor(const QString& inputColorSpace, const QString& outputColorSpace);
+    // Every display of the config with each of its views.
+    QList<QPair<QString, QString>> getDisplayViews();
+    OCIO::ConstCPUProcessorRcPtr getDisplayViewProcessor(const QString& inputColorSpace, const QString& display,
+                                                         const QString& view);
     Image::ChannelData transform(const Image::ChannelData& inputData, const QString& inputColorSpace, const QString& outputColorSpace);
+    // In place on rows of at least 3 channels, on the calling thread.
+    static bool apply(const OCIO::ConstCPUProcessorRcPtr& processor, float* pixels, int width, int rows, int channels);
+
+private:
+    // CPU processors by "input\noutput", shared by everything that draws through this manager.
+    QHash<QString, OCIO::ConstCPUProcessorRcPtr> processors;
+    QMutex processors_mutex;
 };
 
 #endif //COLORMANAGER_H
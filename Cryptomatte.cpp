@@ -0,0 +1,256 @@
+#include "Cryptomatte.h"
+#include <QByteArray>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <algorithm>
+#include <cstring>
+#include "TaskScheduler.h"
+#include "Trace.h"
+
+
+namespace {
+    uint32_t idBits(float value) {
+        uint32_t id;
+        std::memcpy(&id, &value, sizeof(id));
+        return id;
+    }
+
+
+    // IDs are hashes already, their bytes make a color.
+    void idColor(uint32_t id, float* rgb) {
+        rgb[0] = float(id & 0xff) / 255.0f;
+        rgb[1] = float((id >> 8) & 0xff) / 255.0f;
+        rgb[2] = float((id >> 16) & 0xff) / 255.0f;
+    }
+
+
+    // What one band of rows found of one object.
+    struct Found {
+        std::vector<Cryptomatte::Coverage> coverage;
+        int xbegin = INT32_MAX;
+        int xend = 0;
+        int ybegin = INT32_MAX;
+        int yend = 0;
+    };
+}
+
+
+QList<Cryptomatte::Layer> Cryptomatte::findLayers(const OIIO::ImageSpec &spec, const QString &filename) {
+    QList<Layer> layers;
+
+    for (const OIIO::ParamValue &attribute: spec.extra_attribs) {
+        const std::string name = attribute.name().string();
+        if (!name.starts_with("cryptomatte/") || !name.ends_with("/name")) {
+            continue;
+        }
+        const std::string prefix = name.substr(0, name.size() - 4);
+
+        Layer layer;
+        layer.name = QString::fromStdString(attribute.get_string());
+
+        // Two ranks in every RGBA set, CryptoObject00 holds ranks 0 and 1.
+        for (int set = 0; set < 100; ++set) {
+            const std::string base = layer.name.toStdString() + (set < 10 ? "0" : "") + std::to_string(set);
+            const int r = spec.channelindex(base + ".R");
+            const int g = spec.channelindex(base + ".G");
+            const int b = spec.channelindex(base + ".B");
+            const int a = spec.channelindex(base + ".A");
+            if (r < 0 || g < 0) {
+                break;
+            }
+
+            layer.ranks.push_back({r, g});
+            if (b >= 0 && a >= 0) {
+                layer.ranks.push_back({b, a});
+            }
+        }
+
+        if (layer.ranks.empty()) {
+            qDebug() << "No rank channels for Cryptomatte layer:" << layer.name;
+            continue;
+        }
+
+        // The manifest is in the header, or in a file next to the image.
+        QByteArray manifest = QByteArray::fromStdString(spec.get_string_attribute(prefix + "manifest"));
+        const std::string sidecar = spec.get_string_attribute(prefix + "manif_file");
+        if (manifest.isEmpty() && !sidecar.empty()) {
+            QFile file(QFileInfo(filename).dir().filePath(QString::fromStdString(sidecar)));
+            if (file.open(QIODevice::ReadOnly)) {
+                manifest = file.readAll();
+            }
+        }
+
+        const QJsonObject entries = QJsonDocument::fromJson(manifest).object();
+        for (auto entry = entries.begin(); entry != entries.end(); ++entry) {
+            bool ok = false;
+            uint32_t id = entry.value().toString().toUInt(&ok, 16);
+            if (ok) {
+                layer.manifest.insert(id, entry.key());
+            }
+        }
+
+        layers.append(layer);
+    }
+
+    return layers;
+}
+
+
+void Cryptomatte::preview(const Layer &layer, const float *pixels, const OIIO::ImageSpec &spec, const OIIO::ROI &roi,
+                          float *destination) {
+    EXRAY_TRACE_SCOPE("cryptomatte.preview");
+
+    TaskScheduler::parallelFor(roi.ybegin, roi.yend, [&](int64_t y) {
+        previewRow(layer, pixels, spec, int(y), roi.xbegin, roi.xend, destination + size_t(y - roi.ybegin) * roi.width() * 4);
+    });
+}
+
+
+void Cryptomatte::previewRow(const Layer &layer, const float *pixels, const OIIO::ImageSpec &spec, int y, int xbegin,
+                             int xend, float *destination) {
+    const float *source = pixels + (size_t(y) * spec.width + xbegin) * spec.nchannels;
+    float *out = destination;
+
+    for (int x = xbegin; x < xend; ++x, source += spec.nchannels, out += 4) {
+        out[0] = 0.0f;
+        out[1] = 0.0f;
+        out[2] = 0.0f;
+        out[3] = 1.0f;
+
+        for (const auto &rank: layer.ranks) {
+            const float amount = source[rank.second];
+            if (amount <= 0.0f) {
+                continue;
+            }
+
+            float rgb[3];
+            idColor(idBits(source[rank.first]), rgb);
+            out[0] += rgb[0] * amount;
+            out[1] += rgb[1] * amount;
+            out[2] += rgb[2] * amount;
+        }
+    }
+}
+
+
+Cryptomatte::Cryptomatte(const Layer &layer, std::shared_ptr<const FloatBuffer> pixels,
+                         const OIIO::ImageSpec &spec) {
+    EXRAY_TRACE_SCOPE("cryptomatte.index");
+    this->layer = layer;
+    this->pixels = std::move(pixels);
+    this->width = spec.width;
+    this->height = spec.height;
+    this->channels = spec.nchannels;
+
+    // Every band collects its objects on its own.
+    const int bands = (this->height + band_rows - 1) / band_rows;
+    std::vector<std::unordered_map<uint32_t, Found>> found(bands);
+    const float *data = this->pixels->data();
+
+    TaskScheduler::parallelFor(0, bands, [&](int64_t band) {
+        std::unordered_map<uint32_t, Found> &objects = found[band];
+        const int yend = std::min(this->height, int(band + 1) * band_rows);
+
+        for (int y = int(band) * band_rows; y < yend; ++y) {
+            const float *pixel = data + size_t(y) * this->width * this->channels;
+            for (int x = 0; x < this->width; ++x, pixel += this->channels) {
+                for (const auto &rank: this->layer.ranks) {
+                    const float amount = pixel[rank.second];
+                    if (amount <= 0.0f) {
+                        continue;
+                    }
+
+                    Found &object = objects[idBits(pixel[rank.first])];
+                    object.coverage.push_back({uint32_t(size_t(y) * this->width + x), amount});
+                    object.xbegin = std::min(object.xbegin, x);
+                    object.xend = std::max(object.xend, x + 1);
+                    object.ybegin = std::min(object.ybegin, y);
+                    object.yend = y + 1;
+                }
+            }
+        }
+    });
+
+    // Joined in band order, so the pixels of every object stay in order.
+    for (auto &objects: found) {
+        for (auto &[id, part]: objects) {
+            auto [entry, added] = this->object_index.try_emplace(id, this->objects.size());
+            if (added) {
+                this->objects.push_back({id, OIIO::ROI(part.xbegin, part.xend, part.ybegin, part.yend), {}});
+            }
+
+            Object &object = this->objects[entry->second];
+            object.bounds.xbegin = std::min(object.bounds.xbegin, part.xbegin);
+            object.bounds.xend = std::max(object.bounds.xend, part.xend);
+            object.bounds.yend = std::max(object.bounds.yend, part.yend);
+            object.coverage.insert(object.coverage.end(), part.coverage.begin(), part.coverage.end());
+        }
+        objects.clear();
+    }
+}
+
+
+const QString &Cryptomatte::layerName() const {
+    return this->layer.name;
+}
+
+
+uint32_t Cryptomatte::objectAt(int x, int y) const {
+    if (x < 0 || y < 0 || x >= this->width || y >= this->height) {
+        return 0;
+    }
+
+    const float *pixel = this->pixels->data() + (size_t(y) * this->width + x) * this->channels;
+    uint32_t id = 0;
+    float most = 0.0f;
+    for (const auto &rank: this->layer.ranks) {
+        if (pixel[rank.second] > most) {
+            most = pixel[rank.second];
+            id = idBits(pixel[rank.first]);
+        }
+    }
+    return id;
+}
+
+
+QString Cryptomatte::name(uint32_t id) const {
+    return this->layer.manifest.value(id, QString("<%1>").arg(id, 8, 16, QChar('0')));
+}
+
+
+Cryptomatte::Matte Cryptomatte::matte(const QList<uint32_t> &ids) const {
+    Matte matte;
+    matte.roi = OIIO::ROI(0, 0, 0, 0);
+
+    // Only as big as the objects together.
+    std::vector<const Object*> picked;
+    for (uint32_t id: ids) {
+        auto entry = this->object_index.find(id);
+        if (entry == this->object_index.end()) {
+            continue;
+        }
+
+        const Object *object = &this->objects[entry->second];
+        matte.roi = picked.empty() ? object->bounds : OIIO::roi_union(matte.roi, object->bounds);
+        picked.push_back(object);
+    }
+
+    if (picked.empty()) {
+        return matte;
+    }
+
+    matte.coverage.assign(size_t(matte.roi.width()) * matte.roi.height(), 0.0f);
+    for (const Object *object: picked) {
+        for (const Coverage &coverage: object->coverage) {
+            const int x = int(coverage.pixel % this->width) - matte.roi.xbegin;
+            const int y = int(coverage.pixel / this->width) - matte.roi.ybegin;
+            float &value = matte.coverage[size_t(y) * matte.roi.width() + x];
+            value = std::min(1.0f, value + coverage.amount);
+        }
+    }
+
+    return matte;
+}
@@ -0,0 +1,69 @@
+#ifndef CRYPTOMATTE_H
+#define CRYPTOMATTE_H
+
+#include <QHash>
+#include <QList>
+#include <QString>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <OpenImageIO/imageio.h>
+#include "BufferPool.h"
+
+/*
+ * Object picking on Cryptomatte layers.
+ *
+ * The layers and their manifests come from the cryptomatte/<key>/ header attributes, the rank
+ * channels are <name>00.RGBA, <name>01.RGBA, ... holding ID and coverage pairs. Building the index
+ * goes over every pixel and rank once, in parallel bands, and keeps per object the pixels it
+ * covers in order. After that finding the object under a pixel only reads that pixel, and a
+ * matte only touches the pixels of its objects.
+ */
+class Cryptomatte {
+    public:
+        static constexpr int band_rows = 64;
+        struct Layer {
+            QString name;
+            // ID and coverage channel of every rank.
+            std::vector<std::pair<int, int>> ranks;
+            QHash<uint32_t, QString> manifest;
+        };
+        struct Coverage {
+            uint32_t pixel;
+            float amount;
+        };
+        struct Object {
+            uint32_t id;
+            OIIO::ROI bounds;
+            std::vector<Coverage> coverage;
+        };
+        struct Matte {
+            OIIO::ROI roi;
+            std::vector<float> coverage;
+        };
+        static QList<Layer> findLayers(const OIIO::ImageSpec& spec, const QString& filename);
+        // Every object in a color of its own, weighted by coverage, as RGBA.
+        static void preview(const Layer& layer, const float* pixels, const OIIO::ImageSpec& spec, const OIIO::ROI& roi,
+                            float* destination);
+        static void previewRow(const Layer& layer, const float* pixels, const OIIO::ImageSpec& spec, int y, int xbegin,
+                               int xend, float* destination);
+        Cryptomatte(const Layer& layer, std::shared_ptr<const FloatBuffer> pixels, const OIIO::ImageSpec& spec);
+        const QString& layerName() const;
+        // The object with the most coverage, 0 for none.
+        uint32_t objectAt(int x, int y) const;
+        QString name(uint32_t id) const;
+        Matte matte(const QList<uint32_t>& ids) const;
+
+    private:
+        Layer layer;
+        std::shared_ptr<const FloatBuffer> pixels;
+        int width;
+        int height;
+        int channels;
+        std::vector<Object> objects;
+        std::unordered_map<uint32_t, size_t> object_index;
+};
+
+#endif //CRYPTOMATTE_H
@@ -0,0 +1,180 @@
+#include "DecodeCache.h"
+#include <cstdlib>
+
+
+DecodeCache::DecodeCache() {
+    this->budget_bytes = default_budget_mb << 20;
+
+    if (const char* budget = std::getenv("EXRAY_CACHE_MB")) {
+        this->budget_bytes = size_t(std::strtoull(budget, nullptr, 10)) << 20;
+    }
+}
+
+
+DecodeCache& DecodeCache::instance() {
+    static DecodeCache cache;
+    return cache;
+}
+
+
+std::string DecodeCache::key(const std::string& filename) {
+    std::error_code error;
+    std::string key = std::filesystem::weakly_canonical(filename, error).string();
+    return error ? filename : key;
+}
+
+
+DecodeCache::Buffer DecodeCache::get(const std::string& filename, const Decoder& decode) {
+    std::string key = DecodeCache::key(filename);
+    std::error_code error;
+    auto modified = std::filesystem::last_write_time(filename, error);
+    auto done = std::make_shared<std::promise<Buffer>>();
+
+    {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        auto it = this->entries.find(key);
+        if (it != this->entries.end() && it->second.modified == modified) {
+            if (Buffer pixels = it->second.pixels.lock()) {
+                this->hold(it->second, pixels);
+                return pixels;
+            }
+        }
+
+        // The viewer, the thumbnails and the prefetcher all ask as a file opens, it's decoded once.
+        // Waiting blocks rather than helps, a task run meanwhile could want a lock we hold.
+        auto running = this->decoding.find(key);
+        if (running != this->decoding.end() && running->second.modified == modified) {
+            std::shared_future<Buffer> pixels = running->second.pixels;
+            lock.unlock();
+            return pixels.get();
+        }
+        this->decoding[key] = {modified, done, done->get_future().share()};
+    }
+
+    // Decode outside the lock so different files decode in parallel.
+    auto pixels = std::make_shared<FloatBuffer>();
+    bool decoded = false;
+    try {
+        decoded = decode(*pixels);
+    } catch (...) {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->finish(key, done, nullptr);
+        throw;
+    }
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (!decoded) {
+        this->finish(key, done, nullptr);
+        return nullptr;
+    }
+    Entry& entry = this->entries[key];
+
+    // Someone else may have finished the same file in the meantime, keep theirs.
+    if (entry.modified == modified) {
+        if (Buffer existing = entry.pixels.lock()) {
+            this->hold(entry, existing);
+            this->finish(key, done, existing);
+            return existing;
+        }
+    }
+
+    // An older decode of the file no longer counts against the budget.
+    if (entry.held) {
+        this->held_bytes -= entry.held->size() * sizeof(float);
+        entry.held.reset();
+    }
+
+    entry.pixels = pixels;
+    entry.modified = modified;
+    this->hold(entry, pixels);
+    this->finish(key, done, pixels);
+    return pixels;
+}
+
+
+void DecodeCache::finish(const std::string& key, const std::shared_ptr<std::promise<Buffer>>& done,
+                         const Buffer& pixels) {
+    auto running = this->decoding.find(key);
+    if (running != this->decoding.end() && running->second.done == done) {
+        this->decoding.erase(running);
+    }
+    done->set_value(pixels);
+}
+
+
+void DecodeCache::hold(Entry& entry, const Buffer& pixels) {
+    entry.last_used = ++this->clock;
+
+    if (!entry.held) {
+        entry.held = pixels;
+        this->held_bytes += pixels->size() * sizeof(float);
+        this->trim();
+    }
+}
+
+
+void DecodeCache::trim() {
+    // Let go of the least recently used buffers until we're within the budget.
+    while (this->held_bytes > this->budget_bytes) {
+        Entry* oldest = nullptr;
+        for (auto& [key, entry]: this->entries) {
+            if (entry.held && (!oldest || entry.last_used < oldest->last_used)) {
+                oldest = &entry;
+            }
+        }
+
+        if (!oldest) {
+            break;
+        }
+
+        this->held_bytes -= oldest->held->size() * sizeof(float);
+        oldest->held.reset();
+    }
+
+    // Nothing holds these anymore.
+    std::erase_if(this->entries, [](const auto& item) {
+        return item.second.pixels.expired();
+    });
+}
+
+
+void DecodeCache::release(const std::string& filename) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    auto it = this->entries.find(DecodeCache::key(filename));
+    if (it != this->entries.end() && it->second.held) {
+        this->held_bytes -= it->second.held->size() * sizeof(float);
+        it->second.held.reset();
+    }
+}
+
+
+void DecodeCache::setBudget(size_t bytes) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->budget_bytes = bytes;
+    this->trim();
+}
+
+
+size_t DecodeCache::budget() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->budget_bytes;
+}
+
+
+size_t DecodeCache::heldBytes() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->held_bytes;
+}
+
+
+void DecodeCache::clear() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    for (auto& [key, entry]: this->entries) {
+        entry.held.reset();
+    }
+    this->held_bytes = 0;
+
+    std::erase_if(this->entries, [](const auto& item) {
+        return item.second.pixels.expired();
+    });
+}
@@ -0,0 +1,65 @@
+#ifndef DECODECACHE_H
+#define DECODECACHE_H
+
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <filesystem>
+#include "BufferPool.h"
+
+/*
+ * Decoded pixels shared by every Image that opens the same file.
+ *
+ * Buffers are held on to within a memory budget, least recently used ones are let go first, so
+ * switching back to a file doesn't decode it again. A buffer that was let go still lives, and is
+ * still shared, as long as some Image holds it. A file that changed on disk since it was decoded
+ * is decoded again. A file asked for while it's being decoded waits for that decode.
+ *
+ * The budget is default_budget_mb unless EXRAY_CACHE_MB says otherwise.
+ */
+class DecodeCache {
+    public:
+        using Buffer = std::shared_ptr<const FloatBuffer>;
+        using Decoder = std::function<bool(FloatBuffer& pixels)>;
+        static constexpr size_t default_budget_mb = 4096;
+        static DecodeCache& instance();
+        Buffer get(const std::string& filename, const Decoder& decode);
+        void release(const std::string& filename);
+        void setBudget(size_t bytes);
+        size_t budget();
+        size_t heldBytes();
+        void clear();
+
+    private:
+        struct Entry {
+            std::weak_ptr<const FloatBuffer> pixels;
+            Buffer held;
+            std::filesystem::file_time_type modified;
+            uint64_t last_used = 0;
+        };
+        struct Decoding {
+            std::filesystem::file_time_type modified;
+            std::shared_ptr<std::promise<Buffer>> done;
+            std::shared_future<Buffer> pixels;
+        };
+        DecodeCache();
+        static std::string key(const std::string& filename);
+        std::mutex mutex;
+        std::map<std::string, Entry> entries;
+        // Decodes under way, by key.
+        std::map<std::string, Decoding> decoding;
+        size_t budget_bytes = 0;
+        size_t held_bytes = 0;
+        uint64_t clock = 0;
+        void hold(Entry& entry, const Buffer& pixels);
+        // Hands the decode to whoever waits for it, under the lock.
+        void finish(const std::string& key, const std::shared_ptr<std::promise<Buffer>>& done, const Buffer& pixels);
+        void trim();
+};
+
+#endif //DECODECACHE_H
@@ -0,0 +1,392 @@
+#include "DisplayPipeline.h"
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include "BufferPool.h"
+#include "PixelOps.h"
+#include "TaskScheduler.h"
+#include "Trace.h"
+
+
+namespace {
+    // Room for one tile, kept by every thread from tile to tile.
+    float* scratch(std::vector<float>& buffer, size_t values) {
+        if (buffer.size() < values) {
+            buffer.resize(values);
+        }
+        return buffer.data();
+    }
+
+
+    // The half a float holds, false when it holds none.
+    inline bool toHalf(float value, uint16_t &half) {
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        const uint16_t sign = uint16_t((bits >> 16) & 0x8000);
+        const int exponent = int((bits >> 23) & 0xff) - 127;
+        const uint32_t mantissa = bits & 0x7fffff;
+
+        if (exponent == 128) {
+            // Inf, and the NaNs with a payload that fits.
+            half = sign | 0x7c00 | uint16_t(mantissa >> 13);
+            return (mantissa & 0x1fff) == 0;
+        }
+        if (exponent == -127) {
+            // Zero, a float denormal is too small for a half.
+            half = sign;
+            return mantissa == 0;
+        }
+        if (exponent > 15 || exponent < -24) {
+            return false;
+        }
+        if (exponent >= -14) {
+            half = sign | uint16_t((exponent + 15) << 10) | uint16_t(mantissa >> 13);
+            return (mantissa & 0x1fff) == 0;
+        }
+
+        // A half denormal, the implicit one moves into the mantissa.
+        const uint32_t significand = mantissa | 0x800000;
+        const int shift = -1 - exponent;
+        half = sign | uint16_t(significand >> shift);
+        return (significand & ((1u << shift) - 1)) == 0;
+    }
+
+
+    inline float fromHalf(uint16_t half) {
+        const uint32_t sign = uint32_t(half & 0x8000) << 16;
+        int exponent = (half >> 10) & 0x1f;
+        uint32_t mantissa = half & 0x3ff;
+        uint32_t bits = sign;
+
+        if (exponent == 0x1f) {
+            bits |= 0x7f800000 | (mantissa << 13);
+        } else if (exponent != 0) {
+            bits |= uint32_t(exponent - 15 + 127) << 23 | (mantissa << 13);
+        } else if (mantissa != 0) {
+            // Denormal, normalized for the float.
+            exponent = -14;
+            while (!(mantissa & 0x400)) {
+                mantissa <<= 1;
+                exponent--;
+            }
+            bits |= uint32_t(exponent + 127) << 23 | ((mantissa & 0x3ff) << 13);
+        }
+
+        float value;
+        std::memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+
+    // input -> working -> gamma -> output in place, a stage that couldn't be set up is left out.
+    void transform(const OCIO::ConstCPUProcessorRcPtr &toWorking, float gamma, const OCIO::ConstCPUProcessorRcPtr &toOutput,
+                   float *pixels, int width, int rows, int channels) {
+        if (toWorking) {
+            ColorManager::apply(toWorking, pixels, width, rows, channels);
+        }
+        PixelOps::gamma(pixels, size_t(width) * rows, channels, gamma);
+        if (toOutput) {
+            ColorManager::apply(toOutput, pixels, width, rows, channels);
+        }
+    }
+
+
+    // A gray pixel keeps its green through the transforms of the chain, that's what's shown of it.
+    void grayOf(const float *pixels, size_t count, float *gray) {
+        for (size_t i = 0; i < count; ++i) {
+            gray[i] = pixels[i * 4 + 1];
+        }
+    }
+
+
+    // The chain run over every half as a gray pixel.
+    struct HalfTable {
+        OCIO::ConstCPUProcessorRcPtr to_working;
+        OCIO::ConstCPUProcessorRcPtr to_output;
+        float gamma = 1.0f;
+        // Display values and 8 bit grays, by the bits of the half.
+        std::vector<float> gray;
+        std::vector<uint8_t> gray8;
+    };
+
+    constexpr size_t half_tables_kept = 4;
+    // Whole vectors for every kernel, no value goes through what a kernel leaves over.
+    constexpr int half_band = 4096;
+    std::mutex half_tables_mutex;
+    std::vector<std::shared_ptr<const HalfTable>> half_tables;
+
+
+    std::shared_ptr<const HalfTable> halfTable(const OCIO::ConstCPUProcessorRcPtr &toWorking,
+                                               const OCIO::ConstCPUProcessorRcPtr &toOutput, float gamma) {
+        auto find = [&]() -> std::shared_ptr<const HalfTable> {
+            for (const auto &table: half_tables) {
+                if (table->to_working == toWorking && table->to_output == toOutput && table->gamma == gamma) {
+                    return table;
+                }
+            }
+            return nullptr;
+        };
+        {
+            std::lock_guard<std::mutex> lock(half_tables_mutex);
+            if (auto table = find()) {
+                return table;
+            }
+        }
+
+        // Made outside the lock, a worker helping out with it may pick up a display run that wants it too.
+        EXRAY_TRACE_SCOPE("display.half_table");
+        auto table = std::make_shared<HalfTable>();
+        table->to_working = toWorking;
+        table->to_output = toOutput;
+        table->gamma = gamma;
+        table->gray.resize(DisplayPipeline::half_values);
+        table->gray8.resize(DisplayPipeline::half_values);
+
+        TaskScheduler::parallelFor(0, DisplayPipeline::half_values / half_band, [&](int64_t band) {
+            const int first = int(band) * half_band;
+            std::vector<float> values(half_band);
+            std::vector<float> pixels(size_t(half_band) * 4);
+            for (int i = 0; i < half_band; ++i) {
+                values[i] = fromHalf(uint16_t(first + i));
+            }
+
+            // The same pixels and the same steps as a tile of the chain.
+            PixelOps::replicate(values.data(), half_band, 1, 0, pixels.data());
+            transform(toWorking, gamma, toOutput, pixels.data(), half_band, 1, 4);
+            grayOf(pixels.data(), half_band, table->gray.data() + first);
+            PixelOps::toGray8(table->gray.data() + first, half_band, table->gray8.data() + first);
+        });
+
+        std::lock_guard<std::mutex> lock(half_tables_mutex);
+        if (auto made = find()) {
+            return made;
+        }
+        half_tables.insert(half_tables.begin(), table);
+        if (half_tables.size() > half_tables_kept) {
+            half_tables.pop_back();
+        }
+        return table;
+    }
+
+
+    // The halves of one channel of a rectangle, false when one of them isn't.
+    bool halvesOf(const ImageSpec &spec, const Image::Extraction &extraction, int channel, const ROI &roi,
+                  std::vector<uint16_t> &halves) {
+        halves.resize(size_t(roi.width()) * roi.height());
+        uint16_t *half = halves.data();
+
+        // Read in place, the halves are there as they are in the file.
+        if (!extraction.pixels) {
+            if (extraction.mapping->type(channel) != TypeDesc::HALF) {
+                return false;
+            }
+            for (int y = roi.ybegin; y < roi.yend; ++y) {
+                extraction.mapping->copy(channel, y, roi.xbegin, roi.xend, half);
+                half += roi.width();
+            }
+            return true;
+        }
+
+        const float *pixels = extraction.pixels->data();
+        for (int y = roi.ybegin; y < roi.yend; ++y) {
+            const float *source = pixels + (size_t(y) * spec.width + roi.xbegin) * spec.nchannels + channel;
+            for (int x = 0; x < roi.width(); ++x) {
+                if (!toHalf(source[size_t(x) * spec.nchannels], *half++)) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+}
+
+
+int DisplayPipeline::tileRows(int width, int channels) {
+    const size_t row_bytes = size_t(std::max(1, width)) * std::max(1, channels) * sizeof(float);
+    return int(std::max<size_t>(1, tile_bytes / row_bytes));
+}
+
+
+const QList<QRgb> &DisplayPipeline::heatmapColors() {
+    // Turbo, as the polynomial fit of it, dark blue through green and yellow to dark red.
+    static const QList<QRgb> colors = []() {
+        QList<QRgb> colors;
+        for (int i = 0; i < 256; ++i) {
+            const double t = i / 255.0;
+            const double r = 0.13572138 + t * (4.61539260 + t * (-42.66032258 + t * (132.13108234 + t * (-152.94239396 + t * 59.28637943))));
+            const double g = 0.09140261 + t * (2.19418839 + t * (4.84296658 + t * (-14.18503333 + t * (4.27729857 + t * 2.82956604))));
+            const double b = 0.10667330 + t * (12.64194608 + t * (-60.58204836 + t * (110.36276771 + t * (-89.90310912 + t * 27.34824973))));
+            auto byte = [](double value) {
+                return int(std::clamp(value, 0.0, 1.0) * 255.0 + 0.5);
+            };
+            colors.append(qRgb(byte(r), byte(g), byte(b)));
+        }
+        return colors;
+    }();
+    return colors;
+}
+
+
+DisplayPipeline::Result DisplayPipeline::run(Image *image, const QString &layer, const QString &component,
+                                             const Settings &settings, int keep, ROI roi) {
+    EXRAY_TRACE_SCOPE("display.fused");
+    Result result;
+
+    if (!image || !image->inp || !settings.color_manager) {
+        return result;
+    }
+
+    const ImageSpec &spec = image->inp->spec();
+    if (!roi.defined()) {
+        roi = ROI(0, spec.width, 0, spec.height);
+    }
+
+    Image::Extraction extraction;
+    if (!image->extraction(layer, component, extraction)) {
+        return result;
+    }
+
+    const int width = roi.width();
+    const int height = roi.height();
+    const int channels = extraction.channels;
+    const bool single = channels == 1;
+    if (channels < 3 && !single) {
+        qDebug() << "Error: Need 1 or at least 3 channels for display";
+        return result;
+    }
+
+    // A stage that can't be set up is left out, the way the stage at a time transform leaves its input.
+    OCIO::ConstCPUProcessorRcPtr toWorking = settings.color_manager->getProcessor(settings.input_colorspace, "ACEScg");
+    OCIO::ConstCPUProcessorRcPtr toOutput = settings.color_manager->getProcessor("ACEScg", settings.output_colorspace);
+    if (settings.gamma <= 0.0f) {
+        qDebug() << "Error: Gamma value must be greater than 0, got:" << settings.gamma;
+    }
+
+    // A single channel of a half file shown as gray is looked up, the chain made the table.
+    const bool heatmap = single && settings.heatmap;
+    std::shared_ptr<const HalfTable> table;
+    if (single && !heatmap && settings.half_table && extraction.indices.size() == 1
+        && spec.channelformat(extraction.indices[0]) == TypeDesc::HALF) {
+        table = halfTable(toWorking, toOutput, settings.gamma);
+    }
+    const float heatmap_scale = settings.heatmap_high != settings.heatmap_low
+                                ? 1.0f / (settings.heatmap_high - settings.heatmap_low) : 0.0f;
+
+    auto allocate = [&](Image::ChannelData &data) {
+        data.width = width;
+        data.height = height;
+        data.channels = channels;
+        data.channel_names = extraction.channel_names;
+        data.data.resize(size_t(width) * height * channels);
+    };
+    if (keep & KeepScene) {
+        allocate(result.scene_data);
+    }
+    if (keep & KeepDisplay) {
+        allocate(result.display_data);
+    }
+
+    // A single channel stays a byte a pixel, gray or indexed into the heatmap.
+    uchar *bits = nullptr;
+    qsizetype bytes_per_line = 0;
+    if (keep & KeepImage) {
+        if (heatmap) {
+            result.display_image = BufferPool::instance().image(width, height, QImage::Format_Indexed8);
+            result.display_image.setColorTable(heatmapColors());
+        } else {
+            result.display_image = BufferPool::instance().image(width, height,
+                                                                 single ? QImage::Format_Grayscale8 : QImage::Format_RGBA8888);
+        }
+        bits = result.display_image.bits();
+        bytes_per_line = result.display_image.bytesPerLine();
+    }
+
+    // A single channel goes through the transforms as gray RGBA, the tile is as big as that.
+    const int rows = tileRows(width, single ? 4 : channels);
+    const int tiles = (height + rows - 1) / rows;
+    const size_t row_values = size_t(width) * channels;
+
+    TaskScheduler::parallelFor(0, tiles, [&](int64_t tile) {
+        thread_local std::vector<float> scratch_tile;
+        thread_local std::vector<float> scratch_scene;
+        thread_local std::vector<float> scratch_gray;
+        thread_local std::vector<uint16_t> halves;
+        const int first = int(tile) * rows;
+        const int count = std::min(rows, height - first);
+        const size_t offset = size_t(first) * row_values;
+        const size_t values = size_t(count) * row_values;
+        const ROI tileRoi(roi.xbegin, roi.xend, roi.ybegin + first, roi.ybegin + first + count);
+
+        if (single) {
+            const bool looked_up = table && halvesOf(spec, extraction, extraction.indices[0], tileRoi, halves);
+            if (keep & KeepScene || !looked_up) {
+                float *scene = keep & KeepScene ? result.scene_data.data.data() + offset : scratch(scratch_scene, values);
+                image->extract(extraction, tileRoi, scene);
+
+                float *display = keep & KeepDisplay ? result.display_data.data.data() + offset
+                                                    : scratch(scratch_gray, values);
+                if (looked_up) {
+                    // Only kept along, the display values come from the table.
+                } else if (heatmap) {
+                    for (size_t i = 0; i < values; ++i) {
+                        display[i] = (scene[i] - settings.heatmap_low) * heatmap_scale;
+                    }
+                } else {
+                    float *pixels = scratch(scratch_tile, values * 4);
+                    PixelOps::replicate(scene, values, 1, 0, pixels);
+                    transform(toWorking, settings.gamma, toOutput, pixels, width, count, 4);
+                    grayOf(pixels, values, display);
+                }
+
+                if (bits && !looked_up) {
+                    for (int row = 0; row < count; ++row) {
+                        PixelOps::toGray8(display + size_t(row) * width, width, bits + qsizetype(first + row) * bytes_per_line);
+                    }
+                }
+            }
+
+            if (looked_up) {
+                if (keep & KeepDisplay) {
+                    float *display = result.display_data.data.data() + offset;
+                    for (size_t i = 0; i < values; ++i) {
+                        display[i] = table->gray[halves[i]];
+                    }
+                }
+                for (int row = 0; bits && row < count; ++row) {
+                    const uint16_t *half = halves.data() + size_t(row) * width;
+                    uint8_t *line = bits + qsizetype(first + row) * bytes_per_line;
+                    for (int x = 0; x < width; ++x) {
+                        line[x] = table->gray8[half[x]];
+                    }
+                }
+            }
+            return;
+        }
+
+        float *display = keep & KeepDisplay ? result.display_data.data.data() + offset : scratch(scratch_tile, values);
+        if (keep & KeepScene) {
+            float *scene = result.scene_data.data.data() + offset;
+            image->extract(extraction, tileRoi, scene);
+            std::copy_n(scene, values, display);
+        } else {
+            image->extract(extraction, tileRoi, display);
+        }
+
+        transform(toWorking, settings.gamma, toOutput, display, width, count, channels);
+
+        if (bits) {
+            for (int row = 0; row < count; ++row) {
+                const float *source = display + size_t(row) * row_values;
+                uint8_t *line = bits + qsizetype(first + row) * bytes_per_line;
+                if (settings.checkerboard) {
+                    PixelOps::toRgba8OverCheckerboard(source, width, channels, line, roi.xbegin, tileRoi.ybegin + row);
+                } else {
+                    PixelOps::toRgba8(source, width, channels, line);
+                }
+            }
+        }
+    });
+
+    return result;
+}
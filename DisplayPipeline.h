@@ -0,0 +1,62 @@
+#ifndef DISPLAYPIPELINE_H
+#define DISPLAYPIPELINE_H
+
+#include <QImage>
+#include <QList>
+#include <QString>
+#include "ColorManager.h"
+#include "Image.h"
+
+/*
+ * The display chain, extract -> input transform -> gamma -> output transform -> quantize, fused
+ * into one pass over tiles of rows.
+ *
+ * A stage at a time, every stage streams the whole frame through memory and leaves a whole frame
+ * behind for the next one. Here every stage runs on a tile of about tile_bytes before the next
+ * tile is started, so what's in between stays in the cache of the worker. Tiles are spread over
+ * the scheduler. Only what the caller keeps is written at full size: the scene values, the
+ * display values, the 8 bit image or any of them.
+ *
+ * A single channel, a component or a layer of one, stays one float a pixel in what's kept and one
+ * byte in the image, gray through the chain or a heatmap of its scene values from heatmap_low to
+ * heatmap_high. Only the transforms see it as a gray RGBA pixel, a tile at a time.
+ *
+ * Shown as gray, a half channel can only be one of half_values values. The chain runs once over all
+ * of them into a table, kept per transform and gamma, and the pixels are looked up in it, the same
+ * for every component of every layer. The table is made by the same kernels from the same gray
+ * pixels, what's looked up is what the chain would have made. A tile with a value that isn't a
+ * half after all goes through the chain.
+ */
+class DisplayPipeline {
+    public:
+        // Half of a common L2, the display tile and the scene tile kept along still fit.
+        static constexpr size_t tile_bytes = 256 * 1024;
+        static constexpr int half_values = 65536;
+        enum Keep { KeepScene = 1, KeepDisplay = 2, KeepImage = 4 };
+        struct Settings {
+            ColorManager* color_manager = nullptr;
+            QString input_colorspace;
+            QString output_colorspace;
+            float gamma = 1.0f;
+            bool checkerboard = false;
+            // Look single half channels up in a table of the chain, off to compare.
+            bool half_table = true;
+            // A single channel in false color instead of through the transforms.
+            bool heatmap = false;
+            float heatmap_low = 0.0f;
+            float heatmap_high = 1.0f;
+        };
+        struct Result {
+            Image::ChannelData scene_data;
+            Image::ChannelData display_data;
+            QImage display_image;
+        };
+        static int tileRows(int width, int channels);
+        // The color table of a heatmap image, low to high.
+        static const QList<QRgb>& heatmapColors();
+        // Of a rectangle of the image, the checkerboard lines up with the full frame.
+        static Result run(Image* image, const QString& layer, const QString& component, const Settings& settings,
+                          int keep, ROI roi = ROI::All());
+};
+
+#endif //DISPLAYPIPELINE_H
@@ -0,0 +1,220 @@
+#include "Exporter.h"
+#include <QApplication>
+#include <QDir>
+#include <QFileInfo>
+#include <QPointer>
+#include <algorithm>
+#include "DisplayPipeline.h"
+#include "PixelOps.h"
+#include "TaskScheduler.h"
+#include "Trace.h"
+
+
+namespace {
+    // Display pixels ready to be written, 8 bit ones quantized the same way the viewport does it.
+    struct Encoded {
+        int width = 0;
+        int height = 0;
+        int channels = 0;
+        std::vector<uint8_t> rgba8;
+        FloatBuffer pixels;
+    };
+
+
+    bool isEightBit(const QString& extension) {
+        return extension != "exr" && extension != "tif" && extension != "tiff";
+    }
+
+
+    Encoded encode(Image::ChannelData&& displayData, const QString& extension) {
+        EXRAY_TRACE_SCOPE("export.encode");
+        Encoded encoded;
+        encoded.width = displayData.width;
+        encoded.height = displayData.height;
+
+        if (!isEightBit(extension)) {
+            encoded.channels = displayData.channels;
+            encoded.pixels = std::move(displayData.data);
+            return encoded;
+        }
+
+        encoded.channels = 4;
+        encoded.rgba8.resize(size_t(encoded.width) * encoded.height * 4);
+        TaskScheduler::parallelFor(0, encoded.height, [&](int64_t y) {
+            size_t row = size_t(y) * encoded.width;
+            PixelOps::toRgba8(displayData.data.data() + row * displayData.channels, encoded.width, displayData.channels,
+                              encoded.rgba8.data() + row * 4);
+        });
+        return encoded;
+    }
+
+
+    bool writeEncoded(const QString& filename, const Encoded& encoded) {
+        EXRAY_TRACE_SCOPE("export.write");
+        const QString extension = QFileInfo(filename).suffix().toLower();
+
+        auto output = OIIO::ImageOutput::create(filename.toStdString());
+        if (!output) {
+            qDebug() << "No writer for" << filename << OIIO::geterror().c_str();
+            return false;
+        }
+
+        // JPEG has no alpha, the other formats keep what the layer has up to RGBA.
+        int channels = std::min(encoded.channels, 4);
+        if (extension == "jpg" || extension == "jpeg") {
+            channels = std::min(channels, 3);
+        }
+
+        OIIO::TypeDesc format = OIIO::TypeDesc::UINT8;
+        if (extension == "exr") {
+            format = OIIO::TypeDesc::HALF;
+        } else if (extension == "tif" || extension == "tiff") {
+            format = OIIO::TypeDesc::UINT16;
+        }
+
+        OIIO::ImageSpec spec(encoded.width, encoded.height, channels, format);
+        if (extension == "jpg" || extension == "jpeg") {
+            spec.attribute("Compression", "jpeg:95");
+        }
+
+        if (!output->open(filename.toStdString(), spec)) {
+            qDebug() << "Could not write" << filename << output->geterror().c_str();
+            return false;
+        }
+
+        bool written;
+        if (encoded.rgba8.empty()) {
+            written = output->write_image(OIIO::TypeDesc::FLOAT, encoded.pixels.data(), encoded.channels * sizeof(float));
+        } else {
+            written = output->write_image(OIIO::TypeDesc::UINT8, encoded.rgba8.data(), 4);
+        }
+        written = output->close() && written;
+
+        if (!written) {
+            qDebug() << "Could not write" << filename << output->geterror().c_str();
+        }
+        return written;
+    }
+}
+
+
+Exporter::Exporter(QObject *parent): QObject(parent) {
+}
+
+
+Exporter::~Exporter() {
+    this->cancel();
+}
+
+
+void Exporter::start(const Job &job) {
+    this->cancel();
+
+    auto cancelled = std::make_shared<std::atomic<bool>>(false);
+    this->cancelled = cancelled;
+    this->running = true;
+    const int generation = this->generation;
+    QPointer<Exporter> exporter(this);
+
+    auto report = [exporter, generation](int done, int total, bool last) {
+        QMetaObject::invokeMethod(qApp, [exporter, generation, done, total, last]() {
+            if (!exporter || exporter->generation != generation) {
+                return;
+            }
+            if (last) {
+                exporter->running = false;
+                emit exporter->finished(done, total - done);
+            } else {
+                emit exporter->progress(done, total);
+            }
+        }, Qt::QueuedConnection);
+    };
+
+    TaskScheduler::instance().submit([job, cancelled, report]() {
+        EXRAY_TRACE_SCOPE("export");
+        const int total = int(job.outputs.size());
+
+        // An image of our own, the pixels still come from the decode cache or the mapped file.
+        Image image(job.source.toStdString().c_str());
+        if (!image.inp || !job.color_manager) {
+            report(0, total, true);
+            return;
+        }
+        for (const auto &layer: job.virtual_layers) {
+            image.addVirtualLayer(layer.first, layer.second);
+        }
+
+        // Writers still busy with earlier layers while the next one is transformed.
+        TaskScheduler &scheduler = TaskScheduler::instance();
+        std::atomic<int> pending = 0;
+        std::atomic<int> written = 0;
+        std::atomic<int> done = 0;
+
+        for (const auto &output: job.outputs) {
+            if (*cancelled) {
+                break;
+            }
+
+            // Only the display values are kept, the scene values never exist at full size.
+            DisplayPipeline::Result result = DisplayPipeline::run(&image, output.first, job.component,
+                                                                  {job.color_manager, job.input_colorspace,
+                                                                   job.output_colorspace, job.gamma, false},
+                                                                  DisplayPipeline::KeepDisplay);
+            Image::ChannelData &displayData = result.display_data;
+            if (displayData.data.empty()) {
+                qDebug() << "Nothing to export for layer:" << output.first;
+                report(++done, total, false);
+                continue;
+            }
+
+            auto encoded = std::make_shared<Encoded>(encode(std::move(displayData), QFileInfo(output.second).suffix().toLower()));
+
+            scheduler.helpUntil([&pending]() {
+                return pending < max_writes;
+            });
+            pending++;
+            // Not cancelled through the scheduler, every write has to count itself out.
+            scheduler.submit([&, filename = output.second, encoded]() {
+                if (!*cancelled && writeEncoded(filename, *encoded)) {
+                    written++;
+                }
+                report(++done, total, false);
+                pending--;
+            }, TaskScheduler::Priority::Background);
+        }
+
+        scheduler.helpUntil([&pending]() {
+            return pending == 0;
+        });
+        report(written, total, true);
+    }, TaskScheduler::Priority::Background);
+}
+
+
+void Exporter::cancel() {
+    // Files being written are finished, nothing new is started and the results are dropped.
+    if (this->cancelled) {
+        *this->cancelled = true;
+    }
+    this->generation++;
+    this->running = false;
+}
+
+
+bool Exporter::isRunning() const {
+    return this->running;
+}
+
+
+QString Exporter::outputName(const QString &directory, const QString &source, const QString &layer,
+                             const QString &extension) {
+    // Layer names can hold anything, keep what's safe in a file name.
+    QString name = layer;
+    for (QChar &c: name) {
+        if (!c.isLetterOrNumber() && c != '.' && c != '_' && c != '-') {
+            c = '_';
+        }
+    }
+
+    return QDir(directory).filePath(QFileInfo(source).completeBaseName() + "." + name + "." + extension);
+}
@@ -0,0 +1,56 @@
+#ifndef EXPORTER_H
+#define EXPORTER_H
+
+#include <QObject>
+#include <QList>
+#include <QPair>
+#include <QString>
+#include <atomic>
+#include <memory>
+#include "ColorManager.h"
+#include "Image.h"
+
+/*
+ * Writes layers the way the viewport shows them, with the display transform baked in.
+ *
+ * The format follows the extension: 8 bit PNG and JPEG, 16 bit TIFF and half float EXR. Layers
+ * are transformed one after the other, each in one fused pass over tiles, and handed to a
+ * background task of their own, so encoding and compressing overlaps with the next layers. At
+ * most max_writes files are in flight. All of it runs off the GUI thread, behind interactive work.
+ */
+class Exporter : public QObject {
+    Q_OBJECT
+
+    public:
+        static constexpr int max_writes = 8;
+        struct Job {
+            QString source;
+            QList<QPair<QString, QString>> virtual_layers;
+            QString component = "all";
+            ColorManager* color_manager = nullptr;
+            QString input_colorspace;
+            QString output_colorspace;
+            float gamma = 1.0f;
+            // Layers with the file each is written to.
+            QList<QPair<QString, QString>> outputs;
+        };
+        explicit Exporter(QObject *parent = nullptr);
+        ~Exporter();
+        void start(const Job& job);
+        void cancel();
+        bool isRunning() const;
+        // <directory>/<file name>.<layer>.<extension>
+        static QString outputName(const QString& directory, const QString& source, const QString& layer,
+                                  const QString& extension);
+
+    signals:
+        void progress(int done, int total);
+        void finished(int written, int failed);
+
+    private:
+        std::shared_ptr<std::atomic<bool>> cancelled;
+        int generation = 0;
+        bool running = false;
+};
+
+#endif //EXPORTER_H
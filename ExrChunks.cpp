@@ -0,0 +1,369 @@
+#include "ExrChunks.h"
+#include <QByteArray>
+#include <QFile>
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include "TaskScheduler.h"
+
+
+namespace {
+    constexpr int32_t exr_magic = 20000630;
+    constexpr int32_t tiled_flag = 0x200;
+    constexpr int32_t deep_flag = 0x800;
+    constexpr int32_t multipart_flag = 0x1000;
+
+    // EXR is little endian, like everything we run on. Read through the file's own buffer, only
+    // the header, the offset table and the chunk headers are looked at.
+    struct Reader {
+        QFile& file;
+        qint64 size;
+
+        template<typename T>
+        bool read(T& value) {
+            return this->file.read(reinterpret_cast<char*>(&value), sizeof(T)) == qint64(sizeof(T));
+        }
+
+        bool readName(std::string& name) {
+            name.clear();
+            char c = 0;
+            while (this->file.getChar(&c)) {
+                if (c == 0) {
+                    return true;
+                }
+                name.push_back(c);
+            }
+            return false;
+        }
+
+        qint64 position() const {
+            return this->file.pos();
+        }
+
+        bool seek(qint64 position) {
+            return position <= this->size && this->file.seek(position);
+        }
+    };
+
+
+    // Chunks that can't change without moving are told apart by where they are and how big.
+    uint64_t placeHash(uint64_t offset, int32_t size) {
+        const uint64_t place[2] = {offset, uint64_t(uint32_t(size))};
+        return std::hash<std::string_view>{}(std::string_view(reinterpret_cast<const char*>(place), sizeof(place)));
+    }
+
+
+    int linesPerChunk(int compression) {
+        switch (compression) {
+            case 0: // none
+            case 1: // rle
+            case 2: // zips
+                return 1;
+            case 3: // zip
+            case 5: // pxr24
+                return 16;
+            case 4: // piz
+            case 6: // b44
+            case 7: // b44a
+            case 8: // dwaa
+                return 32;
+            case 9: // dwab
+                return 256;
+            default:
+                return 0;
+        }
+    }
+
+
+    int roundLog2(int size, bool roundUp) {
+        int log = 0;
+        if (roundUp) {
+            while ((1 << log) < size) {
+                log++;
+            }
+        } else {
+            while ((size >> (log + 1)) > 0) {
+                log++;
+            }
+        }
+        return log;
+    }
+
+
+    int levelSize(int size, int level, bool roundUp) {
+        int scaled = roundUp ? (size + (1 << level) - 1) >> level : size >> level;
+        return std::max(1, scaled);
+    }
+
+
+    int64_t tileCount(int width, int height, int tileWidth, int tileHeight) {
+        return int64_t((width + tileWidth - 1) / tileWidth) * ((height + tileHeight - 1) / tileHeight);
+    }
+}
+
+
+ExrChunks::Table ExrChunks::scan(const QString& filename) {
+    Table table;
+
+    // Read rather than mapped, a writer truncating the file under a mapping would crash us.
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return table;
+    }
+    Reader reader{file, file.size()};
+
+    int32_t magic = 0;
+    int32_t version = 0;
+    if (!reader.read(magic) || magic != exr_magic || !reader.read(version)) {
+        return table;
+    }
+    if (version & (deep_flag | multipart_flag)) {
+        return table;
+    }
+
+    int32_t window[4] = {0, 0, -1, -1};
+    uint8_t compression = 255;
+    uint32_t tileSize[2] = {0, 0};
+    uint8_t tileMode = 0;
+    bool hasTiles = false;
+
+    // Attributes up to the empty name that ends the header.
+    while (true) {
+        std::string name;
+        std::string type;
+        int32_t size = 0;
+        if (!reader.readName(name)) {
+            return table;
+        }
+        if (name.empty()) {
+            break;
+        }
+        if (!reader.readName(type) || !reader.read(size) || size < 0 || reader.position() + size > reader.size) {
+            return table;
+        }
+
+        qint64 next = reader.position() + size;
+        if (name == "channels") {
+            // Names with 16 bytes of type and sampling each, up to an empty name.
+            std::string channel;
+            while (reader.position() < next && reader.readName(channel) && !channel.empty()) {
+                table.channels++;
+                reader.seek(reader.position() + 16);
+            }
+        } else if (name == "dataWindow" && size == 16) {
+            reader.read(window);
+        } else if (name == "compression" && size == 1) {
+            reader.read(compression);
+        } else if (name == "tiles" && size == 9) {
+            reader.read(tileSize);
+            reader.read(tileMode);
+            hasTiles = true;
+        }
+        if (!reader.seek(next)) {
+            return table;
+        }
+    }
+
+    table.width = window[2] - window[0] + 1;
+    table.height = window[3] - window[1] + 1;
+    table.tiled = (version & tiled_flag) && hasTiles;
+    if (table.width <= 0 || table.height <= 0) {
+        return table;
+    }
+
+    // How the full resolution level is cut into chunks, and how many chunks there are in total.
+    int64_t levelZero = 0;
+    int64_t total = 0;
+    if (table.tiled) {
+        if (tileSize[0] == 0 || tileSize[1] == 0) {
+            return table;
+        }
+        table.chunk_width = int(tileSize[0]);
+        table.chunk_height = int(tileSize[1]);
+        levelZero = tileCount(table.width, table.height, table.chunk_width, table.chunk_height);
+
+        const int levelMode = tileMode & 0xf;
+        const bool roundUp = (tileMode >> 4) & 1;
+        if (levelMode == 1) {
+            int levels = roundLog2(std::max(table.width, table.height), roundUp) + 1;
+            for (int l = 0; l < levels; ++l) {
+                total += tileCount(levelSize(table.width, l, roundUp), levelSize(table.height, l, roundUp),
+                                   table.chunk_width, table.chunk_height);
+            }
+        } else if (levelMode == 2) {
+            int xLevels = roundLog2(table.width, roundUp) + 1;
+            int yLevels = roundLog2(table.height, roundUp) + 1;
+            for (int ly = 0; ly < yLevels; ++ly) {
+                for (int lx = 0; lx < xLevels; ++lx) {
+                    total += tileCount(levelSize(table.width, lx, roundUp), levelSize(table.height, ly, roundUp),
+                                       table.chunk_width, table.chunk_height);
+                }
+            }
+        } else {
+            total = levelZero;
+        }
+    } else {
+        int lines = linesPerChunk(compression);
+        if (lines == 0) {
+            return table;
+        }
+        table.chunk_width = table.width;
+        table.chunk_height = lines;
+        levelZero = (table.height + lines - 1) / lines;
+        total = levelZero;
+    }
+
+    // The full resolution level comes first in the offset table.
+    std::vector<uint64_t> offsets(levelZero, 0);
+    const qint64 tableStart = reader.position();
+    const qint64 tableEnd = tableStart + total * 8;
+    if (tableEnd > reader.size || file.read(reinterpret_cast<char*>(offsets.data()), levelZero * 8) != levelZero * 8) {
+        return table;
+    }
+
+    const int columns = (table.width + table.chunk_width - 1) / table.chunk_width;
+    const int rows = (table.height + table.chunk_height - 1) / table.chunk_height;
+    const qint64 chunkHeader = table.tiled ? 20 : 8;
+
+    // An incomplete table, find the chunks that were written by walking their headers.
+    bool complete = std::all_of(offsets.begin(), offsets.end(), [&](uint64_t offset) {
+        return offset >= uint64_t(tableEnd) && offset < uint64_t(reader.size);
+    });
+    if (!complete) {
+        std::fill(offsets.begin(), offsets.end(), 0);
+        qint64 position = tableEnd;
+
+        while (position + chunkHeader <= reader.size && reader.seek(position)) {
+            int32_t coordinates[4] = {0, 0, 0, 0};
+            int32_t size = 0;
+            int64_t index = -1;
+
+            if (table.tiled) {
+                reader.read(coordinates);
+                if (coordinates[2] == 0 && coordinates[3] == 0 && coordinates[0] >= 0 && coordinates[0] < columns
+                    && coordinates[1] >= 0 && coordinates[1] < rows) {
+                    index = int64_t(coordinates[1]) * columns + coordinates[0];
+                }
+            } else {
+                reader.read(coordinates[0]);
+                int64_t line = int64_t(coordinates[0]) - window[1];
+                if (line >= 0 && line < table.height) {
+                    index = line / table.chunk_height;
+                }
+            }
+
+            if (!reader.read(size) || size < 0 || position + chunkHeader + size > reader.size) {
+                break;
+            }
+            if (index >= 0) {
+                offsets[index] = uint64_t(position);
+            }
+            position += chunkHeader + size;
+        }
+    }
+
+    // Where every chunk is and how big. Compressed chunks are only ever appended, a new one is
+    // somewhere else or of another size, so that's all there is to compare. Uncompressed ones are
+    // rewritten in place and their bytes are hashed, read in bands in parallel.
+    table.hashes.assign(levelZero, 0);
+    std::vector<int32_t> sizes(levelZero, -1);
+    for (int64_t i = 0; i < levelZero; ++i) {
+        int32_t size = 0;
+        const qint64 offset = qint64(offsets[i]);
+        if (offset == 0 || !reader.seek(offset + chunkHeader - 4) || !reader.read(size) || size < 0
+            || offset + chunkHeader + size > reader.size) {
+            continue;
+        }
+        sizes[i] = size;
+        const uint64_t hash = placeHash(offsets[i], size);
+        table.hashes[i] = hash != 0 ? hash : 1;
+    }
+    file.close();
+
+    if (compression == 0) {
+        const int64_t bands = std::min<int64_t>(levelZero, 4 * TaskScheduler::instance().threadCount());
+        TaskScheduler::parallelFor(0, bands, [&](int64_t band) {
+            QFile chunks(filename);
+            if (!chunks.open(QIODevice::ReadOnly)) {
+                return;
+            }
+            QByteArray bytes;
+            for (int64_t i = band * levelZero / bands; i < (band + 1) * levelZero / bands; ++i) {
+                if (sizes[i] < 0 || !chunks.seek(qint64(offsets[i]))) {
+                    continue;
+                }
+                bytes.resize(chunkHeader + sizes[i]);
+                if (chunks.read(bytes.data(), bytes.size()) != bytes.size()) {
+                    table.hashes[i] = 0;
+                    continue;
+                }
+                uint64_t hash = std::hash<std::string_view>{}(std::string_view(bytes.constData(), bytes.size()));
+                table.hashes[i] = hash != 0 ? hash : 1;
+            }
+        });
+    }
+
+    table.valid = true;
+    return table;
+}
+
+
+bool ExrChunks::sameLayout(const Table& before, const Table& after) {
+    return before.valid && after.valid && before.tiled == after.tiled && before.width == after.width
+           && before.height == after.height && before.channels == after.channels && before.chunk_width == after.chunk_width
+           && before.chunk_height == after.chunk_height && before.hashes.size() == after.hashes.size();
+}
+
+
+std::vector<OIIO::ROI> ExrChunks::changed(const Table& before, const Table& after) {
+    std::vector<OIIO::ROI> regions;
+    if (!sameLayout(before, after)) {
+        return regions;
+    }
+
+    const int columns = (after.width + after.chunk_width - 1) / after.chunk_width;
+
+    for (size_t i = 0; i < after.hashes.size(); ++i) {
+        if (after.hashes[i] == 0 || after.hashes[i] == before.hashes[i]) {
+            continue;
+        }
+
+        int x = int(i % columns) * after.chunk_width;
+        int y = int(i / columns) * after.chunk_height;
+        OIIO::ROI roi(x, std::min(after.width, x + after.chunk_width), y, std::min(after.height, y + after.chunk_height));
+
+        // Tiles next to each other on a row, or scanline chunks below each other, are read in one go.
+        if (!regions.empty()) {
+            OIIO::ROI& last = regions.back();
+            if (last.ybegin == roi.ybegin && last.yend == roi.yend && last.xend == roi.xbegin) {
+                last.xend = roi.xend;
+                continue;
+            }
+            if (!after.tiled && last.yend == roi.ybegin) {
+                last.yend = roi.yend;
+                continue;
+            }
+        }
+        regions.push_back(roi);
+    }
+
+    return regions;
+}
+
+
+void ExrChunks::forget(Table& table, const OIIO::ROI& roi) {
+    if (!table.valid) {
+        return;
+    }
+
+    const int columns = (table.width + table.chunk_width - 1) / table.chunk_width;
+
+    for (int y = roi.ybegin / table.chunk_height; y * table.chunk_height < roi.yend; ++y) {
+        for (int x = roi.xbegin / table.chunk_width; x * table.chunk_width < roi.xend; ++x) {
+            size_t index = size_t(y) * columns + x;
+            if (index < table.hashes.size()) {
+                table.hashes[index] = 0;
+            }
+        }
+    }
+}
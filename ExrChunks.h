@@ -0,0 +1,40 @@
+#ifndef EXRCHUNKS_H
+#define EXRCHUNKS_H
+
+#include <QString>
+#include <cstdint>
+#include <vector>
+#include <OpenImageIO/imageio.h>
+
+/*
+ * The chunks of a single part EXR as they are on disk, to tell which parts of the image a
+ * writer changed since we last looked.
+ *
+ * Only the header, the offset table and the chunk headers are read. A compressed chunk written
+ * again lands somewhere else, where it is and how big is enough to tell. An uncompressed chunk
+ * can change without moving, those are read and hashed. While a renderer is still writing, the
+ * table on disk is mostly zeros, then the chunks that are there are found by walking them the
+ * way OpenEXR does for incomplete files.
+ */
+class ExrChunks {
+    public:
+        struct Table {
+            bool valid = false;
+            bool tiled = false;
+            int width = 0;
+            int height = 0;
+            int channels = 0;
+            int chunk_width = 0;
+            int chunk_height = 0;
+            // One per chunk of the full resolution level, 0 for chunks that aren't written yet.
+            std::vector<uint64_t> hashes;
+        };
+        static Table scan(const QString& filename);
+        static bool sameLayout(const Table& before, const Table& after);
+        // Rectangles of the data window that changed, runs of neighbouring chunks merged.
+        static std::vector<OIIO::ROI> changed(const Table& before, const Table& after);
+        // Marks the chunks in a rectangle as not seen, so they count as changed next time.
+        static void forget(Table& table, const OIIO::ROI& roi);
+};
+
+#endif //EXRCHUNKS_H
@@ -0,0 +1,172 @@
+#include "ExrDecode.h"
+#include <QDebug>
+#include <QString>
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "TaskScheduler.h"
+#include "Trace.h"
+
+
+namespace {
+    // As OpenEXR packs scanlines into chunks, see ExrChunks for the same from the file itself.
+    int linesPerChunk(const std::string& compression) {
+        // "dwaa:45" and the like carry their level along.
+        const std::string name = compression.substr(0, compression.find(':'));
+        if (name == "none" || name == "rle" || name == "zips") {
+            return 1;
+        } else if (name == "zip" || name == "pxr24") {
+            return 16;
+        } else if (name == "piz" || name == "b44" || name == "b44a" || name == "dwaa") {
+            return 32;
+        } else if (name == "dwab") {
+            return 256;
+        }
+        return 0;
+    }
+
+
+    // Inputs of the same file for the bands, handed from band to band.
+    class Inputs {
+        public:
+            Inputs(const std::string& filename, ImageInput* first): filename(filename) {
+                first->threads(1);
+                this->free.push_back(first);
+            }
+
+            ~Inputs() {
+                for (ImageInput* input: this->free) {
+                    input->threads(0);
+                }
+            }
+
+            ImageInput* take() {
+                {
+                    std::lock_guard<std::mutex> lock(this->mutex);
+                    if (!this->free.empty()) {
+                        ImageInput* input = this->free.back();
+                        this->free.pop_back();
+                        return input;
+                    }
+                }
+
+                auto opened = ImageInput::open(this->filename);
+                if (!opened) {
+                    return nullptr;
+                }
+                opened->threads(1);
+
+                std::lock_guard<std::mutex> lock(this->mutex);
+                this->owned.push_back(std::move(opened));
+                return this->owned.back().get();
+            }
+
+            void give(ImageInput* input) {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                this->free.push_back(input);
+            }
+
+        private:
+            std::string filename;
+            std::mutex mutex;
+            std::vector<ImageInput*> free;
+            std::vector<std::unique_ptr<ImageInput>> owned;
+    };
+}
+
+
+ExrDecode::Options ExrDecode::defaults() {
+    static const Options options = []() {
+        Options defaults;
+        const char* mode = std::getenv("EXRAY_DECODE");
+        if (mode && std::strcmp(mode, "library") == 0) {
+            defaults.mode = Mode::Library;
+        }
+        return defaults;
+    }();
+    return options;
+}
+
+
+const char* ExrDecode::modeName(Mode mode) {
+    return mode == Mode::Library ? "library" : "chunked";
+}
+
+
+int ExrDecode::chunkRows(const ImageInput* input) {
+    if (std::strcmp(input->format_name(), "openexr") != 0) {
+        return 0;
+    }
+
+    const ImageSpec& spec = input->spec();
+    if (spec.tile_width > 0) {
+        return spec.tile_height;
+    }
+    return linesPerChunk(spec.get_string_attribute("compression", "zip"));
+}
+
+
+bool ExrDecode::read(const std::string& filename, ImageInput* input, float* pixels, const Options& options) {
+    const ImageSpec spec = input->spec();
+    const int threads = options.threads > 0 ? options.threads : TaskScheduler::instance().threadCount();
+    const int rows = chunkRows(input);
+
+    // Deep and volume images, and everything that isn't an EXR, are left to the library.
+    if (options.mode == Mode::Library || rows <= 0 || spec.depth > 1 || spec.deep) {
+        EXRAY_TRACE_SCOPE("decode.library");
+        input->threads(threads);
+        const bool ok = input->read_image(0, 0, 0, spec.nchannels, TypeDesc::FLOAT, pixels);
+        input->threads(0);
+        if (!ok) {
+            qDebug() << "Failed to read image data:" << QString::fromStdString(input->geterror());
+        }
+        return ok;
+    }
+
+    EXRAY_TRACE_SCOPE("decode.chunked");
+
+    // A few bands per thread so the ones with more detail don't hold up the rest.
+    const int chunks = (spec.height + rows - 1) / rows;
+    const int bands = std::min(chunks, threads * TaskScheduler::chunks_per_thread);
+    const int band_rows = (chunks + bands - 1) / bands * rows;
+    const size_t row_values = size_t(spec.width) * spec.nchannels;
+
+    Inputs inputs(filename, input);
+    std::atomic<bool> failed = false;
+
+    TaskScheduler::parallelFor(0, bands, [&](int64_t band) {
+        const int first = int(band) * band_rows;
+        const int last = std::min(first + band_rows, spec.height);
+        if (first >= last || failed) {
+            return;
+        }
+
+        ImageInput* reader = inputs.take();
+        if (!reader) {
+            failed = true;
+            return;
+        }
+
+        float* dest = pixels + size_t(first) * row_values;
+        bool ok;
+        if (spec.tile_width > 0) {
+            ok = reader->read_tiles(0, 0, spec.x, spec.x + spec.width, spec.y + first, spec.y + last, spec.z, spec.z + 1,
+                                    0, spec.nchannels, TypeDesc::FLOAT, dest);
+        } else {
+            ok = reader->read_scanlines(0, 0, spec.y + first, spec.y + last, spec.z, 0, spec.nchannels,
+                                        TypeDesc::FLOAT, dest);
+        }
+
+        if (!ok) {
+            qDebug() << "Failed to read rows" << first << "to" << last << ":" << QString::fromStdString(reader->geterror());
+            failed = true;
+        }
+        inputs.give(reader);
+    });
+
+    return !failed;
+}
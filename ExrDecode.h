@@ -0,0 +1,36 @@
+#ifndef EXRDECODE_H
+#define EXRDECODE_H
+
+#include <string>
+#include <OpenImageIO/imageio.h>
+
+using namespace OIIO;
+
+/*
+ * Decodes the full resolution level of an image as float, with control over how it's spread over threads.
+ *
+ * Library hands the whole image to read_image with the threads attribute set, OpenEXR then
+ * decompresses chunks on its own small pool, see TaskScheduler::library_threads. Chunked cuts the data window into bands of whole chunks,
+ * scanline blocks as the compression packs them or rows of tiles, and decodes every band on the
+ * scheduler with an input of its own straight into its place in the caller's buffer. Files that
+ * aren't EXR always go the library way.
+ *
+ * The default is chunked, or what EXRAY_DECODE says: library or chunked.
+ */
+class ExrDecode {
+    public:
+        enum class Mode { Library, Chunked };
+        struct Options {
+            Mode mode = Mode::Chunked;
+            // 0 uses as many as the scheduler has.
+            int threads = 0;
+        };
+        static Options defaults();
+        static const char* modeName(Mode mode);
+        // Scanlines in one chunk for the compression, the tile height for tiled files, 0 if it's not an EXR.
+        static int chunkRows(const ImageInput* input);
+        // Into width * height * nchannels floats, interleaved.
+        static bool read(const std::string& filename, ImageInput* input, float* pixels, const Options& options = defaults());
+};
+
+#endif //EXRDECODE_H
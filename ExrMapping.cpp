@@ -0,0 +1,305 @@
+#include "ExrMapping.h"
+#include <QFileInfo>
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+
+
+namespace {
+    constexpr int32_t exr_magic = 20000630;
+    constexpr int32_t tiled_flag = 0x200;
+    constexpr int32_t deep_flag = 0x800;
+    constexpr int32_t multipart_flag = 0x1000;
+    // The line number and the size of the data in front of every scanline chunk, the tile and
+    // level coordinates and the size in front of every tile.
+    constexpr qint64 scanline_header = 8;
+    constexpr qint64 tile_header = 20;
+
+    std::atomic<bool> mapping_enabled = true;
+
+    // As in ExrChunks, EXR is little endian like everything we run on.
+    struct Reader {
+        const uchar* data;
+        qint64 size;
+        qint64 position = 0;
+
+        template<typename T>
+        bool read(T& value) {
+            if (this->position + qint64(sizeof(T)) > this->size) {
+                return false;
+            }
+            std::memcpy(&value, this->data + this->position, sizeof(T));
+            this->position += sizeof(T);
+            return true;
+        }
+
+        bool readName(std::string& name) {
+            const char* start = reinterpret_cast<const char*>(this->data + this->position);
+            const char* end = static_cast<const char*>(std::memchr(start, 0, this->size - this->position));
+            if (!end) {
+                return false;
+            }
+            name.assign(start, end);
+            this->position += (end - start) + 1;
+            return true;
+        }
+    };
+
+
+    struct FileChannel {
+        std::string name;
+        OIIO::TypeDesc type;
+    };
+
+
+    // The pixel types of OpenEXR, anything else isn't a file we know how to lay out.
+    bool pixelType(int32_t type, OIIO::TypeDesc& desc) {
+        switch (type) {
+            case 0:
+                desc = OIIO::TypeDesc::UINT;
+                return true;
+            case 1:
+                desc = OIIO::TypeDesc::HALF;
+                return true;
+            case 2:
+                desc = OIIO::TypeDesc::FLOAT;
+                return true;
+            default:
+                return false;
+        }
+    }
+}
+
+
+ExrMapping::~ExrMapping() {
+    if (this->data) {
+        this->file.unmap(this->data);
+    }
+}
+
+
+std::shared_ptr<const ExrMapping> ExrMapping::open(const std::string& filename, const OIIO::ImageSpec& spec) {
+    if (!enabled() || spec.width <= 0 || spec.height <= 0 || spec.nchannels <= 0) {
+        return nullptr;
+    }
+
+    // Mapped pages are only read when they're touched, checking the header doesn't read the pixels.
+    std::shared_ptr<ExrMapping> mapping(new ExrMapping());
+    mapping->file.setFileName(QString::fromStdString(filename));
+    if (!mapping->file.open(QIODevice::ReadOnly)) {
+        return nullptr;
+    }
+    // A renderer writing the file again in place cuts it short under the mapping, and touching a
+    // page past the new end takes the process down. Only files that look done are mapped.
+    const QFileInfo info(mapping->file.fileName());
+    if (info.isWritable() && info.lastModified().secsTo(QDateTime::currentDateTime()) < settle_seconds) {
+        return nullptr;
+    }
+    mapping->size = mapping->file.size();
+    mapping->modified = info.lastModified();
+    mapping->data = mapping->size > 0 ? mapping->file.map(0, mapping->size) : nullptr;
+    if (!mapping->data) {
+        return nullptr;
+    }
+    Reader reader{mapping->data, mapping->size};
+
+    int32_t magic = 0;
+    int32_t version = 0;
+    if (!reader.read(magic) || magic != exr_magic || !reader.read(version)) {
+        return nullptr;
+    }
+    if (version & (deep_flag | multipart_flag)) {
+        return nullptr;
+    }
+
+    int32_t window[4] = {0, 0, -1, -1};
+    uint8_t compression = 255;
+    uint32_t tileSize[2] = {0, 0};
+    uint8_t tileMode = 0;
+    bool hasTiles = false;
+    std::vector<FileChannel> fileChannels;
+
+    // Attributes up to the empty name that ends the header.
+    while (true) {
+        std::string name;
+        std::string type;
+        int32_t size = 0;
+        if (!reader.readName(name)) {
+            return nullptr;
+        }
+        if (name.empty()) {
+            break;
+        }
+        if (!reader.readName(type) || !reader.read(size) || size < 0 || reader.position + size > reader.size) {
+            return nullptr;
+        }
+
+        qint64 next = reader.position + size;
+        if (name == "channels") {
+            // Names with the pixel type, linearity, three reserved bytes and the sampling.
+            FileChannel channel;
+            while (reader.position < next && reader.readName(channel.name) && !channel.name.empty()) {
+                int32_t pixel = 0;
+                int32_t sampling[2] = {0, 0};
+                reader.read(pixel);
+                reader.position += 4;
+                if (!reader.read(sampling) || !pixelType(pixel, channel.type) || sampling[0] != 1 || sampling[1] != 1) {
+                    return nullptr;
+                }
+                fileChannels.push_back(channel);
+            }
+        } else if (name == "dataWindow" && size == 16) {
+            reader.read(window);
+        } else if (name == "compression" && size == 1) {
+            reader.read(compression);
+        } else if (name == "tiles" && size == 9) {
+            reader.read(tileSize);
+            reader.read(tileMode);
+            hasTiles = true;
+        }
+        reader.position = next;
+    }
+
+    // Uncompressed only, a single level if it's tiled, and the same image OpenImageIO saw.
+    const bool tiled = version & tiled_flag;
+    const int width = window[2] - window[0] + 1;
+    const int height = window[3] - window[1] + 1;
+    if (compression != 0 || width != spec.width || height != spec.height || int(fileChannels.size()) != spec.nchannels) {
+        return nullptr;
+    }
+    if (tiled && (!hasTiles || (tileMode & 0xf) != 0 || tileSize[0] == 0 || tileSize[1] == 0)) {
+        return nullptr;
+    }
+    mapping->width = width;
+    mapping->height = height;
+    mapping->chunk_width = tiled ? int(std::min<uint32_t>(tileSize[0], uint32_t(width))) : width;
+    mapping->chunk_height = tiled ? int(std::min<uint32_t>(tileSize[1], uint32_t(height))) : 1;
+    mapping->columns = (width + mapping->chunk_width - 1) / mapping->chunk_width;
+    const int rows = (height + mapping->chunk_height - 1) / mapping->chunk_height;
+
+    // OpenImageIO orders channels its own way, they're found by name.
+    std::vector<qint64> fileOffsets;
+    for (const FileChannel& channel: fileChannels) {
+        fileOffsets.push_back(mapping->pixel_bytes);
+        mapping->pixel_bytes += channel.type.size();
+    }
+    for (int c = 0; c < spec.nchannels; ++c) {
+        auto found = std::find_if(fileChannels.begin(), fileChannels.end(), [&](const FileChannel& channel) {
+            return channel.name == spec.channelnames[c];
+        });
+        if (found == fileChannels.end()) {
+            return nullptr;
+        }
+        mapping->channels.push_back({fileOffsets[found - fileChannels.begin()], found->type});
+    }
+
+    // All chunks written and all of them in the file, each where the table says and as big as it should be.
+    const qint64 count = qint64(mapping->columns) * rows;
+    const qint64 header = tiled ? tile_header : scanline_header;
+    const qint64 tableEnd = reader.position + count * 8;
+    if (tableEnd > reader.size) {
+        return nullptr;
+    }
+    mapping->chunks.resize(count);
+    for (qint64 i = 0; i < count; ++i) {
+        const int column = int(i % mapping->columns);
+        const int row = int(i / mapping->columns);
+        const qint64 chunkWidth = std::min(mapping->chunk_width, width - column * mapping->chunk_width);
+        const qint64 chunkHeight = std::min(mapping->chunk_height, height - row * mapping->chunk_height);
+        const qint64 bytes = chunkWidth * chunkHeight * mapping->pixel_bytes;
+
+        uint64_t offset = 0;
+        reader.read(offset);
+        if (offset < uint64_t(tableEnd) || offset + header + bytes > uint64_t(reader.size)) {
+            return nullptr;
+        }
+
+        int32_t fields[5] = {0, 0, 0, 0, 0};
+        std::memcpy(fields, mapping->data + offset, header);
+        const bool placed = tiled ? fields[0] == column && fields[1] == row && fields[2] == 0 && fields[3] == 0
+                                    && fields[4] == bytes
+                                  : fields[0] == window[1] + row && fields[1] == bytes;
+        if (!placed) {
+            return nullptr;
+        }
+        mapping->chunks[i] = qint64(offset) + header;
+    }
+
+    return mapping;
+}
+
+
+bool ExrMapping::enabled() {
+    static const bool allowed = []() {
+        const char* mmap = std::getenv("EXRAY_MMAP");
+        return !mmap || std::strcmp(mmap, "0") != 0;
+    }();
+    return allowed && mapping_enabled;
+}
+
+
+void ExrMapping::setEnabled(bool enabled) {
+    mapping_enabled = enabled;
+}
+
+
+OIIO::TypeDesc ExrMapping::type(int channel) const {
+    return this->channels[channel].type;
+}
+
+
+const uchar* ExrMapping::span(int channel, int y, int x, int& count) const {
+    const int column = x / this->chunk_width;
+    const int row = y / this->chunk_height;
+    const int left = column * this->chunk_width;
+    const int chunkWidth = std::min(this->chunk_width, this->width - left);
+    const qint64 line = y - row * this->chunk_height;
+    const Channel& found = this->channels[channel];
+
+    count = left + chunkWidth - x;
+    return this->data + this->chunks[size_t(row) * this->columns + column]
+           + (line * this->pixel_bytes + found.offset) * chunkWidth + qint64(x - left) * found.type.size();
+}
+
+
+void ExrMapping::copy(int channel, int y, int xbegin, int xend, void* destination) const {
+    const size_t value = this->channels[channel].type.size();
+    uchar* to = static_cast<uchar*>(destination);
+
+    // A scanline in one go, a tiled line tile by tile.
+    for (int x = xbegin; x < xend;) {
+        int count = 0;
+        const uchar* source = this->span(channel, y, x, count);
+        count = std::min(count, xend - x);
+        std::memcpy(to, source, size_t(count) * value);
+        to += size_t(count) * value;
+        x += count;
+    }
+}
+
+
+void ExrMapping::read(int channel, int y, int xbegin, int xend, float* destination, int stride) const {
+    const OIIO::TypeDesc type = this->channels[channel].type;
+
+    for (int x = xbegin; x < xend;) {
+        int count = 0;
+        const uchar* source = this->span(channel, y, x, count);
+        count = std::min(count, xend - x);
+        OIIO::convert_image(1, count, 1, 1, source, type, OIIO::AutoStride, OIIO::AutoStride, OIIO::AutoStride,
+                            destination, OIIO::TypeDesc::FLOAT, stride * sizeof(float), OIIO::AutoStride, OIIO::AutoStride);
+        destination += size_t(count) * stride;
+        x += count;
+    }
+}
+
+
+bool ExrMapping::unchanged() const {
+    const QFileInfo info(this->file.fileName());
+    return info.size() == this->size && info.lastModified() == this->modified;
+}
+
+
+qint64 ExrMapping::bytes() const {
+    return this->size;
+}
@@ -0,0 +1,75 @@
+#ifndef EXRMAPPING_H
+#define EXRMAPPING_H
+
+#include <QDateTime>
+#include <QFile>
+#include <QString>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include <OpenImageIO/imageio.h>
+
+/*
+ * The pixels of an uncompressed single part EXR, scanline or tiled, read in place from the file
+ * mapped into memory.
+ *
+ * Uncompressed, every chunk, a scanline or a tile, holds its lines one after the other, and every
+ * line the values of each channel after the other, in the file's channel order and type. Mapped, a
+ * run of values of a channel is a pointer into the file, there's nothing to decode and no buffer of
+ * our own to hold the frame. The pages are the system's page cache, shared with every other viewer
+ * of the file and still there when it's opened again. Tiled files with mip or rip levels aren't
+ * mapped, they're decoded as before.
+ *
+ * Only files with all of their chunks there are mapped, the header and offset table are checked
+ * against the spec OpenImageIO read. A file truncated while it's mapped takes the process down
+ * with it, so only files that look done are mapped: ones we can't write to, or that haven't changed
+ * for settle_seconds. Anything else is decoded. Readers check unchanged() once per frame and decode
+ * a file written again since, mapping is off while files are followed as they're written, and
+ * when EXRAY_MMAP is 0.
+ */
+class ExrMapping {
+    public:
+        // How long a file we could write to has to stay untouched before it's mapped.
+        static constexpr int settle_seconds = 30;
+        ~ExrMapping();
+        // Null when the file can't be read in place.
+        static std::shared_ptr<const ExrMapping> open(const std::string& filename, const OIIO::ImageSpec& spec);
+        static bool enabled();
+        static void setEnabled(bool enabled);
+        // Of a channel of the spec, UINT, HALF or FLOAT.
+        OIIO::TypeDesc type(int channel) const;
+        // Values xbegin to xend of a channel on line y of the data window, as they are in the file.
+        void copy(int channel, int y, int xbegin, int xend, void* destination) const;
+        // The same as floats, stride floats apart, converted as read_image does.
+        void read(int channel, int y, int xbegin, int xend, float* destination, int stride) const;
+        // False once the file was written again, what's mapped may not be all there anymore.
+        bool unchanged() const;
+        qint64 bytes() const;
+
+    private:
+        struct Channel {
+            // Bytes of the channels before it in a pixel, times the width of a chunk line is where it starts.
+            qint64 offset = 0;
+            OIIO::TypeDesc type;
+        };
+        ExrMapping() = default;
+        QFile file;
+        uchar* data = nullptr;
+        qint64 size = 0;
+        QDateTime modified;
+        int width = 0;
+        int height = 0;
+        // A scanline is a chunk as wide as the image and a line high.
+        int chunk_width = 0;
+        int chunk_height = 0;
+        int columns = 0;
+        qint64 pixel_bytes = 0;
+        // Where the data of each chunk starts, rows of chunks from the top.
+        std::vector<qint64> chunks;
+        std::vector<Channel> channels;
+        // The values of a channel from x to the end of the chunk holding them on line y, count of them.
+        const uchar* span(int channel, int y, int x, int& count) const;
+};
+
+#endif //EXRMAPPING_H
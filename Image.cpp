@@ -1,29 +1,89 @@
 #include "Image.h"
+#include <algorithm>
+#include "DecodeCache.h"
+#include "ExrDecode.h"
+#include "PixelOps.h"
+#include "TaskScheduler.h"
+#include "Trace.h"
+
+
+namespace {
+    // Stands in for the file of an image whose pixels come from somewhere else, it only has the spec.
+    class StreamInput : public ImageInput {
+        public:
+            explicit StreamInput(const ImageSpec& spec) {
+                this->m_spec = spec;
+            }
+            const char* format_name() const override {
+                return "stream";
+            }
+            bool open(const std::string& name, ImageSpec& spec) override {
+                spec = this->m_spec;
+                return true;
+            }
+            bool close() override {
+                return true;
+            }
+            bool read_native_scanline(int subimage, int miplevel, int y, int z, void* data) override {
+                return false;
+            }
+    };
+}
 
 
 Image::Image(const char* filename) {
+    EXRAY_TRACE_SCOPE("open");
+    this->filename = filename;
     this->inp = ImageInput::open(filename);
 
     if (!this->inp) {
         qDebug() << "File " << filename << " could not be opened";
         return;
     }
+
+    this->cryptomatte_layers = Cryptomatte::findLayers(this->inp->spec(), QString::fromUtf8(filename));
+}
+
+
+Image::Image(const ImageSpec& spec, const std::string& name) {
+    this->filename = name;
+    this->inp = std::make_unique<StreamInput>(spec);
+    this->pixels = std::make_shared<FloatBuffer>(size_t(spec.width) * spec.height * spec.nchannels, 0.0f);
+    this->cryptomatte_layers = Cryptomatte::findLayers(spec, QString::fromStdString(name));
 }
 
 
 QList<QString> Image::getlayers() {
+    QStringList cryptomattes;
+    for (const auto& cryptomatte : this->cryptomatte_layers) {
+        cryptomattes.append(cryptomatte.name);
+    }
+
+    QList<QString> layers = layerNames(this->inp->spec(), cryptomattes);
+    for (const auto& layer : this->virtual_layers) {
+        layers.append(layer.first);
+    }
+
+    return layers;
+}
 
-    const ImageSpec& spec = this->inp->spec();
 
+QList<QString> Image::layerNames(const ImageSpec& spec, const QStringList& cryptomattes) {
     QList<QString> layers;
     for (const auto& channel_name : spec.channelnames) {
-        qDebug() << channel_name;
         QString new_layer_name = channel_name.c_str();
         int pos = channel_name.find_last_of('.');
         if (pos != std::string::npos) {
             new_layer_name.resize(pos);
         }
 
+        // The rank channels of a Cryptomatte are listed as the one layer they make.
+        for (const QString& cryptomatte : cryptomattes) {
+            if (new_layer_name.startsWith(cryptomatte) && new_layer_name.size() == cryptomatte.size() + 2) {
+                new_layer_name = cryptomatte;
+            }
+        }
+
         if (!layers.contains(new_layer_name)) {
             layers.append(new_layer_name);
         }
@@ -36,17 +96,176 @@ QList<QString> Image::getlayers() {
 }
 
 
-Image::ChannelData Image::getChannelDataForOCIO(const QString& channelBaseName, const QString& component) {
+bool Image::addVirtualLayer(const QString& name, const QString& expression, QString* error) {
+    if (!this->inp) {
+        return false;
+    }
+
     const ImageSpec& spec = this->inp->spec();
-    ChannelData result;
+    std::vector<int> indices;
+    std::vector<std::string> names;
+    Image::findLayerChannels(spec, name, indices, names);
+    if (name.isEmpty() || !indices.empty()) {
+        if (error) {
+            *error = "The name is already a layer of the file";
+        }
+        return false;
+    }
 
-    result.width = spec.width;
-    result.height = spec.height;
+    AovExpression compiled = AovExpression::compile(expression, spec, error);
+    if (!compiled.isValid()) {
+        return false;
+    }
+
+    // Defining it again replaces the expression.
+    for (auto& layer : this->virtual_layers) {
+        if (layer.first == name) {
+            layer.second = compiled;
+            return true;
+        }
+    }
+    this->virtual_layers.append({name, compiled});
+    return true;
+}
+
+
+std::shared_ptr<const Cryptomatte> Image::cryptomatte(const QString& layer) {
+    const Cryptomatte::Layer* found = this->cryptomatteLayer(layer);
+    if (!found || !this->loadPixels()) {
+        return nullptr;
+    }
+
+    std::shared_ptr<const FloatBuffer> pixels;
+    std::shared_ptr<const ExrMapping> mapping;
+    this->source(pixels, mapping);
+
+    std::lock_guard<std::mutex> lock(this->cryptomatte_mutex);
+    std::shared_ptr<const Cryptomatte>& index = this->cryptomattes[layer];
+    if (!index) {
+        index = std::make_shared<const Cryptomatte>(*found, pixels, this->inp->spec());
+    }
+    return index;
+}
+
+
+const Cryptomatte::Layer* Image::cryptomatteLayer(const QString& layer) const {
+    for (const auto& cryptomatte : this->cryptomatte_layers) {
+        if (cryptomatte.name == layer) {
+            return &cryptomatte;
+        }
+    }
+    return nullptr;
+}
+
+
+bool Image::isVirtualLayer(const QString& name) const {
+    for (const auto& layer : this->virtual_layers) {
+        if (layer.first == name) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+void Image::source(std::shared_ptr<const FloatBuffer>& pixels, std::shared_ptr<const ExrMapping>& mapping) const {
+    std::lock_guard<std::mutex> lock(this->mapping_mutex);
+    pixels = this->pixels;
+    mapping = this->mapping;
+}
+
+
+bool Image::loadPixels() {
+    std::lock_guard<std::mutex> load(this->load_mutex);
+    std::shared_ptr<const FloatBuffer> pixels;
+    std::shared_ptr<const ExrMapping> mapped;
+    this->source(pixels, mapped);
+    if (pixels) {
+        return true;
+    }
+
+    if (!this->inp) {
+        return false;
+    }
+
+    // Other images of the same file hand us their pixels instead of decoding again.
+    pixels = DecodeCache::instance().get(this->filename, [&](FloatBuffer& buffer) {
+        EXRAY_TRACE_SCOPE("decode");
+        const ImageSpec& spec = this->inp->spec();
+        buffer.resize(size_t(spec.width) * spec.height * spec.nchannels);
+
+        // Uncompressed, the lines are only converted out of the file. Not once it was written
+        // again, what's mapped may be cut short.
+        if (!mapped && this->inp->format_name() == std::string("openexr")) {
+            mapped = ExrMapping::open(this->filename, spec);
+        }
+        if (mapped && mapped->unchanged()) {
+            TaskScheduler::parallelFor(0, spec.height, [&](int64_t y) {
+                float* row = buffer.data() + size_t(y) * spec.width * spec.nchannels;
+                for (int c = 0; c < spec.nchannels; ++c) {
+                    mapped->read(c, int(y), 0, spec.width, row + c, spec.nchannels);
+                }
+            });
+            return true;
+        }
+        return ExrDecode::read(this->filename, this->inp.get(), buffer.data());
+    });
+    if (!pixels) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(this->mapping_mutex);
+    this->pixels = pixels;
+    return true;
+}
+
+
+bool Image::openPixels() {
+    std::shared_ptr<const FloatBuffer> pixels;
+    std::shared_ptr<const ExrMapping> mapping;
+    this->source(pixels, mapping);
+    if (pixels || mapping) {
+        return true;
+    }
+
+    if (!this->inp) {
+        return false;
+    }
+
+    // Read in place, no buffer of our own and nothing to decode.
+    if (this->inp->format_name() == std::string("openexr")) {
+        mapping = ExrMapping::open(this->filename, this->inp->spec());
+        if (mapping) {
+            std::lock_guard<std::mutex> lock(this->mapping_mutex);
+            if (!this->mapping) {
+                this->mapping = mapping;
+            }
+            return true;
+        }
+    }
+    return this->loadPixels();
+}
+
+
+void Image::unmapPixels() {
+    std::shared_ptr<const FloatBuffer> pixels;
+    std::shared_ptr<const ExrMapping> mapping;
+    this->source(pixels, mapping);
+    if (!mapping) {
+        return;
+    }
+
+    // Decoded when it changed since, converted from the mapping while it's still whole. Frames
+    // being made keep the mapping they picked until they're done.
+    if (this->loadPixels()) {
+        std::lock_guard<std::mutex> lock(this->mapping_mutex);
+        this->mapping.reset();
+    }
+}
 
-    // Find all channels that match the base name
-    std::vector<int> matching_channel_indices;
-    std::vector<std::string> matching_channel_names;
 
+void Image::findLayerChannels(const ImageSpec& spec, const QString& channelBaseName,
+                              std::vector<int>& indices, std::vector<std::string>& names) {
     if (channelBaseName == "default") {
         // Handle default channels (R, G, B, A) for PNG, PSD, etc.
         std::vector<std::string> defaultChannels = {"R", "G", "B", "A"};
@@ -54,8 +273,8 @@ Image::ChannelData Image::getChannelDataForOCIO(const QString& channelBaseName,
         for (const std::string& defaultChannel : defaultChannels) {
             for (int i = 0; i < spec.channelnames.size(); ++i) {
                 if (spec.channelnames[i] == defaultChannel) {
-                    matching_channel_indices.push_back(i);
-                    matching_channel_names.push_back(spec.channelnames[i]);
+                    indices.push_back(i);
+                    names.push_back(spec.channelnames[i]);
                     break; // Found this channel, move to next
                 }
             }
@@ -74,45 +293,142 @@ Image::ChannelData Image::getChannelDataForOCIO(const QString& channelBaseName,
             }
 
             if (base_name == channelBaseName) {
-                matching_channel_indices.push_back(i);
-                matching_channel_names.push_back(channel_name);
+                indices.push_back(i);
+                names.push_back(channel_name);
             }
         }
     }
+}
 
-    if (matching_channel_indices.empty()) {
-        qDebug() << "No channels found for base name:" << channelBaseName;
-        return result;
+
+bool Image::updatePixels(const Region& region) {
+    std::shared_ptr<const FloatBuffer> pixels;
+    std::shared_ptr<const ExrMapping> mapping;
+    this->source(pixels, mapping);
+    if (!pixels && !mapping) {
+        return false;
     }
 
-    // Read the entire image data
-    std::vector<float> image_data(spec.width * spec.height * spec.nchannels);
-    if (!this->inp->read_image(0, 0, 0, spec.nchannels, TypeDesc::FLOAT, image_data.data())) {
-        qDebug() << "Failed to read image data";
-        return result;
+    // The file may have been swapped for a different one since we decoded it.
+    const ImageSpec& spec = this->inp->spec();
+    const ROI& roi = region.roi;
+    if (region.pixels.size() != size_t(roi.width()) * roi.height() * spec.nchannels) {
+        return false;
     }
 
-    if (component == "all") {
-        // Return all matching channels (typically RGBA)
-        result.channels = matching_channel_indices.size();
-        result.data.resize(spec.width * spec.height * result.channels);
-        result.channel_names = matching_channel_names;
-
-        // Extract and interleave the matching channels
-        for (int y = 0; y < spec.height; ++y) {
-            for (int x = 0; x < spec.width; ++x) {
-                int pixel_idx = y * spec.width + x;
-                for (int c = 0; c < matching_channel_indices.size(); ++c) {
-                    int src_idx = pixel_idx * spec.nchannels + matching_channel_indices[c];
-                    int dst_idx = pixel_idx * result.channels + c;
-                    result.data[dst_idx] = image_data[src_idx];
-                }
-            }
+    return this->updatePixels(roi, region.pixels.data(), size_t(roi.width()) * spec.nchannels);
+}
+
+
+bool Image::updatePixels(const ROI& roi, const float* source, size_t rowStride) {
+    // Read in place so far, the file written again is decoded and the changes go on top of it.
+    std::shared_ptr<const FloatBuffer> pixels;
+    std::shared_ptr<const ExrMapping> mapping;
+    this->source(pixels, mapping);
+    if (!pixels && !(mapping && this->loadPixels())) {
+        return false;
+    }
+
+    const ImageSpec& spec = this->inp->spec();
+    if (roi.xbegin < 0 || roi.ybegin < 0 || roi.xend > spec.width || roi.yend > spec.height || roi.chbegin < 0
+        || roi.chbegin >= std::min(roi.chend, spec.nchannels)) {
+        return false;
+    }
+
+    // Object indices are made again from the new pixels when next asked for.
+    {
+        std::lock_guard<std::mutex> lock(this->cryptomatte_mutex);
+        this->cryptomattes.clear();
+    }
+
+    // The cache no longer matches the file, anyone else still holding the pixels keeps what they
+    // had and we continue on a copy. Held throughout, nobody picks up the pixels halfway written.
+    DecodeCache::instance().release(this->filename);
+    pixels.reset();
+    std::lock_guard<std::mutex> lock(this->mapping_mutex);
+    if (this->pixels.use_count() > 1) {
+        this->pixels = std::make_shared<FloatBuffer>(*this->pixels);
+    }
+
+    // Buffers are never made const, only handed out that way.
+    FloatBuffer& image_data = const_cast<FloatBuffer&>(*this->pixels);
+    const int chbegin = roi.chbegin;
+    const int chend = std::min(roi.chend, spec.nchannels);
+    const size_t row_values = size_t(roi.width()) * spec.nchannels;
+
+    TaskScheduler::parallelFor(roi.ybegin, roi.yend, [&](int64_t y) {
+        const float* from = source + size_t(y - roi.ybegin) * rowStride;
+        float* to = image_data.data() + (size_t(y) * spec.width + roi.xbegin) * spec.nchannels;
+        if (chbegin == 0 && chend == spec.nchannels) {
+            std::copy_n(from, row_values, to);
+            return;
         }
+
+        // Only some of the channels, the others keep what they had.
+        for (int x = 0; x < roi.width(); ++x) {
+            const size_t pixel = size_t(x) * spec.nchannels;
+            std::copy(from + pixel + chbegin, from + pixel + chend, to + pixel + chbegin);
+        }
+    });
+    return true;
+}
+
+
+bool Image::extraction(const QString& channelBaseName, const QString& component, Extraction& extraction) {
+    extraction = Extraction();
+    const ImageSpec& spec = this->inp->spec();
+
+    // Virtual layers are computed, a single component of them is shown as gray like for the layers of the file.
+    for (const auto& layer : this->virtual_layers) {
+        if (layer.first != channelBaseName) {
+            continue;
+        }
+        if (!this->loadPixels()) {
+            return false;
+        }
+
+        this->source(extraction.pixels, extraction.mapping);
+        extraction.mapping.reset();
+        extraction.expression = &layer.second;
+        extraction.lane = component != "all" ? QString("rgba").indexOf(component) : -1;
+        extraction.channels = extraction.lane != -1 ? 1 : 4;
+        extraction.channel_names = extraction.lane != -1 ? std::vector<std::string>{component.toUpper().toStdString()}
+                                                         : std::vector<std::string>{"R", "G", "B", "A"};
+        return true;
+    }
+
+    // A Cryptomatte shows its objects in colors.
+    if (const Cryptomatte::Layer* cryptomatte = this->cryptomatteLayer(channelBaseName)) {
+        if (!this->loadPixels()) {
+            return false;
+        }
+
+        this->source(extraction.pixels, extraction.mapping);
+        extraction.mapping.reset();
+        extraction.cryptomatte = cryptomatte;
+        extraction.channels = 4;
+        extraction.channel_names = {"R", "G", "B", "A"};
+        return true;
+    }
+
+    // Find all channels that match the base name
+    std::vector<int> matching_channel_indices;
+    std::vector<std::string> matching_channel_names;
+    Image::findLayerChannels(spec, channelBaseName, matching_channel_indices, matching_channel_names);
+
+    if (matching_channel_indices.empty()) {
+        qDebug() << "No channels found for base name:" << channelBaseName;
+        return false;
+    }
+
+    if (component == "all") {
+        // All matching channels (typically RGBA), interleaved
+        extraction.indices = matching_channel_indices;
+        extraction.channels = matching_channel_indices.size();
+        extraction.channel_names = matching_channel_names;
     } else {
-        // Return single component (r, g, b, a, etc.) but prepare for viewport display
-        // We'll create a 4-channel RGBA image where the requested component
-        // is replicated across RGB and alpha is set to 1.0
+        // A single component (r, g, b, a, Z etc.) on its own, one float per pixel. The display
+        // shows it as gray or in false color without making an RGBA image of it first.
 
         // Find the specific component channel
         int target_channel_idx = -1;
@@ -141,29 +457,105 @@ Image::ChannelData Image::getChannelDataForOCIO(const QString& channelBaseName,
 
         if (target_channel_idx == -1) {
             qDebug() << "Component" << component << "not found for channel" << channelBaseName;
-            return result;
+            return false;
         }
 
-        result.channels = 4; // Always RGBA for viewport display
-        result.data.resize(spec.width * spec.height * 4);
-        result.channel_names = {"R", "G", "B", "A"}; // Generic names for single component display
+        extraction.indices = {target_channel_idx};
+        extraction.channels = 1;
+        extraction.channel_names = {spec.channelnames[target_channel_idx]};
+    }
 
-        // Fill the result data
-        for (int y = 0; y < spec.height; ++y) {
-            for (int x = 0; x < spec.width; ++x) {
-                int pixel_idx = y * spec.width + x;
-                int src_idx = pixel_idx * spec.nchannels + target_channel_idx;
-                int dst_base_idx = pixel_idx * 4;
+    // Read the entire image data, this only decodes the file the first time, an uncompressed one is
+    // only mapped. One written again since it was mapped is decoded after all, looked at once here
+    // rather than for every row.
+    if (!this->openPixels()) {
+        return false;
+    }
+    this->source(extraction.pixels, extraction.mapping);
+    if (!extraction.pixels && !extraction.mapping->unchanged()) {
+        if (!this->loadPixels()) {
+            return false;
+        }
+        this->source(extraction.pixels, extraction.mapping);
+    }
+    if (extraction.pixels) {
+        extraction.mapping.reset();
+    }
+    return true;
+}
 
-                float value = image_data[src_idx];
 
-                // Replicate the component value across RGB channels
-                result.data[dst_base_idx + 0] = value; // R
-                result.data[dst_base_idx + 1] = value; // G
-                result.data[dst_base_idx + 2] = value; // B
-                result.data[dst_base_idx + 3] = 1.0f;  // A (full opacity)
+void Image::extract(const Extraction& extraction, const ROI& roi, float* destination) const {
+    const ImageSpec& spec = this->inp->spec();
+    const int width = roi.width();
+
+    // Straight from the mapped file, each channel converted into its place in the rows.
+    if (!extraction.pixels) {
+        for (int y = roi.ybegin; y < roi.yend; ++y) {
+            float* row = destination + size_t(y - roi.ybegin) * width * extraction.channels;
+            for (int c = 0; c < extraction.channels; ++c) {
+                extraction.mapping->read(extraction.indices[c], y, roi.xbegin, roi.xend, row + c, extraction.channels);
             }
         }
+        return;
+    }
+
+    const float* image_data = extraction.pixels->data();
+    for (int y = roi.ybegin; y < roi.yend; ++y) {
+        const float* source = image_data + (size_t(y) * spec.width + roi.xbegin) * spec.nchannels;
+        float* row = destination + size_t(y - roi.ybegin) * width * extraction.channels;
+
+        if (extraction.expression && extraction.lane != -1) {
+            // All four lanes are computed, only the one asked for is kept.
+            thread_local std::vector<float> lanes;
+            lanes.resize(size_t(width) * 4);
+            extraction.expression->evaluateRow(image_data, spec, y, roi.xbegin, roi.xend, lanes.data());
+            for (int x = 0; x < width; ++x) {
+                row[x] = lanes[size_t(x) * 4 + extraction.lane];
+            }
+        } else if (extraction.expression) {
+            extraction.expression->evaluateRow(image_data, spec, y, roi.xbegin, roi.xend, row);
+        } else if (extraction.cryptomatte) {
+            Cryptomatte::previewRow(*extraction.cryptomatte, image_data, spec, y, roi.xbegin, roi.xend, row);
+        } else {
+            PixelOps::gather(source, width, spec.nchannels, extraction.indices.data(), extraction.channels, row);
+        }
+    }
+}
+
+
+Image::ChannelData Image::getChannelDataForOCIO(const QString& channelBaseName, const QString& component, ROI roi) {
+    EXRAY_TRACE_SCOPE("extract");
+    const ImageSpec& spec = this->inp->spec();
+    ChannelData result;
+
+    // The whole image, or only a rectangle of it.
+    if (!roi.defined()) {
+        roi = ROI(0, spec.width, 0, spec.height);
+    }
+
+    result.width = roi.width();
+    result.height = roi.height();
+    result.channels = 0;
+
+    Extraction extraction;
+    if (!this->extraction(channelBaseName, component, extraction)) {
+        return result;
+    }
+
+    result.channels = extraction.channels;
+    result.channel_names = extraction.channel_names;
+    result.data.resize(size_t(result.width) * result.height * result.channels);
+
+    TaskScheduler::parallelFor(roi.ybegin, roi.yend, [&](int64_t y) {
+        this->extract(extraction, ROI(roi.xbegin, roi.xend, int(y), int(y) + 1),
+                      result.data.data() + size_t(y - roi.ybegin) * result.width * result.channels);
+    });
+
+    // The index of a Cryptomatte is built along when the whole image is asked for.
+    if (extraction.cryptomatte && roi.xbegin == 0 && roi.ybegin == 0 && roi.width() == spec.width
+        && roi.height() == spec.height) {
+        this->cryptomatte(channelBaseName);
     }
 
     return result;
@@ -171,6 +563,7 @@ Image::ChannelData Image::getChannelDataForOCIO(const QString& channelBaseName,
 
 
 Image::ChannelData Image::applyGammaCorrection(const Image::ChannelData& inputData, float gamma) {
+    EXRAY_TRACE_SCOPE("gamma");
 
     // Create a copy of the input data
     ChannelData result = inputData;
@@ -186,36 +579,12 @@ Image::ChannelData Image::applyGammaCorrection(const Image::ChannelData& inputDa
         return result;
     }
 
-    // Calculate the gamma correction exponent
-    float gammaExponent = 1.0f / gamma;
-
-    // Apply gamma correction to RGB channels only (preserve alpha unchanged)
-    int numPixels = inputData.width * inputData.height;
-
-    for (int i = 0; i < numPixels; ++i) {
-        int pixelBaseIdx = i * inputData.channels;
-
-        // Apply gamma to RGB channels (first 3 channels)
-        int channelsToProcess = std::min(3, inputData.channels);
-
-        for (int c = 0; c < channelsToProcess; ++c) {
-            float value = result.data[pixelBaseIdx + c];
-
-            // Only apply gamma to positive values to avoid NaN/inf
-            if (value > 0.0f) {
-                result.data[pixelBaseIdx + c] = std::pow(value, gammaExponent);
-            } else if (value < 0.0f) {
-                // For negative values, apply gamma to absolute value and restore sign
-                result.data[pixelBaseIdx + c] = -std::pow(-value, gammaExponent);
-            }
-            // value == 0.0f remains unchanged
-        }
-
-        // Alpha channel (if present) is left unchanged
-        // Channels beyond RGBA are also left unchanged
-    }
-
-    qDebug() << "Applied gamma correction with factor" << gamma << "to" << numPixels << "pixels";
+    // Apply gamma correction to RGB channels only, alpha and anything after it are left alone.
+    // Negative values mirror the curve, zero, NaN and Inf remain unchanged.
+    TaskScheduler::parallelFor(0, inputData.height, [&](int64_t y) {
+        size_t row = size_t(y) * inputData.width * inputData.channels;
+        PixelOps::gamma(result.data.data() + row, inputData.width, inputData.channels, gamma);
+    });
 
     return result;
 }
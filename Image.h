@@ -4,11 +4,20 @@
 #include <QObject>
 #include <QDebug>
 #include <QList>
+#include <QMap>
+#include <QPair>
+#include <QStringList>
 #include <vector>
 #include <memory>
+#include <mutex>
+#include <string>
 #include <OpenImageIO/imagebuf.h>
 // #include <OpenImageIO/imagespec.h>
 #include <OpenImageIO/imageio.h>
+#include "AovExpression.h"
+#include "BufferPool.h"
+#include "Cryptomatte.h"
+#include "ExrMapping.h"
 
 using namespace OIIO;
 
@@ -21,19 +30,82 @@ class Image : public QObject {
 
     public:
         struct ChannelData {
-            std::vector<float> data;
+            FloatBuffer data;
             int width;
             int height;
             int channels;
             std::vector<std::string> channel_names;
         };
+        // How the pixels of a layer are read out, worked out once for any number of rectangles.
+        struct Extraction {
+            int channels = 0;
+            std::vector<std::string> channel_names;
+            // Channels interleaved as they are, a single component on its own.
+            std::vector<int> indices;
+            // Or a virtual layer, only the component at lane when it isn't -1.
+            const AovExpression* expression = nullptr;
+            int lane = -1;
+            // Or a Cryptomatte preview.
+            const Cryptomatte::Layer* cryptomatte = nullptr;
+            // What the rows are read from, picked once so every rectangle of a frame reads the same
+            // source however the image changes meanwhile. Decoded pixels, or else the mapped file.
+            std::shared_ptr<const FloatBuffer> pixels;
+            std::shared_ptr<const ExrMapping> mapping;
+        };
+        // All channels of a rectangle of the file, as read again after it changed on disk.
+        struct Region {
+            ROI roi;
+            std::vector<float> pixels;
+        };
         explicit Image(const char* filename);
+        // Not from a file, the pixels start out black and come in through updatePixels.
+        Image(const ImageSpec& spec, const std::string& name);
         ~Image();
         std::unique_ptr<ImageInput> inp;
+        std::string filename;
+        // Only set under mapping_mutex, other threads take them through source().
+        std::shared_ptr<const FloatBuffer> pixels;
+        // An uncompressed EXR read in place, pixels stays null until something needs all of it as floats.
+        std::shared_ptr<const ExrMapping> mapping;
+        // The pixels and the mapping as they are now.
+        void source(std::shared_ptr<const FloatBuffer>& pixels, std::shared_ptr<const ExrMapping>& mapping) const;
+        bool loadPixels();
+        // Maps the file when it can be read in place, loads the pixels when it can't.
+        bool openPixels();
+        // Decodes a mapped file and lets go of the mapping, for a file that may be cut short while
+        // it's shown. On the thread the image is used on.
+        void unmapPixels();
         QList<QString> getlayers();
-        ChannelData getChannelDataForOCIO(const QString& channelBaseName, const QString& component);
-        ChannelData applyGammaCorrection(const Image::ChannelData& inputData, float gamma);
+        // The layers the channels of a file make, without virtual ones.
+        static QList<QString> layerNames(const ImageSpec& spec, const QStringList& cryptomattes);
+        // Layers computed from the others with an expression, listed after the ones in the file.
+        bool addVirtualLayer(const QString& name, const QString& expression, QString* error = nullptr);
+        bool isVirtualLayer(const QString& name) const;
+        // The object index of a Cryptomatte layer, built the first time it's asked for. Null for
+        // other layers.
+        std::shared_ptr<const Cryptomatte> cryptomatte(const QString& layer);
+        bool updatePixels(const Region& region);
+        // The channels of roi from pixels holding all channels, rows rowStride floats apart.
+        bool updatePixels(const ROI& roi, const float* source, size_t rowStride);
+        // Loads or maps the pixels, false when the layer or component isn't there.
+        bool extraction(const QString& channelBaseName, const QString& component, Extraction& extraction);
+        // The rows of a rectangle into destination, on the calling thread, from the source of the extraction.
+        void extract(const Extraction& extraction, const ROI& roi, float* destination) const;
+        ChannelData getChannelDataForOCIO(const QString& channelBaseName, const QString& component,
+                                          ROI roi = ROI::All());
+        static void findLayerChannels(const ImageSpec& spec, const QString& channelBaseName,
+                                      std::vector<int>& indices, std::vector<std::string>& names);
+        static ChannelData applyGammaCorrection(const Image::ChannelData& inputData, float gamma);
 
+    private:
+        QList<QPair<QString, AovExpression>> virtual_layers;
+        QList<Cryptomatte::Layer> cryptomatte_layers;
+        QMap<QString, std::shared_ptr<const Cryptomatte>> cryptomattes;
+        std::mutex cryptomatte_mutex;
+        mutable std::mutex mapping_mutex;
+        // One decode at a time, the others find the pixels it left.
+        std::mutex load_mutex;
+        const Cryptomatte::Layer* cryptomatteLayer(const QString& layer) const;
 };
 
 #endif //IMAGE_H
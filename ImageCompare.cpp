@@ -0,0 +1,110 @@
+#include "ImageCompare.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include "BufferPool.h"
+#include "TaskScheduler.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+
+// Yellow for differences just over the threshold, running to red.
+static inline void heatColor(float t, uchar* out) {
+    t = t > 0.0f ? (t < 1.0f ? t : 1.0f) : 0.0f;
+    out[0] = 255;
+    out[1] = uchar(255.0f * (1.0f - t));
+    out[2] = 0;
+    out[3] = 255;
+}
+
+
+QImage ImageCompare::difference(const Image::ChannelData& a, const Image::ChannelData& b, float scale, float threshold) {
+    if (a.data.empty() || b.data.empty()) {
+        return QImage();
+    }
+
+    const int width = std::min(a.width, b.width);
+    const int height = std::min(a.height, b.height);
+    const int color_channels = std::min(3, std::min(a.channels, b.channels));
+
+    QImage image = BufferPool::instance().image(width, height, QImage::Format_RGBA8888);
+    uchar* bits = image.bits();
+    qsizetype bytes_per_line = image.bytesPerLine();
+
+    TaskScheduler::parallelFor(0, height, [&](int64_t y) {
+        uchar* out = bits + y * bytes_per_line;
+        const float* row_a = a.data.data() + size_t(y) * a.width * a.channels;
+        const float* row_b = b.data.data() + size_t(y) * b.width * b.channels;
+        int x = 0;
+
+#if defined(__SSE2__)
+        // Four channel layers are compared a whole pixel per vector.
+        if (a.channels == 4 && b.channels == 4) {
+            const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+            const __m128 color_mask = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+            const __m128 opaque = _mm_castsi128_ps(_mm_set_epi32(0x437F0000, 0, 0, 0)); // 255.0f in alpha
+            const __m128 scale_255 = _mm_set1_ps(scale * 255.0f);
+            const __m128 max_255 = _mm_set1_ps(255.0f);
+
+            for (; x < width; ++x) {
+                __m128 diff = _mm_and_ps(_mm_sub_ps(_mm_loadu_ps(row_a + x * 4), _mm_loadu_ps(row_b + x * 4)), abs_mask);
+                diff = _mm_and_ps(diff, color_mask);
+
+                if (threshold > 0.0f) {
+                    // Horizontal max over the color lanes.
+                    __m128 max = _mm_max_ps(diff, _mm_shuffle_ps(diff, diff, _MM_SHUFFLE(2, 3, 0, 1)));
+                    max = _mm_max_ps(max, _mm_shuffle_ps(max, max, _MM_SHUFFLE(1, 0, 3, 2)));
+                    float largest = _mm_cvtss_f32(max);
+
+                    if (largest > threshold) {
+                        heatColor(largest * scale, out + x * 4);
+                        continue;
+                    }
+                }
+
+                // min() picks 255 for NaN, so broken pixels show up white.
+                __m128 value = _mm_min_ps(_mm_mul_ps(diff, scale_255), max_255);
+                value = _mm_or_ps(value, opaque);
+
+                __m128i ints = _mm_cvttps_epi32(value);
+                ints = _mm_packs_epi32(ints, ints);
+                ints = _mm_packus_epi16(ints, ints);
+                int packed = _mm_cvtsi128_si32(ints);
+                std::memcpy(out + x * 4, &packed, 4);
+            }
+        }
+#endif
+
+        for (; x < width; ++x) {
+            const float* pixel_a = row_a + size_t(x) * a.channels;
+            const float* pixel_b = row_b + size_t(x) * b.channels;
+            float diff[3] = {0.0f, 0.0f, 0.0f};
+            float largest = 0.0f;
+
+            for (int c = 0; c < color_channels; ++c) {
+                diff[c] = std::fabs(pixel_a[c] - pixel_b[c]);
+                largest = std::max(largest, diff[c]);
+            }
+
+            // Single channel layers show as grey.
+            if (color_channels == 1) {
+                diff[1] = diff[2] = diff[0];
+            }
+
+            if (threshold > 0.0f && largest > threshold) {
+                heatColor(largest * scale, out + x * 4);
+                continue;
+            }
+
+            for (int c = 0; c < 3; ++c) {
+                float value = diff[c] * scale * 255.0f;
+                out[x * 4 + c] = uchar(value < 255.0f ? value : 255.0f);
+            }
+            out[x * 4 + 3] = 255;
+        }
+    });
+
+    return image;
+}
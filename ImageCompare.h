@@ -0,0 +1,19 @@
+#ifndef IMAGECOMPARE_H
+#define IMAGECOMPARE_H
+
+#include <QImage>
+#include "Image.h"
+
+class ImageCompare {
+    public:
+        /*
+         * Absolute difference of the color channels of two layers, multiplied by scale.
+         * Pixels where any channel differs by more than threshold are painted as a heatmap
+         * instead, a threshold of zero or less turns that off. Layers of different sizes
+         * are compared over the area they share.
+         */
+        static QImage difference(const Image::ChannelData& a, const Image::ChannelData& b,
+                                 float scale, float threshold);
+};
+
+#endif //IMAGECOMPARE_H
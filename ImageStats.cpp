@@ -0,0 +1,278 @@
+#include "ImageStats.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include "TaskScheduler.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+
+namespace {
+    struct Partial {
+        std::vector<float> min;
+        std::vector<float> max;
+        std::vector<double> sum;
+        std::vector<uint64_t> finite;
+        std::vector<uint64_t> nan;
+        std::vector<uint64_t> inf;
+        std::vector<uint64_t> negative;
+        uint64_t nan_pixels = 0;
+        uint64_t inf_pixels = 0;
+        uint64_t negative_pixels = 0;
+        uint64_t out_of_gamut_pixels = 0;
+
+        explicit Partial(int channels) {
+            this->min.assign(channels, std::numeric_limits<float>::infinity());
+            this->max.assign(channels, -std::numeric_limits<float>::infinity());
+            this->sum.assign(channels, 0.0);
+            this->finite.assign(channels, 0);
+            this->nan.assign(channels, 0);
+            this->inf.assign(channels, 0);
+            this->negative.assign(channels, 0);
+        }
+    };
+
+    inline void addValue(Partial& partial, int channel, float value) {
+        if (std::isnan(value)) {
+            partial.nan[channel]++;
+        } else if (std::isinf(value)) {
+            partial.inf[channel]++;
+            if (value < 0.0f) partial.negative[channel]++;
+        } else {
+            partial.min[channel] = std::min(partial.min[channel], value);
+            partial.max[channel] = std::max(partial.max[channel], value);
+            partial.sum[channel] += value;
+            partial.finite[channel]++;
+            if (value < 0.0f) partial.negative[channel]++;
+        }
+    }
+
+    // The first three channels as RGB, one of them negative while the luminance is positive.
+    inline bool outOfGamut(const float* pixel) {
+        bool color_negative = pixel[0] < 0.0f || pixel[1] < 0.0f || pixel[2] < 0.0f;
+        return color_negative && 0.2126f * pixel[0] + 0.7152f * pixel[1] + 0.0722f * pixel[2] > 0.0f;
+    }
+
+#if defined(__SSE2__)
+    // Reduce a run of floats four at a time. Lane i always holds channel (start + i) % channels,
+    // which works for every channel count that divides four.
+    size_t reduceVectors(Partial& partial, const float* values, size_t count, int channels) {
+        const __m128 infinity = _mm_set1_ps(std::numeric_limits<float>::infinity());
+        const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+        const __m128 zero = _mm_setzero_ps();
+
+        __m128 lane_min = infinity;
+        __m128 lane_max = _mm_sub_ps(zero, infinity);
+        __m128 lane_sum = zero;
+        __m128i lane_finite = _mm_setzero_si128();
+        __m128i lane_nan = _mm_setzero_si128();
+        __m128i lane_inf = _mm_setzero_si128();
+        __m128i lane_negative = _mm_setzero_si128();
+
+        size_t vectors = count / 4;
+        for (size_t i = 0; i < vectors; ++i) {
+            __m128 v = _mm_loadu_ps(values + i * 4);
+            __m128 magnitude = _mm_and_ps(v, abs_mask);
+
+            __m128 is_nan = _mm_cmpunord_ps(v, v);
+            __m128 is_inf = _mm_cmpeq_ps(magnitude, infinity);
+            __m128 is_finite = _mm_cmplt_ps(magnitude, infinity);
+            __m128 is_negative = _mm_cmplt_ps(v, zero);
+
+            // Non-finite lanes are swapped for values that can't win the min, max or sum.
+            lane_min = _mm_min_ps(lane_min, _mm_or_ps(_mm_and_ps(is_finite, v), _mm_andnot_ps(is_finite, infinity)));
+            lane_max = _mm_max_ps(lane_max, _mm_or_ps(_mm_and_ps(is_finite, v), _mm_andnot_ps(is_finite, _mm_sub_ps(zero, infinity))));
+            lane_sum = _mm_add_ps(lane_sum, _mm_and_ps(is_finite, v));
+
+            // Compare masks are -1 where true, so subtracting them counts.
+            lane_finite = _mm_sub_epi32(lane_finite, _mm_castps_si128(is_finite));
+            lane_nan = _mm_sub_epi32(lane_nan, _mm_castps_si128(is_nan));
+            lane_inf = _mm_sub_epi32(lane_inf, _mm_castps_si128(is_inf));
+            lane_negative = _mm_sub_epi32(lane_negative, _mm_castps_si128(is_negative));
+        }
+
+        alignas(16) float mins[4], maxs[4], sums[4];
+        alignas(16) int32_t finites[4], nans[4], infs[4], negatives[4];
+        _mm_store_ps(mins, lane_min);
+        _mm_store_ps(maxs, lane_max);
+        _mm_store_ps(sums, lane_sum);
+        _mm_store_si128(reinterpret_cast<__m128i*>(finites), lane_finite);
+        _mm_store_si128(reinterpret_cast<__m128i*>(nans), lane_nan);
+        _mm_store_si128(reinterpret_cast<__m128i*>(infs), lane_inf);
+        _mm_store_si128(reinterpret_cast<__m128i*>(negatives), lane_negative);
+
+        for (int lane = 0; lane < 4; ++lane) {
+            int c = lane % channels;
+            partial.min[c] = std::min(partial.min[c], mins[lane]);
+            partial.max[c] = std::max(partial.max[c], maxs[lane]);
+            partial.sum[c] += sums[lane];
+            partial.finite[c] += finites[lane];
+            partial.nan[c] += nans[lane];
+            partial.inf[c] += infs[lane];
+            partial.negative[c] += negatives[lane];
+        }
+
+        return vectors * 4;
+    }
+#endif
+}
+
+
+bool ImageStats::Result::isClean(bool allowNegative) const {
+    return this->nan_pixels == 0 && this->inf_pixels == 0 && (allowNegative || this->negative_pixels == 0);
+}
+
+
+ImageStats::Result ImageStats::analyze(const float* pixels, int width, int height, int channels,
+                                       const std::vector<std::string>& channelNames, bool color) {
+    Result result;
+    result.width = width;
+    result.height = height;
+    result.channels = channels;
+    result.channel_names = channelNames;
+
+    if (!pixels || width <= 0 || height <= 0 || channels <= 0) {
+        return result;
+    }
+
+    color = color && channels >= 3;
+
+    int max_tasks = TaskScheduler::instance().threadCount();
+    int tasks = std::clamp(height / 16, 1, max_tasks);
+    std::vector<Partial> partials(tasks, Partial(channels));
+
+    TaskScheduler::parallelFor(0, tasks, [&](int64_t t) {
+        Partial& partial = partials[t];
+        int row_begin = int(int64_t(height) * t / tasks);
+        int row_end = int(int64_t(height) * (t + 1) / tasks);
+
+        for (int y = row_begin; y < row_end; ++y) {
+            const float* line = pixels + size_t(y) * width * channels;
+            size_t count = size_t(width) * channels;
+            size_t done = 0;
+
+#if defined(__SSE2__)
+            if (4 % channels == 0) {
+                done = reduceVectors(partial, line, count, channels);
+            }
+#endif
+            for (size_t i = done; i < count; ++i) {
+                addValue(partial, int(i % channels), line[i]);
+            }
+
+            // Pixel level counts, the row is still in cache.
+            for (int x = 0; x < width; ++x) {
+                const float* pixel = line + size_t(x) * channels;
+                bool has_nan = false;
+                bool has_inf = false;
+                bool has_negative = false;
+
+                for (int c = 0; c < channels; ++c) {
+                    has_nan = has_nan || std::isnan(pixel[c]);
+                    has_inf = has_inf || std::isinf(pixel[c]);
+                    has_negative = has_negative || pixel[c] < 0.0f;
+                }
+
+                partial.nan_pixels += has_nan;
+                partial.inf_pixels += has_inf;
+                partial.negative_pixels += has_negative;
+
+                if (color && has_negative && !has_nan && !has_inf) {
+                    partial.out_of_gamut_pixels += outOfGamut(pixel);
+                }
+            }
+        }
+    });
+
+    // Merge the partials.
+    Partial total(channels);
+    for (const Partial& partial: partials) {
+        for (int c = 0; c < channels; ++c) {
+            total.min[c] = std::min(total.min[c], partial.min[c]);
+            total.max[c] = std::max(total.max[c], partial.max[c]);
+            total.sum[c] += partial.sum[c];
+            total.finite[c] += partial.finite[c];
+            total.nan[c] += partial.nan[c];
+            total.inf[c] += partial.inf[c];
+            total.negative[c] += partial.negative[c];
+        }
+        total.nan_pixels += partial.nan_pixels;
+        total.inf_pixels += partial.inf_pixels;
+        total.negative_pixels += partial.negative_pixels;
+        total.out_of_gamut_pixels += partial.out_of_gamut_pixels;
+    }
+
+    result.min = total.min;
+    result.max = total.max;
+    result.mean.resize(channels);
+    for (int c = 0; c < channels; ++c) {
+        result.mean[c] = total.finite[c] > 0 ? total.sum[c] / double(total.finite[c]) : 0.0;
+    }
+    result.nan_count = total.nan;
+    result.inf_count = total.inf;
+    result.negative_count = total.negative;
+    result.nan_pixels = total.nan_pixels;
+    result.inf_pixels = total.inf_pixels;
+    result.negative_pixels = total.negative_pixels;
+    result.out_of_gamut_pixels = total.out_of_gamut_pixels;
+
+    return result;
+}
+
+
+ImageStats::Result ImageStats::analyze(const Image::ChannelData& channelData) {
+    return ImageStats::analyze(channelData.data.data(), channelData.width, channelData.height,
+                               channelData.channels, channelData.channel_names, true);
+}
+
+
+QImage ImageStats::overlay(const Image::ChannelData& channelData) {
+    const int width = channelData.width;
+    const int height = channelData.height;
+    const int channels = channelData.channels;
+
+    if (channelData.data.empty() || width <= 0 || height <= 0) {
+        return QImage();
+    }
+
+    QImage image(width, height, QImage::Format_ARGB32_Premultiplied);
+
+    // Take the pointers up front, scanLine() may detach and isn't safe across threads.
+    uchar* bits = image.bits();
+    qsizetype bytes_per_line = image.bytesPerLine();
+    const float* pixels = channelData.data.data();
+
+    TaskScheduler::parallelFor(0, height, [&](int64_t y) {
+        QRgb* line = reinterpret_cast<QRgb*>(bits + y * bytes_per_line);
+        const float* source = pixels + size_t(y) * width * channels;
+
+        for (int x = 0; x < width; ++x) {
+            const float* pixel = source + size_t(x) * channels;
+            bool has_nan = false;
+            bool has_inf = false;
+            bool has_negative = false;
+
+            for (int c = 0; c < channels; ++c) {
+                has_nan = has_nan || std::isnan(pixel[c]);
+                has_inf = has_inf || std::isinf(pixel[c]);
+                has_negative = has_negative || pixel[c] < 0.0f;
+            }
+
+            // Worst problem wins: NaN magenta, Inf cyan, negative blue, out of gamut orange.
+            if (has_nan) {
+                line[x] = qRgba(255, 0, 255, 255);
+            } else if (has_inf) {
+                line[x] = qRgba(0, 255, 255, 255);
+            } else if (has_negative) {
+                bool out_of_gamut = channels >= 3 && outOfGamut(pixel);
+                line[x] = out_of_gamut ? qRgba(255, 140, 0, 255) : qRgba(0, 90, 255, 255);
+            } else {
+                line[x] = qRgba(0, 0, 0, 0);
+            }
+        }
+    });
+
+    return image;
+}
@@ -0,0 +1,42 @@
+#ifndef IMAGESTATS_H
+#define IMAGESTATS_H
+
+#include <QImage>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "Image.h"
+
+/*
+ * Per channel statistics and a count of the pixels that shouldn't be in a render.
+ *
+ * Min, max and mean only look at finite values. A pixel is out of gamut when one of its
+ * color channels is negative while its luminance is still positive, a real color outside
+ * the primaries rather than broken data.
+ */
+class ImageStats {
+    public:
+        struct Result {
+            int width = 0;
+            int height = 0;
+            int channels = 0;
+            std::vector<std::string> channel_names;
+            std::vector<float> min;
+            std::vector<float> max;
+            std::vector<double> mean;
+            std::vector<uint64_t> nan_count;
+            std::vector<uint64_t> inf_count;
+            std::vector<uint64_t> negative_count;
+            uint64_t nan_pixels = 0;
+            uint64_t inf_pixels = 0;
+            uint64_t negative_pixels = 0;
+            uint64_t out_of_gamut_pixels = 0;
+            bool isClean(bool allowNegative = true) const;
+        };
+        static Result analyze(const float* pixels, int width, int height, int channels,
+                              const std::vector<std::string>& channelNames, bool color);
+        static Result analyze(const Image::ChannelData& channelData);
+        static QImage overlay(const Image::ChannelData& channelData);
+};
+
+#endif //IMAGESTATS_H
@@ -0,0 +1,169 @@
+#include "LiveReload.h"
+#include <QApplication>
+#include <QFileInfo>
+#include <QPointer>
+#include "TaskScheduler.h"
+#include "Trace.h"
+
+
+LiveReload::LiveReload(QObject *parent): QObject(parent) {
+    this->timer.setSingleShot(true);
+    this->timer.setInterval(reload_interval);
+
+    connect(&this->watcher, &QFileSystemWatcher::fileChanged, this, &LiveReload::fileChanged);
+    connect(&this->timer, &QTimer::timeout, this, &LiveReload::refresh);
+}
+
+
+void LiveReload::watch(const QString &filename) {
+    this->stop();
+    this->filename = filename;
+    this->watcher.addPath(filename);
+
+    // What the file looks like now, changes are measured against it.
+    this->busy = true;
+    const int generation = this->generation;
+    QPointer<LiveReload> reload(this);
+
+    TaskScheduler::instance().submit([reload, filename, generation]() {
+        Update update;
+        update.table = ExrChunks::scan(filename);
+
+        QMetaObject::invokeMethod(qApp, [reload, generation, update = std::move(update)]() {
+            if (reload) {
+                reload->finish(generation, update);
+            }
+        }, Qt::QueuedConnection);
+    });
+}
+
+
+void LiveReload::stop() {
+    if (!this->watcher.files().isEmpty()) {
+        this->watcher.removePaths(this->watcher.files());
+    }
+
+    // Whatever is still being read belongs to the old file.
+    this->generation++;
+    this->timer.stop();
+    this->filename.clear();
+    this->table = ExrChunks::Table();
+    this->busy = false;
+    this->pending = false;
+}
+
+
+QString LiveReload::watchedFile() const {
+    return this->filename;
+}
+
+
+void LiveReload::fileChanged(const QString &path) {
+    // Writers that replace the file drop it from the watcher.
+    if (!this->watcher.files().contains(path) && QFileInfo::exists(path)) {
+        this->watcher.addPath(path);
+    }
+
+    // Refresh at most every interval while the writer keeps going.
+    if (!this->timer.isActive()) {
+        this->timer.start();
+    }
+}
+
+
+void LiveReload::refresh() {
+    if (this->filename.isEmpty()) {
+        return;
+    }
+
+    if (this->busy) {
+        this->pending = true;
+        return;
+    }
+
+    this->busy = true;
+    const int generation = this->generation;
+    const QString filename = this->filename;
+    const ExrChunks::Table before = this->table;
+    QPointer<LiveReload> reload(this);
+
+    TaskScheduler::instance().submit([reload, filename, before, generation]() {
+        Update update = LiveReload::readChanges(filename, before);
+
+        QMetaObject::invokeMethod(qApp, [reload, generation, update = std::move(update)]() {
+            if (reload) {
+                reload->finish(generation, update);
+            }
+        }, Qt::QueuedConnection);
+    });
+}
+
+
+LiveReload::Update LiveReload::readChanges(const QString &filename, const ExrChunks::Table &before) {
+    EXRAY_TRACE_SCOPE("reload");
+    Update update;
+    update.table = ExrChunks::scan(filename);
+
+    if (!ExrChunks::sameLayout(before, update.table)) {
+        update.replaced = true;
+        return update;
+    }
+
+    std::vector<ROI> changed = ExrChunks::changed(before, update.table);
+    if (changed.empty()) {
+        return update;
+    }
+
+    auto input = ImageInput::open(filename.toStdString());
+    if (!input || input->spec().nchannels != update.table.channels) {
+        // Most likely caught halfway through a write, the next change tries again.
+        update.table = before;
+        return update;
+    }
+
+    // Regions are relative to the data window, the reads want file coordinates.
+    const ImageSpec &spec = input->spec();
+    for (const ROI &roi: changed) {
+        Image::Region region;
+        region.roi = roi;
+        region.pixels.resize(size_t(roi.width()) * roi.height() * spec.nchannels);
+
+        bool read;
+        if (update.table.tiled) {
+            read = input->read_tiles(0, 0, spec.x + roi.xbegin, spec.x + roi.xend, spec.y + roi.ybegin,
+                                     spec.y + roi.yend, 0, 1, 0, spec.nchannels, TypeDesc::FLOAT, region.pixels.data());
+        } else {
+            read = input->read_scanlines(0, 0, spec.y + roi.ybegin, spec.y + roi.yend, 0, 0, spec.nchannels,
+                                         TypeDesc::FLOAT, region.pixels.data());
+        }
+
+        if (!read) {
+            ExrChunks::forget(update.table, roi);
+            continue;
+        }
+        update.regions.push_back(std::move(region));
+    }
+
+    return update;
+}
+
+
+void LiveReload::finish(int generation, const Update &update) {
+    if (generation != this->generation) {
+        return;
+    }
+
+    this->busy = false;
+    this->table = update.table;
+
+    if (update.replaced) {
+        emit fileReplaced(this->filename);
+    } else if (!update.regions.empty()) {
+        emit regionsChanged(update.regions);
+    }
+
+    if (this->pending) {
+        this->pending = false;
+        this->refresh();
+    }
+}
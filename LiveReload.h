@@ -0,0 +1,53 @@
+#ifndef LIVERELOAD_H
+#define LIVERELOAD_H
+
+#include <QObject>
+#include <QFileSystemWatcher>
+#include <QString>
+#include <QTimer>
+#include <vector>
+#include "ExrChunks.h"
+#include "Image.h"
+
+/*
+ * Follows a file while a renderer writes it.
+ *
+ * Changes are picked up at most every reload_interval ms. For a single part EXR only the chunks
+ * whose bytes changed are read again, on the thread pool, and handed over as regions. Anything
+ * else, or an EXR that changed size, layout or compression, asks for the whole file to be opened
+ * again.
+ */
+class LiveReload : public QObject {
+    Q_OBJECT
+
+    public:
+        static constexpr int reload_interval = 100;
+        explicit LiveReload(QObject *parent = nullptr);
+        void watch(const QString& filename);
+        void stop();
+        QString watchedFile() const;
+
+    signals:
+        void regionsChanged(const std::vector<Image::Region>& regions);
+        void fileReplaced(const QString& filename);
+
+    private:
+        struct Update {
+            ExrChunks::Table table;
+            std::vector<Image::Region> regions;
+            bool replaced = false;
+        };
+        QFileSystemWatcher watcher;
+        QTimer timer;
+        QString filename;
+        ExrChunks::Table table;
+        bool busy = false;
+        bool pending = false;
+        int generation = 0;
+        void fileChanged(const QString& path);
+        void refresh();
+        void finish(int generation, const Update& update);
+        static Update readChanges(const QString& filename, const ExrChunks::Table& before);
+};
+
+#endif //LIVERELOAD_H
@@ -9,9 +9,23 @@
 #include <QScrollBar>
 #include <QStyleFactory>
 #include <QApplication>
+#include <QStatusBar>
+#include <QMenuBar>
+#include <QActionGroup>
+#include <QFileDialog>
+#include <QFileInfo>
+#include <QInputDialog>
+#include <QMimeData>
+#include <QSignalBlocker>
+#include <QUrl>
+#include "Trace.h"
 
 MainWindow::MainWindow(QWidget *parent): QMainWindow(parent) {
     this->setWindowTitle("EXRay v0.0.1");
+
+    // Shared by every open file, starts parsing the ocio config right away.
+    this->session = new Session(this);
+
     this->setupUi();
 }
 
@@ -34,12 +48,531 @@ void MainWindow::setupUi() {
     QWidget *centralWidget = new QWidget(this);
     centralWidget->setLayout(main_layout);
     this->setCentralWidget(centralWidget);
+
+    // Pixel probe readouts in the status bar.
+    this->probe_label = new QLabel(this);
+    this->region_label = new QLabel(this);
+    this->statusBar()->addWidget(this->probe_label, 1);
+    this->statusBar()->addPermanentWidget(this->region_label);
+
+    this->stats_label = new QLabel(this);
+    this->statusBar()->addPermanentWidget(this->stats_label);
+
+    // The Cryptomatte object under the cursor.
+    this->object_label = new QLabel(this);
+    this->statusBar()->addPermanentWidget(this->object_label);
+    connect(this->viewport, &Viewport::objectHovered, this->object_label, &QLabel::setText);
+
+    connect(this->viewport, &Viewport::pixelProbed, this, &MainWindow::showPixelSample);
+    connect(this->viewport, &Viewport::regionProbed, this, &MainWindow::showRegionStats);
+    connect(this->viewport, &Viewport::statsComputed, this, &MainWindow::showLayerStats);
+    this->showLayerStats(this->viewport->layer_stats);
+
+    this->setupFileMenu();
+    this->setupFileList();
+    this->setupBrowser();
+    this->setupScopes();
+    this->setupThumbnails();
+    this->setupSplitView();
+    this->setupTracing();
+}
+
+
+void MainWindow::setupFileMenu() {
+    QMenu *fileMenu = this->menuBar()->addMenu("File");
+    this->file_menu = fileMenu;
+
+    fileMenu->addAction("Open...", this, [this]() {
+        QStringList files = QFileDialog::getOpenFileNames(this, "Open Image", QString(), "Images (*.exr *.png *.tif *.tiff *.jpg *.psd)");
+        this->openFiles(files);
+    });
+
+    QAction *closeAction = fileMenu->addAction("Close", this, [this]() {
+        this->session->remove(this->session->currentIndex());
+    });
+    closeAction->setShortcut(QKeySequence::Close);
+
+    fileMenu->addSeparator();
+
+    QAction *previousAction = fileMenu->addAction("Previous File", this, [this]() {
+        this->session->setCurrent(this->session->currentIndex() - 1);
+    });
+    previousAction->setShortcut(QKeySequence(Qt::Key_PageUp));
+
+    QAction *nextAction = fileMenu->addAction("Next File", this, [this]() {
+        this->session->setCurrent(this->session->currentIndex() + 1);
+    });
+    nextAction->setShortcut(QKeySequence(Qt::Key_PageDown));
+
+    fileMenu->addSeparator();
+
+    // Exports what the viewport shows, with the display transform baked in.
+    this->exporter = new Exporter(this);
+
+    connect(this->exporter, &Exporter::progress, this, [this](int done, int total) {
+        this->statusBar()->showMessage(QString("Exporting %1 / %2").arg(done).arg(total));
+    });
+    connect(this->exporter, &Exporter::finished, this, [this](int written, int failed) {
+        QString message = QString("Exported %1 files").arg(written);
+        if (failed > 0) {
+            message += QString(", %1 failed").arg(failed);
+        }
+        this->statusBar()->showMessage(message, 5000);
+    });
+
+    fileMenu->addAction("Export Layer...", this, [this]() {
+        if (!this->viewport->image) {
+            return;
+        }
+
+        const QString source = QString::fromStdString(this->viewport->image->filename);
+        QString filename = QFileDialog::getSaveFileName(this, "Export Layer",
+                                                        Exporter::outputName(QFileInfo(source).absolutePath(), source,
+                                                                             this->viewport->current_layer, "png"),
+                                                        "Images (*.png *.jpg *.tif *.exr)");
+        if (!filename.isEmpty()) {
+            this->exportLayers({{this->viewport->current_layer, filename}}, this->viewport->current_component);
+        }
+    });
+
+    fileMenu->addAction("Export All Layers...", this, [this]() {
+        if (!this->viewport->image) {
+            return;
+        }
+
+        const QString source = QString::fromStdString(this->viewport->image->filename);
+        QString directory = QFileDialog::getExistingDirectory(this, "Export All Layers", QFileInfo(source).absolutePath());
+        if (directory.isEmpty()) {
+            return;
+        }
+
+        bool ok = false;
+        QString extension = QInputDialog::getItem(this, "Export All Layers", "Format", {"png", "jpg", "tif", "exr"}, 0,
+                                                  false, &ok);
+        if (!ok) {
+            return;
+        }
+
+        QList<QPair<QString, QString>> outputs;
+        for (const QString &layer: this->viewport->image->getlayers()) {
+            outputs.append({layer, Exporter::outputName(directory, source, layer, extension)});
+        }
+        this->exportLayers(outputs, "all");
+    });
+
+    fileMenu->addSeparator();
+
+    // Follows the open file while a render writes it.
+    this->live_reload = new LiveReload(this);
+
+    connect(this->live_reload, &LiveReload::regionsChanged, this->viewport, &Viewport::updateRegions);
+    connect(this->live_reload, &LiveReload::fileReplaced, this->viewport, &Viewport::openImage);
+    connect(this->viewport, &Viewport::imageOpened, this, [this]() {
+        // A render view image has no file to watch.
+        const QString filename = QString::fromStdString(this->viewport->image->filename);
+        if (this->auto_reload && QFileInfo::exists(filename)) {
+            // Made ahead while it was still mapped.
+            this->viewport->image->unmapPixels();
+            this->live_reload->watch(filename);
+        } else {
+            this->live_reload->stop();
+        }
+    });
+
+    QAction *reloadAction = fileMenu->addAction("Auto Reload", this, [this](bool checked) {
+        this->auto_reload = checked;
+        // A file followed while it's written may be cut short under a mapping, the one shown too.
+        ExrMapping::setEnabled(!checked);
+        if (checked && this->viewport->image && QFileInfo::exists(QString::fromStdString(this->viewport->image->filename))) {
+            this->viewport->image->unmapPixels();
+            this->live_reload->watch(QString::fromStdString(this->viewport->image->filename));
+        } else {
+            this->live_reload->stop();
+        }
+    });
+    reloadAction->setCheckable(true);
+    reloadAction->setChecked(this->auto_reload);
+
+    // Buckets straight from a renderer while it renders.
+    this->render_server = new RenderServer(this);
+
+    connect(this->render_server, &RenderServer::imageStarted, this->viewport, &Viewport::showImage);
+    connect(this->render_server, &RenderServer::regionsChanged, this, [this](Image *image, const std::vector<ROI> &regions) {
+        if (this->viewport->image == image) {
+            this->viewport->showRegions(regions);
+        }
+    });
+    connect(this->render_server, &RenderServer::imageFinished, this, [this](Image *image) {
+        if (this->viewport->image == image) {
+            this->statusBar()->showMessage("Render finished", 5000);
+        }
+    });
+
+    QAction *renderViewAction = fileMenu->addAction("Render View", this, [this](bool checked) {
+        if (!checked) {
+            this->render_server->close();
+            this->statusBar()->showMessage("Render view stopped", 5000);
+        } else if (this->render_server->listen()) {
+            this->statusBar()->showMessage("Render view listening on " + this->render_server->path());
+        } else {
+            this->statusBar()->showMessage("Render view could not listen on " + RenderServer::defaultPath(), 5000);
+        }
+    });
+    renderViewAction->setCheckable(true);
+}
+
+
+void MainWindow::exportLayers(const QList<QPair<QString, QString>> &outputs, const QString &component) {
+    Exporter::Job job;
+    job.source = QString::fromStdString(this->viewport->image->filename);
+    job.virtual_layers = this->session->virtualLayers();
+    job.component = component;
+    job.color_manager = this->viewport->color_manager;
+    job.input_colorspace = this->viewport->input_colorspace;
+    job.output_colorspace = this->viewport->output_colorspace;
+    job.gamma = this->viewport->gamma;
+    job.outputs = outputs;
+
+    this->statusBar()->showMessage(QString("Exporting 0 / %1").arg(outputs.size()));
+    this->exporter->start(job);
+}
+
+
+void MainWindow::setupTracing() {
+    QMenu *traceMenu = this->menuBar()->addMenu("Trace");
+
+    QAction *hudAction = traceMenu->addAction("Timing HUD", this, [this](bool checked) {
+        this->viewport->setShowTimingHud(checked);
+    });
+    hudAction->setCheckable(true);
+    hudAction->setChecked(this->viewport->show_timing_hud);
+
+    QAction *recordAction = traceMenu->addAction("Record Spans", this, [](bool checked) {
+        Trace::setEnabled(checked);
+    });
+    recordAction->setCheckable(true);
+    recordAction->setChecked(Trace::isEnabled());
+    recordAction->setEnabled(Trace::isEnabled());
+
+    traceMenu->addSeparator();
+
+    traceMenu->addAction("Export Chrome Trace...", this, [this]() {
+        QString filename = QFileDialog::getSaveFileName(this, "Export Chrome Trace", "exray-trace.json", "Trace (*.json)");
+        if (!filename.isEmpty()) {
+            Trace::exportChromeTrace(filename);
+        }
+    });
+}
+
+
+void MainWindow::setupSplitView() {
+    QMenu *displayMenu = this->menuBar()->addMenu("Display");
+    this->split_view = new SplitView(this);
+
+    // The same pixels under other displays and views, next to the viewport.
+    QDockWidget *dock = new QDockWidget("Outputs", this);
+    dock->setObjectName("Outputs");
+    dock->setWidget(this->split_view);
+    this->addDockWidget(Qt::BottomDockWidgetArea, dock);
+    dock->hide();
+    displayMenu->addAction(dock->toggleViewAction());
+
+    connect(this->viewport, &Viewport::layerDisplayed, this, [this]() {
+        this->split_view->setSource(&this->viewport->shownSceneData(), this->viewport->displaySettings(),
+                                    this->viewport->visibleImageRect());
+    });
+    connect(this->viewport, &Viewport::visibleRegionChanged, this, [this]() {
+        this->split_view->setVisibleRect(this->viewport->visibleImageRect());
+    });
+}
+
+
+void MainWindow::setupThumbnails() {
+    this->thumbnail_strip = new ThumbnailStrip(this);
+
+    QDockWidget *dock = new QDockWidget("Layers", this);
+    dock->setObjectName("Layers");
+    dock->setWidget(this->thumbnail_strip);
+    this->addDockWidget(Qt::BottomDockWidgetArea, dock);
+
+    connect(this->thumbnail_strip, &ThumbnailStrip::layerActivated, this, [this](const QString &layer) {
+        this->viewport->displayLayer(layer, "all");
+    });
+
+    // Filled in once the viewport has the image open.
+    connect(this->viewport, &Viewport::imageOpened, this, [this]() {
+        Image *image = this->viewport->image;
+        this->thumbnail_strip->load(QString::fromStdString(image->filename), image->getlayers(), this->viewport->color_manager,
+                                    this->viewport->input_colorspace, this->viewport->output_colorspace, this->viewport->gamma);
+    });
+}
+
+
+void MainWindow::setupFileList() {
+    this->file_list = new QListWidget(this);
+
+    QDockWidget *dock = new QDockWidget("Files", this);
+    dock->setObjectName("Files");
+    dock->setWidget(this->file_list);
+    this->addDockWidget(Qt::LeftDockWidgetArea, dock);
+
+    connect(this->file_list, &QListWidget::currentRowChanged, this->session, &Session::setCurrent);
+    connect(this->session, &Session::filesChanged, this, &MainWindow::showFiles);
+    connect(this->session, &Session::currentChanged, this, &MainWindow::showCurrentFile);
+
+    // Files are dropped anywhere on the window, not onto the scene.
+    this->setAcceptDrops(true);
+    this->viewport->setAcceptDrops(false);
+    this->viewport->viewport()->setAcceptDrops(false);
+}
+
+
+void MainWindow::setupBrowser() {
+    this->shot_browser = new ShotBrowser(this);
+
+    // Next to the open files, for finding the ones to open.
+    QDockWidget *dock = new QDockWidget("Browser", this);
+    dock->setObjectName("Browser");
+    dock->setWidget(this->shot_browser);
+    this->addDockWidget(Qt::LeftDockWidgetArea, dock);
+    this->tabifyDockWidget(this->findChild<QDockWidget*>("Files"), dock);
+    dock->hide();
+
+    this->file_menu->addSeparator();
+    this->file_menu->addAction(dock->toggleViewAction());
+
+    connect(this->shot_browser, &ShotBrowser::fileActivated, this, [this](const QString &filename) {
+        this->openFiles({filename});
+    });
+}
+
+
+void MainWindow::showFiles() {
+    QSignalBlocker blocker(this->file_list);
+    this->file_list->clear();
+
+    for (const QString &file: this->session->files()) {
+        QListWidgetItem *item = new QListWidgetItem(QFileInfo(file).fileName(), this->file_list);
+        item->setToolTip(file);
+    }
+
+    this->file_list->setCurrentRow(this->session->currentIndex());
+}
+
+
+void MainWindow::showCurrentFile(const QString &filename) {
+    {
+        QSignalBlocker blocker(this->file_list);
+        this->file_list->setCurrentRow(this->session->currentIndex());
+    }
+
+    this->setWindowTitle(QString("EXRay v0.0.1 - %1").arg(QFileInfo(filename).fileName()));
+    this->viewport->openImage(filename);
+}
+
+
+void MainWindow::openFiles(const QStringList &files) {
+    if (files.isEmpty()) {
+        return;
+    }
+
+    // Show the first of them, the rest wait in the file list.
+    this->session->setCurrent(this->session->add(files));
+}
+
+
+void MainWindow::dragEnterEvent(QDragEnterEvent *event) {
+    if (event->mimeData()->hasUrls()) {
+        event->acceptProposedAction();
+    }
+}
+
+
+void MainWindow::dropEvent(QDropEvent *event) {
+    QStringList files;
+    for (const QUrl &url: event->mimeData()->urls()) {
+        if (url.isLocalFile()) {
+            files.append(url.toLocalFile());
+        }
+    }
+
+    this->openFiles(files);
+    event->acceptProposedAction();
+}
+
+
+void MainWindow::showLayerStats(const ImageStats::Result &stats) {
+    QString text = QString("NaN %1  Inf %2  Neg %3  Gamut %4")
+            .arg(stats.nan_pixels).arg(stats.inf_pixels)
+            .arg(stats.negative_pixels).arg(stats.out_of_gamut_pixels);
+
+    // Per channel ranges in the tooltip.
+    QStringList ranges;
+    for (int c = 0; c < stats.channels; ++c) {
+        QString name = c < stats.channel_names.size() ? QString::fromStdString(stats.channel_names[c]) : QString::number(c);
+        ranges.append(QString("%1  min %2  max %3  mean %4").arg(name)
+                .arg(stats.min[c]).arg(stats.max[c]).arg(stats.mean[c]));
+    }
+
+    this->stats_label->setText(text);
+    this->stats_label->setToolTip(ranges.join("\n"));
+    this->stats_label->setStyleSheet(stats.isClean() ? "" : "QLabel { color: rgb(255, 80, 80); }");
+}
+
+
+void MainWindow::setupScopes() {
+    QMenu *scopesMenu = this->menuBar()->addMenu("Scopes");
+
+    // One dock per scope, tabbed together on the right.
+    const QList<QPair<QString, ScopeWidget::Mode> > panels = {
+        {"Histogram", ScopeWidget::Mode::Histogram},
+        {"Waveform", ScopeWidget::Mode::Waveform},
+        {"Vectorscope", ScopeWidget::Mode::Vectorscope}
+    };
+
+    for (const auto &panel: panels) {
+        ScopeWidget *widget = new ScopeWidget(panel.second, this);
+        QDockWidget *dock = new QDockWidget(panel.first, this);
+        dock->setObjectName(panel.first);
+        dock->setWidget(widget);
+        this->addDockWidget(Qt::RightDockWidgetArea, dock);
+
+        if (!this->scope_docks.isEmpty()) {
+            this->tabifyDockWidget(this->scope_docks.first(), dock);
+        }
+
+        dock->hide();
+        connect(dock, &QDockWidget::visibilityChanged, this, &MainWindow::updateScopes);
+        scopesMenu->addAction(dock->toggleViewAction());
+
+        this->scope_docks.append(dock);
+        this->scope_widgets.append(widget);
+    }
+
+    scopesMenu->addSeparator();
+
+    /*
+     * Buffer the scopes are computed from.
+     */
+    QActionGroup *sourceGroup = new QActionGroup(this);
+    QAction *displaySource = scopesMenu->addAction("Display Values", this, [this]() {
+        this->scope_source = Scopes::Source::Display;
+        this->resetScopes();
+    });
+    QAction *sceneSource = scopesMenu->addAction("Scene-Linear Values", this, [this]() {
+        this->scope_source = Scopes::Source::Scene;
+        this->resetScopes();
+    });
+    for (QAction *action: {displaySource, sceneSource}) {
+        action->setCheckable(true);
+        sourceGroup->addAction(action);
+    }
+    displaySource->setChecked(true);
+
+    scopesMenu->addSeparator();
+
+    /*
+     * Sampling density.
+     */
+    QActionGroup *samplingGroup = new QActionGroup(this);
+    const QList<QPair<QString, int> > samplings = {
+        {"Every Pixel", 1}, {"Every 2nd Pixel", 2}, {"Every 4th Pixel", 4}, {"Every 8th Pixel", 8}
+    };
+
+    for (const auto &sampling: samplings) {
+        int step = sampling.second;
+        QAction *action = scopesMenu->addAction(sampling.first, this, [this, step]() {
+            this->scopes.setSampling(step);
+            this->updateScopes();
+        });
+        action->setCheckable(true);
+        action->setChecked(step == this->scopes.sampling());
+        samplingGroup->addAction(action);
+    }
+
+    connect(this->viewport, &Viewport::layerDisplayed, this, &MainWindow::resetScopes);
+    connect(this->viewport, &Viewport::visibleRegionChanged, this, &MainWindow::updateScopes);
+
+    this->resetScopes();
+}
+
+
+void MainWindow::resetScopes() {
+    if (this->scope_source == Scopes::Source::Scene) {
+        this->scopes.setData(&this->viewport->shownSceneData(), Scopes::Source::Scene);
+    } else {
+        this->scopes.setData(&this->viewport->shownDisplayData(), Scopes::Source::Display);
+    }
+
+    this->updateScopes();
+}
+
+
+void MainWindow::updateScopes() {
+    // Nothing to do while all scopes are hidden.
+    bool visible = false;
+    for (QDockWidget *dock: this->scope_docks) {
+        visible = visible || dock->isVisible();
+    }
+
+    if (!visible) {
+        return;
+    }
+
+    const Scopes::Result &result = this->scopes.update(this->viewport->visibleImageRect());
+
+    for (ScopeWidget *widget: this->scope_widgets) {
+        widget->setResult(&result);
+    }
 }
 
 
 QGraphicsView *MainWindow::setupViewport() {
-    Viewport *viewport = new Viewport(this);
-    return viewport;
+    this->viewport = new Viewport(this->session, this);
+    return this->viewport;
+}
+
+
+void MainWindow::showPixelSample(const PixelProbe::Sample &sample) {
+    if (!sample.valid) {
+        this->probe_label->clear();
+        return;
+    }
+
+    QString text = QString("x %1  y %2").arg(sample.x).arg(sample.y);
+
+    for (int c = 0; c < sample.scene.size(); ++c) {
+        QString name = c < sample.channel_names.size() ? QString::fromStdString(sample.channel_names[c]) : QString::number(c);
+        text += QString("   %1 %2").arg(name).arg(sample.scene[c], 0, 'f', 5);
+
+        // Display value and its 8-bit code next to the scene-linear value.
+        if (c < sample.display.size()) {
+            float display = std::max(0.0f, std::min(1.0f, sample.display[c]));
+            text += QString(" / %1 (%2)").arg(sample.display[c], 0, 'f', 4).arg(int(display * 255.0f));
+        }
+    }
+
+    this->probe_label->setText(text);
+}
+
+
+void MainWindow::showRegionStats(const SummedAreaTable::Region &region) {
+    if (region.rect.isEmpty() || region.mean.empty()) {
+        this->region_label->clear();
+        return;
+    }
+
+    QString text = QString("%1,%2 %3x%4").arg(region.rect.x()).arg(region.rect.y())
+            .arg(region.rect.width()).arg(region.rect.height());
+
+    for (int c = 0; c < region.mean.size(); ++c) {
+        text += QString("   mean %1 min %2 max %3")
+                .arg(region.mean[c], 0, 'f', 5)
+                .arg(region.min[c], 0, 'f', 5)
+                .arg(region.max[c], 0, 'f', 5);
+    }
+
+    this->region_label->setText(text);
 }
 
 
@@ -2,6 +2,7 @@
 #define MAINWINDOW_H
 
 #include <QMainWindow>
+#include <QMenu>
 #include <QVBoxLayout>
 #include <QHBoxLayout>
 #include <QWidget>
@@ -15,7 +16,20 @@
 #include <QStringList>
 #include <QPoint>
 #include <OpenColorIO/OpenColorIO.h>
+#include <QDockWidget>
+#include <QListWidget>
+#include <QDragEnterEvent>
+#include <QDropEvent>
 #include "Viewport.h"
+#include "Scopes.h"
+#include "ScopeWidget.h"
+#include "ThumbnailStrip.h"
+#include "LiveReload.h"
+#include "Session.h"
+#include "Exporter.h"
+#include "RenderServer.h"
+#include "SplitView.h"
+#include "ShotBrowser.h"
 
 namespace OCIO = OCIO_NAMESPACE;
 
@@ -26,11 +40,52 @@ class MainWindow : public QMainWindow
     public:
         MainWindow(QWidget *parent = nullptr);
         ~MainWindow();
+        void openFiles(const QStringList& files);
+
+    protected:
+        void dragEnterEvent(QDragEnterEvent *event) override;
+        void dropEvent(QDropEvent *event) override;
 
     private:
+        Session* session;
+        Viewport* viewport;
+        QListWidget* file_list;
+        QMenu* file_menu;
+        QLabel* probe_label;
+        QLabel* region_label;
+        QLabel* stats_label;
+        QLabel* object_label;
+        Scopes scopes;
+        Scopes::Source scope_source = Scopes::Source::Display;
+        QList<QDockWidget*> scope_docks;
+        QList<ScopeWidget*> scope_widgets;
+        ThumbnailStrip* thumbnail_strip;
+        LiveReload* live_reload;
+        bool auto_reload = false;
+        Exporter* exporter;
+        RenderServer* render_server;
+        SplitView* split_view;
+        ShotBrowser* shot_browser;
         void setupUi();
         QGraphicsView* setupViewport();
+        void setupScopes();
+        void setupThumbnails();
+        void setupTracing();
+        void setupSplitView();
+        void setupFileMenu();
+        void setupFileList();
+        void setupBrowser();
+        void showFiles();
+        void showCurrentFile(const QString& filename);
+        void exportLayers(const QList<QPair<QString, QString>>& outputs, const QString& component);
         QMap<QString, QStringList> loadOcioConfigAndPopulateData();
 
+    private slots:
+        void showPixelSample(const PixelProbe::Sample& sample);
+        void showRegionStats(const SummedAreaTable::Region& region);
+        void showLayerStats(const ImageStats::Result& stats);
+        void resetScopes();
+        void updateScopes();
+
 };
 #endif // MAINWINDOW_H
\ No newline at end of file
@@ -0,0 +1,316 @@
+#include "PixelOps.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include "PixelOpsKernels.h"
+
+
+namespace {
+    size_t noVector(float*, size_t, int, float) { return 0; }
+    size_t noVector(float*, size_t, int, float, float) { return 0; }
+    size_t noVector(float*, size_t) { return 0; }
+    size_t noVector(const float*, size_t, int, uint8_t*) { return 0; }
+    size_t noVector(const float*, size_t, int, uint8_t*, int, int) { return 0; }
+
+    // The kernels do pixels in multiples of their vector width, this is one of all of them.
+    constexpr size_t widest_vector = 16;
+
+    std::atomic<PixelOps::Isa> selected{PixelOps::Isa::Scalar};
+    std::atomic<bool> detected{false};
+
+    PixelOps::Isa detectIsa() {
+        PixelOps::Isa isa = PixelOps::Isa::Scalar;
+
+#if defined(EXRAY_PIXELOPS_X86)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f")) {
+            isa = PixelOps::Isa::AVX512;
+        } else if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+            isa = PixelOps::Isa::AVX2;
+        } else if (__builtin_cpu_supports("sse4.2")) {
+            isa = PixelOps::Isa::SSE42;
+        }
+#endif
+
+        return isa;
+    }
+
+    const PixelKernels& kernels() {
+        if (!detected.load(std::memory_order_acquire)) {
+            PixelOps::Isa isa = PixelOps::supportedIsa();
+
+            // Let a lower instruction set be forced, handy to compare them.
+            if (const char* forced = std::getenv("EXRAY_SIMD")) {
+                for (PixelOps::Isa candidate: {PixelOps::Isa::Scalar, PixelOps::Isa::SSE42, PixelOps::Isa::AVX2,
+                                               PixelOps::Isa::AVX512}) {
+                    if (std::strcmp(forced, PixelOps::isaName(candidate)) == 0) {
+                        isa = std::min(isa, candidate);
+                    }
+                }
+            }
+
+            selected.store(isa, std::memory_order_relaxed);
+            detected.store(true, std::memory_order_release);
+        }
+
+        switch (selected.load(std::memory_order_relaxed)) {
+#if defined(EXRAY_PIXELOPS_X86)
+            case PixelOps::Isa::AVX512:
+                return avx512Kernels();
+            case PixelOps::Isa::AVX2:
+                return avx2Kernels();
+            case PixelOps::Isa::SSE42:
+                return sse42Kernels();
+#endif
+            default:
+                return scalarKernels();
+        }
+    }
+
+
+    /*
+     * Scalar reference, also used for whatever the vector kernels leave over.
+     */
+    inline int colorChannels(int channels) {
+        return std::min(3, channels);
+    }
+
+
+    void referenceGamma(float* pixels, size_t count, int channels, float exponent) {
+        const int color = colorChannels(channels);
+
+        for (size_t i = 0; i < count; ++i) {
+            float* pixel = pixels + i * channels;
+            for (int c = 0; c < color; ++c) {
+                float value = pixel[c];
+
+                // Negative values mirror the curve, zero, NaN and Inf stay as they are.
+                if (value > 0.0f) {
+                    pixel[c] = std::pow(value, exponent);
+                } else if (value < 0.0f) {
+                    pixel[c] = -std::pow(-value, exponent);
+                }
+            }
+        }
+    }
+
+
+    void referenceScale(float* pixels, size_t count, int channels, float factor) {
+        const int color = colorChannels(channels);
+
+        for (size_t i = 0; i < count; ++i) {
+            for (int c = 0; c < color; ++c) {
+                pixels[i * channels + c] *= factor;
+            }
+        }
+    }
+
+
+    void referenceClamp(float* pixels, size_t count, int channels, float low, float high) {
+        const size_t values = count * channels;
+
+        for (size_t i = 0; i < values; ++i) {
+            pixels[i] = std::max(low, std::min(high, pixels[i]));
+        }
+    }
+
+
+    void referencePremultiply(float* pixels, size_t count) {
+        for (size_t i = 0; i < count; ++i) {
+            float* pixel = pixels + i * 4;
+            pixel[0] *= pixel[3];
+            pixel[1] *= pixel[3];
+            pixel[2] *= pixel[3];
+        }
+    }
+
+
+    void referenceUnpremultiply(float* pixels, size_t count) {
+        for (size_t i = 0; i < count; ++i) {
+            float* pixel = pixels + i * 4;
+            if (pixel[3] != 0.0f) {
+                pixel[0] /= pixel[3];
+                pixel[1] /= pixel[3];
+                pixel[2] /= pixel[3];
+            }
+        }
+    }
+
+
+    inline uint8_t toByte(float value) {
+        return uint8_t(std::max(0.0f, std::min(1.0f, value)) * 255.0f);
+    }
+
+
+    // Single channel data shows as grey, missing alpha as opaque.
+    template<int Channels>
+    void referenceRgba8(const float* pixels, size_t count, int channels, uint8_t* destination, bool checker, int x, int y) {
+        const int stride = Channels > 0 ? Channels : channels;
+
+        for (size_t i = 0; i < count; ++i) {
+            const float* pixel = pixels + i * stride;
+            float r = pixel[0];
+            float g = stride >= 3 ? pixel[1] : r;
+            float b = stride >= 3 ? pixel[2] : r;
+            float a = stride >= 4 ? pixel[3] : 1.0f;
+
+            if (checker) {
+                float background = (1.0f - a) * checkerAt(x + int(i), y);
+                r += background;
+                g += background;
+                b += background;
+                a = 1.0f;
+            }
+
+            uint8_t* out = destination + i * 4;
+            out[0] = toByte(r);
+            out[1] = toByte(g);
+            out[2] = toByte(b);
+            out[3] = toByte(a);
+        }
+    }
+
+
+    void referenceToRgba8(const float* pixels, size_t count, int channels, uint8_t* destination, bool checker, int x, int y) {
+        switch (channels) {
+            case 3:
+                referenceRgba8<3>(pixels, count, channels, destination, checker, x, y);
+                return;
+            case 4:
+                referenceRgba8<4>(pixels, count, channels, destination, checker, x, y);
+                return;
+            default:
+                referenceRgba8<0>(pixels, count, channels, destination, checker, x, y);
+        }
+    }
+}
+
+
+const PixelKernels& scalarKernels() {
+    static const PixelKernels kernels = {
+        noVector, noVector, noVector, noVector, noVector, noVector, noVector, gatherPixels, replicatePixels
+    };
+    return kernels;
+}
+
+
+PixelOps::Isa PixelOps::supportedIsa() {
+    static const Isa supported = detectIsa();
+    return supported;
+}
+
+
+PixelOps::Isa PixelOps::isa() {
+    kernels();
+    return selected.load(std::memory_order_relaxed);
+}
+
+
+void PixelOps::setIsa(Isa isa) {
+    kernels();
+    selected.store(std::min(isa, PixelOps::supportedIsa()), std::memory_order_relaxed);
+}
+
+
+const char* PixelOps::isaName(Isa isa) {
+    switch (isa) {
+        case Isa::SSE42:
+            return "sse4.2";
+        case Isa::AVX2:
+            return "avx2";
+        case Isa::AVX512:
+            return "avx512";
+        default:
+            return "scalar";
+    }
+}
+
+
+void PixelOps::gamma(float* pixels, size_t count, int channels, float gamma) {
+    // A gamma of one is the default, there's nothing to do.
+    if (gamma == 1.0f || gamma <= 0.0f || channels <= 0) {
+        return;
+    }
+
+    float exponent = 1.0f / gamma;
+    const PixelKernels& vector = kernels();
+    size_t done = vector.gamma(pixels, count, channels, exponent);
+    size_t left = count - done;
+    if (left == 0) {
+        return;
+    }
+
+    // The approximation isn't std::pow, the last few pixels are padded out to whole vectors so a
+    // value comes out the same wherever it is, in a tile or in the half table.
+    if (left < widest_vector && channels <= 4) {
+        float padded[widest_vector * 4] = {};
+        std::memcpy(padded, pixels + done * channels, left * channels * sizeof(float));
+        if (vector.gamma(padded, widest_vector, channels, exponent) == widest_vector) {
+            std::memcpy(pixels + done * channels, padded, left * channels * sizeof(float));
+            return;
+        }
+    }
+    referenceGamma(pixels + done * channels, left, channels, exponent);
+}
+
+
+void PixelOps::exposure(float* pixels, size_t count, int channels, float stops) {
+    if (stops == 0.0f || channels <= 0) {
+        return;
+    }
+
+    float factor = std::exp2(stops);
+    size_t done = kernels().scale(pixels, count, channels, factor);
+    referenceScale(pixels + done * channels, count - done, channels, factor);
+}
+
+
+void PixelOps::clamp(float* pixels, size_t count, int channels, float low, float high) {
+    size_t done = kernels().clamp(pixels, count, channels, low, high);
+    referenceClamp(pixels + done * channels, count - done, channels, low, high);
+}
+
+
+void PixelOps::premultiply(float* pixels, size_t count) {
+    size_t done = kernels().premultiply(pixels, count);
+    referencePremultiply(pixels + done * 4, count - done);
+}
+
+
+void PixelOps::unpremultiply(float* pixels, size_t count) {
+    size_t done = kernels().unpremultiply(pixels, count);
+    referenceUnpremultiply(pixels + done * 4, count - done);
+}
+
+
+void PixelOps::gather(const float* source, size_t count, int sourceChannels, const int* indices, int channels,
+                      float* destination) {
+    kernels().gather(source, count, sourceChannels, indices, channels, destination);
+}
+
+
+void PixelOps::replicate(const float* source, size_t count, int sourceChannels, int channel, float* destination) {
+    kernels().replicate(source, count, sourceChannels, channel, destination);
+}
+
+
+void PixelOps::toRgba8(const float* pixels, size_t count, int channels, uint8_t* destination) {
+    size_t done = kernels().toRgba8(pixels, count, channels, destination);
+    referenceToRgba8(pixels + done * channels, count - done, channels, destination + done * 4, false, 0, 0);
+}
+
+
+void PixelOps::toRgba8OverCheckerboard(const float* pixels, size_t count, int channels, uint8_t* destination,
+                                       int x, int y) {
+    size_t done = kernels().toRgba8Over(pixels, count, channels, destination, x, y);
+    referenceToRgba8(pixels + done * channels, count - done, channels, destination + done * 4, true, x + int(done), y);
+}
+
+
+void PixelOps::toGray8(const float* values, size_t count, uint8_t* destination) {
+    for (size_t i = 0; i < count; ++i) {
+        destination[i] = toByte(values[i]);
+    }
+}
@@ -0,0 +1,45 @@
+#ifndef PIXELOPS_H
+#define PIXELOPS_H
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * Vectorized per pixel math on interleaved float pixels.
+ *
+ * The kernels are built for SSE4.2, AVX2 and AVX-512 and picked at runtime for the CPU we run on,
+ * EXRAY_SIMD=scalar|sse4.2|avx2|avx512 forces a lower one. Everything on other CPUs, and what
+ * the kernels leave over of the exact ops, goes through the scalar reference they are verified
+ * against (exray-bench --verify). Gamma is approximated and pads what's left over instead.
+ *
+ * Color channels are the first three, anything after is left alone by gamma and exposure.
+ */
+class PixelOps {
+    public:
+        enum class Isa { Scalar, SSE42, AVX2, AVX512 };
+        static constexpr int checker_size = 8;
+        static constexpr float checker_light = 0.6f;
+        static constexpr float checker_dark = 0.4f;
+        static Isa isa();
+        static Isa supportedIsa();
+        static void setIsa(Isa isa);
+        static const char* isaName(Isa isa);
+        // Sign mirrored |x|^(1/gamma). The fast path stays within 4e-6 relative of std::pow for
+        // normal values, denormal results flush to zero. All pixels of a call take the fast path
+        // when there is one, a value maps to the same result at any count.
+        static void gamma(float* pixels, size_t count, int channels, float gamma);
+        static void exposure(float* pixels, size_t count, int channels, float stops);
+        static void clamp(float* pixels, size_t count, int channels, float low, float high);
+        static void premultiply(float* pixels, size_t count);
+        static void unpremultiply(float* pixels, size_t count);
+        static void gather(const float* source, size_t count, int sourceChannels, const int* indices, int channels,
+                           float* destination);
+        static void replicate(const float* source, size_t count, int sourceChannels, int channel, float* destination);
+        static void toRgba8(const float* pixels, size_t count, int channels, uint8_t* destination);
+        static void toRgba8OverCheckerboard(const float* pixels, size_t count, int channels, uint8_t* destination,
+                                            int x, int y);
+        // One value per pixel, quantized the way toRgba8 does every channel.
+        static void toGray8(const float* values, size_t count, uint8_t* destination);
+};
+
+#endif //PIXELOPS_H
@@ -0,0 +1,67 @@
+#include <immintrin.h>
+#include "PixelOpsKernels.h"
+
+// Built with -mavx2 -mfma, only called once the CPU said it has both.
+
+
+namespace {
+    struct Avx2 {
+        using V = __m256;
+        using I = __m256i;
+        using M = __m256;
+        static constexpr int width = 8;
+
+        static V load(const float* p) { return _mm256_loadu_ps(p); }
+        static void store(float* p, V v) { _mm256_storeu_ps(p, v); }
+        static V set1(float v) { return _mm256_set1_ps(v); }
+        static V add(V a, V b) { return _mm256_add_ps(a, b); }
+        static V sub(V a, V b) { return _mm256_sub_ps(a, b); }
+        static V mul(V a, V b) { return _mm256_mul_ps(a, b); }
+        static V div(V a, V b) { return _mm256_div_ps(a, b); }
+        static V madd(V a, V b, V c) { return _mm256_fmadd_ps(a, b, c); }
+        static V min(V a, V b) { return _mm256_min_ps(a, b); }
+        static V max(V a, V b) { return _mm256_max_ps(a, b); }
+        static V floor(V a) { return _mm256_floor_ps(a); }
+        static V abs(V a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a); }
+        static V sign(V a) { return _mm256_and_ps(_mm256_set1_ps(-0.0f), a); }
+        static V orv(V a, V b) { return _mm256_or_ps(a, b); }
+
+        static M less(V a, V b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+        static M greater(V a, V b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+        static M notEqual(V a, V b) { return _mm256_cmp_ps(a, b, _CMP_NEQ_OQ); }
+        static M maskAnd(M a, M b) { return _mm256_and_ps(a, b); }
+        static M maskFromLanes(const float* lanes) { return notEqual(_mm256_loadu_ps(lanes), _mm256_setzero_ps()); }
+        static V select(M m, V a, V b) { return _mm256_blendv_ps(b, a, m); }
+
+        static I asInt(V a) { return _mm256_castps_si256(a); }
+        static V asFloat(I a) { return _mm256_castsi256_ps(a); }
+        static I seti(int v) { return _mm256_set1_epi32(v); }
+        static I addi(I a, I b) { return _mm256_add_epi32(a, b); }
+        static I subi(I a, I b) { return _mm256_sub_epi32(a, b); }
+        static I andi(I a, I b) { return _mm256_and_si256(a, b); }
+        static I ori(I a, I b) { return _mm256_or_si256(a, b); }
+        static I srli23(I a) { return _mm256_srli_epi32(a, 23); }
+        static I slli23(I a) { return _mm256_slli_epi32(a, 23); }
+        static I truncate(V a) { return _mm256_cvttps_epi32(a); }
+        static V toFloat(I a) { return _mm256_cvtepi32_ps(a); }
+
+        // Two pixels per vector, one in each 128 bit half.
+        static V broadcastAlpha(V a) { return _mm256_permute_ps(a, 0xFF); }
+        static V perPixel(const float* values) { return _mm256_setr_m128(_mm_set1_ps(values[0]), _mm_set1_ps(values[1])); }
+
+        // The packs work per half, the permute puts the four vectors back in order.
+        static void storeBytes(uint8_t* out, V a, V b, V c, V d) {
+            __m256i low = _mm256_packs_epi32(_mm256_cvttps_epi32(a), _mm256_cvttps_epi32(b));
+            __m256i high = _mm256_packs_epi32(_mm256_cvttps_epi32(c), _mm256_cvttps_epi32(d));
+            __m256i bytes = _mm256_packus_epi16(low, high);
+            bytes = _mm256_permutevar8x32_epi32(bytes, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), bytes);
+        }
+    };
+}
+
+
+const PixelKernels& avx2Kernels() {
+    static const PixelKernels kernels = makeKernels<Avx2>();
+    return kernels;
+}
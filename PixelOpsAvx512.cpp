@@ -0,0 +1,70 @@
+#include <immintrin.h>
+#include "PixelOpsKernels.h"
+
+// Built with -mavx512f, only called once the CPU said it has it. Sticks to AVX-512F, so no float
+// logic ops, those go through the integer side.
+
+
+namespace {
+    struct Avx512 {
+        using V = __m512;
+        using I = __m512i;
+        using M = __mmask16;
+        static constexpr int width = 16;
+
+        static V load(const float* p) { return _mm512_loadu_ps(p); }
+        static void store(float* p, V v) { _mm512_storeu_ps(p, v); }
+        static V set1(float v) { return _mm512_set1_ps(v); }
+        static V add(V a, V b) { return _mm512_add_ps(a, b); }
+        static V sub(V a, V b) { return _mm512_sub_ps(a, b); }
+        static V mul(V a, V b) { return _mm512_mul_ps(a, b); }
+        static V div(V a, V b) { return _mm512_div_ps(a, b); }
+        static V madd(V a, V b, V c) { return _mm512_fmadd_ps(a, b, c); }
+        static V min(V a, V b) { return _mm512_min_ps(a, b); }
+        static V max(V a, V b) { return _mm512_max_ps(a, b); }
+        static V floor(V a) { return _mm512_roundscale_ps(a, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC); }
+        static V abs(V a) { return asFloat(_mm512_and_si512(asInt(a), _mm512_set1_epi32(0x7FFFFFFF))); }
+        static V sign(V a) { return asFloat(_mm512_and_si512(asInt(a), _mm512_set1_epi32(int(0x80000000u)))); }
+        static V orv(V a, V b) { return asFloat(_mm512_or_si512(asInt(a), asInt(b))); }
+
+        static M less(V a, V b) { return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ); }
+        static M greater(V a, V b) { return _mm512_cmp_ps_mask(a, b, _CMP_GT_OQ); }
+        static M notEqual(V a, V b) { return _mm512_cmp_ps_mask(a, b, _CMP_NEQ_OQ); }
+        static M maskAnd(M a, M b) { return M(a & b); }
+        static M maskFromLanes(const float* lanes) { return notEqual(_mm512_loadu_ps(lanes), _mm512_setzero_ps()); }
+        static V select(M m, V a, V b) { return _mm512_mask_blend_ps(m, b, a); }
+
+        static I asInt(V a) { return _mm512_castps_si512(a); }
+        static V asFloat(I a) { return _mm512_castsi512_ps(a); }
+        static I seti(int v) { return _mm512_set1_epi32(v); }
+        static I addi(I a, I b) { return _mm512_add_epi32(a, b); }
+        static I subi(I a, I b) { return _mm512_sub_epi32(a, b); }
+        static I andi(I a, I b) { return _mm512_and_si512(a, b); }
+        static I ori(I a, I b) { return _mm512_or_si512(a, b); }
+        static I srli23(I a) { return _mm512_srli_epi32(a, 23); }
+        static I slli23(I a) { return _mm512_slli_epi32(a, 23); }
+        static I truncate(V a) { return _mm512_cvttps_epi32(a); }
+        static V toFloat(I a) { return _mm512_cvtepi32_ps(a); }
+
+        // Four pixels per vector, one in each 128 bit quarter.
+        static V broadcastAlpha(V a) { return _mm512_permute_ps(a, 0xFF); }
+        static V perPixel(const float* values) {
+            const __m512i spread = _mm512_setr_epi32(0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3);
+            return _mm512_permutexvar_ps(spread, _mm512_castps128_ps512(_mm_loadu_ps(values)));
+        }
+
+        // Values are already clamped, so the saturating narrow is a plain one.
+        static void storeBytes(uint8_t* out, V a, V b, V c, V d) {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm512_cvtusepi32_epi8(_mm512_cvttps_epi32(a)));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 16), _mm512_cvtusepi32_epi8(_mm512_cvttps_epi32(b)));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 32), _mm512_cvtusepi32_epi8(_mm512_cvttps_epi32(c)));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 48), _mm512_cvtusepi32_epi8(_mm512_cvttps_epi32(d)));
+        }
+    };
+}
+
+
+const PixelKernels& avx512Kernels() {
+    static const PixelKernels kernels = makeKernels<Avx512>();
+    return kernels;
+}
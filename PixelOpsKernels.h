@@ -0,0 +1,358 @@
+#ifndef PIXELOPSKERNELS_H
+#define PIXELOPSKERNELS_H
+
+#include <cstddef>
+#include <cstdint>
+#include "PixelOps.h"
+
+/*
+ * Kernels behind PixelOps, only to be included by PixelOps.cpp and the per instruction set files.
+ *
+ * Each instruction set file compiles these templates with its own flags against a small wrapper
+ * around its intrinsics. Everything here has internal linkage and stays clear of the standard
+ * library, so no AVX code can end up behind a shared inline symbol.
+ *
+ * The vector kernels return how many pixels they did, always a multiple of the vector width.
+ */
+
+struct PixelKernels {
+    size_t (*gamma)(float* pixels, size_t count, int channels, float exponent);
+    size_t (*scale)(float* pixels, size_t count, int channels, float factor);
+    size_t (*clamp)(float* pixels, size_t count, int channels, float low, float high);
+    size_t (*premultiply)(float* pixels, size_t count);
+    size_t (*unpremultiply)(float* pixels, size_t count);
+    size_t (*toRgba8)(const float* pixels, size_t count, int channels, uint8_t* destination);
+    size_t (*toRgba8Over)(const float* pixels, size_t count, int channels, uint8_t* destination, int x, int y);
+    void (*gather)(const float* source, size_t count, int sourceChannels, const int* indices, int channels,
+                   float* destination);
+    void (*replicate)(const float* source, size_t count, int sourceChannels, int channel, float* destination);
+};
+
+const PixelKernels& scalarKernels();
+const PixelKernels& sse42Kernels();
+const PixelKernels& avx2Kernels();
+const PixelKernels& avx512Kernels();
+
+
+namespace {
+    inline float checkerAt(int x, int y) {
+        const int size = PixelOps::checker_size;
+        return ((x / size + y / size) & 1) ? PixelOps::checker_light : PixelOps::checker_dark;
+    }
+
+
+    /*
+     * Channel shuffles, plain loops the compiler unrolls per channel count.
+     */
+    template<int Channels>
+    void gatherFixed(const float* source, size_t count, int sourceChannels, const int* indices, float* destination) {
+        int offsets[Channels];
+        for (int c = 0; c < Channels; ++c) {
+            offsets[c] = indices[c];
+        }
+
+        for (size_t i = 0; i < count; ++i) {
+            const float* pixel = source + i * sourceChannels;
+            for (int c = 0; c < Channels; ++c) {
+                destination[i * Channels + c] = pixel[offsets[c]];
+            }
+        }
+    }
+
+
+    void gatherPixels(const float* source, size_t count, int sourceChannels, const int* indices, int channels,
+                      float* destination) {
+        switch (channels) {
+            case 1: gatherFixed<1>(source, count, sourceChannels, indices, destination); return;
+            case 2: gatherFixed<2>(source, count, sourceChannels, indices, destination); return;
+            case 3: gatherFixed<3>(source, count, sourceChannels, indices, destination); return;
+            case 4: gatherFixed<4>(source, count, sourceChannels, indices, destination); return;
+        }
+
+        for (size_t i = 0; i < count; ++i) {
+            for (int c = 0; c < channels; ++c) {
+                destination[i * channels + c] = source[i * sourceChannels + indices[c]];
+            }
+        }
+    }
+
+
+    // One channel out to grey RGB with an opaque alpha.
+    void replicatePixels(const float* source, size_t count, int sourceChannels, int channel, float* destination) {
+        for (size_t i = 0; i < count; ++i) {
+            float value = source[i * sourceChannels + channel];
+            destination[i * 4 + 0] = value;
+            destination[i * 4 + 1] = value;
+            destination[i * 4 + 2] = value;
+            destination[i * 4 + 3] = 1.0f;
+        }
+    }
+
+
+    /*
+     * Vector kernels, W wraps one instruction set.
+     */
+
+    // Lanes holding a color channel. Widths are multiples of 1, 2 and 4, and every lane is color for 3.
+    template<class W>
+    typename W::M colorLanes(int channels) {
+        float lanes[W::width];
+        for (int i = 0; i < W::width; ++i) {
+            lanes[i] = channels == 3 || i % channels < 3 ? 1.0f : 0.0f;
+        }
+        return W::maskFromLanes(lanes);
+    }
+
+
+    // Natural log for positive normal values, the Cephes polynomial.
+    template<class W>
+    typename W::V logApprox(typename W::V x) {
+        using V = typename W::V;
+        using I = typename W::I;
+
+        I bits = W::asInt(x);
+        V e = W::add(W::toFloat(W::subi(W::srli23(bits), W::seti(127))), W::set1(1.0f));
+        V m = W::asFloat(W::ori(W::andi(bits, W::seti(0x007FFFFF)), W::seti(0x3F000000)));
+
+        // Keep the mantissa between sqrt(0.5) and sqrt(2).
+        auto small = W::less(m, W::set1(0.707106781186547524f));
+        e = W::select(small, W::sub(e, W::set1(1.0f)), e);
+        m = W::sub(W::select(small, W::add(m, m), m), W::set1(1.0f));
+
+        V z = W::mul(m, m);
+        V y = W::set1(7.0376836292e-2f);
+        y = W::madd(y, m, W::set1(-1.1514610310e-1f));
+        y = W::madd(y, m, W::set1(1.1676998740e-1f));
+        y = W::madd(y, m, W::set1(-1.2420140846e-1f));
+        y = W::madd(y, m, W::set1(1.4249322787e-1f));
+        y = W::madd(y, m, W::set1(-1.6668057665e-1f));
+        y = W::madd(y, m, W::set1(2.0000714765e-1f));
+        y = W::madd(y, m, W::set1(-2.4999993993e-1f));
+        y = W::madd(y, m, W::set1(3.3333331174e-1f));
+        y = W::mul(W::mul(y, m), z);
+
+        y = W::madd(e, W::set1(-2.12194440e-4f), y);
+        y = W::madd(z, W::set1(-0.5f), y);
+        return W::madd(e, W::set1(0.693359375f), W::add(m, y));
+    }
+
+
+    // e^x, Inf past the largest float and zero below 2^-125.
+    template<class W>
+    typename W::V expApprox(typename W::V x) {
+        using V = typename W::V;
+
+        auto overflow = W::greater(x, W::set1(88.7228391f));
+        auto underflow = W::less(x, W::set1(-86.6433640f));
+        x = W::max(W::min(x, W::set1(88.7228391f)), W::set1(-86.6433640f));
+
+        V n = W::floor(W::madd(x, W::set1(1.44269504088896341f), W::set1(0.5f)));
+        x = W::madd(n, W::set1(-0.693359375f), x);
+        x = W::madd(n, W::set1(2.12194440e-4f), x);
+
+        V z = W::mul(x, x);
+        V y = W::set1(1.9875691500e-4f);
+        y = W::madd(y, x, W::set1(1.3981999507e-3f));
+        y = W::madd(y, x, W::set1(8.3334519073e-3f));
+        y = W::madd(y, x, W::set1(4.1665795894e-2f));
+        y = W::madd(y, x, W::set1(1.6666665459e-1f));
+        y = W::madd(y, x, W::set1(5.0000001201e-1f));
+        y = W::add(W::madd(y, z, x), W::set1(1.0f));
+
+        // Scale by 2^n through the exponent bits, in two steps so n = 128 still fits.
+        V scale = W::asFloat(W::slli23(W::addi(W::truncate(n), W::seti(126))));
+        y = W::mul(W::add(y, y), scale);
+
+        y = W::select(underflow, W::set1(0.0f), y);
+        return W::select(overflow, W::asFloat(W::seti(0x7F800000)), y);
+    }
+
+
+    template<class W>
+    size_t gammaKernel(float* pixels, size_t count, int channels, float exponent) {
+        using V = typename W::V;
+
+        if (channels < 1 || channels > 4) {
+            return 0;
+        }
+
+        const auto color = colorLanes<W>(channels);
+        const V power = W::set1(exponent);
+        const V zero = W::set1(0.0f);
+        const V infinity = W::asFloat(W::seti(0x7F800000));
+        const V smallest = W::asFloat(W::seti(0x00800000));
+
+        const size_t done = count - count % W::width;
+        const size_t values = done * channels;
+
+        for (size_t i = 0; i < values; i += W::width) {
+            V x = W::load(pixels + i);
+            V magnitude = W::abs(x);
+
+            V y = expApprox<W>(W::mul(logApprox<W>(W::max(magnitude, smallest)), power));
+            y = W::orv(y, W::sign(x));
+
+            // Zero, NaN and Inf come out as they went in, like they do from std::pow.
+            auto finite = W::maskAnd(W::greater(magnitude, zero), W::less(magnitude, infinity));
+            W::store(pixels + i, W::select(W::maskAnd(color, finite), y, x));
+        }
+
+        return done;
+    }
+
+
+    template<class W>
+    size_t scaleKernel(float* pixels, size_t count, int channels, float factor) {
+        using V = typename W::V;
+
+        if (channels < 1 || channels > 4) {
+            return 0;
+        }
+
+        const auto color = colorLanes<W>(channels);
+        const V scale = W::set1(factor);
+        const size_t done = count - count % W::width;
+        const size_t values = done * channels;
+
+        for (size_t i = 0; i < values; i += W::width) {
+            V x = W::load(pixels + i);
+            W::store(pixels + i, W::select(color, W::mul(x, scale), x));
+        }
+
+        return done;
+    }
+
+
+    // min then max, in this order NaN ends up at high just like std::max(low, std::min(high, x)).
+    template<class W>
+    size_t clampKernel(float* pixels, size_t count, int channels, float low, float high) {
+        using V = typename W::V;
+
+        const V lower = W::set1(low);
+        const V upper = W::set1(high);
+        const size_t done = count - count % W::width;
+        const size_t values = done * channels;
+
+        for (size_t i = 0; i < values; i += W::width) {
+            W::store(pixels + i, W::max(W::min(W::load(pixels + i), upper), lower));
+        }
+
+        return done;
+    }
+
+
+    template<class W>
+    size_t premultiplyKernel(float* pixels, size_t count) {
+        const auto color = colorLanes<W>(4);
+        const size_t done = count - count % W::width;
+        const size_t values = done * 4;
+
+        for (size_t i = 0; i < values; i += W::width) {
+            auto x = W::load(pixels + i);
+            W::store(pixels + i, W::select(color, W::mul(x, W::broadcastAlpha(x)), x));
+        }
+
+        return done;
+    }
+
+
+    template<class W>
+    size_t unpremultiplyKernel(float* pixels, size_t count) {
+        const auto color = colorLanes<W>(4);
+        const auto zero = W::set1(0.0f);
+        const size_t done = count - count % W::width;
+        const size_t values = done * 4;
+
+        for (size_t i = 0; i < values; i += W::width) {
+            auto x = W::load(pixels + i);
+            auto alpha = W::broadcastAlpha(x);
+            // Fully transparent pixels have no color to get back.
+            auto divide = W::maskAnd(color, W::notEqual(alpha, zero));
+            W::store(pixels + i, W::select(divide, W::div(x, alpha), x));
+        }
+
+        return done;
+    }
+
+
+    template<class W>
+    inline typename W::V toByteRange(typename W::V x) {
+        return W::mul(W::max(W::min(x, W::set1(1.0f)), W::set1(0.0f)), W::set1(255.0f));
+    }
+
+
+    // RGBA only, four vectors make width pixels.
+    template<class W>
+    size_t toRgba8Kernel(const float* pixels, size_t count, int channels, uint8_t* destination) {
+        if (channels != 4) {
+            return 0;
+        }
+
+        const size_t done = count - count % W::width;
+
+        for (size_t i = 0; i < done; i += W::width) {
+            const float* source = pixels + i * 4;
+            W::storeBytes(destination + i * 4,
+                          toByteRange<W>(W::load(source)),
+                          toByteRange<W>(W::load(source + W::width)),
+                          toByteRange<W>(W::load(source + W::width * 2)),
+                          toByteRange<W>(W::load(source + W::width * 3)));
+        }
+
+        return done;
+    }
+
+
+    // Premultiplied RGBA over the checkerboard, the result is opaque.
+    template<class W>
+    inline typename W::V overChecker(typename W::V x, const float* background, typename W::M color) {
+        auto behind = W::mul(W::sub(W::set1(1.0f), W::broadcastAlpha(x)), W::perPixel(background));
+        return W::select(color, W::add(x, behind), W::set1(1.0f));
+    }
+
+
+    template<class W>
+    size_t toRgba8OverKernel(const float* pixels, size_t count, int channels, uint8_t* destination, int x, int y) {
+        if (channels != 4) {
+            return 0;
+        }
+
+        constexpr int pixels_per_vector = W::width / 4;
+        const auto color = colorLanes<W>(4);
+        const size_t done = count - count % W::width;
+
+        for (size_t i = 0; i < done; i += W::width) {
+            float background[W::width];
+            for (int p = 0; p < W::width; ++p) {
+                background[p] = checkerAt(x + int(i) + p, y);
+            }
+
+            const float* source = pixels + i * 4;
+            W::storeBytes(destination + i * 4,
+                          toByteRange<W>(overChecker<W>(W::load(source), background, color)),
+                          toByteRange<W>(overChecker<W>(W::load(source + W::width), background + pixels_per_vector, color)),
+                          toByteRange<W>(overChecker<W>(W::load(source + W::width * 2), background + pixels_per_vector * 2, color)),
+                          toByteRange<W>(overChecker<W>(W::load(source + W::width * 3), background + pixels_per_vector * 3, color)));
+        }
+
+        return done;
+    }
+
+
+    template<class W>
+    PixelKernels makeKernels() {
+        return {
+            gammaKernel<W>,
+            scaleKernel<W>,
+            clampKernel<W>,
+            premultiplyKernel<W>,
+            unpremultiplyKernel<W>,
+            toRgba8Kernel<W>,
+            toRgba8OverKernel<W>,
+            gatherPixels,
+            replicatePixels
+        };
+    }
+}
+
+#endif //PIXELOPSKERNELS_H
@@ -0,0 +1,65 @@
+#include <nmmintrin.h>
+#include "PixelOpsKernels.h"
+
+// Built with -msse4.2, only called once the CPU said it has it.
+
+
+namespace {
+    struct Sse42 {
+        using V = __m128;
+        using I = __m128i;
+        using M = __m128;
+        static constexpr int width = 4;
+
+        static V load(const float* p) { return _mm_loadu_ps(p); }
+        static void store(float* p, V v) { _mm_storeu_ps(p, v); }
+        static V set1(float v) { return _mm_set1_ps(v); }
+        static V add(V a, V b) { return _mm_add_ps(a, b); }
+        static V sub(V a, V b) { return _mm_sub_ps(a, b); }
+        static V mul(V a, V b) { return _mm_mul_ps(a, b); }
+        static V div(V a, V b) { return _mm_div_ps(a, b); }
+        static V madd(V a, V b, V c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+        static V min(V a, V b) { return _mm_min_ps(a, b); }
+        static V max(V a, V b) { return _mm_max_ps(a, b); }
+        static V floor(V a) { return _mm_floor_ps(a); }
+        static V abs(V a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+        static V sign(V a) { return _mm_and_ps(_mm_set1_ps(-0.0f), a); }
+        static V orv(V a, V b) { return _mm_or_ps(a, b); }
+
+        static M less(V a, V b) { return _mm_cmplt_ps(a, b); }
+        static M greater(V a, V b) { return _mm_cmpgt_ps(a, b); }
+        static M notEqual(V a, V b) { return _mm_cmpneq_ps(a, b); }
+        static M maskAnd(M a, M b) { return _mm_and_ps(a, b); }
+        static M maskFromLanes(const float* lanes) { return _mm_cmpneq_ps(_mm_loadu_ps(lanes), _mm_setzero_ps()); }
+        static V select(M m, V a, V b) { return _mm_blendv_ps(b, a, m); }
+
+        static I asInt(V a) { return _mm_castps_si128(a); }
+        static V asFloat(I a) { return _mm_castsi128_ps(a); }
+        static I seti(int v) { return _mm_set1_epi32(v); }
+        static I addi(I a, I b) { return _mm_add_epi32(a, b); }
+        static I subi(I a, I b) { return _mm_sub_epi32(a, b); }
+        static I andi(I a, I b) { return _mm_and_si128(a, b); }
+        static I ori(I a, I b) { return _mm_or_si128(a, b); }
+        static I srli23(I a) { return _mm_srli_epi32(a, 23); }
+        static I slli23(I a) { return _mm_slli_epi32(a, 23); }
+        static I truncate(V a) { return _mm_cvttps_epi32(a); }
+        static V toFloat(I a) { return _mm_cvtepi32_ps(a); }
+
+        // One pixel per vector.
+        static V broadcastAlpha(V a) { return _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 3, 3, 3)); }
+        static V perPixel(const float* values) { return _mm_set1_ps(values[0]); }
+
+        // Four vectors of 0-255 values to sixteen bytes.
+        static void storeBytes(uint8_t* out, V a, V b, V c, V d) {
+            __m128i low = _mm_packs_epi32(_mm_cvttps_epi32(a), _mm_cvttps_epi32(b));
+            __m128i high = _mm_packs_epi32(_mm_cvttps_epi32(c), _mm_cvttps_epi32(d));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_packus_epi16(low, high));
+        }
+    };
+}
+
+
+const PixelKernels& sse42Kernels() {
+    static const PixelKernels kernels = makeKernels<Sse42>();
+    return kernels;
+}
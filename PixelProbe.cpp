@@ -0,0 +1,44 @@
+#include "PixelProbe.h"
+
+
+void PixelProbe::setSceneData(const Image::ChannelData* sceneData) {
+    this->scene_data = sceneData;
+    this->table = SummedAreaTable(sceneData);
+}
+
+
+void PixelProbe::setDisplayData(const Image::ChannelData* displayData) {
+    this->display_data = displayData;
+}
+
+
+PixelProbe::Sample PixelProbe::sample(int x, int y) const {
+    Sample result;
+    result.x = x;
+    result.y = y;
+
+    const Image::ChannelData* scene = this->scene_data;
+    if (!scene || scene->data.empty() || x < 0 || y < 0 || x >= scene->width || y >= scene->height) {
+        return result;
+    }
+
+    size_t pixel = size_t(y) * scene->width + x;
+
+    result.valid = true;
+    result.channel_names = scene->channel_names;
+    result.scene.assign(scene->data.begin() + pixel * scene->channels,
+                        scene->data.begin() + (pixel + 1) * scene->channels);
+
+    const Image::ChannelData* display = this->display_data;
+    if (display && !display->data.empty() && display->width == scene->width && display->height == scene->height) {
+        result.display.assign(display->data.begin() + pixel * display->channels,
+                              display->data.begin() + (pixel + 1) * display->channels);
+    }
+
+    return result;
+}
+
+
+SummedAreaTable::Region PixelProbe::region(const QRect& rect) const {
+    return this->table.region(rect);
+}
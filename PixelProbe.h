@@ -0,0 +1,37 @@
+#ifndef PIXELPROBE_H
+#define PIXELPROBE_H
+
+#include <QRect>
+#include <string>
+#include <vector>
+#include "Image.h"
+#include "SummedAreaTable.h"
+
+/*
+ * Reads pixel values of the layer on screen.
+ *
+ * Points are looked up directly in the scene-linear and display buffers, rectangles go through
+ * a summed-area table that is built once whenever the scene-linear buffer changes.
+ */
+class PixelProbe {
+    public:
+        struct Sample {
+            bool valid = false;
+            int x = 0;
+            int y = 0;
+            std::vector<std::string> channel_names;
+            std::vector<float> scene;
+            std::vector<float> display;
+        };
+        void setSceneData(const Image::ChannelData* sceneData);
+        void setDisplayData(const Image::ChannelData* displayData);
+        Sample sample(int x, int y) const;
+        SummedAreaTable::Region region(const QRect& rect) const;
+
+    private:
+        const Image::ChannelData* scene_data = nullptr;
+        const Image::ChannelData* display_data = nullptr;
+        SummedAreaTable table;
+};
+
+#endif //PIXELPROBE_H
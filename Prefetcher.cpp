@@ -0,0 +1,272 @@
+#include "Prefetcher.h"
+#include <QApplication>
+#include <QFileInfo>
+#include <QPointer>
+#include <algorithm>
+#include <cstdlib>
+#include "TaskScheduler.h"
+#include "Trace.h"
+#include "Viewport.h"
+
+
+Prefetcher::Prefetcher(Session *session, QObject *parent): QObject(parent), session(session) {
+    size_t budget_mb = default_budget_mb;
+    if (const char *budget = std::getenv("EXRAY_PREFETCH_MB")) {
+        budget_mb = std::strtoull(budget, nullptr, 10);
+    }
+    this->budget_bytes = budget_mb * 1024 * 1024;
+    this->cancelled = std::make_shared<std::atomic<bool>>(false);
+}
+
+
+Prefetcher::~Prefetcher() {
+    *this->cancelled = true;
+}
+
+
+void Prefetcher::cancel() {
+    *this->cancelled = true;
+    this->cancelled = std::make_shared<std::atomic<bool>>(false);
+    this->wanted_frames.clear();
+    this->next_wanted = 0;
+    this->busy = false;
+}
+
+
+void Prefetcher::predict(const std::string &filename, const QStringList &layers, const QString &layer,
+                         const DisplayPipeline::Settings &settings) {
+    this->cancel();
+    this->current_file = filename;
+
+    // Made for other transforms, they won't be asked for again.
+    const QString key = settingsKey(settings);
+    std::erase_if(this->made, [&](const auto &frame) {
+        return frame->settings != key;
+    });
+    this->settings = settings;
+
+    // Which way the user is going through the layers and the files.
+    if (this->history.value(0) != layer) {
+        const int from = layers.indexOf(this->history.value(0));
+        const int to = layers.indexOf(layer);
+        if (from != -1 && to != -1) {
+            this->last_layer_step = to > from ? 1 : -1;
+        }
+        this->history.removeAll(layer);
+        this->history.prepend(layer);
+        while (this->history.size() > history_size) {
+            this->history.removeLast();
+        }
+    }
+
+    const QStringList files = this->session->files();
+    const int file_index = this->session->currentIndex();
+    if (file_index != this->last_file_index) {
+        if (this->last_file_index != -1 && file_index != -1) {
+            this->last_file_step = file_index > this->last_file_index ? 1 : -1;
+        }
+        this->last_file_index = file_index;
+    }
+
+    // A render view image has no file to make anything from.
+    if (this->budget_bytes == 0 || !QFileInfo::exists(QString::fromStdString(filename))) {
+        return;
+    }
+
+    // The layer flipped back to, the neighbours with the one ahead first, then the ones seen lately.
+    QStringList ranked_layers;
+    auto addLayer = [&](const QString &name) {
+        if (layers.contains(name) && name != layer && !ranked_layers.contains(name) && ranked_layers.size() < max_layers) {
+            ranked_layers.append(name);
+        }
+    };
+    const int at = layers.indexOf(layer);
+    addLayer(this->history.value(1));
+    if (at != -1) {
+        addLayer(layers.value(at + this->last_layer_step));
+        addLayer(layers.value(at - this->last_layer_step));
+    }
+    for (const QString &seen: this->history) {
+        addLayer(seen);
+    }
+
+    // Files the same way, they open on the layer they were last seen with.
+    std::vector<Wanted> ranked_files;
+    for (int step: {this->last_file_step, -this->last_file_step}) {
+        const QString file = files.value(file_index + step);
+        if (file_index != -1 && !file.isEmpty() && int(ranked_files.size()) < max_files) {
+            ranked_files.push_back({file.toStdString(), this->session->lastLayer(file)});
+        }
+    }
+
+    // The likeliest layer and the next file first, then the rest of the layers and files.
+    for (int i = 0; i < ranked_layers.size(); ++i) {
+        this->wanted_frames.push_back({filename, ranked_layers[i]});
+        if (i == 0 && !ranked_files.empty()) {
+            this->wanted_frames.push_back(ranked_files.front());
+        }
+    }
+    for (size_t i = ranked_layers.isEmpty() ? 0 : 1; i < ranked_files.size(); ++i) {
+        this->wanted_frames.push_back(ranked_files[i]);
+    }
+
+    this->next();
+}
+
+
+bool Prefetcher::take(const std::string &filename, const QString &requested, const DisplayPipeline::Settings &settings,
+                      Made &made) {
+    this->counts.lookups++;
+
+    const QString key = settingsKey(settings);
+    const QDateTime modified = QFileInfo(QString::fromStdString(filename)).lastModified();
+    auto found = std::find_if(this->made.begin(), this->made.end(), [&](const auto &frame) {
+        return frame->filename == filename && frame->requested == requested && frame->settings == key
+               && frame->modified == modified;
+    });
+    if (found == this->made.end()) {
+        return false;
+    }
+
+    made = std::move(**found);
+    this->made.erase(found);
+    this->counts.hits++;
+    return true;
+}
+
+
+void Prefetcher::forget(const std::string &filename) {
+    std::erase_if(this->made, [&](const auto &frame) {
+        return frame->filename == filename;
+    });
+}
+
+
+Prefetcher::Stats Prefetcher::stats() const {
+    Stats stats = this->counts;
+    stats.held_bytes = this->heldBytes();
+    stats.held = int(this->made.size());
+    return stats;
+}
+
+
+QString Prefetcher::settingsKey(const DisplayPipeline::Settings &settings) {
+    return QString("%1\n%2\n%3\n%4\n%5\n%6\n%7\n%8").arg(quintptr(settings.color_manager)).arg(settings.input_colorspace)
+            .arg(settings.output_colorspace).arg(settings.gamma).arg(settings.checkerboard).arg(settings.heatmap)
+            .arg(settings.heatmap_low).arg(settings.heatmap_high);
+}
+
+
+void Prefetcher::next() {
+    if (this->busy) {
+        return;
+    }
+
+    const QString key = settingsKey(this->settings);
+    while (this->next_wanted < this->wanted_frames.size()) {
+        const Wanted wanted = this->wanted_frames[this->next_wanted++];
+        const bool done = std::any_of(this->made.begin(), this->made.end(), [&](const auto &frame) {
+            return frame->filename == wanted.filename && frame->requested == wanted.requested;
+        });
+        if (done) {
+            continue;
+        }
+
+        // What isn't likely anymore makes room, what still is stays.
+        const size_t room = this->budget_bytes - std::min(this->budget_bytes, this->heldBytes(true));
+        const bool other_file = wanted.filename != this->current_file;
+        const DisplayPipeline::Settings settings = this->settings;
+        const QList<QPair<QString, QString>> virtualLayers = this->session->virtualLayers();
+        auto cancelled = this->cancelled;
+        QPointer<Prefetcher> prefetcher(this);
+        this->busy = true;
+
+        TaskScheduler::instance().submit([=]() {
+            EXRAY_TRACE_SCOPE("prefetch");
+            auto frame = std::make_shared<Made>();
+            frame->filename = wanted.filename;
+            frame->requested = wanted.requested;
+            frame->settings = key;
+            frame->modified = QFileInfo(QString::fromStdString(wanted.filename)).lastModified();
+            frame->image = std::make_unique<Image>(wanted.filename.c_str());
+
+            Image *image = frame->image.get();
+            bool ok = image->inp != nullptr;
+            if (ok) {
+                // Not worth decoding what can't be kept.
+                const ImageSpec &spec = image->inp->spec();
+                const size_t pixels = size_t(spec.width) * spec.height;
+                const size_t decoded = other_file ? pixels * spec.nchannels * sizeof(float) : 0;
+                ok = decoded + pixels * (2 * 4 * sizeof(float) + 4) <= room;
+            }
+            if (ok) {
+                for (const auto &layer: virtualLayers) {
+                    image->addVirtualLayer(layer.first, layer.second);
+                }
+                frame->layer = Viewport::startLayer(image, wanted.requested);
+                ok = !*cancelled && image->openPixels();
+            }
+            if (ok && !*cancelled) {
+                frame->result = DisplayPipeline::run(image, frame->layer, "all", settings, DisplayPipeline::KeepScene
+                                                     | DisplayPipeline::KeepDisplay | DisplayPipeline::KeepImage);
+                ok = !frame->result.scene_data.data.empty();
+            }
+
+            if (ok && !*cancelled) {
+                const DisplayPipeline::Result &result = frame->result;
+                frame->bytes = (result.scene_data.data.size() + result.display_data.data.size()) * sizeof(float)
+                               + size_t(result.display_image.sizeInBytes());
+                // Read in place, the file's pages are the system's to keep.
+                if (other_file && image->pixels) {
+                    frame->bytes += image->pixels->size() * sizeof(float);
+                }
+                image->moveToThread(qApp->thread());
+            } else {
+                frame.reset();
+            }
+
+            QMetaObject::invokeMethod(qApp, [prefetcher, cancelled, frame]() {
+                if (!prefetcher || *cancelled) {
+                    return;
+                }
+                prefetcher->busy = false;
+                if (frame) {
+                    prefetcher->keep(std::make_unique<Made>(std::move(*frame)));
+                }
+                prefetcher->next();
+            }, Qt::QueuedConnection);
+        }, TaskScheduler::Priority::Background, cancelled);
+        return;
+    }
+}
+
+
+void Prefetcher::keep(std::unique_ptr<Made> frame) {
+    this->made.push_back(std::move(frame));
+
+    // Over budget, what's no longer likely goes first, then the oldest.
+    while (!this->made.empty() && this->heldBytes() > this->budget_bytes) {
+        auto victim = std::find_if(this->made.begin(), this->made.end(), [this](const auto &made) {
+            return !this->isWanted(*made);
+        });
+        this->made.erase(victim != this->made.end() ? victim : this->made.begin());
+    }
+}
+
+
+bool Prefetcher::isWanted(const Made &frame) const {
+    return std::any_of(this->wanted_frames.begin(), this->wanted_frames.end(), [&](const Wanted &wanted) {
+        return wanted.filename == frame.filename && wanted.requested == frame.requested;
+    });
+}
+
+
+size_t Prefetcher::heldBytes(bool onlyWanted) const {
+    size_t bytes = 0;
+    for (const auto &frame: this->made) {
+        if (!onlyWanted || this->isWanted(*frame)) {
+            bytes += frame->bytes;
+        }
+    }
+    return bytes;
+}
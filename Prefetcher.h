@@ -0,0 +1,96 @@
+#ifndef PREFETCHER_H
+#define PREFETCHER_H
+
+#include <QObject>
+#include <QDateTime>
+#include <QList>
+#include <QPair>
+#include <QString>
+#include <QStringList>
+#include <atomic>
+#include <memory>
+#include "DisplayPipeline.h"
+#include "Image.h"
+#include "Session.h"
+
+/*
+ * Makes the frames the user is likely to look at next while the viewer is idle.
+ *
+ * After every frame that's shown, the candidates are ranked: the layer seen before this one, as
+ * users flip between the beauty and the AOV they're looking into, the neighbours in the layer list,
+ * the one in the direction of the last step first, then the neighbouring files of the session the
+ * same way. They're decoded and sent through the display chain one at a time, as background tasks.
+ *
+ * Anything real the viewer does cancels what's still to be made at once, what's done is kept within
+ * the memory budget, default_budget_mb unless EXRAY_PREFETCH_MB says otherwise. Every layer switch
+ * and file open looks here first, how often it finds its frame is the hit rate.
+ */
+class Prefetcher : public QObject {
+    Q_OBJECT
+
+    public:
+        static constexpr size_t default_budget_mb = 1024;
+        static constexpr int max_layers = 3;
+        static constexpr int max_files = 2;
+        static constexpr int history_size = 8;
+        // A frame made ahead, with the image it was made from.
+        struct Made {
+            std::string filename;
+            // What was asked for, the layer the viewer would pick for it.
+            QString requested;
+            QString layer;
+            QString settings;
+            QDateTime modified;
+            std::unique_ptr<Image> image;
+            DisplayPipeline::Result result;
+            size_t bytes = 0;
+        };
+        struct Stats {
+            int64_t lookups = 0;
+            int64_t hits = 0;
+            size_t held_bytes = 0;
+            int held = 0;
+        };
+        explicit Prefetcher(Session *session, QObject *parent = nullptr);
+        ~Prefetcher();
+        // Real work is about to start, nothing more is made until the next predict().
+        void cancel();
+        // The user is on this layer of the current file, make what's likely next.
+        void predict(const std::string& filename, const QStringList& layers, const QString& layer,
+                     const DisplayPipeline::Settings& settings);
+        // Whether a frame for this is ready, handed over if it is. Counts towards the hit rate.
+        bool take(const std::string& filename, const QString& requested, const DisplayPipeline::Settings& settings,
+                  Made& made);
+        // The file changed, what was made from it is stale.
+        void forget(const std::string& filename);
+        Stats stats() const;
+
+    private:
+        struct Wanted {
+            std::string filename;
+            QString requested;
+        };
+        Session* session;
+        std::vector<std::unique_ptr<Made>> made;
+        // Ranked, the ones before next_wanted are made or being made.
+        std::vector<Wanted> wanted_frames;
+        size_t next_wanted = 0;
+        std::string current_file;
+        DisplayPipeline::Settings settings;
+        std::shared_ptr<std::atomic<bool>> cancelled;
+        bool busy = false;
+        size_t budget_bytes = 0;
+        Stats counts;
+        // Layers most recently shown first.
+        QStringList history;
+        int last_layer_step = 1;
+        int last_file_index = -1;
+        int last_file_step = 1;
+        static QString settingsKey(const DisplayPipeline::Settings& settings);
+        void next();
+        void keep(std::unique_ptr<Made> frame);
+        bool isWanted(const Made& frame) const;
+        size_t heldBytes(bool onlyWanted = false) const;
+};
+
+#endif //PREFETCHER_H
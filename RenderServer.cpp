@@ -0,0 +1,278 @@
+#include "RenderServer.h"
+#include <QDir>
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "Trace.h"
+
+
+namespace {
+    // A uint32_t length and that many bytes, moving at along.
+    bool readString(const char*& at, const char* end, std::string& text) {
+        uint32_t length;
+        if (end - at < ptrdiff_t(sizeof(length))) {
+            return false;
+        }
+        std::memcpy(&length, at, sizeof(length));
+        at += sizeof(length);
+
+        if (end - at < ptrdiff_t(length)) {
+            return false;
+        }
+        text.assign(at, length);
+        at += length;
+        return true;
+    }
+}
+
+
+RenderServer::RenderServer(QObject *parent): QObject(parent) {
+    connect(&this->server, &QLocalServer::newConnection, this, &RenderServer::accept);
+}
+
+
+RenderServer::~RenderServer() {
+    this->close();
+}
+
+
+QString RenderServer::defaultPath() {
+    const QString path = qEnvironmentVariable("EXRAY_RENDER_VIEW");
+    return path.isEmpty() ? QDir::temp().filePath("exray-render-view") : path;
+}
+
+
+bool RenderServer::listen(const QString &path) {
+    this->close();
+
+    // A socket left behind by a viewer that didn't shut down would be in the way.
+    QLocalServer::removeServer(path);
+    this->server.setSocketOptions(QLocalServer::UserAccessOption);
+    if (!this->server.listen(path)) {
+        qDebug() << "Render view could not listen on" << path << ":" << this->server.errorString();
+        return false;
+    }
+    return true;
+}
+
+
+void RenderServer::close() {
+    while (!this->connections.empty()) {
+        this->drop(this->connections.back().get());
+    }
+    this->server.close();
+}
+
+
+bool RenderServer::isListening() const {
+    return this->server.isListening();
+}
+
+
+QString RenderServer::path() const {
+    return this->server.fullServerName();
+}
+
+
+void RenderServer::accept() {
+    while (QLocalSocket *socket = this->server.nextPendingConnection()) {
+        auto connection = std::make_unique<Connection>();
+        connection->socket = socket;
+        Connection *added = connection.get();
+        this->connections.push_back(std::move(connection));
+
+        connect(socket, &QLocalSocket::readyRead, this, [this, added]() {
+            this->read(added);
+        });
+        connect(socket, &QLocalSocket::disconnected, this, [this, added]() {
+            this->drop(added);
+        });
+    }
+}
+
+
+void RenderServer::read(Connection *connection) {
+    EXRAY_TRACE_SCOPE("render_view");
+    connection->buffer.append(connection->socket->readAll());
+
+    // Everything that came in at once is shown at once.
+    std::vector<ROI> regions;
+    const size_t header_size = sizeof(RenderViewProtocol::Header);
+    size_t at = 0;
+
+    while (size_t(connection->buffer.size()) - at >= header_size) {
+        RenderViewProtocol::Header header;
+        std::memcpy(&header, connection->buffer.constData() + at, header_size);
+        if (header.magic != RenderViewProtocol::magic || header.size > RenderViewProtocol::max_message) {
+            qDebug() << "Render view: not a render view client, dropped";
+            this->drop(connection);
+            return;
+        }
+
+        if (size_t(connection->buffer.size()) - at - header_size < header.size) {
+            break;
+        }
+
+        const char *payload = connection->buffer.constData() + at + header_size;
+        if (!this->handle(connection, RenderViewProtocol::Type(header.type), payload, header.size, regions)) {
+            this->drop(connection);
+            return;
+        }
+        at += header_size + header.size;
+    }
+
+    connection->buffer.remove(0, qsizetype(at));
+    this->flush(connection, regions);
+}
+
+
+bool RenderServer::handle(Connection *connection, RenderViewProtocol::Type type, const char *payload, size_t size,
+                          std::vector<ROI> &regions) {
+    switch (type) {
+        case RenderViewProtocol::Type::Open:
+            // What came before belongs to the image before.
+            this->flush(connection, regions);
+            return this->open(connection, payload, size);
+
+        case RenderViewProtocol::Type::Bucket: {
+            RenderViewProtocol::Bucket bucket;
+            if (size != sizeof(bucket)) {
+                qDebug() << "Render view: broken bucket message";
+                return false;
+            }
+            std::memcpy(&bucket, payload, sizeof(bucket));
+
+            // Nobody shows the image anymore, the renderer can go on all the same.
+            Image *image = connection->image;
+            if (!image || !connection->frame) {
+                return true;
+            }
+
+            const ImageSpec &spec = image->inp->spec();
+            const ROI roi(bucket.xbegin, bucket.xend, bucket.ybegin, bucket.yend, 0, 1, bucket.chbegin, bucket.chend);
+            if (roi.xbegin < 0 || roi.ybegin < 0 || roi.xend > spec.width || roi.yend > spec.height
+                || roi.width() <= 0 || roi.height() <= 0) {
+                qDebug() << "Render view: bucket outside of the frame skipped";
+                return true;
+            }
+
+            const float *source = connection->frame + (size_t(roi.ybegin) * spec.width + roi.xbegin) * spec.nchannels;
+            if (image->updatePixels(roi, source, size_t(spec.width) * spec.nchannels)) {
+                regions.push_back(roi);
+            }
+            return true;
+        }
+
+        case RenderViewProtocol::Type::Close:
+            this->flush(connection, regions);
+            this->unmap(connection);
+            if (connection->image) {
+                emit this->imageFinished(connection->image);
+            }
+            return true;
+    }
+
+    qDebug() << "Render view: unknown message" << uint32_t(type);
+    return false;
+}
+
+
+bool RenderServer::open(Connection *connection, const char *payload, size_t size) {
+    RenderViewProtocol::Open open;
+    if (size < sizeof(open)) {
+        qDebug() << "Render view: broken open message";
+        return false;
+    }
+    std::memcpy(&open, payload, sizeof(open));
+
+    if (open.version != RenderViewProtocol::version || open.width <= 0 || open.height <= 0 || open.channels <= 0
+        || open.channels > 1024) {
+        qDebug() << "Render view: can't show a" << open.width << "x" << open.height << "image with"
+                 << open.channels << "channels, protocol version" << open.version;
+        return false;
+    }
+
+    const char *at = payload + sizeof(open);
+    const char *end = payload + size;
+    std::string name;
+    std::vector<std::string> channel_names(open.channels);
+    std::string segment;
+    bool ok = readString(at, end, name);
+    for (std::string &channel: channel_names) {
+        ok = ok && readString(at, end, channel);
+    }
+    ok = ok && readString(at, end, segment);
+    if (!ok) {
+        qDebug() << "Render view: broken open message";
+        return false;
+    }
+
+    // The frame the renderer writes into, we only ever read it.
+    this->unmap(connection);
+    const size_t bytes = size_t(open.width) * open.height * open.channels * sizeof(float);
+    const int fd = shm_open(segment.c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+        qDebug() << "Render view: no shared memory segment" << QString::fromStdString(segment);
+        return false;
+    }
+
+    struct stat info;
+    void *frame = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && size_t(info.st_size) >= bytes) {
+        frame = mmap(nullptr, bytes, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    ::close(fd);
+
+    if (frame == MAP_FAILED) {
+        qDebug() << "Render view: shared memory segment" << QString::fromStdString(segment) << "too small or not mapped";
+        return false;
+    }
+    connection->frame = static_cast<const float*>(frame);
+    connection->frame_bytes = bytes;
+
+    ImageSpec spec(open.width, open.height, open.channels, TypeDesc::FLOAT);
+    spec.channelnames = channel_names;
+    Image *image = new Image(spec, "render-view:" + name);
+    connection->image = image;
+    emit this->imageStarted(image);
+    return true;
+}
+
+
+void RenderServer::flush(Connection *connection, std::vector<ROI> &regions) {
+    if (!regions.empty() && connection->image) {
+        emit this->regionsChanged(connection->image, regions);
+    }
+    regions.clear();
+}
+
+
+void RenderServer::unmap(Connection *connection) {
+    if (connection->frame) {
+        munmap(const_cast<float*>(connection->frame), connection->frame_bytes);
+        connection->frame = nullptr;
+        connection->frame_bytes = 0;
+    }
+}
+
+
+void RenderServer::drop(Connection *connection) {
+    this->unmap(connection);
+
+    // Taken off first, aborting says it disconnected right away.
+    QLocalSocket *socket = connection->socket;
+    socket->disconnect(this);
+    socket->abort();
+    socket->deleteLater();
+
+    auto found = std::find_if(this->connections.begin(), this->connections.end(), [connection](const auto &c) {
+        return c.get() == connection;
+    });
+    if (found != this->connections.end()) {
+        this->connections.erase(found);
+    }
+}
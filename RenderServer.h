@@ -0,0 +1,61 @@
+#ifndef RENDERSERVER_H
+#define RENDERSERVER_H
+
+#include <QObject>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QPointer>
+#include <QString>
+#include <memory>
+#include <vector>
+#include "Image.h"
+#include "RenderViewProtocol.h"
+
+/*
+ * The render view, a renderer streams its buckets straight into the viewer while it renders.
+ *
+ * Renderers connect to a Unix domain socket, see RenderViewProtocol.h. The frame they render into
+ * is a shared memory segment that's mapped here as well, so a bucket is only a rectangle: its
+ * pixels are copied from the segment into the Image once and go from there through the display
+ * path, nothing touches the disk. Buckets that come in together are handed over together.
+ */
+class RenderServer : public QObject {
+    Q_OBJECT
+
+    public:
+        explicit RenderServer(QObject *parent = nullptr);
+        ~RenderServer();
+        // $EXRAY_RENDER_VIEW, or exray-render-view in the temp directory.
+        static QString defaultPath();
+        bool listen(const QString& path = defaultPath());
+        void close();
+        bool isListening() const;
+        QString path() const;
+
+    signals:
+        // A new image to show, whoever shows it owns it.
+        void imageStarted(Image* image);
+        void regionsChanged(Image* image, const std::vector<ROI>& regions);
+        void imageFinished(Image* image);
+
+    private:
+        struct Connection {
+            QLocalSocket* socket = nullptr;
+            QByteArray buffer;
+            QPointer<Image> image;
+            const float* frame = nullptr;
+            size_t frame_bytes = 0;
+        };
+        QLocalServer server;
+        std::vector<std::unique_ptr<Connection>> connections;
+        void accept();
+        void read(Connection* connection);
+        bool handle(Connection* connection, RenderViewProtocol::Type type, const char* payload, size_t size,
+                    std::vector<ROI>& regions);
+        bool open(Connection* connection, const char* payload, size_t size);
+        void flush(Connection* connection, std::vector<ROI>& regions);
+        void unmap(Connection* connection);
+        void drop(Connection* connection);
+};
+
+#endif //RENDERSERVER_H
@@ -0,0 +1,54 @@
+#ifndef RENDERVIEWPROTOCOL_H
+#define RENDERVIEWPROTOCOL_H
+
+#include <cstdint>
+
+/*
+ * What a renderer sends to the render view, kept free of Qt so it can be included on the renderer side.
+ *
+ * Messages go over a Unix domain socket, a Header followed by size bytes of payload, in the byte
+ * order of the machine. The pixels don't go over the socket: the renderer puts the whole frame in a
+ * POSIX shared memory segment, width * height * channels floats interleaved, and only says which
+ * rectangle and channels of it are done.
+ *
+ *   Open    Open, then the name of the image, the names of the channels and the name of the shared
+ *           memory segment, each as a uint32_t length followed by that many bytes of UTF-8.
+ *   Bucket  Bucket, a rectangle and channel range of the frame that's been written.
+ *   Close   Nothing, the frame is done. The image stays in the viewer.
+ *
+ * A connection shows one image at a time, Open again for the next frame. The viewer maps the
+ * segment when it reads Open, a renderer that shuts down its end of the socket and waits for the
+ * viewer to hang up knows it's safe to unlink the segment.
+ */
+namespace RenderViewProtocol {
+    constexpr uint32_t magic = 0x56525845; // "EXRV"
+    constexpr uint32_t version = 1;
+    // Anything bigger is a broken client, not a big image.
+    constexpr uint32_t max_message = 1 << 20;
+
+    enum class Type : uint32_t { Open = 1, Bucket = 2, Close = 3 };
+
+    struct Header {
+        uint32_t magic;
+        uint32_t type;
+        uint32_t size;
+    };
+
+    struct Open {
+        uint32_t version;
+        int32_t width;
+        int32_t height;
+        int32_t channels;
+    };
+
+    struct Bucket {
+        int32_t xbegin;
+        int32_t xend;
+        int32_t ybegin;
+        int32_t yend;
+        int32_t chbegin;
+        int32_t chend;
+    };
+}
+
+#endif //RENDERVIEWPROTOCOL_H
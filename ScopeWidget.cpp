@@ -0,0 +1,196 @@
+#include "ScopeWidget.h"
+#include <QImage>
+#include <QMenu>
+#include <QPainterPath>
+#include <algorithm>
+#include <cmath>
+
+
+// Counts span several orders of magnitude, so every scope is drawn on a log scale.
+static inline float logScale(uint32_t count, float logMax) {
+    return logMax > 0.0f ? std::log1p(float(count)) / logMax : 0.0f;
+}
+
+
+ScopeWidget::ScopeWidget(Mode mode, QWidget *parent): QWidget(parent), mode(mode) {
+    this->setMinimumSize(160, 120);
+    this->setAttribute(Qt::WA_OpaquePaintEvent);
+}
+
+
+void ScopeWidget::setResult(const Scopes::Result* result) {
+    this->result = result;
+    this->update();
+}
+
+
+QSize ScopeWidget::sizeHint() const {
+    return this->mode == Mode::Vectorscope ? QSize(256, 256) : QSize(320, 200);
+}
+
+
+void ScopeWidget::paintEvent(QPaintEvent *event) {
+    QPainter painter(this);
+    painter.fillRect(this->rect(), QColor(20, 20, 20));
+
+    if (!this->result || this->result->samples == 0) {
+        return;
+    }
+
+    switch (this->mode) {
+        case Mode::Histogram:
+            this->paintHistogram(painter);
+            break;
+        case Mode::Waveform:
+            this->paintWaveform(painter);
+            break;
+        case Mode::Vectorscope:
+            this->paintVectorscope(painter);
+            break;
+    }
+}
+
+
+void ScopeWidget::contextMenuEvent(QContextMenuEvent *event) {
+    if (this->mode != Mode::Waveform) {
+        return;
+    }
+
+    QMenu menu(this);
+
+    QAction *luma = menu.addAction("Luma", this, [this]() {
+        this->luma_only = true;
+        this->update();
+    });
+    luma->setCheckable(true);
+    luma->setChecked(this->luma_only);
+
+    QAction *rgb = menu.addAction("RGB", this, [this]() {
+        this->luma_only = false;
+        this->update();
+    });
+    rgb->setCheckable(true);
+    rgb->setChecked(!this->luma_only);
+
+    menu.exec(event->globalPos());
+}
+
+
+void ScopeWidget::paintHistogram(QPainter &painter) {
+    const int bins = Scopes::bins;
+    const QColor colors[Scopes::PlaneCount] = {
+        QColor(255, 60, 60, 160), QColor(60, 255, 60, 160), QColor(60, 120, 255, 160), QColor(220, 220, 220, 200)
+    };
+
+    painter.setRenderHint(QPainter::Antialiasing);
+    painter.setCompositionMode(QPainter::CompositionMode_Plus);
+
+    float width = this->width();
+    float height = this->height();
+
+    for (int p = 0; p < Scopes::PlaneCount; ++p) {
+        const uint32_t *counts = &this->result->histogram[p * bins];
+        uint32_t max = *std::max_element(counts, counts + bins);
+        float logMax = std::log1p(float(max));
+
+        QPainterPath path(QPointF(0, height));
+        for (int i = 0; i < bins; ++i) {
+            float x = (i + 0.5f) * width / bins;
+            path.lineTo(x, height - logScale(counts[i], logMax) * height);
+        }
+        path.lineTo(width, height);
+        path.closeSubpath();
+
+        QColor fill = colors[p];
+        fill.setAlpha(60);
+        painter.fillPath(path, fill);
+        painter.setPen(colors[p]);
+        painter.drawPath(path);
+    }
+}
+
+
+void ScopeWidget::paintWaveform(QPainter &painter) {
+    const int bins = Scopes::bins;
+    const int columns = Scopes::waveform_columns;
+    const Scopes::Result &data = *this->result;
+
+    if (data.image_width <= 0 || data.roi.isEmpty()) {
+        return;
+    }
+
+    // Only the columns that fall inside the region are shown.
+    int first = int(int64_t(data.roi.left()) * columns / data.image_width);
+    int last = int(int64_t(data.roi.left() + data.roi.width() - 1) * columns / data.image_width);
+    int count = last - first + 1;
+
+    float logMax[Scopes::PlaneCount];
+    for (int p = 0; p < Scopes::PlaneCount; ++p) {
+        auto begin = data.waveform.begin() + size_t(p) * columns * bins;
+        logMax[p] = std::log1p(float(*std::max_element(begin + size_t(first) * bins, begin + size_t(last + 1) * bins)));
+    }
+
+    QImage image(count, bins, QImage::Format_RGB32);
+
+    for (int row = 0; row < bins; ++row) {
+        QRgb *line = reinterpret_cast<QRgb *>(image.scanLine(row));
+        int bin = bins - 1 - row;
+
+        for (int i = 0; i < count; ++i) {
+            size_t cell = size_t(first + i) * bins + bin;
+
+            if (this->luma_only) {
+                size_t plane = size_t(Scopes::Luma) * columns * bins;
+                int value = int(logScale(data.waveform[plane + cell], logMax[Scopes::Luma]) * 255.0f);
+                line[i] = qRgb(value, value, value);
+            } else {
+                int rgb[3];
+                for (int p = 0; p < 3; ++p) {
+                    size_t plane = size_t(p) * columns * bins;
+                    rgb[p] = int(logScale(data.waveform[plane + cell], logMax[p]) * 255.0f);
+                }
+                line[i] = qRgb(rgb[0], rgb[1], rgb[2]);
+            }
+        }
+    }
+
+    painter.setRenderHint(QPainter::SmoothPixmapTransform);
+    painter.drawImage(this->rect(), image);
+
+    // Graticule at the quarter marks.
+    painter.setPen(QColor(255, 255, 255, 40));
+    for (int i = 1; i < 4; ++i) {
+        int y = this->height() * i / 4;
+        painter.drawLine(0, y, this->width(), y);
+    }
+}
+
+
+void ScopeWidget::paintVectorscope(QPainter &painter) {
+    const int size = Scopes::vectorscope_size;
+    const uint32_t *counts = this->result->vectorscope.data();
+
+    float logMax = std::log1p(float(*std::max_element(counts, counts + size * size)));
+
+    QImage image(size, size, QImage::Format_RGB32);
+    for (int y = 0; y < size; ++y) {
+        QRgb *line = reinterpret_cast<QRgb *>(image.scanLine(y));
+        for (int x = 0; x < size; ++x) {
+            int value = int(logScale(counts[y * size + x], logMax) * 255.0f);
+            line[x] = qRgb(value / 2, value, value / 2);
+        }
+    }
+
+    // Keep the scope square and centered.
+    int side = std::min(this->width(), this->height());
+    QRect target((this->width() - side) / 2, (this->height() - side) / 2, side, side);
+
+    painter.setRenderHint(QPainter::SmoothPixmapTransform);
+    painter.drawImage(target, image);
+
+    painter.setRenderHint(QPainter::Antialiasing);
+    painter.setPen(QColor(255, 255, 255, 60));
+    painter.drawEllipse(target);
+    painter.drawLine(target.center().x(), target.top(), target.center().x(), target.bottom());
+    painter.drawLine(target.left(), target.center().y(), target.right(), target.center().y());
+}
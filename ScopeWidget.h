@@ -0,0 +1,33 @@
+#ifndef SCOPEWIDGET_H
+#define SCOPEWIDGET_H
+
+#include <QWidget>
+#include <QPainter>
+#include <QPaintEvent>
+#include <QContextMenuEvent>
+#include <QSize>
+#include "Scopes.h"
+
+class ScopeWidget : public QWidget {
+    Q_OBJECT
+
+    public:
+        enum class Mode { Histogram, Waveform, Vectorscope };
+        explicit ScopeWidget(Mode mode, QWidget *parent = nullptr);
+        void setResult(const Scopes::Result* result);
+        QSize sizeHint() const override;
+
+    protected:
+        void paintEvent(QPaintEvent *event) override;
+        void contextMenuEvent(QContextMenuEvent *event) override;
+
+    private:
+        Mode mode;
+        bool luma_only = true;
+        const Scopes::Result* result = nullptr;
+        void paintHistogram(QPainter& painter);
+        void paintWaveform(QPainter& painter);
+        void paintVectorscope(QPainter& painter);
+};
+
+#endif //SCOPEWIDGET_H
@@ -0,0 +1,272 @@
+#include "Scopes.h"
+#include <algorithm>
+#include <cmath>
+#include "TaskScheduler.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+
+// Smallest value that still gets its own stop on the logarithmic scale.
+static constexpr float min_log_value = 1.0f / 65536.0f;
+static constexpr float stop_scale = Scopes::bins / (Scopes::max_stop - Scopes::min_stop);
+
+
+#if defined(__SSE2__)
+// log2 from the float exponent plus a quadratic on the mantissa, within about 0.005 stops.
+static inline __m128 log2Approx(__m128 x) {
+    __m128i bits = _mm_castps_si128(x);
+    __m128 exponent = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srli_epi32(bits, 23), _mm_set1_epi32(127)));
+    __m128 mantissa = _mm_castsi128_ps(_mm_or_si128(_mm_and_si128(bits, _mm_set1_epi32(0x007FFFFF)),
+                                                    _mm_set1_epi32(0x3F800000)));
+
+    __m128 poly = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(-0.34484843f), mantissa), _mm_set1_ps(2.02466578f));
+    poly = _mm_sub_ps(_mm_mul_ps(poly, mantissa), _mm_set1_ps(1.67487759f));
+
+    return _mm_add_ps(exponent, poly);
+}
+#endif
+
+
+// Bin the red, green, blue and luma value of a pixel in one go.
+static inline void binPixel(float r, float g, float b, float luma, bool logarithmic, int* index) {
+#if defined(__SSE2__)
+    __m128 values = _mm_set_ps(luma, b, g, r);
+    __m128 position;
+
+    if (logarithmic) {
+        // max() puts NaN and non-positive values in the lowest bin.
+        __m128 stops = log2Approx(_mm_max_ps(values, _mm_set1_ps(min_log_value)));
+        position = _mm_mul_ps(_mm_sub_ps(stops, _mm_set1_ps(Scopes::min_stop)), _mm_set1_ps(stop_scale));
+    } else {
+        position = _mm_mul_ps(values, _mm_set1_ps(float(Scopes::bins)));
+    }
+
+    position = _mm_min_ps(_mm_max_ps(position, _mm_setzero_ps()), _mm_set1_ps(float(Scopes::bins - 1)));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(index), _mm_cvttps_epi32(position));
+#else
+    float values[4] = {r, g, b, luma};
+
+    for (int p = 0; p < 4; ++p) {
+        float position;
+        if (logarithmic) {
+            float value = values[p] > min_log_value ? values[p] : min_log_value;
+            position = (std::log2(value) - Scopes::min_stop) * stop_scale;
+        } else {
+            position = values[p] * Scopes::bins;
+        }
+        index[p] = position > 0.0f ? (position < Scopes::bins - 1 ? int(position) : Scopes::bins - 1) : 0;
+    }
+#endif
+}
+
+
+static inline float clampUnit(float value) {
+    // Written as comparisons so NaN ends up at 0.
+    return value > 0.0f ? (value < 1.0f ? value : 1.0f) : 0.0f;
+}
+
+
+Scopes::Scopes() {
+    this->reset();
+}
+
+
+void Scopes::setData(const Image::ChannelData* channelData, Source source) {
+    this->data = channelData;
+    this->current.source = source;
+    this->current.image_width = channelData ? channelData->width : 0;
+    this->valid = false;
+}
+
+
+void Scopes::setSampling(int step) {
+    if (step < 1 || step == this->sample_step) {
+        return;
+    }
+
+    this->sample_step = step;
+    this->valid = false;
+}
+
+
+int Scopes::sampling() const {
+    return this->sample_step;
+}
+
+
+const Scopes::Result& Scopes::result() const {
+    return this->current;
+}
+
+
+void Scopes::reset() {
+    this->current.histogram.assign(PlaneCount * bins, 0);
+    this->current.waveform.assign(size_t(PlaneCount) * waveform_columns * bins, 0);
+    this->current.vectorscope.assign(vectorscope_size * vectorscope_size, 0);
+    this->current.samples = 0;
+    this->current.roi = QRect();
+}
+
+
+const Scopes::Result& Scopes::update(const QRect& roi) {
+    if (!this->data || this->data->data.empty()) {
+        this->reset();
+        return this->current;
+    }
+
+    QRect bounds = roi.normalized().intersected(QRect(0, 0, this->data->width, this->data->height));
+
+    if (this->valid && bounds == this->current.roi) {
+        return this->current;
+    }
+
+    // Only go incremental when the pixels that changed are fewer than the pixels in view.
+    QRect overlap = bounds.intersected(this->current.roi);
+    qint64 overlap_area = qint64(overlap.width()) * overlap.height();
+    qint64 changed_area = qint64(this->current.roi.width()) * this->current.roi.height() - overlap_area
+                        + qint64(bounds.width()) * bounds.height() - overlap_area;
+
+    if (this->valid && !overlap.isEmpty() && changed_area < qint64(bounds.width()) * bounds.height()) {
+        for (const QRect& rect: Scopes::subtract(this->current.roi, bounds)) {
+            this->accumulate(rect, true);
+        }
+        for (const QRect& rect: Scopes::subtract(bounds, this->current.roi)) {
+            this->accumulate(rect, false);
+        }
+    } else {
+        this->reset();
+        this->accumulate(bounds, false);
+    }
+
+    this->current.roi = bounds;
+    this->valid = true;
+
+    return this->current;
+}
+
+
+void Scopes::accumulate(const QRect& rect, bool remove) {
+    if (rect.isEmpty()) {
+        return;
+    }
+
+    const int step = this->sample_step;
+    const int width = this->data->width;
+    const int channels = this->data->channels;
+    const bool logarithmic = this->current.source == Source::Scene;
+    const float* pixels = this->data->data.data();
+
+    // Samples sit on a grid anchored at the image origin, so added and removed regions agree.
+    int x_first = ((rect.left() + step - 1) / step) * step;
+    int y_first = ((rect.top() + step - 1) / step) * step;
+    int x_end = rect.left() + rect.width();
+    int y_end = rect.top() + rect.height();
+
+    if (x_first >= x_end || y_first >= y_end) {
+        return;
+    }
+
+    int rows = (y_end - y_first + step - 1) / step;
+    int max_tasks = TaskScheduler::instance().threadCount();
+    int tasks = std::clamp(rows / 16, 1, max_tasks);
+
+    // Every task counts into its own partial result, which are merged afterwards.
+    std::vector<Result> partials(tasks);
+
+    TaskScheduler::parallelFor(0, tasks, [&](int64_t t) {
+        Result& partial = partials[t];
+        partial.histogram.assign(PlaneCount * bins, 0);
+        partial.waveform.assign(size_t(PlaneCount) * waveform_columns * bins, 0);
+        partial.vectorscope.assign(vectorscope_size * vectorscope_size, 0);
+
+        int row_begin = int(int64_t(rows) * t / tasks);
+        int row_end = int(int64_t(rows) * (t + 1) / tasks);
+
+        for (int row = row_begin; row < row_end; ++row) {
+            int y = y_first + row * step;
+            const float* line = pixels + size_t(y) * width * channels;
+
+            for (int x = x_first; x < x_end; x += step) {
+                const float* pixel = line + size_t(x) * channels;
+                float r = pixel[0];
+                float g = channels >= 3 ? pixel[1] : r;
+                float b = channels >= 3 ? pixel[2] : r;
+                float luma = 0.2126f * r + 0.7152f * g + 0.0722f * b;
+
+                int index[4];
+                binPixel(r, g, b, luma, logarithmic, index);
+
+                int column = int(int64_t(x) * waveform_columns / width);
+                for (int p = 0; p < PlaneCount; ++p) {
+                    partial.histogram[p * bins + index[p]]++;
+                    partial.waveform[(size_t(p) * waveform_columns + column) * bins + index[p]]++;
+                }
+
+                // Rec.709 chroma of the clamped color.
+                float cr = clampUnit(r);
+                float cg = clampUnit(g);
+                float cb = clampUnit(b);
+                float y709 = 0.2126f * cr + 0.7152f * cg + 0.0722f * cb;
+                float u = (cb - y709) / 1.8556f;
+                float v = (cr - y709) / 1.5748f;
+                int vx = std::clamp(int((u + 0.5f) * vectorscope_size), 0, vectorscope_size - 1);
+                int vy = std::clamp(int((0.5f - v) * vectorscope_size), 0, vectorscope_size - 1);
+                partial.vectorscope[vy * vectorscope_size + vx]++;
+
+                partial.samples++;
+            }
+        }
+    });
+
+    // Merge the partials, counts are unsigned so removing simply wraps back.
+    for (const Result& partial: partials) {
+        for (size_t i = 0; i < partial.histogram.size(); ++i) {
+            this->current.histogram[i] += remove ? -partial.histogram[i] : partial.histogram[i];
+        }
+        for (size_t i = 0; i < partial.waveform.size(); ++i) {
+            this->current.waveform[i] += remove ? -partial.waveform[i] : partial.waveform[i];
+        }
+        for (size_t i = 0; i < partial.vectorscope.size(); ++i) {
+            this->current.vectorscope[i] += remove ? -partial.vectorscope[i] : partial.vectorscope[i];
+        }
+        this->current.samples += remove ? -partial.samples : partial.samples;
+    }
+}
+
+
+QList<QRect> Scopes::subtract(const QRect& rect, const QRect& other) {
+    QList<QRect> result;
+    QRect overlap = rect.intersected(other);
+
+    if (overlap.isEmpty()) {
+        if (!rect.isEmpty()) {
+            result.append(rect);
+        }
+        return result;
+    }
+
+    int left = rect.left();
+    int right = rect.left() + rect.width();
+    int top = rect.top();
+    int bottom = rect.top() + rect.height();
+    int overlap_right = overlap.left() + overlap.width();
+    int overlap_bottom = overlap.top() + overlap.height();
+
+    // Full width bands above and below the overlap, then the pieces left and right of it.
+    if (overlap.top() > top) {
+        result.append(QRect(left, top, right - left, overlap.top() - top));
+    }
+    if (overlap_bottom < bottom) {
+        result.append(QRect(left, overlap_bottom, right - left, bottom - overlap_bottom));
+    }
+    if (overlap.left() > left) {
+        result.append(QRect(left, overlap.top(), overlap.left() - left, overlap.height()));
+    }
+    if (overlap_right < right) {
+        result.append(QRect(overlap_right, overlap.top(), right - overlap_right, overlap.height()));
+    }
+
+    return result;
+}
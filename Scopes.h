@@ -0,0 +1,52 @@
+#ifndef SCOPES_H
+#define SCOPES_H
+
+#include <QRect>
+#include <QList>
+#include <cstdint>
+#include <vector>
+#include "Image.h"
+
+/*
+ * Histogram, waveform and vectorscope counts for a region of a layer.
+ *
+ * All three scopes are plain counts, so moving the region only adds the pixels that came into
+ * view and subtracts the ones that left it instead of starting over. Waveform columns are
+ * mapped from image coordinates for the same reason.
+ */
+class Scopes {
+    public:
+        enum class Source { Scene, Display };
+        enum Plane { Red = 0, Green, Blue, Luma, PlaneCount };
+        static constexpr int bins = 256;
+        static constexpr int waveform_columns = 256;
+        static constexpr int vectorscope_size = 256;
+        static constexpr float min_stop = -10.0f;
+        static constexpr float max_stop = 6.0f;
+        struct Result {
+            std::vector<uint32_t> histogram;
+            std::vector<uint32_t> waveform;
+            std::vector<uint32_t> vectorscope;
+            uint32_t samples = 0;
+            QRect roi;
+            int image_width = 0;
+            Source source = Source::Display;
+        };
+        Scopes();
+        void setData(const Image::ChannelData* channelData, Source source);
+        void setSampling(int step);
+        int sampling() const;
+        const Result& update(const QRect& roi);
+        const Result& result() const;
+        static QList<QRect> subtract(const QRect& rect, const QRect& other);
+
+    private:
+        const Image::ChannelData* data = nullptr;
+        int sample_step = 1;
+        bool valid = false;
+        Result current;
+        void reset();
+        void accumulate(const QRect& rect, bool remove);
+};
+
+#endif //SCOPES_H
@@ -0,0 +1,155 @@
+#include "Session.h"
+#include <QApplication>
+#include <QDebug>
+#include <QFileInfo>
+#include <algorithm>
+
+
+Session::Session(QObject *parent): QObject(parent) {
+    // Parsing the ocio config takes a while, it happens on the side while the window comes up.
+    // Its own thread rather than the scheduler, opens wait for it on a worker and would hold up the one running it.
+    this->color_manager_loaded = std::async(std::launch::async, []() -> ColorManager * {
+        try {
+            ColorManager *colorManager = new ColorManager();
+            colorManager->moveToThread(qApp->thread());
+            return colorManager;
+        } catch (const std::exception &error) {
+            // Images still open without it, they just don't show.
+            qDebug() << "Can't load the color config:" << error.what();
+            return nullptr;
+        }
+    }).share();
+}
+
+
+Session::~Session() {
+    delete this->color_manager_loaded.get();
+}
+
+
+std::shared_future<ColorManager *> Session::colorManagerLoaded() const {
+    return this->color_manager_loaded;
+}
+
+
+QStringList Session::files() const {
+    return this->file_list;
+}
+
+
+int Session::currentIndex() const {
+    return this->current_index;
+}
+
+
+QString Session::currentFile() const {
+    return this->file_list.value(this->current_index);
+}
+
+
+int Session::add(const QStringList &files) {
+    // Index of the first of them, files that are already open aren't added twice.
+    int first = -1;
+
+    for (const QString &file: files) {
+        QString path = QFileInfo(file).absoluteFilePath();
+        int index = this->file_list.indexOf(path);
+
+        if (index < 0) {
+            this->file_list.append(path);
+            index = this->file_list.size() - 1;
+        }
+
+        if (first < 0) {
+            first = index;
+        }
+    }
+
+    emit filesChanged();
+    return first;
+}
+
+
+void Session::remove(int index) {
+    if (index < 0 || index >= this->file_list.size()) {
+        return;
+    }
+
+    QString filename = this->file_list.takeAt(index);
+    this->warm.removeIf([&](const Warm &entry) {
+        return entry.filename == filename;
+    });
+    emit filesChanged();
+
+    // The next file takes the place of a removed current one.
+    if (index == this->current_index) {
+        this->current_index = -1;
+        this->setCurrent(std::min<int>(index, this->file_list.size() - 1));
+    } else if (index < this->current_index) {
+        this->current_index--;
+    }
+}
+
+
+void Session::setCurrent(int index) {
+    if (index < 0 || index >= this->file_list.size() || index == this->current_index) {
+        return;
+    }
+
+    this->current_index = index;
+    emit currentChanged(this->file_list[index]);
+}
+
+
+void Session::storePreview(const QString &filename, const QString &layer, const QImage &image) {
+    this->warm.removeIf([&](const Warm &entry) {
+        return entry.filename == filename;
+    });
+
+    // A full frame each would hold gigabytes outside the decode cache budget.
+    QImage preview = image;
+    if (image.width() > warm_width || image.height() > warm_height) {
+        preview = image.scaled(warm_width, warm_height, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    }
+    this->warm.prepend({filename, layer, preview, image.size()});
+    while (this->warm.size() > warm_previews) {
+        this->warm.removeLast();
+    }
+}
+
+
+QImage Session::preview(const QString &filename, QSize &size) const {
+    for (const Warm &entry: this->warm) {
+        if (entry.filename == filename) {
+            size = entry.size;
+            return entry.image;
+        }
+    }
+    return QImage();
+}
+
+
+QString Session::lastLayer(const QString &filename) const {
+    for (const Warm &entry: this->warm) {
+        if (entry.filename == filename) {
+            return entry.layer;
+        }
+    }
+    return QString();
+}
+
+
+void Session::addVirtualLayer(const QString &name, const QString &expression) {
+    for (auto &layer: this->virtual_layers) {
+        if (layer.first == name) {
+            layer.second = expression;
+            return;
+        }
+    }
+    this->virtual_layers.append({name, expression});
+}
+
+
+QList<QPair<QString, QString>> Session::virtualLayers() const {
+    return this->virtual_layers;
+}
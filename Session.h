@@ -0,0 +1,68 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <QObject>
+#include <QImage>
+#include <QSize>
+#include <QList>
+#include <QPair>
+#include <QString>
+#include <QStringList>
+#include <future>
+#include "ColorManager.h"
+
+/*
+ * The files open in the viewer.
+ *
+ * What's expensive to make is shared by all of them: one OCIO config with its processor cache,
+ * the decode cache with its memory budget, and the global thread pool everything runs on. The
+ * display images of the last warm_previews files are kept scaled down to preview size, so
+ * switching back shows a file right away while its full frame is made again in the background.
+ *
+ * Virtual layers belong to the session too, every file that has the layers they use gets them.
+ */
+class Session : public QObject {
+    Q_OBJECT
+
+    public:
+        static constexpr int warm_previews = 8;
+        // As big as the previews made while a file opens.
+        static constexpr int warm_width = 960;
+        static constexpr int warm_height = 540;
+        explicit Session(QObject *parent = nullptr);
+        ~Session();
+        std::shared_future<ColorManager*> colorManagerLoaded() const;
+        QStringList files() const;
+        int currentIndex() const;
+        QString currentFile() const;
+        int add(const QStringList& files);
+        void remove(int index);
+        void setCurrent(int index);
+        void storePreview(const QString& filename, const QString& layer, const QImage& image);
+        // Scaled down, size is that of the frame it was made from.
+        QImage preview(const QString& filename, QSize& size) const;
+        QString lastLayer(const QString& filename) const;
+        void addVirtualLayer(const QString& name, const QString& expression);
+        QList<QPair<QString, QString>> virtualLayers() const;
+
+    signals:
+        void filesChanged();
+        void currentChanged(const QString& filename);
+
+    private:
+        struct Warm {
+            QString filename;
+            QString layer;
+            QImage image;
+            QSize size;
+        };
+        std::shared_future<ColorManager*> color_manager_loaded;
+        QStringList file_list;
+        int current_index = -1;
+        // Most recently shown first.
+        QList<Warm> warm;
+        // Names and expressions, in the order they were made.
+        QList<QPair<QString, QString>> virtual_layers;
+};
+
+#endif //SESSION_H
@@ -0,0 +1,166 @@
+#include "ShotBrowser.h"
+#include <QAbstractTableModel>
+#include <QFileDialog>
+#include <QFileInfo>
+#include <QHBoxLayout>
+#include <QHeaderView>
+#include <QPushButton>
+#include <QVBoxLayout>
+#include <vector>
+
+
+// The rows of the index that match the filter, nothing is copied out of it.
+class ShotModel : public QAbstractTableModel {
+    public:
+        enum Column { File, Resolution, Layers, Compression, Type, DataWindow, Columns };
+
+        ShotModel(ShotIndex* index, QObject* parent): QAbstractTableModel(parent), index(index) {
+        }
+
+        void setRows(std::vector<int> rows) {
+            this->beginResetModel();
+            this->rows = std::move(rows);
+            this->endResetModel();
+        }
+
+        const ShotIndex::Entry& entry(int row) const {
+            return this->index->entries()[this->rows[row]];
+        }
+
+        int rowCount(const QModelIndex& parent = QModelIndex()) const override {
+            return parent.isValid() ? 0 : int(this->rows.size());
+        }
+
+        int columnCount(const QModelIndex& parent = QModelIndex()) const override {
+            return parent.isValid() ? 0 : Columns;
+        }
+
+        QVariant headerData(int section, Qt::Orientation orientation, int role) const override {
+            static const char* names[Columns] = {"File", "Resolution", "Layers", "Compression", "Type", "Data Window"};
+            if (orientation != Qt::Horizontal || role != Qt::DisplayRole || section < 0 || section >= Columns) {
+                return QVariant();
+            }
+            return QString(names[section]);
+        }
+
+        QVariant data(const QModelIndex& index, int role) const override {
+            if (!index.isValid() || index.row() >= int(this->rows.size())) {
+                return QVariant();
+            }
+
+            const ShotIndex::Entry& entry = this->entry(index.row());
+            if (role == Qt::ToolTipRole) {
+                if (!entry.error.isEmpty()) {
+                    return entry.path + "\n" + entry.error;
+                }
+                return entry.path + "\n" + entry.layers.join(", ");
+            }
+            if (role != Qt::DisplayRole) {
+                return QVariant();
+            }
+
+            const QRect& window = entry.data_window;
+            switch (index.column()) {
+                case File:
+                    return QFileInfo(entry.path).fileName();
+                case Resolution:
+                    return QString("%1 x %2").arg(entry.display_window.width()).arg(entry.display_window.height());
+                case Layers:
+                    return entry.layers.size();
+                case Compression:
+                    return entry.compression;
+                case Type:
+                    return entry.type;
+                case DataWindow:
+                    return QString("%1,%2 %3 x %4").arg(window.x()).arg(window.y()).arg(window.width()).arg(window.height());
+            }
+            return QVariant();
+        }
+
+    private:
+        ShotIndex* index;
+        std::vector<int> rows;
+};
+
+
+ShotBrowser::ShotBrowser(QWidget *parent): QWidget(parent) {
+    this->shot_index = new ShotIndex(this);
+    this->model = new ShotModel(this->shot_index, this);
+
+    QPushButton *scanButton = new QPushButton("Scan Folder...", this);
+    QPushButton *rescanButton = new QPushButton("Rescan", this);
+    this->filter_edit = new QLineEdit(this);
+    this->filter_edit->setPlaceholderText("has:cryptomatte has:crop layer:depth compression:dwaa meta:key=value");
+    this->filter_edit->setClearButtonEnabled(true);
+
+    this->table = new QTableView(this);
+    this->table->setModel(this->model);
+    this->table->setSelectionBehavior(QAbstractItemView::SelectRows);
+    this->table->setEditTriggers(QAbstractItemView::NoEditTriggers);
+    this->table->setWordWrap(false);
+    this->table->verticalHeader()->hide();
+    this->table->verticalHeader()->setDefaultSectionSize(this->fontMetrics().height() + 4);
+    this->table->horizontalHeader()->setSectionResizeMode(ShotModel::File, QHeaderView::Stretch);
+
+    this->status_label = new QLabel(this);
+
+    QHBoxLayout *buttons = new QHBoxLayout();
+    buttons->addWidget(scanButton);
+    buttons->addWidget(rescanButton);
+    buttons->addStretch();
+
+    QVBoxLayout *layout = new QVBoxLayout(this);
+    layout->setContentsMargins(4, 4, 4, 4);
+    layout->addLayout(buttons);
+    layout->addWidget(this->filter_edit);
+    layout->addWidget(this->table);
+    layout->addWidget(this->status_label);
+
+    connect(scanButton, &QPushButton::clicked, this, [this]() {
+        QString directory = QFileDialog::getExistingDirectory(this, "Scan Folder", this->shot_index->root());
+        if (!directory.isEmpty()) {
+            this->shot_index->scan(directory);
+        }
+    });
+    connect(rescanButton, &QPushButton::clicked, this, [this]() {
+        if (!this->shot_index->root().isEmpty()) {
+            this->shot_index->scan(this->shot_index->root());
+        }
+    });
+
+    connect(this->filter_edit, &QLineEdit::textChanged, this, &ShotBrowser::applyFilter);
+    connect(this->shot_index, &ShotIndex::entriesChanged, this, &ShotBrowser::applyFilter);
+    connect(this->shot_index, &ShotIndex::progress, this, [this](int done, int total) {
+        this->scan_status = QString("reading headers %1 / %2").arg(done).arg(total);
+        this->showStatus();
+    });
+    connect(this->shot_index, &ShotIndex::finished, this, [this](int opened, int reused, double ms) {
+        this->scan_status = QString("%1 read, %2 unchanged in %3 s").arg(opened).arg(reused).arg(ms / 1000.0, 0, 'f', 2);
+        this->showStatus();
+    });
+
+    connect(this->table, &QTableView::activated, this, [this](const QModelIndex &index) {
+        emit fileActivated(this->model->entry(index.row()).path);
+    });
+}
+
+
+ShotIndex *ShotBrowser::index() const {
+    return this->shot_index;
+}
+
+
+void ShotBrowser::applyFilter() {
+    this->model->setRows(this->shot_index->find(this->filter_edit->text()));
+    this->showStatus();
+}
+
+
+void ShotBrowser::showStatus() {
+    QString status = QString("%1 of %2 files").arg(this->model->rowCount())
+            .arg(this->shot_index->entries().size());
+    if (!this->scan_status.isEmpty()) {
+        status += ", " + this->scan_status;
+    }
+    this->status_label->setText(status);
+}
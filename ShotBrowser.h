@@ -0,0 +1,40 @@
+#ifndef SHOTBROWSER_H
+#define SHOTBROWSER_H
+
+#include <QWidget>
+#include <QLabel>
+#include <QLineEdit>
+#include <QString>
+#include <QTableView>
+#include "ShotIndex.h"
+
+class ShotModel;
+
+/*
+ * The EXRs below a folder in a table, narrowed down as a filter is typed.
+ *
+ * Everything shown comes from the shot index, see ShotIndex for what a filter can ask for. Filtering
+ * runs over the index in memory on every key press, the table only holds the rows that match.
+ */
+class ShotBrowser : public QWidget {
+    Q_OBJECT
+
+    public:
+        explicit ShotBrowser(QWidget *parent = nullptr);
+        ShotIndex* index() const;
+
+    signals:
+        void fileActivated(const QString& filename);
+
+    private:
+        ShotIndex* shot_index;
+        ShotModel* model;
+        QLineEdit* filter_edit;
+        QTableView* table;
+        QLabel* status_label;
+        QString scan_status;
+        void applyFilter();
+        void showStatus();
+};
+
+#endif //SHOTBROWSER_H
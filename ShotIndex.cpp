@@ -0,0 +1,412 @@
+#include "ShotIndex.h"
+#include <QApplication>
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QPointer>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <algorithm>
+#include <OpenImageIO/imageio.h>
+#include "Image.h"
+#include "TaskScheduler.h"
+#include "Trace.h"
+
+
+namespace {
+    constexpr quint32 index_magic = 0x45584958;
+    constexpr quint32 index_version = 1;
+
+
+    void writeEntry(QDataStream& stream, const ShotIndex::Entry& entry) {
+        stream << entry.path << entry.modified << entry.size << entry.error << entry.data_window << entry.display_window
+               << qint32(entry.channels) << qint32(entry.parts) << entry.tiled << entry.deep << entry.compression
+               << entry.type << entry.channel_names << entry.layers << entry.cryptomattes << entry.metadata;
+    }
+
+
+    void readEntry(QDataStream& stream, ShotIndex::Entry& entry) {
+        qint32 channels, parts;
+        stream >> entry.path >> entry.modified >> entry.size >> entry.error >> entry.data_window >> entry.display_window
+               >> channels >> parts >> entry.tiled >> entry.deep >> entry.compression >> entry.type
+               >> entry.channel_names >> entry.layers >> entry.cryptomattes >> entry.metadata;
+        entry.channels = channels;
+        entry.parts = parts;
+    }
+
+
+    bool containsText(const QStringList& list, const QString& text) {
+        return std::any_of(list.begin(), list.end(), [&](const QString& each) {
+            return each.contains(text, Qt::CaseInsensitive);
+        });
+    }
+
+
+    bool has(const ShotIndex::Entry& entry, const QString& what) {
+        if (what == "cryptomatte") {
+            return !entry.cryptomattes.isEmpty();
+        } else if (what == "crop") {
+            return entry.data_window != entry.display_window && entry.display_window.contains(entry.data_window);
+        } else if (what == "overscan") {
+            return !entry.display_window.contains(entry.data_window);
+        } else if (what == "deep") {
+            return entry.deep;
+        } else if (what == "tiles") {
+            return entry.tiled;
+        } else if (what == "parts") {
+            return entry.parts > 1;
+        } else if (what == "error") {
+            return !entry.error.isEmpty();
+        }
+        return false;
+    }
+}
+
+
+ShotIndex::ShotIndex(QObject *parent): QObject(parent) {
+    this->cancelled = std::make_shared<std::atomic<bool>>(false);
+}
+
+
+ShotIndex::~ShotIndex() {
+    *this->cancelled = true;
+}
+
+
+void ShotIndex::scan(const QString &root) {
+    this->cancel();
+
+    // Another folder starts from its own index on disk, the same one from what's shown.
+    const QString path = QDir(root).absolutePath();
+    std::vector<Entry> previous;
+    if (path == this->scan_root) {
+        previous = this->scan_entries;
+    } else {
+        this->scan_root = path;
+        this->scan_entries.clear();
+        emit entriesChanged();
+    }
+
+    auto cancelled = this->cancelled;
+    QPointer<ShotIndex> index(this);
+
+    TaskScheduler::instance().submit([=]() mutable {
+        EXRAY_TRACE_SCOPE("index.scan");
+        if (previous.empty() && load(indexPath(path), path, previous)) {
+            auto loaded = std::make_shared<std::vector<Entry>>(previous);
+            QMetaObject::invokeMethod(qApp, [index, cancelled, loaded]() {
+                if (!index || *cancelled) {
+                    return;
+                }
+                index->scan_entries = std::move(*loaded);
+                emit index->entriesChanged();
+            }, Qt::QueuedConnection);
+        }
+
+        auto scan = std::make_shared<Scan>(scanFolder(path, previous, cancelled, [index, cancelled](int done, int total) {
+            QMetaObject::invokeMethod(qApp, [index, cancelled, done, total]() {
+                if (index && !*cancelled) {
+                    emit index->progress(done, total);
+                }
+            }, Qt::QueuedConnection);
+        }));
+        if (*cancelled) {
+            return;
+        }
+
+        if (scan->opened > 0 || scan->entries.size() != previous.size()) {
+            save(indexPath(path), path, scan->entries);
+        }
+
+        QMetaObject::invokeMethod(qApp, [index, cancelled, scan]() {
+            if (!index || *cancelled) {
+                return;
+            }
+            index->scan_entries = std::move(scan->entries);
+            emit index->entriesChanged();
+            emit index->finished(scan->opened, scan->reused, scan->ms);
+        }, Qt::QueuedConnection);
+    }, TaskScheduler::Priority::Background, cancelled);
+}
+
+
+void ShotIndex::cancel() {
+    *this->cancelled = true;
+    this->cancelled = std::make_shared<std::atomic<bool>>(false);
+}
+
+
+QString ShotIndex::root() const {
+    return this->scan_root;
+}
+
+
+const std::vector<ShotIndex::Entry> &ShotIndex::entries() const {
+    return this->scan_entries;
+}
+
+
+std::vector<int> ShotIndex::find(const QString &filter) const {
+    const Filter parsed = parseFilter(filter);
+
+    std::vector<int> found;
+    for (size_t i = 0; i < this->scan_entries.size(); ++i) {
+        if (parsed.matches(this->scan_entries[i])) {
+            found.push_back(int(i));
+        }
+    }
+    return found;
+}
+
+
+ShotIndex::Filter ShotIndex::parseFilter(const QString &text) {
+    static const QStringList keys = {"has", "layer", "channel", "compression", "type", "meta"};
+
+    Filter filter;
+    for (QString word: text.split(' ', Qt::SkipEmptyParts)) {
+        Filter::Term term;
+        if (word.size() > 1 && word.startsWith('-')) {
+            term.negated = true;
+            word.remove(0, 1);
+        }
+
+        // Anything that isn't one of the keys is part of a path, colons and all.
+        const int colon = word.indexOf(':');
+        if (colon > 0 && keys.contains(word.left(colon).toLower())) {
+            term.key = word.left(colon).toLower();
+            term.value = word.mid(colon + 1);
+        } else {
+            term.value = word;
+        }
+        filter.terms.push_back(term);
+    }
+    return filter;
+}
+
+
+bool ShotIndex::Filter::matches(const Entry &entry) const {
+    for (const Term &term: this->terms) {
+        bool match;
+        if (term.key.isEmpty()) {
+            match = entry.path.contains(term.value, Qt::CaseInsensitive);
+        } else if (term.key == "has") {
+            match = has(entry, term.value.toLower());
+        } else if (term.key == "layer") {
+            match = containsText(entry.layers, term.value);
+        } else if (term.key == "channel") {
+            match = containsText(entry.channel_names, term.value);
+        } else if (term.key == "compression") {
+            // "dwaa:45" is a dwaa.
+            match = entry.compression.startsWith(term.value, Qt::CaseInsensitive);
+        } else if (term.key == "type") {
+            match = entry.type.compare(term.value, Qt::CaseInsensitive) == 0;
+        } else {
+            const int equals = term.value.indexOf('=');
+            const QString key = equals == -1 ? term.value : term.value.left(equals);
+            match = false;
+            for (auto attribute = entry.metadata.begin(); attribute != entry.metadata.end() && !match; ++attribute) {
+                match = attribute.key().contains(key, Qt::CaseInsensitive)
+                        && (equals == -1 || attribute.value().contains(term.value.mid(equals + 1), Qt::CaseInsensitive));
+            }
+        }
+
+        if (match == term.negated) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+ShotIndex::Scan ShotIndex::scanFolder(const QString &root, const std::vector<Entry> &previous,
+                                      const std::shared_ptr<std::atomic<bool>> &cancelled,
+                                      const std::function<void(int, int)> &progress) {
+    const int64_t start = Trace::now();
+    Scan scan;
+
+    QHash<QString, const Entry*> known;
+    for (const Entry &entry: previous) {
+        known.insert(entry.path, &entry);
+    }
+
+    // Listing and a stat per file, that's all an unchanged file costs.
+    std::vector<size_t> changed;
+    {
+        EXRAY_TRACE_SCOPE("index.list");
+        QDirIterator files(root, {"*.exr"}, QDir::Files, QDirIterator::Subdirectories);
+        while (files.hasNext()) {
+            files.next();
+            const QFileInfo info = files.fileInfo();
+            const QString path = info.absoluteFilePath();
+            const qint64 modified = info.lastModified().toMSecsSinceEpoch();
+            const qint64 size = info.size();
+
+            const Entry *entry = known.value(path);
+            if (entry && entry->modified == modified && entry->size == size) {
+                scan.entries.push_back(*entry);
+                scan.reused++;
+            } else {
+                changed.push_back(scan.entries.size());
+                scan.entries.push_back({path, modified, size});
+            }
+        }
+    }
+
+    // Headers of new and changed files, a file a time on every worker.
+    std::atomic<int> done = 0;
+    const int total = int(changed.size());
+    TaskScheduler::parallelFor(0, total, [&](int64_t i) {
+        if (cancelled && *cancelled) {
+            return;
+        }
+
+        Entry &entry = scan.entries[changed[i]];
+        const qint64 modified = entry.modified;
+        const qint64 size = entry.size;
+        entry = readHeader(entry.path);
+        entry.modified = modified;
+        entry.size = size;
+
+        const int count = ++done;
+        if (progress && (count % 64 == 0 || count == total)) {
+            progress(count, total);
+        }
+    });
+
+    scan.opened = total;
+    for (size_t index: changed) {
+        if (!scan.entries[index].error.isEmpty()) {
+            scan.failed++;
+        }
+    }
+
+    std::sort(scan.entries.begin(), scan.entries.end(), [](const Entry &a, const Entry &b) {
+        return a.path < b.path;
+    });
+    scan.ms = double(Trace::now() - start) / 1e6;
+    return scan;
+}
+
+
+ShotIndex::Entry ShotIndex::readHeader(const QString &path) {
+    EXRAY_TRACE_SCOPE("index.header");
+    const QFileInfo info(path);
+    Entry entry;
+    entry.path = path;
+    entry.modified = info.lastModified().toMSecsSinceEpoch();
+    entry.size = info.size();
+
+    // Opening reads the header and the chunk offsets, nothing else.
+    auto input = ImageInput::open(path.toStdString());
+    if (!input) {
+        entry.error = QString::fromStdString(OIIO::geterror());
+        return entry;
+    }
+
+    const ImageSpec &spec = input->spec();
+    entry.data_window = QRect(spec.x, spec.y, spec.width, spec.height);
+    entry.display_window = QRect(spec.full_x, spec.full_y, spec.full_width, spec.full_height);
+    entry.channels = spec.nchannels;
+    entry.parts = spec.get_int_attribute("oiio:subimages", 1);
+    entry.tiled = spec.tile_width > 0;
+    entry.deep = spec.deep;
+    entry.compression = QString::fromStdString(spec.get_string_attribute("compression", "none"));
+
+    for (int channel = 0; channel < spec.nchannels; ++channel) {
+        entry.channel_names.append(QString::fromStdString(spec.channelnames[channel]));
+        const QString type = spec.channelformat(channel).c_str();
+        if (entry.type.isEmpty()) {
+            entry.type = type;
+        } else if (entry.type != type) {
+            entry.type = "mixed";
+        }
+    }
+
+    for (const ParamValue &attribute: spec.extra_attribs) {
+        const std::string name = attribute.name().string();
+        if (name.starts_with("cryptomatte/") && name.ends_with("/name")) {
+            entry.cryptomattes.append(QString::fromStdString(attribute.get_string()));
+        }
+        if (name.ends_with("/manifest")) {
+            continue;
+        }
+
+        QString value = QString::fromStdString(attribute.get_string());
+        if (value.size() > max_metadata_value) {
+            value.truncate(max_metadata_value);
+        }
+        entry.metadata.insert(QString::fromStdString(name), value);
+    }
+
+    entry.layers = Image::layerNames(spec, entry.cryptomattes);
+    return entry;
+}
+
+
+QString ShotIndex::indexPath(const QString &root) {
+    const QString directory = QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/shot-index";
+    const QByteArray hash = QCryptographicHash::hash(QDir(root).absolutePath().toUtf8(), QCryptographicHash::Sha1);
+    return directory + "/" + QString::fromLatin1(hash.toHex()) + ".index";
+}
+
+
+bool ShotIndex::load(const QString &filename, const QString &root, std::vector<Entry> &entries) {
+    EXRAY_TRACE_SCOPE("index.load");
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_6_0);
+    quint32 magic, version, count;
+    QString indexed;
+    stream >> magic >> version;
+    if (magic != index_magic || version != index_version) {
+        qDebug() << "Ignoring index of another version:" << filename;
+        return false;
+    }
+    stream >> indexed >> count;
+    if (stream.status() != QDataStream::Ok || count > quint64(file.size()) || indexed != QDir(root).absolutePath()) {
+        return false;
+    }
+
+    entries.resize(count);
+    for (Entry &entry: entries) {
+        readEntry(stream, entry);
+    }
+
+    if (stream.status() != QDataStream::Ok) {
+        qDebug() << "Failed to read index:" << filename;
+        entries.clear();
+        return false;
+    }
+    return true;
+}
+
+
+bool ShotIndex::save(const QString &filename, const QString &root, const std::vector<Entry> &entries) {
+    EXRAY_TRACE_SCOPE("index.save");
+    QDir().mkpath(QFileInfo(filename).absolutePath());
+
+    // Written aside and moved over, a scan cut short never leaves half an index.
+    QSaveFile file(filename);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qDebug() << "Failed to write index:" << filename;
+        return false;
+    }
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_6_0);
+    stream << index_magic << index_version << QDir(root).absolutePath() << quint32(entries.size());
+    for (const Entry &entry: entries) {
+        writeEntry(stream, entry);
+    }
+    return file.commit();
+}
@@ -0,0 +1,104 @@
+#ifndef SHOTINDEX_H
+#define SHOTINDEX_H
+
+#include <QObject>
+#include <QMap>
+#include <QRect>
+#include <QString>
+#include <QStringList>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <vector>
+
+/*
+ * What's in every EXR below a folder, from the headers alone, to search through.
+ *
+ * A scan lists the folder and only opens the files that are new or changed since the last one, by
+ * modification time and size, the rest are taken from the index as they were. Files are opened on
+ * the scheduler's workers, a header and nothing else, no pixel is read. The index is kept in the
+ * cache directory per folder, so the next start has it without opening anything.
+ *
+ * A filter is words that all have to match: has:cryptomatte, has:crop (data window smaller than
+ * the display window), has:overscan, has:deep, has:tiles, has:parts, layer:NAME, channel:NAME,
+ * compression:NAME, type:half|float|mixed, meta:KEY or meta:KEY=VALUE, anything else is looked for
+ * in the path. A word starting with - has to not match.
+ */
+class ShotIndex : public QObject {
+    Q_OBJECT
+
+    public:
+        // Longer metadata values are cut, a manifest in the header would be most of the index.
+        static constexpr int max_metadata_value = 256;
+        struct Entry {
+            QString path;
+            qint64 modified = 0;
+            qint64 size = 0;
+            // Empty when the header could be read.
+            QString error;
+            QRect data_window;
+            QRect display_window;
+            int channels = 0;
+            int parts = 1;
+            bool tiled = false;
+            bool deep = false;
+            QString compression;
+            QString type;
+            QStringList channel_names;
+            QStringList layers;
+            QStringList cryptomattes;
+            QMap<QString, QString> metadata;
+        };
+        struct Scan {
+            std::vector<Entry> entries;
+            int opened = 0;
+            int reused = 0;
+            int failed = 0;
+            double ms = 0.0;
+        };
+        class Filter {
+            public:
+                bool matches(const Entry& entry) const;
+
+            private:
+                friend class ShotIndex;
+                struct Term {
+                    QString key;
+                    QString value;
+                    bool negated = false;
+                };
+                std::vector<Term> terms;
+        };
+        explicit ShotIndex(QObject *parent = nullptr);
+        ~ShotIndex();
+        // Scans in the background, starting from the index of the last scan of the folder.
+        void scan(const QString& root);
+        void cancel();
+        QString root() const;
+        const std::vector<Entry>& entries() const;
+        // Indices into entries() of the ones that match, in order.
+        std::vector<int> find(const QString& filter) const;
+        static Filter parseFilter(const QString& text);
+        // On the calling thread, opening only files not in previous or changed since.
+        static Scan scanFolder(const QString& root, const std::vector<Entry>& previous,
+                               const std::shared_ptr<std::atomic<bool>>& cancelled = nullptr,
+                               const std::function<void(int, int)>& progress = nullptr);
+        static Entry readHeader(const QString& path);
+        // Where the index of a folder is kept.
+        static QString indexPath(const QString& root);
+        static bool load(const QString& filename, const QString& root, std::vector<Entry>& entries);
+        static bool save(const QString& filename, const QString& root, const std::vector<Entry>& entries);
+
+    signals:
+        // The entries were replaced, by the index on disk or a finished scan.
+        void entriesChanged();
+        void progress(int done, int total);
+        void finished(int opened, int reused, double ms);
+
+    private:
+        QString scan_root;
+        std::vector<Entry> scan_entries;
+        std::shared_ptr<std::atomic<bool>> cancelled;
+};
+
+#endif //SHOTINDEX_H
@@ -0,0 +1,340 @@
+#include "SplitView.h"
+#include <QMap>
+#include <QMenu>
+#include <QPainter>
+#include <algorithm>
+#include <functional>
+#include "PixelOps.h"
+#include "TaskScheduler.h"
+#include "Trace.h"
+
+
+SplitView::SplitView(QWidget *parent): QWidget(parent) {
+    this->setMinimumSize(240, 120);
+    this->setAttribute(Qt::WA_OpaquePaintEvent);
+}
+
+
+void SplitView::setSource(const Image::ChannelData *sceneData, const DisplayPipeline::Settings &settings,
+                          const QRect &visible) {
+    this->scene_data = sceneData;
+    this->settings = settings;
+    this->visible = visible;
+
+    // A config has a default for everything, that's where a new split view starts.
+    if (this->panes.isEmpty() && settings.color_manager && settings.color_manager->config) {
+        const char *display = settings.color_manager->config->getDefaultDisplay();
+        this->panes.append({{display, settings.color_manager->config->getDefaultView(display)}});
+    }
+
+    this->invalidate();
+}
+
+
+void SplitView::setVisibleRect(const QRect &visible) {
+    if (visible == this->visible) {
+        return;
+    }
+    this->visible = visible;
+    this->working_dirty = true;
+    this->update();
+}
+
+
+void SplitView::addOutput(const QString &display, const QString &view) {
+    // Narrower panes need fewer pixels, the working buffer is kept, see render().
+    this->panes.append({{display, view}});
+    this->update();
+}
+
+
+void SplitView::setOutput(int index, const QString &display, const QString &view) {
+    if (index < 0 || index >= this->panes.size()) {
+        return;
+    }
+    this->panes[index].output = {display, view};
+    this->panes[index].dirty = true;
+    this->update();
+}
+
+
+void SplitView::removeOutput(int index) {
+    if (index < 0 || index >= this->panes.size()) {
+        return;
+    }
+    this->panes.removeAt(index);
+    this->update();
+}
+
+
+QList<SplitView::Output> SplitView::outputs() const {
+    QList<Output> outputs;
+    for (const Pane &pane: this->panes) {
+        outputs.append(pane.output);
+    }
+    return outputs;
+}
+
+
+QSize SplitView::sizeHint() const {
+    return QSize(640, 240);
+}
+
+
+void SplitView::resizeEvent(QResizeEvent *event) {
+    QWidget::resizeEvent(event);
+    this->update();
+}
+
+
+QRect SplitView::sourceRect() const {
+    if (!this->scene_data || this->scene_data->data.empty()) {
+        return QRect();
+    }
+
+    const QRect frame(0, 0, this->scene_data->width, this->scene_data->height);
+    return this->visible.isEmpty() ? frame : this->visible.intersected(frame);
+}
+
+
+QRect SplitView::paneRect(int index) const {
+    const int count = std::max<int>(1, this->panes.size());
+    const int left = this->width() * index / count;
+    const int right = this->width() * (index + 1) / count;
+    return QRect(left, header_height, right - left, std::max(1, this->height() - header_height));
+}
+
+
+int SplitView::paneAt(const QPoint &pos) const {
+    for (int i = 0; i < this->panes.size(); ++i) {
+        const QRect pane = this->paneRect(i);
+        if (pos.x() >= pane.left() && pos.x() <= pane.right()) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+
+void SplitView::invalidate() {
+    this->working_dirty = true;
+    this->update();
+}
+
+
+void SplitView::render() {
+    const QRect rect = this->sourceRect();
+    if (rect.isEmpty() || this->panes.isEmpty() || (this->scene_data->channels < 3 && this->scene_data->channels != 1)) {
+        return;
+    }
+
+    // Every step-th pixel, as many as one pane has room for.
+    const QSize pane = this->paneRect(0).size();
+    const int step = std::max({1, (rect.width() + pane.width() - 1) / pane.width(),
+                               (rect.height() + pane.height() - 1) / pane.height()});
+
+    // Up to twice the pixels a pane needs is still fine, then a pane more doesn't make all of them again.
+    if (this->working_dirty || rect != this->working_rect || step < this->working_step
+        || step >= 2 * this->working_step) {
+        this->renderWorking(rect, step);
+        for (Pane &each: this->panes) {
+            each.dirty = true;
+        }
+    }
+
+    for (Pane &each: this->panes) {
+        if (each.dirty || each.image.isNull()) {
+            this->renderPane(each);
+        }
+    }
+}
+
+
+void SplitView::renderWorking(const QRect &rect, int step) {
+    EXRAY_TRACE_SCOPE("split.working");
+    const int64_t start = Trace::now();
+    const Image::ChannelData &scene = *this->scene_data;
+    // A single channel goes through the transforms as gray.
+    const bool single = scene.channels == 1;
+    const int channels = single ? 4 : scene.channels;
+    const int width = (rect.width() + step - 1) / step;
+    const int height = (rect.height() + step - 1) / step;
+
+    this->working.resize(size_t(width) * height * channels);
+    this->working_rect = rect;
+    this->working_step = step;
+    this->working_width = width;
+    this->working_height = height;
+    this->working_channels = channels;
+    this->working_dirty = false;
+
+    OCIO::ConstCPUProcessorRcPtr toWorking;
+    if (this->settings.color_manager) {
+        toWorking = this->settings.color_manager->getProcessor(this->settings.input_colorspace, "ACEScg");
+    }
+    const bool gamma = this->settings.gamma > 0.0f;
+
+    const int rows = DisplayPipeline::tileRows(width, channels);
+    const int tiles = (height + rows - 1) / rows;
+    TaskScheduler::parallelFor(0, tiles, [&](int64_t tile) {
+        const int first = int(tile) * rows;
+        const int count = std::min(rows, height - first);
+        float *dest = this->working.data() + size_t(first) * width * channels;
+
+        for (int row = 0; row < count; ++row) {
+            const size_t source_row = size_t(rect.y() + (first + row) * step) * scene.width;
+            float *line = dest + size_t(row) * width * channels;
+            for (int x = 0; x < width; ++x) {
+                const float *pixel = scene.data.data() + (source_row + rect.x() + size_t(x) * step) * scene.channels;
+                if (single) {
+                    PixelOps::replicate(pixel, 1, 1, 0, line + size_t(x) * channels);
+                } else {
+                    std::copy_n(pixel, channels, line + size_t(x) * channels);
+                }
+            }
+        }
+
+        if (toWorking) {
+            ColorManager::apply(toWorking, dest, width, count, channels);
+        }
+        if (gamma) {
+            PixelOps::gamma(dest, size_t(width) * count, channels, this->settings.gamma);
+        }
+    });
+
+    this->working_ms = double(Trace::now() - start) / 1e6;
+}
+
+
+void SplitView::renderPane(Pane &pane) {
+    EXRAY_TRACE_SCOPE("split.output");
+    const int64_t start = Trace::now();
+    const int width = this->working_width;
+    const int height = this->working_height;
+    const int channels = this->working_channels;
+    pane.dirty = false;
+
+    OCIO::ConstCPUProcessorRcPtr toOutput;
+    if (this->settings.color_manager) {
+        toOutput = this->settings.color_manager->getDisplayViewProcessor("ACEScg", pane.output.display,
+                                                                         pane.output.view);
+    }
+
+    pane.image = QImage(width, height, QImage::Format_RGBA8888);
+    uchar *bits = pane.image.bits();
+    const qsizetype bytes_per_line = pane.image.bytesPerLine();
+    const bool checkerboard = this->settings.checkerboard;
+
+    // The working buffer is shared by every pane, each works on a copy of a tile at a time.
+    const int rows = DisplayPipeline::tileRows(width, channels);
+    const int tiles = (height + rows - 1) / rows;
+    const size_t row_values = size_t(width) * channels;
+    TaskScheduler::parallelFor(0, tiles, [&](int64_t tile) {
+        thread_local std::vector<float> scratch;
+        const int first = int(tile) * rows;
+        const int count = std::min(rows, height - first);
+        scratch.assign(this->working.begin() + ptrdiff_t(first * row_values),
+                       this->working.begin() + ptrdiff_t((first + count) * row_values));
+
+        if (toOutput) {
+            ColorManager::apply(toOutput, scratch.data(), width, count, channels);
+        }
+
+        for (int row = 0; row < count; ++row) {
+            const float *source = scratch.data() + size_t(row) * row_values;
+            uint8_t *line = bits + qsizetype(first + row) * bytes_per_line;
+            if (checkerboard) {
+                PixelOps::toRgba8OverCheckerboard(source, width, channels, line, 0, first + row);
+            } else {
+                PixelOps::toRgba8(source, width, channels, line);
+            }
+        }
+    });
+
+    pane.time_ms = double(Trace::now() - start) / 1e6;
+}
+
+
+void SplitView::paintEvent(QPaintEvent *event) {
+    this->render();
+
+    QPainter painter(this);
+    painter.fillRect(this->rect(), QColor(10, 10, 10));
+    const QRect source = this->working_rect;
+
+    for (int i = 0; i < this->panes.size(); ++i) {
+        const Pane &pane = this->panes[i];
+        const QRect area = this->paneRect(i);
+
+        if (!pane.image.isNull() && !source.isEmpty()) {
+            // The visible part at the same scale in every pane, centered.
+            const double scale = std::min(double(area.width()) / source.width(), double(area.height()) / source.height());
+            const QSize size(int(source.width() * scale), int(source.height() * scale));
+            const QRect target(area.center() - QPoint(size.width() / 2, size.height() / 2), size);
+            painter.setRenderHint(QPainter::SmoothPixmapTransform, scale * this->working_step < 1.0);
+            painter.drawImage(target, pane.image);
+        }
+
+        const QRect header(area.left(), 0, area.width(), header_height);
+        painter.fillRect(header, QColor(30, 30, 30));
+        painter.setPen(QColor(200, 200, 200));
+        QString label = QString("%1 / %2  %3 ms").arg(pane.output.display, pane.output.view)
+                .arg(pane.time_ms, 0, 'f', 1);
+        if (i == 0) {
+            label += QString(" (+%1 ms shared)").arg(this->working_ms, 0, 'f', 1);
+        }
+        painter.drawText(header.adjusted(6, 0, -6, 0), Qt::AlignVCenter | Qt::AlignLeft, label);
+
+        if (i > 0) {
+            painter.setPen(QColor(60, 60, 60));
+            painter.drawLine(area.left(), 0, area.left(), this->height());
+        }
+    }
+}
+
+
+void SplitView::contextMenuEvent(QContextMenuEvent *event) {
+    if (!this->settings.color_manager) {
+        return;
+    }
+
+    const int index = this->paneAt(event->pos());
+    const QList<QPair<QString, QString>> displayViews = this->settings.color_manager->getDisplayViews();
+
+    // Every display with its views, picking one calls back with it.
+    auto addDisplayViews = [&](QMenu *menu, const std::function<void(const QString&, const QString&)> &picked,
+                               const Output *current) {
+        QMap<QString, QMenu*> displays;
+        for (const auto &displayView: displayViews) {
+            QMenu *&display = displays[displayView.first];
+            if (!display) {
+                display = menu->addMenu(displayView.first);
+            }
+            QAction *action = display->addAction(displayView.second, this, [=]() {
+                picked(displayView.first, displayView.second);
+            });
+            if (current) {
+                action->setCheckable(true);
+                action->setChecked(current->display == displayView.first && current->view == displayView.second);
+            }
+        }
+    };
+
+    QMenu menu(this);
+    if (index != -1) {
+        const Output current = this->panes[index].output;
+        addDisplayViews(menu.addMenu("Output"), [this, index](const QString &display, const QString &view) {
+            this->setOutput(index, display, view);
+        }, &current);
+    }
+    addDisplayViews(menu.addMenu("Add Output"), [this](const QString &display, const QString &view) {
+        this->addOutput(display, view);
+    }, nullptr);
+    if (index != -1 && this->panes.size() > 1) {
+        menu.addAction("Remove Output", this, [this, index]() {
+            this->removeOutput(index);
+        });
+    }
+
+    menu.exec(event->globalPos());
+}
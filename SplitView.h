@@ -0,0 +1,81 @@
+#ifndef SPLITVIEW_H
+#define SPLITVIEW_H
+
+#include <QWidget>
+#include <QImage>
+#include <QList>
+#include <QRect>
+#include <QSize>
+#include <QString>
+#include <QPaintEvent>
+#include <QResizeEvent>
+#include <QContextMenuEvent>
+#include <vector>
+#include "DisplayPipeline.h"
+#include "Image.h"
+
+/*
+ * The shown layer under several display / view outputs at once, side by side.
+ *
+ * All outputs start from the viewport's scene-linear buffer, nothing is decoded for them. The part
+ * of the frame that's on screen in the viewport is sampled down to the size of a pane and taken to
+ * the working space once, with the input transform and gamma. Every pane then only runs its own
+ * output transform, from a processor the color manager caches per display and view, and
+ * quantizes. A new or changed output costs its own transform and nothing else.
+ */
+class SplitView : public QWidget {
+    Q_OBJECT
+
+    public:
+        static constexpr int header_height = 20;
+        struct Output {
+            QString display;
+            QString view;
+        };
+        explicit SplitView(QWidget *parent = nullptr);
+        // The buffer stays the viewport's, it's read again whenever something is painted.
+        void setSource(const Image::ChannelData* sceneData, const DisplayPipeline::Settings& settings,
+                       const QRect& visible);
+        // The part of the frame on screen in the viewport, in pixels. Empty is all of it.
+        void setVisibleRect(const QRect& visible);
+        void addOutput(const QString& display, const QString& view);
+        void setOutput(int index, const QString& display, const QString& view);
+        void removeOutput(int index);
+        QList<Output> outputs() const;
+        QSize sizeHint() const override;
+
+    protected:
+        void paintEvent(QPaintEvent *event) override;
+        void resizeEvent(QResizeEvent *event) override;
+        void contextMenuEvent(QContextMenuEvent *event) override;
+
+    private:
+        struct Pane {
+            Output output;
+            QImage image;
+            bool dirty = true;
+            double time_ms = 0.0;
+        };
+        const Image::ChannelData* scene_data = nullptr;
+        DisplayPipeline::Settings settings;
+        QRect visible;
+        QList<Pane> panes;
+        // The visible part, every step-th pixel, in the working space.
+        std::vector<float> working;
+        QRect working_rect;
+        int working_step = 0;
+        int working_width = 0;
+        int working_height = 0;
+        int working_channels = 0;
+        bool working_dirty = true;
+        double working_ms = 0.0;
+        QRect sourceRect() const;
+        QRect paneRect(int index) const;
+        int paneAt(const QPoint& pos) const;
+        void invalidate();
+        void render();
+        void renderWorking(const QRect& rect, int step);
+        void renderPane(Pane& pane);
+};
+
+#endif //SPLITVIEW_H
@@ -0,0 +1,184 @@
+#include "SummedAreaTable.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include "TaskScheduler.h"
+
+
+SummedAreaTable::SummedAreaTable(const Image::ChannelData* channelData) {
+    if (!channelData || channelData->data.empty() || channelData->width <= 0 || channelData->height <= 0) {
+        return;
+    }
+
+    this->source = channelData;
+    this->width = channelData->width;
+    this->height = channelData->height;
+    this->channels = channelData->channels;
+
+    const float* data = channelData->data.data();
+
+    // Per block sums, finite value counts and extremes, one row of blocks per task.
+    this->blocks_x = (this->width + block_size - 1) / block_size;
+    this->blocks_y = (this->height + block_size - 1) / block_size;
+    const size_t block_values = size_t(this->blocks_x) * this->blocks_y * this->channels;
+    const size_t table_values = size_t(this->blocks_x + 1) * (this->blocks_y + 1) * this->channels;
+    this->block_sums.assign(table_values, 0.0);
+    this->block_counts.assign(table_values, 0.0);
+    this->block_min.assign(block_values, std::numeric_limits<float>::infinity());
+    this->block_max.assign(block_values, -std::numeric_limits<float>::infinity());
+
+    TaskScheduler::parallelFor(0, this->blocks_y, [&](int64_t by) {
+        int y_end = std::min(int(by + 1) * block_size, this->height);
+
+        for (int y = int(by) * block_size; y < y_end; ++y) {
+            const float* src = data + size_t(y) * this->width * this->channels;
+
+            for (int x = 0; x < this->width; ++x) {
+                const int bx = x / block_size;
+                size_t block = (size_t(by) * this->blocks_x + bx) * this->channels;
+                size_t sum = this->blockAt(bx + 1, int(by) + 1);
+
+                for (int c = 0; c < this->channels; ++c) {
+                    float value = src[x * this->channels + c];
+                    // Written as comparisons so NaN pixels never win.
+                    if (value < this->block_min[block + c]) this->block_min[block + c] = value;
+                    if (value > this->block_max[block + c]) this->block_max[block + c] = value;
+                    if (std::isfinite(value)) {
+                        this->block_sums[sum + c] += value;
+                        this->block_counts[sum + c] += 1.0;
+                    }
+                }
+            }
+        }
+    });
+
+    // Then summed along the rows of blocks and down, small enough to do in one go.
+    for (int by = 1; by <= this->blocks_y; ++by) {
+        for (int bx = 1; bx <= this->blocks_x; ++bx) {
+            size_t here = this->blockAt(bx, by);
+            size_t left = this->blockAt(bx - 1, by);
+            size_t above = this->blockAt(bx, by - 1);
+            size_t corner = this->blockAt(bx - 1, by - 1);
+            for (int c = 0; c < this->channels; ++c) {
+                this->block_sums[here + c] += this->block_sums[left + c] + this->block_sums[above + c]
+                                              - this->block_sums[corner + c];
+                this->block_counts[here + c] += this->block_counts[left + c] + this->block_counts[above + c]
+                                                - this->block_counts[corner + c];
+            }
+        }
+    }
+}
+
+
+bool SummedAreaTable::isValid() const {
+    return this->source != nullptr;
+}
+
+
+size_t SummedAreaTable::blockAt(int bx, int by) const {
+    return (size_t(by) * (this->blocks_x + 1) + bx) * this->channels;
+}
+
+
+SummedAreaTable::Region SummedAreaTable::region(const QRect& rect) const {
+    Region result;
+
+    if (!this->isValid()) {
+        return result;
+    }
+
+    QRect bounds = rect.normalized().intersected(QRect(0, 0, this->width, this->height));
+    result.rect = bounds;
+
+    if (bounds.isEmpty()) {
+        return result;
+    }
+
+    int x0 = bounds.left();
+    int y0 = bounds.top();
+    int x1 = x0 + bounds.width();
+    int y1 = y0 + bounds.height();
+
+    std::vector<double> sums(this->channels, 0.0);
+    std::vector<double> counts(this->channels, 0.0);
+    auto mean = [&]() {
+        result.mean.resize(this->channels);
+        for (int c = 0; c < this->channels; ++c) {
+            result.mean[c] = counts[c] > 0.0 ? sums[c] / counts[c] : std::numeric_limits<double>::quiet_NaN();
+        }
+    };
+
+    result.min.assign(this->channels, std::numeric_limits<float>::infinity());
+    result.max.assign(this->channels, -std::numeric_limits<float>::infinity());
+
+    // Range of blocks that lie completely inside the rectangle. A clipped block at the
+    // right or bottom edge of the image counts as inside when the rectangle reaches that edge.
+    int bx0 = (x0 + block_size - 1) / block_size;
+    int by0 = (y0 + block_size - 1) / block_size;
+    int bx1 = (x1 == this->width) ? this->blocks_x : x1 / block_size;
+    int by1 = (y1 == this->height) ? this->blocks_y : y1 / block_size;
+
+    if (bx0 >= bx1 || by0 >= by1) {
+        // Too small to cover a whole block, just scan it.
+        this->scanPixels(x0, y0, x1, y1, result, sums, counts);
+        mean();
+        return result;
+    }
+
+    // Sums of the covered blocks from four lookups per channel.
+    size_t bottom_right = this->blockAt(bx1, by1);
+    size_t bottom_left = this->blockAt(bx0, by1);
+    size_t top_right = this->blockAt(bx1, by0);
+    size_t top_left = this->blockAt(bx0, by0);
+    for (int c = 0; c < this->channels; ++c) {
+        sums[c] = this->block_sums[bottom_right + c] - this->block_sums[bottom_left + c]
+                  - this->block_sums[top_right + c] + this->block_sums[top_left + c];
+        counts[c] = this->block_counts[bottom_right + c] - this->block_counts[bottom_left + c]
+                    - this->block_counts[top_right + c] + this->block_counts[top_left + c];
+    }
+
+    for (int by = by0; by < by1; ++by) {
+        for (int bx = bx0; bx < bx1; ++bx) {
+            size_t block = (size_t(by) * this->blocks_x + bx) * this->channels;
+            for (int c = 0; c < this->channels; ++c) {
+                result.min[c] = std::min(result.min[c], this->block_min[block + c]);
+                result.max[c] = std::max(result.max[c], this->block_max[block + c]);
+            }
+        }
+    }
+
+    // Scan the partial blocks around the covered area.
+    int inner_x0 = bx0 * block_size;
+    int inner_y0 = by0 * block_size;
+    int inner_x1 = std::min(bx1 * block_size, this->width);
+    int inner_y1 = std::min(by1 * block_size, this->height);
+
+    this->scanPixels(x0, y0, x1, inner_y0, result, sums, counts);
+    this->scanPixels(x0, inner_y1, x1, y1, result, sums, counts);
+    this->scanPixels(x0, inner_y0, inner_x0, inner_y1, result, sums, counts);
+    this->scanPixels(inner_x1, inner_y0, x1, inner_y1, result, sums, counts);
+
+    mean();
+    return result;
+}
+
+
+void SummedAreaTable::scanPixels(int x0, int y0, int x1, int y1, Region& region, std::vector<double>& sums,
+                                 std::vector<double>& counts) const {
+    const float* data = this->source->data.data();
+
+    for (int y = y0; y < y1; ++y) {
+        const float* row = data + size_t(y) * this->width * this->channels;
+        for (int x = x0; x < x1; ++x) {
+            for (int c = 0; c < this->channels; ++c) {
+                float value = row[x * this->channels + c];
+                if (value < region.min[c]) region.min[c] = value;
+                if (value > region.max[c]) region.max[c] = value;
+                if (std::isfinite(value)) {
+                    sums[c] += value;
+                    counts[c] += 1.0;
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,53 @@
+#ifndef SUMMEDAREATABLE_H
+#define SUMMEDAREATABLE_H
+
+#include <QRect>
+#include <vector>
+#include "Image.h"
+
+/*
+ * Summed-area table over the channels of a single layer.
+ *
+ * The table is over blocks of block_size pixels rather than pixels, a few MB for an 8K layer
+ * instead of a double for every value. The blocks that lie inside a rectangle are four lookups
+ * per channel, the partial blocks along its edges are scanned, the same as for minimum and
+ * maximum, which come from a grid of per-block extremes. Sums are kept in double precision.
+ *
+ * Only finite values are summed, and counted alongside, so a NaN or Inf pixel leaves the mean of
+ * the rest alone, the way the extremes and ImageStats skip them too. A channel without a finite
+ * value in the rectangle has a NaN mean.
+ *
+ * The table keeps a pointer to the channel data it was built from, which has to outlive it.
+ */
+class SummedAreaTable {
+    public:
+        struct Region {
+            QRect rect;
+            std::vector<double> mean;
+            std::vector<float> min;
+            std::vector<float> max;
+        };
+        SummedAreaTable() = default;
+        explicit SummedAreaTable(const Image::ChannelData* channelData);
+        bool isValid() const;
+        Region region(const QRect& rect) const;
+
+    private:
+        static constexpr int block_size = 32;
+        const Image::ChannelData* source = nullptr;
+        int width = 0;
+        int height = 0;
+        int channels = 0;
+        int blocks_x = 0;
+        int blocks_y = 0;
+        // Summed over blocks, the first row and column are zero.
+        std::vector<double> block_sums;
+        std::vector<double> block_counts;
+        std::vector<float> block_min;
+        std::vector<float> block_max;
+        size_t blockAt(int bx, int by) const;
+        void scanPixels(int x0, int y0, int x1, int y1, Region& region, std::vector<double>& sums,
+                        std::vector<double>& counts) const;
+};
+
+#endif //SUMMEDAREATABLE_H
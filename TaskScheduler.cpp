@@ -0,0 +1,349 @@
+#include "TaskScheduler.h"
+#include <QDebug>
+#include <OpenImageIO/imageio.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <exception>
+
+
+namespace {
+    // Which worker the thread is, -1 for threads that aren't one.
+    thread_local int current_worker = -1;
+    // Chunks of a parallelFor go at the priority of whatever started it.
+    thread_local TaskScheduler::Priority current_priority = TaskScheduler::Priority::Interactive;
+    // Tasks run while helping are part of the busy time of the task that waits.
+    thread_local int running_depth = 0;
+
+
+    int64_t now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+}
+
+
+TaskScheduler &TaskScheduler::instance() {
+    static TaskScheduler scheduler;
+    return scheduler;
+}
+
+
+TaskScheduler::TaskScheduler() {
+    int count = int(std::thread::hardware_concurrency());
+    if (const char *threads = std::getenv("EXRAY_THREADS")) {
+        count = std::atoi(threads);
+    }
+    this->startWorkers(std::max(1, count));
+}
+
+
+TaskScheduler::~TaskScheduler() {
+    this->stopWorkers();
+}
+
+
+void TaskScheduler::setThreadCount(int count) {
+    std::lock_guard<std::mutex> lock(this->config_mutex);
+    count = std::max(1, count);
+    if (count == this->thread_count) {
+        return;
+    }
+
+    this->stopWorkers();
+
+    // What the old workers had queued goes to the new ones.
+    {
+        std::lock_guard<std::mutex> injected(this->injected.mutex);
+        for (auto &worker: this->workers) {
+            for (int priority = 0; priority < 2; ++priority) {
+                auto &tasks = worker->queue.tasks[priority];
+                this->injected.tasks[priority].insert(this->injected.tasks[priority].end(),
+                                                      std::make_move_iterator(tasks.begin()),
+                                                      std::make_move_iterator(tasks.end()));
+            }
+        }
+    }
+    this->workers.clear();
+
+    this->startWorkers(count);
+}
+
+
+int TaskScheduler::threadCount() const {
+    return this->thread_count;
+}
+
+
+void TaskScheduler::startWorkers(int count) {
+    this->stopping = false;
+    this->thread_count = count;
+
+    // Decoding runs on our workers, a pool as big next to it would fight them for the cores. OpenEXR
+    // only keeps a few for reads left to it whole, OIIO none.
+    OIIO::attribute("threads", 1);
+    OIIO::attribute("exr_threads", library_threads);
+
+    for (int i = 0; i < count; ++i) {
+        this->workers.push_back(std::make_unique<Worker>());
+    }
+    for (int i = 0; i < count; ++i) {
+        this->workers[i]->thread = std::thread([this, i]() {
+            this->work(i);
+        });
+    }
+}
+
+
+void TaskScheduler::stopWorkers() {
+    {
+        std::lock_guard<std::mutex> lock(this->sleep_mutex);
+        this->stopping = true;
+    }
+    this->wake.notify_all();
+
+    for (auto &worker: this->workers) {
+        if (worker->thread.joinable()) {
+            worker->thread.join();
+        }
+    }
+}
+
+
+void TaskScheduler::submit(std::function<void()> task, Priority priority, Cancel cancelled) {
+    // Workers keep what they make themselves, for others to steal.
+    Queue &queue = current_worker >= 0 ? this->workers[current_worker]->queue : this->injected;
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks[int(priority)].push_back({std::move(task), priority, std::move(cancelled)});
+    }
+    this->queued++;
+
+    {
+        std::lock_guard<std::mutex> lock(this->sleep_mutex);
+    }
+    this->wake.notify_one();
+}
+
+
+bool TaskScheduler::take(int index, Task &task, bool &stolen) {
+    const int count = int(this->workers.size());
+
+    for (int priority = 0; priority < 2; ++priority) {
+        // The newest of our own first, it's the most likely to still be in cache.
+        if (index >= 0) {
+            Queue &own = this->workers[index]->queue;
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.tasks[priority].empty()) {
+                task = std::move(own.tasks[priority].back());
+                own.tasks[priority].pop_back();
+                this->queued--;
+                stolen = false;
+                return true;
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(this->injected.mutex);
+            if (!this->injected.tasks[priority].empty()) {
+                task = std::move(this->injected.tasks[priority].front());
+                this->injected.tasks[priority].pop_front();
+                this->queued--;
+                stolen = false;
+                return true;
+            }
+        }
+
+        // Then the oldest of someone else.
+        for (int k = 1; k <= count; ++k) {
+            int victim = (std::max(index, 0) + k) % count;
+            if (victim == index) {
+                continue;
+            }
+
+            Queue &other = this->workers[victim]->queue;
+            std::lock_guard<std::mutex> lock(other.mutex);
+            if (!other.tasks[priority].empty()) {
+                task = std::move(other.tasks[priority].front());
+                other.tasks[priority].pop_front();
+                this->queued--;
+                stolen = true;
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+
+void TaskScheduler::execute(int index, Task &task, bool stolen) {
+    if (task.cancelled && *task.cancelled) {
+        return;
+    }
+
+    const Priority previous = current_priority;
+    current_priority = task.priority;
+    running_depth++;
+    const int64_t start = now();
+
+    try {
+        task.function();
+    } catch (const std::exception &e) {
+        qDebug() << "Task failed:" << e.what();
+    } catch (...) {
+        // Anything else would take the worker, and with it the process, down.
+        qDebug() << "Task failed with an unknown exception";
+    }
+
+    running_depth--;
+    current_priority = previous;
+
+    if (index >= 0) {
+        Worker &worker = *this->workers[index];
+        if (running_depth == 0) {
+            worker.busy += now() - start;
+        }
+        worker.tasks++;
+        if (stolen) {
+            worker.steals++;
+        }
+    }
+}
+
+
+void TaskScheduler::work(int index) {
+    current_worker = index;
+
+    while (true) {
+        Task task;
+        bool stolen = false;
+        if (this->take(index, task, stolen)) {
+            this->execute(index, task, stolen);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(this->sleep_mutex);
+        this->wake.wait(lock, [this]() {
+            return this->stopping || this->queued > 0;
+        });
+        if (this->stopping) {
+            return;
+        }
+    }
+}
+
+
+void TaskScheduler::helpUntil(const std::function<bool()> &done) {
+    while (!done()) {
+        Task task;
+        bool stolen = false;
+        if (current_worker >= 0 && this->take(current_worker, task, stolen)) {
+            this->execute(current_worker, task, stolen);
+            continue;
+        }
+
+        // Nothing to help with, look again after a bit or when new work comes in.
+        std::unique_lock<std::mutex> lock(this->sleep_mutex);
+        this->wake.wait_for(lock, std::chrono::milliseconds(1));
+    }
+}
+
+
+void TaskScheduler::run(int64_t begin, int64_t end, const std::function<void(int64_t, int64_t)> &body) {
+    const int64_t count = end - begin;
+    const int threads = this->thread_count;
+    const int64_t chunks = std::min<int64_t>(count, int64_t(threads) * chunks_per_thread);
+
+    if (chunks <= 1) {
+        if (count > 0) {
+            body(begin, end);
+        }
+        return;
+    }
+
+    // Shared with the helpers, which may only get to run after we're done.
+    struct Loop {
+        std::atomic<int64_t> next = 0;
+        std::atomic<int64_t> done = 0;
+        // The first chunk to throw, on whichever thread it ran.
+        std::mutex mutex;
+        std::exception_ptr error;
+    };
+    auto loop = std::make_shared<Loop>();
+
+    auto claim = [loop, begin, count, chunks, &body]() {
+        while (true) {
+            const int64_t chunk = loop->next.fetch_add(1);
+            if (chunk >= chunks) {
+                return;
+            }
+
+            try {
+                body(begin + count * chunk / chunks, begin + count * (chunk + 1) / chunks);
+            } catch (...) {
+                {
+                    std::lock_guard<std::mutex> lock(loop->mutex);
+                    if (!loop->error) {
+                        loop->error = std::current_exception();
+                    }
+                }
+
+                // Nobody takes the chunks left after a failure, they count as done along with this
+                // one. Waiting for them would hang with no helper around to run them.
+                const int64_t left = std::max<int64_t>(0, chunks - loop->next.exchange(chunks));
+                loop->done += 1 + left;
+                loop->done.notify_all();
+                return;
+            }
+
+            if (++loop->done == chunks) {
+                loop->done.notify_all();
+            }
+        }
+    };
+
+    const int helpers = int(std::min<int64_t>(threads, chunks)) - 1;
+    for (int i = 0; i < helpers; ++i) {
+        this->submit(claim, current_priority);
+    }
+
+    // Once a chunk throws the rest is skipped, only chunks already started are waited for, they
+    // still have our body.
+    claim();
+
+    // Only chunks that are being worked on are left.
+    int64_t done;
+    while ((done = loop->done.load()) < chunks) {
+        loop->done.wait(done);
+    }
+
+    // What a helper threw is ours to throw, it would otherwise only be logged by the worker.
+    if (loop->error) {
+        std::rethrow_exception(loop->error);
+    }
+}
+
+
+TaskScheduler::Snapshot TaskScheduler::snapshot() const {
+    Snapshot snapshot;
+    snapshot.time = now();
+    for (const auto &worker: this->workers) {
+        snapshot.workers.push_back({worker->busy.load(), worker->tasks.load(), worker->steals.load()});
+    }
+    return snapshot;
+}
+
+
+std::vector<double> TaskScheduler::utilization(const Snapshot &before, const Snapshot &after) {
+    std::vector<double> busy;
+    const double elapsed = double(after.time - before.time);
+    if (elapsed <= 0.0 || before.workers.size() != after.workers.size()) {
+        return busy;
+    }
+
+    for (size_t i = 0; i < after.workers.size(); ++i) {
+        busy.push_back(std::clamp(double(after.workers[i].busy - before.workers[i].busy) / elapsed, 0.0, 1.0));
+    }
+    return busy;
+}
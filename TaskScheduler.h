@@ -0,0 +1,103 @@
+#ifndef TASKSCHEDULER_H
+#define TASKSCHEDULER_H
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+
+/*
+ * The one pool of worker threads every pixel stage runs on.
+ *
+ * Every worker has its own deques, one per priority. It takes the newest task from its own end,
+ * idle workers steal the oldest from the other end of someone else's. Interactive work always goes
+ * before background work like thumbnails and exports. Tasks can come with a cancel flag, they're
+ * skipped if it's set by the time they would start.
+ *
+ * parallelFor cuts a range into a few chunks per thread. The calling thread works along, and only
+ * waits for chunks other threads already started, so it can be called from inside tasks. A chunk
+ * that throws skips the ones nobody started yet, the first exception comes out of parallelFor.
+ *
+ * The thread count is the number of cores, or EXRAY_THREADS. EXR chunks are decoded here as well,
+ * see ExrDecode. OIIO gets no pool of its own, OpenEXR library_threads for the files ExrDecode
+ * hands to it whole, so decoding doesn't take more cores than there are. OCIO processors run
+ * single threaded in whichever task applies them.
+ */
+class TaskScheduler {
+    public:
+        enum class Priority { Interactive, Background };
+        using Cancel = std::shared_ptr<std::atomic<bool>>;
+        struct WorkerStats {
+            int64_t busy = 0;
+            int64_t tasks = 0;
+            int64_t steals = 0;
+        };
+        struct Snapshot {
+            int64_t time = 0;
+            std::vector<WorkerStats> workers;
+        };
+        static constexpr int chunks_per_thread = 4;
+        // OpenEXR's own pool, only used by decodes left to the library.
+        static constexpr int library_threads = 4;
+        static TaskScheduler& instance();
+        ~TaskScheduler();
+        // Best done while idle, tasks still queued are kept.
+        void setThreadCount(int count);
+        int threadCount() const;
+        void submit(std::function<void()> task, Priority priority = Priority::Interactive, Cancel cancelled = nullptr);
+        // Workers run other tasks while they wait, other threads block.
+        void helpUntil(const std::function<bool()>& done);
+        Snapshot snapshot() const;
+        // How busy every worker was between two snapshots, 0 to 1.
+        static std::vector<double> utilization(const Snapshot& before, const Snapshot& after);
+
+        template<typename F>
+        static void parallelFor(int64_t begin, int64_t end, F&& function) {
+            instance().run(begin, end, [&function](int64_t chunkBegin, int64_t chunkEnd) {
+                for (int64_t i = chunkBegin; i < chunkEnd; ++i) {
+                    function(i);
+                }
+            });
+        }
+
+    private:
+        struct Task {
+            std::function<void()> function;
+            Priority priority;
+            Cancel cancelled;
+        };
+        struct Queue {
+            std::mutex mutex;
+            std::deque<Task> tasks[2];
+        };
+        struct Worker {
+            std::thread thread;
+            Queue queue;
+            std::atomic<int64_t> busy = 0;
+            std::atomic<int64_t> tasks = 0;
+            std::atomic<int64_t> steals = 0;
+        };
+        std::vector<std::unique_ptr<Worker>> workers;
+        // Tasks from threads that aren't workers.
+        Queue injected;
+        std::atomic<int> queued = 0;
+        std::atomic<int> thread_count = 0;
+        std::mutex sleep_mutex;
+        std::condition_variable wake;
+        bool stopping = false;
+        std::mutex config_mutex;
+        TaskScheduler();
+        void startWorkers(int count);
+        void stopWorkers();
+        void work(int index);
+        bool take(int index, Task& task, bool& stolen);
+        void execute(int index, Task& task, bool stolen);
+        void run(int64_t begin, int64_t end, const std::function<void(int64_t, int64_t)>& body);
+};
+
+#endif //TASKSCHEDULER_H
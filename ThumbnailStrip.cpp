@@ -0,0 +1,256 @@
+#include "ThumbnailStrip.h"
+#include <QApplication>
+#include <QFileInfo>
+#include <QIcon>
+#include <QPixmap>
+#include <QPointer>
+#include <algorithm>
+#include "TaskScheduler.h"
+#include "Viewport.h"
+
+
+namespace {
+    // Box filtered RGBA, row(y, scratch) gives line y of the image with channels floats a pixel,
+    // offsets are where the layer's channels are in a pixel.
+    template<class Row>
+    Image::ChannelData boxFilter(int imageWidth, int imageHeight, int width, int height, int channels,
+                                 const std::vector<int> &offsets, Row row) {
+        int step = std::max(1, std::max(imageWidth / width, imageHeight / height));
+        Image::ChannelData data;
+        data.width = std::max(1, imageWidth / step);
+        data.height = std::max(1, imageHeight / step);
+        data.channels = 4;
+        data.channel_names = {"R", "G", "B", "A"};
+        data.data.resize(size_t(data.width) * data.height * 4);
+
+        const int used = std::min<int>(offsets.size(), 4);
+        const float weight = 1.0f / float(step * step);
+
+        // Rows in parallel, the viewport uses this for its much bigger preview too.
+        TaskScheduler::parallelFor(0, data.height, [&](int64_t y) {
+            thread_local std::vector<float> scratch;
+            std::vector<float> sums(size_t(data.width) * 4, 0.0f);
+
+            for (int by = int(y) * step; by < (int(y) + 1) * step; ++by) {
+                const float *line = row(by, scratch);
+                for (int x = 0; x < data.width; ++x) {
+                    const float *pixels = line + size_t(x) * step * channels;
+                    for (int bx = 0; bx < step; ++bx) {
+                        for (int c = 0; c < used; ++c) {
+                            sums[size_t(x) * 4 + c] += pixels[bx * channels + offsets[c]];
+                        }
+                    }
+                }
+            }
+
+            for (int x = 0; x < data.width; ++x) {
+                const float *sum = &sums[size_t(x) * 4];
+                float *out = &data.data[(size_t(y) * data.width + x) * 4];
+                if (used < 3) {
+                    // Single channel layers are shown as grey.
+                    out[0] = out[1] = out[2] = sum[0] * weight;
+                } else {
+                    out[0] = sum[0] * weight;
+                    out[1] = sum[1] * weight;
+                    out[2] = sum[2] * weight;
+                }
+                out[3] = used == 4 ? sum[3] * weight : 1.0f;
+            }
+        });
+        return data;
+    }
+
+
+    QImage toDisplay(const Image::ChannelData &data, ColorManager *colorManager, const QString &inputColorSpace,
+                     const QString &outputColorSpace, float gamma) {
+        // Same chain as the viewport, through the shared processor cache.
+        auto transformedData = colorManager->transform(data, inputColorSpace, "ACEScg");
+        transformedData = Image::applyGammaCorrection(transformedData, gamma);
+        transformedData = colorManager->transform(transformedData, "ACEScg", outputColorSpace);
+
+        return Viewport::createDisplayImage(transformedData);
+    }
+}
+
+
+ThumbnailStrip::ThumbnailStrip(QWidget *parent): QListWidget(parent) {
+    this->setViewMode(QListView::IconMode);
+    this->setFlow(QListView::LeftToRight);
+    this->setWrapping(false);
+    this->setMovement(QListView::Static);
+    this->setResizeMode(QListView::Adjust);
+    this->setUniformItemSizes(true);
+    this->setIconSize(QSize(thumbnail_width, thumbnail_height));
+    this->setSpacing(4);
+
+    connect(this, &QListWidget::itemClicked, this, [this](QListWidgetItem *item) {
+        emit layerActivated(item->data(Qt::UserRole).toString());
+    });
+}
+
+
+ThumbnailStrip::~ThumbnailStrip() {
+    if (this->cancelled) {
+        *this->cancelled = true;
+    }
+}
+
+
+void ThumbnailStrip::load(const QString &filename, const QList<QString> &layers, ColorManager *colorManager,
+                          const QString &inputColorSpace, const QString &outputColorSpace, float gamma) {
+    // Drop whatever is still being made for the previous file.
+    if (this->cancelled) {
+        *this->cancelled = true;
+    }
+
+    this->clear();
+    for (const QString &layer: layers) {
+        QListWidgetItem *item = new QListWidgetItem(layer, this);
+        item->setData(Qt::UserRole, layer);
+        item->setToolTip(layer);
+    }
+
+    QDateTime modified = QFileInfo(filename).lastModified();
+    QString settings = inputColorSpace + "\n" + outputColorSpace + "\n" + QString::number(gamma);
+
+    // Same file with the same transforms, nothing to make.
+    auto cached = this->cache.constFind(filename);
+    if (cached != this->cache.constEnd() && cached->modified == modified && cached->settings == settings
+        && cached->thumbnails.size() == layers.size()) {
+        for (int i = 0; i < layers.size(); ++i) {
+            this->setThumbnail(i, cached->thumbnails[i]);
+        }
+        return;
+    }
+
+    // Without a color config the names are all there is to show.
+    if (!colorManager) {
+        return;
+    }
+
+    auto cancelled = std::make_shared<std::atomic<bool>>(false);
+    this->cancelled = cancelled;
+    QPointer<ThumbnailStrip> strip(this);
+
+    TaskScheduler::instance().submit([=]() {
+        auto input = ImageInput::open(filename.toStdString());
+        if (!input) {
+            return;
+        }
+
+        // Look for the smallest mip level that still covers a thumbnail.
+        ImageSpec spec = input->spec();
+        int level = 0;
+        while (input->seek_subimage(0, level + 1) && input->spec().width >= thumbnail_width) {
+            spec = input->spec();
+            level++;
+        }
+
+        std::shared_ptr<const FloatBuffer> pixels;
+        std::unique_ptr<Image> image;
+        if (level > 0) {
+            auto buffer = std::make_shared<FloatBuffer>(size_t(spec.width) * spec.height * spec.nchannels);
+            if (!input->read_image(0, level, 0, spec.nchannels, TypeDesc::FLOAT, buffer->data())) {
+                return;
+            }
+            pixels = buffer;
+        } else {
+            // No mips, read like the viewer does, in place or sharing its decode.
+            input.reset();
+            image = std::make_unique<Image>(filename.toStdString().c_str());
+            if (!image->inp || !image->openPixels()) {
+                return;
+            }
+        }
+
+        if (*cancelled) {
+            return;
+        }
+
+        std::vector<QImage> thumbnails(layers.size());
+
+        TaskScheduler::parallelFor(0, layers.size(), [&](int64_t i) {
+            if (*cancelled) {
+                return;
+            }
+
+            QImage thumbnail = image ? ThumbnailStrip::renderThumbnail(image.get(), layers[i], colorManager,
+                                                                       inputColorSpace, outputColorSpace, gamma)
+                                     : ThumbnailStrip::renderThumbnail(*pixels, spec, layers[i], colorManager,
+                                                                       inputColorSpace, outputColorSpace, gamma);
+            thumbnails[i] = thumbnail;
+
+            // Hand each one over as soon as it's done.
+            QMetaObject::invokeMethod(qApp, [strip, cancelled, i, thumbnail]() {
+                if (strip && !*cancelled) {
+                    strip->setThumbnail(int(i), thumbnail);
+                }
+            }, Qt::QueuedConnection);
+        });
+
+        QMetaObject::invokeMethod(qApp, [strip, cancelled, filename, modified, settings, thumbnails]() {
+            if (strip && !*cancelled) {
+                strip->cache.insert(filename, {modified, settings, QList<QImage>(thumbnails.begin(), thumbnails.end())});
+            }
+        }, Qt::QueuedConnection);
+    }, TaskScheduler::Priority::Background, cancelled);
+}
+
+
+QImage ThumbnailStrip::renderThumbnail(const FloatBuffer &pixels, const ImageSpec &spec, const QString &layer,
+                                       ColorManager *colorManager, const QString &inputColorSpace,
+                                       const QString &outputColorSpace, float gamma, int width, int height) {
+    std::vector<int> indices;
+    std::vector<std::string> names;
+    Image::findLayerChannels(spec, layer, indices, names);
+
+    if (indices.empty()) {
+        return QImage();
+    }
+
+    // Box filter down to the thumbnail size.
+    const Image::ChannelData data = boxFilter(spec.width, spec.height, width, height, spec.nchannels, indices,
+                                              [&](int y, std::vector<float> &) {
+        return pixels.data() + size_t(y) * spec.width * spec.nchannels;
+    });
+    return toDisplay(data, colorManager, inputColorSpace, outputColorSpace, gamma);
+}
+
+
+QImage ThumbnailStrip::renderThumbnail(Image *image, const QString &layer, ColorManager *colorManager,
+                                       const QString &inputColorSpace, const QString &outputColorSpace, float gamma,
+                                       int width, int height) {
+    const ImageSpec &spec = image->inp->spec();
+    std::vector<int> indices;
+    std::vector<std::string> names;
+    Image::findLayerChannels(spec, layer, indices, names);
+
+    // Layers of the file only, virtual ones would have to decode what's mapped.
+    Image::Extraction extraction;
+    if (indices.empty() || !image->extraction(layer, "all", extraction)) {
+        return QImage();
+    }
+
+    // The layer's channels, a line at a time out of the file or the decode.
+    std::vector<int> offsets(extraction.channels);
+    for (int c = 0; c < extraction.channels; ++c) {
+        offsets[c] = c;
+    }
+    const Image::ChannelData data = boxFilter(spec.width, spec.height, width, height, extraction.channels, offsets,
+                                              [&](int y, std::vector<float> &scratch) {
+        scratch.resize(size_t(spec.width) * extraction.channels);
+        image->extract(extraction, ROI(0, spec.width, y, y + 1), scratch.data());
+        return static_cast<const float *>(scratch.data());
+    });
+    return toDisplay(data, colorManager, inputColorSpace, outputColorSpace, gamma);
+}
+
+
+void ThumbnailStrip::setThumbnail(int index, const QImage &image) {
+    QListWidgetItem *item = this->item(index);
+    if (!item || image.isNull()) {
+        return;
+    }
+
+    item->setIcon(QIcon(QPixmap::fromImage(image)));
+}
@@ -0,0 +1,56 @@
+#ifndef THUMBNAILSTRIP_H
+#define THUMBNAILSTRIP_H
+
+#include <QListWidget>
+#include <QDateTime>
+#include <QHash>
+#include <QImage>
+#include <QList>
+#include <QString>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include "Image.h"
+#include "ColorManager.h"
+
+/*
+ * Strip with a small display-transformed preview of every layer in a file.
+ *
+ * Previews are made on the thread pool from one read of the file: the smallest mip level that
+ * is still big enough when the file has them, otherwise the full image the way the viewer reads
+ * it, mapped in place or decoded into the decode cache, which the viewer then shares. They show up one by one as they finish and are kept per file.
+ */
+class ThumbnailStrip : public QListWidget {
+    Q_OBJECT
+
+    public:
+        static constexpr int thumbnail_width = 160;
+        static constexpr int thumbnail_height = 90;
+        explicit ThumbnailStrip(QWidget *parent = nullptr);
+        ~ThumbnailStrip();
+        void load(const QString& filename, const QList<QString>& layers, ColorManager* colorManager,
+                  const QString& inputColorSpace, const QString& outputColorSpace, float gamma);
+        static QImage renderThumbnail(const FloatBuffer& pixels, const ImageSpec& spec, const QString& layer,
+                                      ColorManager* colorManager, const QString& inputColorSpace,
+                                      const QString& outputColorSpace, float gamma, int width = thumbnail_width,
+                                      int height = thumbnail_height);
+        // The same from the rows of an image, read in place when it's mapped.
+        static QImage renderThumbnail(Image* image, const QString& layer, ColorManager* colorManager,
+                                      const QString& inputColorSpace, const QString& outputColorSpace, float gamma,
+                                      int width = thumbnail_width, int height = thumbnail_height);
+
+    signals:
+        void layerActivated(const QString& layer);
+
+    private:
+        struct CacheEntry {
+            QDateTime modified;
+            QString settings;
+            QList<QImage> thumbnails;
+        };
+        QHash<QString, CacheEntry> cache;
+        std::shared_ptr<std::atomic<bool>> cancelled;
+        void setThumbnail(int index, const QImage& image);
+};
+
+#endif //THUMBNAILSTRIP_H
@@ -0,0 +1,157 @@
+#include "Trace.h"
+#include <QDebug>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+
+namespace {
+    struct Event {
+        const char* name;
+        int64_t start;
+        int64_t end;
+    };
+
+    // Only its own thread writes, so appending is a store and a release of the counter.
+    struct ThreadBuffer {
+        static constexpr uint64_t capacity = 1 << 16;
+        std::unique_ptr<Event[]> events{new Event[capacity]};
+        std::atomic<uint64_t> written{0};
+        int thread_id = 0;
+    };
+
+    std::atomic<bool> enabled{true};
+    const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+
+    // Buffers outlive their threads so spans from finished workers still export.
+    std::mutex registry_mutex;
+    std::vector<std::shared_ptr<ThreadBuffer>> registry;
+
+    ThreadBuffer& localBuffer() {
+        thread_local std::shared_ptr<ThreadBuffer> buffer = []() {
+            auto created = std::make_shared<ThreadBuffer>();
+            std::lock_guard<std::mutex> lock(registry_mutex);
+            created->thread_id = int(registry.size()) + 1;
+            registry.push_back(created);
+            return created;
+        }();
+        return *buffer;
+    }
+
+    // Calls fn for every event still in the buffer, oldest first. The oldest ones can be
+    // overwritten while we read, which is fine for profiling.
+    template<typename Fn>
+    void forEachEvent(const ThreadBuffer& buffer, Fn fn) {
+        uint64_t written = buffer.written.load(std::memory_order_acquire);
+        uint64_t first = written > ThreadBuffer::capacity ? written - ThreadBuffer::capacity : 0;
+
+        for (uint64_t i = first; i < written; ++i) {
+            fn(buffer.events[i % ThreadBuffer::capacity]);
+        }
+    }
+}
+
+
+Trace::Span::Span(const char* name): name(name), start(enabled.load(std::memory_order_relaxed) ? Trace::now() : -1) {
+}
+
+
+Trace::Span::~Span() {
+    if (this->start >= 0) {
+        Trace::record(this->name, this->start, Trace::now());
+    }
+}
+
+
+void Trace::setEnabled(bool enable) {
+    enabled.store(enable, std::memory_order_relaxed);
+}
+
+
+bool Trace::isEnabled() {
+#if defined(EXRAY_TRACING)
+    return enabled.load(std::memory_order_relaxed);
+#else
+    return false;
+#endif
+}
+
+
+int64_t Trace::now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+
+void Trace::record(const char* name, int64_t start, int64_t end) {
+    ThreadBuffer& buffer = localBuffer();
+    uint64_t index = buffer.written.load(std::memory_order_relaxed);
+    buffer.events[index % ThreadBuffer::capacity] = {name, start, end};
+    buffer.written.store(index + 1, std::memory_order_release);
+}
+
+
+QList<QPair<QString, double>> Trace::summarize(int64_t since) {
+    // Milliseconds per stage this thread spent since then, in the order they finished.
+    QList<QPair<QString, double>> stages;
+
+    forEachEvent(localBuffer(), [&](const Event& event) {
+        if (event.start < since) {
+            return;
+        }
+
+        QString name = QString::fromLatin1(event.name);
+        double ms = double(event.end - event.start) / 1e6;
+
+        for (auto& stage: stages) {
+            if (stage.first == name) {
+                stage.second += ms;
+                return;
+            }
+        }
+        stages.append({name, ms});
+    });
+
+    return stages;
+}
+
+
+bool Trace::exportChromeTrace(const QString& filename) {
+    std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        buffers = registry;
+    }
+
+    // Complete events, timestamps and durations in microseconds.
+    QJsonArray events;
+    for (const auto& buffer: buffers) {
+        forEachEvent(*buffer, [&](const Event& event) {
+            QJsonObject object;
+            object["name"] = QString::fromLatin1(event.name);
+            object["ph"] = "X";
+            object["ts"] = double(event.start) / 1000.0;
+            object["dur"] = double(event.end - event.start) / 1000.0;
+            object["pid"] = 1;
+            object["tid"] = buffer->thread_id;
+            events.append(object);
+        });
+    }
+
+    QFile file(filename);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qDebug() << "Could not write trace to" << filename;
+        return false;
+    }
+
+    QJsonObject trace;
+    trace["traceEvents"] = events;
+    trace["displayTimeUnit"] = "ms";
+    file.write(QJsonDocument(trace).toJson(QJsonDocument::Compact));
+    return true;
+}
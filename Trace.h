@@ -0,0 +1,43 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <QList>
+#include <QPair>
+#include <QString>
+#include <cstdint>
+
+/*
+ * Scoped timing spans around the pipeline stages.
+ *
+ * Every thread writes into its own ring buffer without locking, readers take what is there.
+ * Spans are exported as Chrome / Perfetto trace JSON, or summed per stage for the timing HUD.
+ * Building without EXRAY_TRACING turns EXRAY_TRACE_SCOPE into nothing.
+ */
+class Trace {
+    public:
+        // Records the time between its construction and destruction.
+        class Span {
+            public:
+                explicit Span(const char* name);
+                ~Span();
+            private:
+                const char* name;
+                int64_t start;
+        };
+        static void setEnabled(bool enabled);
+        static bool isEnabled();
+        static int64_t now();
+        static void record(const char* name, int64_t start, int64_t end);
+        static QList<QPair<QString, double>> summarize(int64_t since);
+        static bool exportChromeTrace(const QString& filename);
+};
+
+#if defined(EXRAY_TRACING)
+#define EXRAY_TRACE_CONCAT_(a, b) a##b
+#define EXRAY_TRACE_CONCAT(a, b) EXRAY_TRACE_CONCAT_(a, b)
+#define EXRAY_TRACE_SCOPE(name) Trace::Span EXRAY_TRACE_CONCAT(trace_span_, __LINE__)(name)
+#else
+#define EXRAY_TRACE_SCOPE(name) ((void) 0)
+#endif
+
+#endif //TRACE_H
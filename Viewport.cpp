@@ -1,6 +1,27 @@
 #include "Viewport.h"
+#include <QApplication>
+#include <QClipboard>
+#include <QFileDialog>
+#include <QInputDialog>
+#include <QLineEdit>
+#include <QPair>
+#include <QGuiApplication>
+#include <QPointer>
+#include <QPen>
+#include <QFont>
+#include <QFontMetrics>
+#include <QPainter>
+#include <algorithm>
+#include <cmath>
+#include "BufferPool.h"
+#include "ImageCompare.h"
+#include "PixelOps.h"
+#include "TaskScheduler.h"
+#include "ThumbnailStrip.h"
+#include "Trace.h"
 
-Viewport::Viewport(QWidget *parent): QGraphicsView(parent) {
+Viewport::Viewport(Session *session, QWidget *parent): QGraphicsView(parent), session(session),
+                                                       prefetcher(new Prefetcher(session, this)) {
     this->setStyleSheet("QGraphicsView { border: 0px; }");
     this->setRenderHint(QPainter::Antialiasing);
     this->setDragMode(QGraphicsView::NoDrag);
@@ -16,35 +37,15 @@ Viewport::Viewport(QWidget *parent): QGraphicsView(parent) {
     scene->setSceneRect(-5000, -5000, 10000, 10000);
     this->setScene(scene);
 
-    // Create the ocio color manager.
-    this->color_manager = new ColorManager();
-
-    // Load in a new image.
-    this->image = new Image("../test.exr");
-
-    // Get the selected channel data.
-    auto rgba_data = image->getChannelDataForOCIO("ViewLayer.Combined", "all");
-
-    // Convert from input color space to ACEScg
-    auto transformedData = this->color_manager->transform(rgba_data, "Linear Rec.709 (sRGB)", "ACEScg");
-
-    // Add a gamma correction.
-    transformedData = image->applyGammaCorrection(transformedData, 1.0);
-
-    // Convert from ACEScg to the output color space
-    transformedData = this->color_manager->transform(transformedData, "ACEScg", "sRGB - Display");
-
-    // Turn the image data into a QGraphicsPixmapItem
-    QGraphicsPixmapItem *item = this->createPixmapItem(transformedData);
-
-    // Set the item position based on its width and height.
-    item->setPos(item->boundingRect().width() / -2, item->boundingRect().height() / -2);
-
-    // Add the item to the scene.
-    scene->addItem(item);
+    // Track the mouse without a button pressed for the pixel probe.
+    this->setMouseTracking(true);
 
     this->setContextMenuPolicy(Qt::CustomContextMenu);
     connect(this, &QGraphicsView::customContextMenuRequested, this, &Viewport::showContextMenu);
+
+    this->settle_timer.setSingleShot(true);
+    this->settle_timer.setInterval(settle_interval);
+    connect(&this->settle_timer, &QTimer::timeout, this, &Viewport::settleRegions);
 }
 
 
@@ -56,53 +57,225 @@ void Viewport::showContextMenu(const QPoint &pos) {
     QGraphicsItem *item = this->scene()->itemAt(scenePos, this->transform());
 
     if (item) {
-        qDebug() << "Item was rightclicked.";
-    } else {
         /*
-         * View layers menu.
+         * Pixel values under the cursor.
          */
-        QMenu *viewMenu = contextMenu.addMenu("View Layer");
-        QList<QString> layers = this->image->getlayers();
-        for (const QString &layer: layers) {
-            viewMenu->addAction(layer, this, []() {
-                qDebug() << "Layer selected";
+        QPoint pixel = this->mapToPixel(pos);
+        PixelProbe::Sample sample = this->probeAt(pixel).sample(pixel.x(), pixel.y());
+        if (sample.valid) {
+            QStringList values;
+            for (int c = 0; c < sample.scene.size(); ++c) {
+                values.append(QString::number(sample.scene[c], 'g', 6));
+            }
+
+            contextMenu.addAction("Copy Pixel Values", this, [values]() {
+                QGuiApplication::clipboard()->setText(values.join("\t"));
             });
+            contextMenu.addSeparator();
         }
+    }
 
-        contextMenu.addSeparator();
+    /*
+     * View layers menu.
+     */
+    QMenu *viewMenu = contextMenu.addMenu("View Layer");
+    QList<QString> layers = this->image ? this->image->getlayers() : QList<QString>();
+    for (const QString &layer: layers) {
+        viewMenu->addAction(layer, this, [this, layer]() {
+            this->displayLayer(layer, "all");
+        });
+    }
 
-        QMap<QString, QList<QString> > color_transforms = this->color_manager->getTransforms();
+    viewMenu->addSeparator();
+    QAction *virtualAction = viewMenu->addAction("New Virtual Layer...", this, [this]() {
+        // Asked again with what went wrong until it compiles or is cancelled.
+        QString definition;
+        QString error;
+        while (true) {
+            bool ok = false;
+            QString label = error.isEmpty() ? QString("name = expression, like beauty = diffuse + specular * mask") : error;
+            definition = QInputDialog::getText(this, "New Virtual Layer", label, QLineEdit::Normal, definition, &ok);
+            if (!ok || this->addVirtualLayer(definition, &error)) {
+                return;
+            }
+        }
+    });
+    virtualAction->setEnabled(this->image != nullptr);
 
-        /*
-         * Input colorspace menu.
-         */
-        QMenu *inputMenu = contextMenu.addMenu("Input Colorspace");
+    /*
+     * Channel menu, a single channel of the shown layer as gray.
+     */
+    QMenu *channelMenu = contextMenu.addMenu("Channel");
+    QStringList components = {"all"};
+    if (this->image && this->image->isVirtualLayer(this->current_layer)) {
+        components << "r" << "g" << "b" << "a";
+    } else if (this->image) {
+        std::vector<int> indices;
+        std::vector<std::string> names;
+        Image::findLayerChannels(this->image->inp->spec(), this->current_layer, indices, names);
+        for (const std::string &name: names) {
+            components.append(QString::fromStdString(name).section('.', -1));
+        }
+    }
+    for (const QString &component: components) {
+        QAction *action = channelMenu->addAction(component == "all" ? "All" : component, this, [this, component]() {
+            this->displayLayer(this->current_layer, component);
+        });
+        action->setCheckable(true);
+        action->setChecked(component == this->current_component);
+    }
+    channelMenu->addSeparator();
 
-        for (QMap<QString, QList<QString> >::const_iterator it = color_transforms.constBegin();
-             it != color_transforms.constEnd(); ++it) {
-            QMenu *subMenu = inputMenu->addMenu(it.key());
+    // Depth, masks and the like read better in false color, over a range that fits them.
+    QAction *heatmapAction = channelMenu->addAction("False Color", this, [this](bool checked) {
+        this->setHeatmap(checked, this->heatmap_low, this->heatmap_high);
+    });
+    heatmapAction->setCheckable(true);
+    heatmapAction->setChecked(this->show_heatmap);
 
-            for (const QString transform: it.value()) {
-                subMenu->addAction(transform, this, []() {
-                    qDebug() << "Click";
-                });
-            }
+    QAction *fitAction = channelMenu->addAction("Fit False Color to Layer", this, [this]() {
+        if (!this->layer_stats.min.empty() && this->layer_stats.min[0] < this->layer_stats.max[0]) {
+            this->setHeatmap(true, this->layer_stats.min[0], this->layer_stats.max[0]);
         }
+    });
+    fitAction->setEnabled(this->scene_data.channels == 1);
 
-        /*
-         * Output colorspace menu.
-         */
-        QMenu *outputMenu = contextMenu.addMenu("Output Colorspace");
+    channelMenu->addAction("False Color Range...", this, [this]() {
+        bool ok = false;
+        QString range = QInputDialog::getText(this, "False Color Range", "low high", QLineEdit::Normal,
+                                              QString("%1 %2").arg(this->heatmap_low).arg(this->heatmap_high), &ok);
+        const QStringList values = range.split(' ', Qt::SkipEmptyParts);
+        bool low_ok = false;
+        bool high_ok = false;
+        const float low = values.value(0).toFloat(&low_ok);
+        const float high = values.value(1).toFloat(&high_ok);
+        if (ok && low_ok && high_ok && low != high) {
+            this->setHeatmap(true, low, high);
+        }
+    });
+    channelMenu->setEnabled(this->image != nullptr && !this->current_layer.isEmpty());
 
-        for (QMap<QString, QList<QString> >::const_iterator it = color_transforms.constBegin();
-             it != color_transforms.constEnd(); ++it) {
-            QMenu *subMenu = outputMenu->addMenu(it.key());
+    /*
+     * Cryptomatte menu, for the objects picked on a Cryptomatte layer.
+     */
+    if (this->cryptomatte) {
+        QMenu *matteMenu = contextMenu.addMenu("Cryptomatte");
+        QAction *copyAction = matteMenu->addAction("Copy Matte Names", this, [this]() {
+            QGuiApplication::clipboard()->setText(this->matteNames().join(", "));
+        });
+        copyAction->setEnabled(!this->matte_objects.isEmpty());
 
-            for (const QString transform: it.value()) {
-                subMenu->addAction(transform, this, []() {
-                    qDebug() << "Click";
-                });
-            }
+        QAction *clearAction = matteMenu->addAction("Clear Matte", this, [this]() {
+            this->clearMatte();
+        });
+        clearAction->setEnabled(!this->matte_objects.isEmpty());
+    }
+
+    /*
+     * A/B compare menu.
+     */
+    QMenu *compareMenu = contextMenu.addMenu("Compare");
+    compareMenu->addAction("Open B Image...", this, [this]() {
+        QString filename = QFileDialog::getOpenFileName(this, "Open B Image", QString(), "Images (*.exr *.png *.tif *.tiff *.jpg *.psd)");
+        if (!filename.isEmpty()) {
+            this->loadCompareImage(filename);
+        }
+    });
+
+    QMenu *compareLayerMenu = compareMenu->addMenu("B Layer");
+    for (const QString &layer: layers) {
+        compareLayerMenu->addAction(layer, this, [this, layer]() {
+            this->compareLayer(layer);
+        });
+    }
+
+    compareMenu->addSeparator();
+
+    const QList<QPair<QString, CompareMode> > modes = {
+        {"A", CompareMode::A}, {"B", CompareMode::B}, {"Wipe", CompareMode::Wipe},
+        {"Side by Side", CompareMode::SideBySide}, {"Onion Skin", CompareMode::OnionSkin},
+        {"Difference", CompareMode::Difference}
+    };
+    for (const auto &mode: modes) {
+        QAction *action = compareMenu->addAction(mode.first, this, [this, mode]() {
+            this->setCompareMode(mode.second);
+        });
+        action->setCheckable(true);
+        action->setChecked(this->compare_mode == mode.second);
+        action->setEnabled(mode.second == CompareMode::A || !this->compare.pixmap.isNull());
+    }
+
+    compareMenu->addSeparator();
+
+    QMenu *differenceMenu = compareMenu->addMenu("Difference Scale");
+    for (float scale: {1.0f, 10.0f, 100.0f}) {
+        QAction *action = differenceMenu->addAction(QString("x%1").arg(scale), this, [this, scale]() {
+            this->setDifferenceScale(scale, this->difference_threshold);
+        });
+        action->setCheckable(true);
+        action->setChecked(this->difference_scale == scale);
+    }
+
+    QMenu *thresholdMenu = compareMenu->addMenu("Heatmap Threshold");
+    for (float threshold: {0.0f, 0.001f, 0.01f, 0.1f}) {
+        QString label = threshold > 0.0f ? QString::number(threshold) : QString("Off");
+        QAction *action = thresholdMenu->addAction(label, this, [this, threshold]() {
+            this->setDifferenceScale(this->difference_scale, threshold);
+        });
+        action->setCheckable(true);
+        action->setChecked(this->difference_threshold == threshold);
+    }
+
+    contextMenu.addSeparator();
+
+    QAction *invalidAction = contextMenu.addAction("Highlight NaN / Inf / Negative", this, [this](bool checked) {
+        this->setShowInvalidPixels(checked);
+    });
+    invalidAction->setCheckable(true);
+    invalidAction->setChecked(this->show_invalid_pixels);
+
+    QAction *checkerAction = contextMenu.addAction("Checkerboard Background", this, [this](bool checked) {
+        this->setShowCheckerboard(checked);
+    });
+    checkerAction->setCheckable(true);
+    checkerAction->setChecked(this->show_checkerboard);
+
+    contextMenu.addSeparator();
+
+    QMap<QString, QList<QString> > color_transforms;
+    if (this->color_manager) {
+        color_transforms = this->color_manager->getTransforms();
+    }
+
+    /*
+     * Input colorspace menu.
+     */
+    QMenu *inputMenu = contextMenu.addMenu("Input Colorspace");
+
+    for (QMap<QString, QList<QString> >::const_iterator it = color_transforms.constBegin();
+         it != color_transforms.constEnd(); ++it) {
+        QMenu *subMenu = inputMenu->addMenu(it.key());
+
+        for (const QString transform: it.value()) {
+            subMenu->addAction(transform, this, []() {
+                qDebug() << "Click";
+            });
+        }
+    }
+
+    /*
+     * Output colorspace menu.
+     */
+    QMenu *outputMenu = contextMenu.addMenu("Output Colorspace");
+
+    for (QMap<QString, QList<QString> >::const_iterator it = color_transforms.constBegin();
+         it != color_transforms.constEnd(); ++it) {
+        QMenu *subMenu = outputMenu->addMenu(it.key());
+
+        for (const QString transform: it.value()) {
+            subMenu->addAction(transform, this, []() {
+                qDebug() << "Click";
+            });
         }
     }
 
@@ -110,53 +283,59 @@ void Viewport::showContextMenu(const QPoint &pos) {
 }
 
 
-QGraphicsPixmapItem *Viewport::createPixmapItem(const Image::ChannelData &channelData) {
+QImage Viewport::createDisplayImage(const Image::ChannelData &channelData, bool checkerboard, int x, int y) {
+    EXRAY_TRACE_SCOPE("quantize");
+
     // Validate input data
     if (channelData.data.empty() || channelData.width <= 0 || channelData.height <= 0) {
         qDebug() << "Error: Invalid channel data for pixmap creation";
-        return nullptr;
+        return QImage();
     }
 
-    // We need at least 3 channels (RGB) for display
-    if (channelData.channels < 3) {
-        qDebug() << "Error: Need at least 3 channels for display";
-        return nullptr;
+    // We need at least 3 channels (RGB) for display, or a single one shown as gray
+    if (channelData.channels < 3 && channelData.channels != 1) {
+        qDebug() << "Error: Need 1 or at least 3 channels for display";
+        return QImage();
     }
 
-    // Create QImage - we'll use RGBA format for consistency
-    QImage image(channelData.width, channelData.height, QImage::Format_RGBA8888);
+    // Create QImage - RGBA, or a byte a pixel for a single channel
+    const bool single = channelData.channels == 1;
+    QImage image = BufferPool::instance().image(channelData.width, channelData.height,
+                                                single ? QImage::Format_Grayscale8 : QImage::Format_RGBA8888);
 
-    // Convert float data to 8-bit and populate QImage
-    for (int y = 0; y < channelData.height; ++y) {
-        for (int x = 0; x < channelData.width; ++x) {
-            int pixelIdx = y * channelData.width + x;
-            int dataIdx = pixelIdx * channelData.channels;
+    // Take the pointers up front, scanLine() may detach and isn't safe across threads.
+    uchar *bits = image.bits();
+    qsizetype bytes_per_line = image.bytesPerLine();
+    const float *pixels = channelData.data.data();
+    const int width = channelData.width;
+    const int channels = channelData.channels;
 
-            // Get float values (0.0 to 1.0 range)
-            float r = channelData.data[dataIdx + 0];
-            float g = channelData.data[dataIdx + 1];
-            float b = channelData.data[dataIdx + 2];
-            float a = (channelData.channels >= 4) ? channelData.data[dataIdx + 3] : 1.0f;
+    // Clamp to 0-1 and quantize to 8-bit, optionally over a checkerboard so alpha shows. The
+    // checkerboard lines up with the full frame when this is only a part of it, starting at x, y.
+    TaskScheduler::parallelFor(0, channelData.height, [&](int64_t row) {
+        const float *source = pixels + size_t(row) * width * channels;
+        uint8_t *line = bits + row * bytes_per_line;
+        if (single) {
+            PixelOps::toGray8(source, width, line);
+        } else if (checkerboard) {
+            PixelOps::toRgba8OverCheckerboard(source, width, channels, line, x, y + int(row));
+        } else {
+            PixelOps::toRgba8(source, width, channels, line);
+        }
+    });
 
-            // Clamp values to valid range
-            r = std::max(0.0f, std::min(1.0f, r));
-            g = std::max(0.0f, std::min(1.0f, g));
-            b = std::max(0.0f, std::min(1.0f, b));
-            a = std::max(0.0f, std::min(1.0f, a));
+    return image;
+}
 
-            // Convert to 8-bit values (0-255)
-            quint8 r8 = static_cast<quint8>(r * 255.0f);
-            quint8 g8 = static_cast<quint8>(g * 255.0f);
-            quint8 b8 = static_cast<quint8>(b * 255.0f);
-            quint8 a8 = static_cast<quint8>(a * 255.0f);
 
-            // Set pixel in QImage
-            QRgb pixel = qRgba(r8, g8, b8, a8);
-            image.setPixel(x, y, pixel);
-        }
+QGraphicsPixmapItem *Viewport::createPixmapItem(const Image::ChannelData &channelData) {
+    QImage image = createDisplayImage(channelData);
+    if (image.isNull()) {
+        return nullptr;
     }
 
     // Create QPixmap from QImage
+    EXRAY_TRACE_SCOPE("upload");
     QPixmap pixmap = QPixmap::fromImage(image);
 
     // Create QGraphicsPixmapItem
@@ -165,9 +344,6 @@ QGraphicsPixmapItem *Viewport::createPixmapItem(const Image::ChannelData &channe
     // Optional: Set some useful properties
     pixmapItem->setTransformationMode(Qt::SmoothTransformation);
 
-    qDebug() << "Created pixmap item:" << channelData.width << "x" << channelData.height
-            << "with" << channelData.channels << "channels";
-
     return pixmapItem;
 }
 
@@ -189,3 +365,1103 @@ QGraphicsPixmapItem *Viewport::displayChannel(const QString &channelBaseName, co
 
     return pixmapItem;
 }
+
+
+
+DisplayPipeline::Settings Viewport::displaySettings() const {
+    DisplayPipeline::Settings settings = {this->color_manager, this->input_colorspace, this->output_colorspace,
+                                          this->gamma, this->show_checkerboard};
+    settings.heatmap = this->show_heatmap;
+    settings.heatmap_low = this->heatmap_low;
+    settings.heatmap_high = this->heatmap_high;
+    return settings;
+}
+
+
+Image::ChannelData Viewport::toDisplay(const Image::ChannelData &sceneData, ColorManager *colorManager,
+                                       const QString &inputColorSpace, const QString &outputColorSpace, float gamma) {
+    // Convert from input color space to ACEScg
+    Image::ChannelData transformedData;
+    {
+        EXRAY_TRACE_SCOPE("ocio.input");
+        transformedData = colorManager->transform(sceneData, inputColorSpace, "ACEScg");
+    }
+
+    // Add a gamma correction.
+    transformedData = Image::applyGammaCorrection(transformedData, gamma);
+
+    // Convert from ACEScg to the output color space
+    EXRAY_TRACE_SCOPE("ocio.output");
+    return colorManager->transform(transformedData, "ACEScg", outputColorSpace);
+}
+
+
+Viewport::Frame Viewport::renderFrame(Image *image, const QString &layer, const QString &component,
+                                      const DisplayPipeline::Settings &settings) {
+    Frame frame;
+    frame.layer = layer;
+    frame.component = component;
+    frame.scheduler = TaskScheduler::instance().snapshot();
+
+    // The raw scene-linear values of the layer, their display values and the display pixels, in one pass.
+    DisplayPipeline::Result result = DisplayPipeline::run(image, layer, component, settings, DisplayPipeline::KeepScene | DisplayPipeline::KeepDisplay
+                                                          | DisplayPipeline::KeepImage);
+    if (result.scene_data.data.empty()) {
+        qDebug() << "No data for layer:" << layer << component;
+        return frame;
+    }
+
+    frame.scene_data = std::move(result.scene_data);
+    frame.display_data = std::move(result.display_data);
+    frame.display_image = std::move(result.display_image);
+    return frame;
+}
+
+
+void Viewport::displayLayer(const QString &layer, const QString &component) {
+    // Nothing to show until an image is open.
+    if (!this->image || !this->color_manager) {
+        return;
+    }
+
+    // Real work goes first, whatever is being made ahead is dropped.
+    this->prefetcher->cancel();
+    int64_t frame_start = Trace::now();
+
+    Frame frame;
+    Prefetcher::Made made;
+    if (component == "all" && this->prefetcher->take(this->image->filename, layer, this->displaySettings(), made)) {
+        frame = Viewport::madeFrame(made);
+    } else {
+        frame = renderFrame(this->image, layer, component, this->displaySettings());
+    }
+    if (frame.display_image.isNull()) {
+        return;
+    }
+
+    this->showFrame(frame, frame_start, {});
+}
+
+
+Viewport::Frame Viewport::madeFrame(Prefetcher::Made &made) {
+    Frame frame;
+    frame.layer = made.layer;
+    frame.component = "all";
+    frame.scene_data = std::move(made.result.scene_data);
+    frame.display_data = std::move(made.result.display_data);
+    frame.display_image = std::move(made.result.display_image);
+    frame.scheduler = TaskScheduler::instance().snapshot();
+    return frame;
+}
+
+
+void Viewport::showFrame(Frame &frame, int64_t frameStart, const QList<QPair<QString, double>> &timings) {
+    // Everything of the frame is made again below.
+    this->settle_timer.stop();
+
+    {
+        EXRAY_TRACE_SCOPE("upload");
+        this->pixmap_a = QPixmap::fromImage(frame.display_image);
+    }
+
+    if (!this->pixmap_item) {
+        this->pixmap_item = new QGraphicsPixmapItem();
+        this->pixmap_item->setTransformationMode(Qt::SmoothTransformation);
+        this->scene()->addItem(this->pixmap_item);
+    }
+
+    // Set the item position based on its width and height, a preview may have left it scaled up.
+    this->pixmap_item->setScale(1.0);
+    this->pixmap_item->setPos(frame.display_image.width() / -2, frame.display_image.height() / -2);
+
+    this->current_layer = frame.layer;
+    this->current_component = frame.component;
+    this->session->storePreview(QString::fromStdString(this->image->filename), frame.layer, frame.display_image);
+    this->scene_data = std::move(frame.scene_data);
+    this->display_data = std::move(frame.display_data);
+
+    // Rebuild the probe tables for the new layer.
+    {
+        EXRAY_TRACE_SCOPE("probe");
+        this->probe.setSceneData(&this->scene_data);
+        this->probe.setDisplayData(&this->display_data);
+    }
+
+    // Check the layer for NaN, Inf and negative values.
+    {
+        EXRAY_TRACE_SCOPE("stats");
+        this->layer_stats = ImageStats::analyze(this->scene_data);
+    }
+    this->updateOverlay();
+    this->updateCryptomatte();
+
+    // A compared file follows along to the same layer.
+    if (!this->compare.file.isEmpty() && this->compare.follow_layer) {
+        this->updateCompareSource();
+    }
+
+    this->difference_dirty = true;
+    this->updateCompareItems();
+
+    // Per stage timings of this frame for the HUD, the stages done on a worker come in with it.
+    this->frame_timings = timings + Trace::summarize(frameStart);
+    this->frame_time = double(Trace::now() - frameStart) / 1e6;
+    this->frame_utilization = TaskScheduler::utilization(frame.scheduler, TaskScheduler::instance().snapshot());
+    if (this->show_timing_hud) {
+        this->viewport()->update();
+    }
+
+    // From here the user is likely to go on to the neighbours.
+    this->prefetcher->predict(this->image->filename, this->image->getlayers(), this->current_layer,
+                              this->displaySettings());
+
+    emit layerDisplayed();
+    emit statsComputed(this->layer_stats);
+}
+
+
+void Viewport::updateRegions(const std::vector<Image::Region> &regions) {
+    if (!this->image) {
+        return;
+    }
+
+    std::vector<ROI> changed;
+    for (const Image::Region &region: regions) {
+        if (this->image->updatePixels(region)) {
+            changed.push_back(region.roi);
+        }
+    }
+    this->showRegions(changed);
+}
+
+
+void Viewport::showRegions(const std::vector<ROI> &regions) {
+    if (!this->image || !this->color_manager || this->current_layer.isEmpty() || this->pixmap_a.isNull()
+        || regions.empty()) {
+        return;
+    }
+
+    // What was made ahead from the file is stale now.
+    this->prefetcher->cancel();
+    this->prefetcher->forget(this->image->filename);
+
+    int64_t frame_start = Trace::now();
+    const TaskScheduler::Snapshot scheduler = TaskScheduler::instance().snapshot();
+
+    // Let go of the item's copy so painting doesn't detach the whole pixmap.
+    this->pixmap_item->setPixmap(QPixmap());
+    QPainter painter(&this->pixmap_a);
+    painter.setCompositionMode(QPainter::CompositionMode_Source);
+
+    // Only the changed rectangles go through the color and display stages.
+    for (const ROI &roi: regions) {
+        DisplayPipeline::Result result = DisplayPipeline::run(this->image, this->current_layer, this->current_component,
+                                                              this->displaySettings(), DisplayPipeline::KeepScene
+                                                              | DisplayPipeline::KeepDisplay | DisplayPipeline::KeepImage, roi);
+        const Image::ChannelData &sceneData = result.scene_data;
+        const Image::ChannelData &displayData = result.display_data;
+        if (sceneData.data.empty() || sceneData.channels != this->scene_data.channels) {
+            continue;
+        }
+
+        // Into the full frame buffers the probe and scopes read from.
+        TaskScheduler::parallelFor(0, sceneData.height, [&](int64_t row) {
+            size_t from = size_t(row) * sceneData.width * sceneData.channels;
+            size_t to = (size_t(roi.ybegin + row) * this->scene_data.width + roi.xbegin) * sceneData.channels;
+            std::copy_n(sceneData.data.data() + from, size_t(sceneData.width) * sceneData.channels, this->scene_data.data.data() + to);
+            std::copy_n(displayData.data.data() + from, size_t(sceneData.width) * sceneData.channels, this->display_data.data.data() + to);
+        });
+
+        painter.drawImage(roi.xbegin, roi.ybegin, result.display_image);
+    }
+    painter.end();
+
+    // What looks at the whole frame waits until the writer stops for a moment, not at every refresh.
+    this->settle_timer.start();
+
+    this->difference_dirty = true;
+    this->updateCompareItems();
+
+    this->frame_timings = Trace::summarize(frame_start);
+    this->frame_time = double(Trace::now() - frame_start) / 1e6;
+    this->frame_utilization = TaskScheduler::utilization(scheduler, TaskScheduler::instance().snapshot());
+    if (this->show_timing_hud) {
+        this->viewport()->update();
+    }
+
+    emit layerDisplayed();
+}
+
+
+void Viewport::settleRegions() {
+    if (!this->image || this->scene_data.data.empty()) {
+        return;
+    }
+
+    {
+        EXRAY_TRACE_SCOPE("probe");
+        this->probe.setSceneData(&this->scene_data);
+        this->probe.setDisplayData(&this->display_data);
+    }
+
+    {
+        EXRAY_TRACE_SCOPE("stats");
+        this->layer_stats = ImageStats::analyze(this->scene_data);
+    }
+    this->updateOverlay();
+    this->updateCryptomatte();
+
+    // Another layer of the same file changed along with it.
+    if (this->compare.image == this->image) {
+        this->updateCompareSource();
+    }
+
+    emit statsComputed(this->layer_stats);
+}
+
+
+void Viewport::openImage(const QString &filename) {
+    // Whatever is still loading is dropped.
+    if (this->loading) {
+        *this->loading = true;
+    }
+
+    // Made ahead of time, there's nothing left to load.
+    this->prefetcher->cancel();
+    Prefetcher::Made made;
+    if (this->prefetcher->take(filename.toStdString(), this->session->lastLayer(filename), this->displaySettings(), made)) {
+        const int64_t openStart = Trace::now();
+        Frame frame = Viewport::madeFrame(made);
+        this->finishOpen(made.image.release(), this->color_manager, frame, openStart, {}, openStart);
+        return;
+    }
+
+    auto cancelled = std::make_shared<std::atomic<bool>>(false);
+    this->loading = cancelled;
+
+    QPointer<Viewport> viewport(this);
+    std::shared_future<ColorManager *> colorManagerLoaded = this->session->colorManagerLoaded();
+    const QString lastLayer = this->session->lastLayer(filename);
+    const QList<QPair<QString, QString>> virtualLayers = this->session->virtualLayers();
+    const QString inputColorSpace = this->input_colorspace;
+    const QString outputColorSpace = this->output_colorspace;
+    const float gamma = this->gamma;
+    const DisplayPipeline::Settings settings = this->displaySettings();
+    const int64_t openStart = Trace::now();
+
+    // A file seen recently shows what it looked like right away.
+    QSize warmSize;
+    const QImage warm = this->session->preview(filename, warmSize);
+    if (!warm.isNull()) {
+        this->showPreview(warm, warmSize.width(), warmSize.height(), openStart);
+    }
+
+    TaskScheduler::instance().submit([=]() {
+        Image *image = new Image(filename.toStdString().c_str());
+        if (!image->inp) {
+            delete image;
+            return;
+        }
+
+        // It's handed over to the viewport once we're done with it here.
+        image->moveToThread(qApp->thread());
+        ColorManager *colorManager = colorManagerLoaded.get();
+
+        // The virtual layers of the session, as far as this file has what they use.
+        for (const auto &layer: virtualLayers) {
+            image->addVirtualLayer(layer.first, layer.second);
+        }
+
+        const QString layer = Viewport::startLayer(image, lastLayer);
+        const int width = image->inp->spec().width;
+        const int height = image->inp->spec().height;
+
+        QImage preview;
+        if (warm.isNull()) {
+            preview = Viewport::renderPreview(image, layer, colorManager, inputColorSpace, outputColorSpace, gamma);
+        }
+        if (*cancelled) {
+            delete image;
+            return;
+        }
+
+        if (!preview.isNull()) {
+            QMetaObject::invokeMethod(qApp, [viewport, cancelled, preview, width, height, openStart]() {
+                if (viewport && !*cancelled) {
+                    viewport->showPreview(preview, width, height, openStart);
+                }
+            }, Qt::QueuedConnection);
+        }
+
+        // Then the full resolution frame, everything but the upload still off the GUI thread.
+        const int64_t frameStart = Trace::now();
+        DisplayPipeline::Settings loaded = settings;
+        loaded.color_manager = colorManager;
+        auto frame = std::make_shared<Frame>(Viewport::renderFrame(image, layer, "all", loaded));
+        const QList<QPair<QString, double>> timings = Trace::summarize(frameStart);
+
+        QMetaObject::invokeMethod(qApp, [viewport, cancelled, image, colorManager, frame, frameStart, timings, openStart]() {
+            if (!viewport || *cancelled) {
+                delete image;
+                return;
+            }
+            viewport->finishOpen(image, colorManager, *frame, frameStart, timings, openStart);
+        }, Qt::QueuedConnection);
+    }, TaskScheduler::Priority::Interactive, cancelled);
+}
+
+
+QString Viewport::startLayer(Image *image, const QString &lastLayer) {
+    // Back to the layer it was last viewed with, or start on the combined pass or the plain RGBA channels.
+    const QList<QString> layers = image->getlayers();
+    if (layers.contains(lastLayer) || (lastLayer == "default" && layers.contains("R"))) {
+        return lastLayer;
+    } else if (layers.contains("ViewLayer.Combined")) {
+        return "ViewLayer.Combined";
+    } else if (layers.contains("R")) {
+        return "default";
+    }
+    return layers.value(0);
+}
+
+
+void Viewport::showImage(Image *image) {
+    // It takes the place of whatever is still loading.
+    if (this->loading) {
+        *this->loading = true;
+        this->loading.reset();
+    }
+    this->prefetcher->cancel();
+
+    const int64_t openStart = Trace::now();
+    ColorManager *colorManager = this->session->colorManagerLoaded().get();
+    for (const auto &layer: this->session->virtualLayers()) {
+        image->addVirtualLayer(layer.first, layer.second);
+    }
+
+    // A render keeps its layers from frame to frame.
+    const QString layer = Viewport::startLayer(image, this->current_layer);
+    const int64_t frameStart = Trace::now();
+    DisplayPipeline::Settings settings = this->displaySettings();
+    settings.color_manager = colorManager;
+    Frame frame = Viewport::renderFrame(image, layer, "all", settings);
+    this->finishOpen(image, colorManager, frame, frameStart, Trace::summarize(frameStart), openStart);
+}
+
+
+QImage Viewport::renderPreview(Image *image, const QString &layer, ColorManager *colorManager,
+                               const QString &inputColorSpace, const QString &outputColorSpace, float gamma) {
+    EXRAY_TRACE_SCOPE("preview");
+    if (!colorManager) {
+        return QImage();
+    }
+    ImageInput *input = image->inp.get();
+    ImageSpec spec = input->spec();
+
+    // Look for the smallest mip level that still covers the preview.
+    int level = 0;
+    while (input->seek_subimage(0, level + 1) && input->spec().width >= preview_width) {
+        spec = input->spec();
+        level++;
+    }
+
+    std::shared_ptr<FloatBuffer> mip;
+    if (level > 0) {
+        mip = std::make_shared<FloatBuffer>(size_t(spec.width) * spec.height * spec.nchannels);
+        if (!input->read_image(0, level, 0, spec.nchannels, TypeDesc::FLOAT, mip->data())) {
+            mip.reset();
+        }
+    }
+
+    // The full frame reads from the top level.
+    input->seek_subimage(0, 0);
+
+    if (mip) {
+        return ThumbnailStrip::renderThumbnail(*mip, spec, layer, colorManager, inputColorSpace, outputColorSpace, gamma,
+                                               preview_width, preview_height);
+    }
+
+    // Read in place, the full frame comes as quick as a preview would.
+    std::shared_ptr<const FloatBuffer> pixels;
+    std::shared_ptr<const ExrMapping> mapping;
+    if (!image->openPixels()) {
+        return QImage();
+    }
+    image->source(pixels, mapping);
+    if (!pixels) {
+        return QImage();
+    }
+
+    // No mips, box filter the full decode, which the full frame then reuses.
+    return ThumbnailStrip::renderThumbnail(*pixels, input->spec(), layer, colorManager, inputColorSpace,
+                                           outputColorSpace, gamma, preview_width, preview_height);
+}
+
+
+void Viewport::showPreview(const QImage &preview, int width, int height, int64_t openStart) {
+    if (!this->pixmap_item) {
+        this->pixmap_item = new QGraphicsPixmapItem();
+        this->pixmap_item->setTransformationMode(Qt::SmoothTransformation);
+        this->scene()->addItem(this->pixmap_item);
+    }
+
+    // Stretched over the size of the full frame that replaces it.
+    this->pixmap_item->setPixmap(QPixmap::fromImage(preview));
+    this->pixmap_item->setScale(double(width) / preview.width());
+    this->pixmap_item->setPos(width / -2, height / -2);
+
+    // Overlays belong to the previous frame.
+    for (QGraphicsItem *child: this->pixmap_item->childItems()) {
+        child->setVisible(false);
+    }
+
+    int64_t now = Trace::now();
+    Trace::record("first_pixel", openStart, now);
+    qDebug().noquote() << QString("Time to first pixel: %1 ms (%2 ms since launch)")
+            .arg(double(now - openStart) / 1e6, 0, 'f', 1).arg(double(now) / 1e6, 0, 'f', 1);
+}
+
+
+void Viewport::finishOpen(Image *image, ColorManager *colorManager, Frame &frame, int64_t frameStart,
+                          const QList<QPair<QString, double>> &timings, int64_t openStart) {
+    // A layer compare of the previous image goes with it.
+    if (this->compare.image == this->image) {
+        this->compare.image = nullptr;
+        this->compare.pixmap = QPixmap();
+        this->compare.scene_data = Image::ChannelData();
+        this->compare.display_data = Image::ChannelData();
+    }
+
+    delete this->image;
+    this->image = image;
+    this->color_manager = colorManager;
+
+    if (!frame.display_image.isNull()) {
+        this->showFrame(frame, frameStart, timings);
+    }
+
+    int64_t now = Trace::now();
+    Trace::record("full_resolution", openStart, now);
+    qDebug().noquote() << QString("Time to full resolution: %1 ms").arg(double(now - openStart) / 1e6, 0, 'f', 1);
+
+    emit imageOpened();
+}
+
+
+void Viewport::setShowTimingHud(bool show) {
+    this->show_timing_hud = show;
+
+    // Scrolling copies the old pixels along, which would drag the HUD with it.
+    this->setViewportUpdateMode(show ? QGraphicsView::FullViewportUpdate : QGraphicsView::MinimalViewportUpdate);
+    this->viewport()->update();
+}
+
+
+void Viewport::drawForeground(QPainter *painter, const QRectF &rect) {
+    if (!this->show_timing_hud) {
+        return;
+    }
+
+    // Drawn in widget coordinates so it stays put while panning and zooming.
+    painter->save();
+    painter->resetTransform();
+
+    QStringList lines;
+    for (const auto &stage: this->frame_timings) {
+        lines.append(QString("%1 %2 ms").arg(stage.first, -12).arg(stage.second, 8, 'f', 2));
+    }
+    lines.append(QString("%1 %2 ms").arg(QString("frame"), -12).arg(this->frame_time, 8, 'f', 2));
+
+    // How busy every worker was while the frame was made, eight to a line.
+    for (size_t i = 0; i < this->frame_utilization.size(); i += 8) {
+        QString line = QString("%1").arg(i == 0 ? QString("workers") : QString(), -12);
+        for (size_t k = i; k < std::min(i + 8, this->frame_utilization.size()); ++k) {
+            line += QString(" %1%").arg(int(std::lround(this->frame_utilization[k] * 100.0)), 3);
+        }
+        lines.append(line);
+    }
+
+    if (!Trace::isEnabled()) {
+        lines = {"tracing disabled"};
+    }
+
+    // How often a layer or file was already made when it was asked for.
+    const Prefetcher::Stats prefetch = this->prefetcher->stats();
+    lines.append(QString("%1 %2/%3 hits %4% %5 MB").arg(QString("prefetch"), -12).arg(prefetch.hits).arg(prefetch.lookups)
+                         .arg(prefetch.lookups ? int(std::lround(100.0 * prefetch.hits / prefetch.lookups)) : 0)
+                         .arg(double(prefetch.held_bytes) / (1024.0 * 1024.0), 0, 'f', 0));
+
+    // Frame buffers in use, and the ones kept for the next frame.
+    const BufferPool::Stats pool = BufferPool::instance().stats();
+    lines.append(QString("%1 %2 MB out %3 MB pooled %4 reused").arg(QString("buffers"), -12)
+                         .arg(double(pool.outstanding_bytes) / (1024.0 * 1024.0), 0, 'f', 0)
+                         .arg(double(pool.pooled_bytes) / (1024.0 * 1024.0), 0, 'f', 0).arg(pool.reuses));
+
+    QFont font("monospace");
+    font.setStyleHint(QFont::Monospace);
+    painter->setFont(font);
+    QFontMetrics metrics(font);
+
+    int width = 0;
+    for (const QString &line: lines) {
+        width = std::max(width, metrics.horizontalAdvance(line));
+    }
+    QRect box(8, 8, width + 16, metrics.height() * lines.size() + 12);
+
+    painter->fillRect(box, QColor(0, 0, 0, 160));
+    painter->setPen(QColor(230, 230, 230));
+    for (int i = 0; i < lines.size(); ++i) {
+        painter->drawText(box.left() + 8, box.top() + 6 + metrics.ascent() + i * metrics.height(), lines[i]);
+    }
+
+    painter->restore();
+}
+
+
+void Viewport::loadCompareImage(const QString &filename) {
+    if (!this->image) {
+        return;
+    }
+
+    // Made on a worker, what's shown as B so far stays until then.
+    this->compare.file = filename;
+    this->compare.follow_layer = true;
+    this->compare.start = true;
+    this->updateCompareSource();
+}
+
+
+bool Viewport::addVirtualLayer(const QString &definition, QString *error) {
+    if (!this->image) {
+        return false;
+    }
+
+    // "name = expression", or only the expression which then is its own name.
+    QString name = definition.trimmed();
+    QString expression = name;
+    int equals = definition.indexOf('=');
+    if (equals != -1) {
+        name = definition.left(equals).trimmed();
+        expression = definition.mid(equals + 1).trimmed();
+    }
+
+    if (!this->image->addVirtualLayer(name, expression, error)) {
+        return false;
+    }
+    if (this->compare.image && this->compare.image != this->image) {
+        this->compare.image->addVirtualLayer(name, expression);
+    }
+
+    this->session->addVirtualLayer(name, expression);
+    this->displayLayer(name, "all");
+    return true;
+}
+
+
+void Viewport::compareLayer(const QString &layer) {
+    if (!this->image) {
+        return;
+    }
+
+    if (this->compare.image && this->compare.image != this->image) {
+        delete this->compare.image;
+    }
+
+    // Another layer of the open file, its pixels are already decoded.
+    this->compare.image = this->image;
+    this->compare.file.clear();
+    this->compare.layer = layer;
+    this->compare.follow_layer = false;
+    this->compare.start = true;
+    this->updateCompareSource();
+}
+
+
+void Viewport::updateCompareSource() {
+    // Whatever is still being made for the B side is out of date.
+    if (this->comparing) {
+        *this->comparing = true;
+        this->comparing.reset();
+    }
+
+    const QString layer = this->compare.follow_layer ? this->current_layer : this->compare.layer;
+    const int keep = DisplayPipeline::KeepScene | DisplayPipeline::KeepDisplay | DisplayPipeline::KeepImage;
+
+    // Another layer of the open image, made right here like the A side, that image is only touched on the GUI thread.
+    if (this->compare.file.isEmpty()) {
+        DisplayPipeline::Result result = DisplayPipeline::run(this->compare.image, layer, this->current_component,
+                                                              this->displaySettings(), keep);
+        this->finishCompare(this->compare.image, result);
+        return;
+    }
+
+    auto cancelled = std::make_shared<std::atomic<bool>>(false);
+    this->comparing = cancelled;
+
+    QPointer<Viewport> viewport(this);
+    const QString filename = this->compare.file;
+    const QString component = this->current_component;
+    const QList<QPair<QString, QString>> virtualLayers = this->session->virtualLayers();
+    const DisplayPipeline::Settings settings = this->displaySettings();
+
+    TaskScheduler::instance().submit([=]() {
+        // An image of its own, the pixels come from the decode cache if the file was open before.
+        Image *image = new Image(filename.toStdString().c_str());
+        if (!image->inp) {
+            delete image;
+            return;
+        }
+
+        // It's handed over to the viewport once we're done with it here.
+        image->moveToThread(qApp->thread());
+        for (const auto &virtualLayer: virtualLayers) {
+            image->addVirtualLayer(virtualLayer.first, virtualLayer.second);
+        }
+
+        // Goes through the same cached processors as the A side.
+        auto result = std::make_shared<DisplayPipeline::Result>(DisplayPipeline::run(image, layer, component, settings, keep));
+        if (*cancelled) {
+            delete image;
+            return;
+        }
+
+        QMetaObject::invokeMethod(qApp, [viewport, cancelled, image, result]() {
+            if (!viewport || *cancelled) {
+                delete image;
+                return;
+            }
+            viewport->finishCompare(image, *result);
+        }, Qt::QueuedConnection);
+    }, TaskScheduler::Priority::Interactive, cancelled);
+}
+
+
+void Viewport::finishCompare(Image *image, DisplayPipeline::Result &result) {
+    // A file made on a worker takes the place of the one before.
+    if (this->compare.image != image) {
+        if (this->compare.image && this->compare.image != this->image) {
+            delete this->compare.image;
+        }
+        this->compare.image = image;
+    }
+
+    this->compare.scene_data = std::move(result.scene_data);
+    this->compare.display_data = std::move(result.display_data);
+    this->compare.pixmap = QPixmap();
+
+    if (!result.display_image.isNull()) {
+        this->compare.pixmap = QPixmap::fromImage(result.display_image);
+    }
+
+    this->compare.probe.setSceneData(&this->compare.scene_data);
+    this->compare.probe.setDisplayData(&this->compare.display_data);
+    this->difference_dirty = true;
+
+    const bool start = this->compare.start;
+    this->compare.start = false;
+    if (start && this->compare_mode == CompareMode::A) {
+        this->setCompareMode(CompareMode::Wipe);
+    } else {
+        this->updateCompareItems();
+    }
+}
+
+
+void Viewport::setCompareMode(CompareMode mode) {
+    if (mode != CompareMode::A && this->compare.pixmap.isNull()) {
+        qDebug() << "Nothing to compare against, load a B image or layer first";
+        return;
+    }
+
+    this->compare_mode = mode;
+
+    // Start a wipe in the middle of the frame.
+    if (mode == CompareMode::Wipe && (this->wipe_position <= 0 || this->wipe_position >= this->scene_data.width)) {
+        this->wipe_position = this->scene_data.width / 2;
+    }
+
+    this->updateCompareItems();
+    emit layerDisplayed();
+}
+
+
+void Viewport::setDifferenceScale(float scale, float threshold) {
+    this->difference_scale = scale;
+    this->difference_threshold = threshold;
+    this->difference_dirty = true;
+    this->updateCompareItems();
+}
+
+
+void Viewport::updateCompareItems() {
+    if (!this->pixmap_item) {
+        return;
+    }
+
+    if (!this->compare_clip) {
+        // B is drawn through a clipping rectangle, moving the wipe only changes the clip.
+        this->compare_clip = new QGraphicsRectItem(this->pixmap_item);
+        this->compare_clip->setPen(Qt::NoPen);
+        this->compare_clip->setFlag(QGraphicsItem::ItemClipsChildrenToShape);
+        this->compare_item = new QGraphicsPixmapItem(this->compare_clip);
+        this->compare_item->setTransformationMode(Qt::SmoothTransformation);
+
+        this->wipe_line = new QGraphicsLineItem(this->pixmap_item);
+        QPen pen(QColor(255, 255, 255, 180));
+        pen.setCosmetic(true);
+        this->wipe_line->setPen(pen);
+        this->wipe_line->setZValue(1);
+    }
+
+    const CompareMode mode = this->compare.pixmap.isNull() ? CompareMode::A : this->compare_mode;
+    const int width = this->pixmap_a.width();
+    const int height = this->pixmap_a.height();
+
+    // Showing either side on its own is only a pixmap swap.
+    QPixmap shown = this->pixmap_a;
+    if (mode == CompareMode::B) {
+        shown = this->compare.pixmap;
+    } else if (mode == CompareMode::Difference) {
+        if (this->difference_dirty) {
+            QImage difference = ImageCompare::difference(this->scene_data, this->compare.scene_data,
+                                                         this->difference_scale, this->difference_threshold);
+            this->pixmap_difference = QPixmap::fromImage(difference);
+            this->difference_dirty = false;
+        }
+        shown = this->pixmap_difference;
+    }
+    this->pixmap_item->setPixmap(shown);
+
+    bool overlaid = mode == CompareMode::Wipe || mode == CompareMode::SideBySide || mode == CompareMode::OnionSkin;
+    this->compare_clip->setVisible(overlaid);
+    this->wipe_line->setVisible(mode == CompareMode::Wipe);
+
+    if (this->overlay_item) {
+        this->overlay_item->setVisible(mode == CompareMode::A);
+    }
+
+    if (!overlaid) {
+        return;
+    }
+
+    this->compare_item->setPixmap(this->compare.pixmap);
+    this->compare_item->setOpacity(mode == CompareMode::OnionSkin ? 0.5 : 1.0);
+
+    if (mode == CompareMode::SideBySide) {
+        this->compare_clip->setPos(width + side_by_side_gap, 0);
+        this->compare_clip->setRect(0, 0, this->compare.pixmap.width(), this->compare.pixmap.height());
+    } else if (mode == CompareMode::Wipe) {
+        this->compare_clip->setPos(0, 0);
+        this->compare_clip->setRect(this->wipe_position, 0, width - this->wipe_position, height);
+        this->wipe_line->setLine(this->wipe_position, 0, this->wipe_position, height);
+    } else {
+        this->compare_clip->setPos(0, 0);
+        this->compare_clip->setRect(0, 0, width, height);
+    }
+}
+
+
+const Image::ChannelData &Viewport::shownSceneData() const {
+    return this->compare_mode == CompareMode::B && !this->compare.pixmap.isNull() ? this->compare.scene_data : this->scene_data;
+}
+
+
+const Image::ChannelData &Viewport::shownDisplayData() const {
+    return this->compare_mode == CompareMode::B && !this->compare.pixmap.isNull() ? this->compare.display_data : this->display_data;
+}
+
+
+const PixelProbe &Viewport::probeAt(QPoint &pixel) const {
+    if (this->compare.pixmap.isNull()) {
+        return this->probe;
+    }
+
+    switch (this->compare_mode) {
+        case CompareMode::B:
+            return this->compare.probe;
+        case CompareMode::Wipe:
+            return pixel.x() >= this->wipe_position ? this->compare.probe : this->probe;
+        case CompareMode::SideBySide:
+            // Pixels right of the gap belong to B.
+            if (pixel.x() >= this->scene_data.width + side_by_side_gap) {
+                pixel.rx() -= this->scene_data.width + side_by_side_gap;
+                return this->compare.probe;
+            }
+            return this->probe;
+        default:
+            return this->probe;
+    }
+}
+
+
+void Viewport::setShowInvalidPixels(bool show) {
+    this->show_invalid_pixels = show;
+    this->updateOverlay();
+}
+
+
+void Viewport::setHeatmap(bool show, float low, float high) {
+    this->show_heatmap = show;
+    this->heatmap_low = low;
+    this->heatmap_high = high;
+
+    if (!this->current_layer.isEmpty()) {
+        this->displayLayer(this->current_layer, this->current_component);
+    }
+}
+
+
+void Viewport::setShowCheckerboard(bool show) {
+    this->show_checkerboard = show;
+
+    // Alpha is baked into the pixmaps, so they are made again.
+    if (!this->current_layer.isEmpty()) {
+        this->displayLayer(this->current_layer, this->current_component);
+    }
+}
+
+
+void Viewport::updateOverlay() {
+    if (this->overlay_item) {
+        this->scene()->removeItem(this->overlay_item);
+        delete this->overlay_item;
+        this->overlay_item = nullptr;
+    }
+
+    // A clean layer has nothing to highlight.
+    if (!this->show_invalid_pixels || !this->pixmap_item || this->layer_stats.isClean(false)) {
+        return;
+    }
+
+    QImage overlay = ImageStats::overlay(this->scene_data);
+    if (overlay.isNull()) {
+        return;
+    }
+
+    // Parented to the layer so it follows it around, and kept sharp when zoomed in.
+    this->overlay_item = new QGraphicsPixmapItem(QPixmap::fromImage(overlay), this->pixmap_item);
+    this->overlay_item->setTransformationMode(Qt::FastTransformation);
+    this->overlay_item->setVisible(this->compare_mode == CompareMode::A || this->compare.pixmap.isNull());
+}
+
+
+QPoint Viewport::mapToPixel(const QPoint &pos) const {
+    if (!this->pixmap_item) {
+        return QPoint(-1, -1);
+    }
+
+    QPointF itemPos = this->pixmap_item->mapFromScene(this->mapToScene(pos));
+    return QPoint(int(std::floor(itemPos.x())), int(std::floor(itemPos.y())));
+}
+
+
+QRect Viewport::visibleImageRect() const {
+    if (!this->pixmap_item) {
+        return QRect();
+    }
+
+    // Part of the image that is on screen, in pixel coordinates.
+    QRectF visible = this->pixmap_item->mapFromScene(this->mapToScene(this->viewport()->rect())).boundingRect();
+    return visible.toAlignedRect().intersected(QRect(0, 0, this->scene_data.width, this->scene_data.height));
+}
+
+
+void Viewport::scrollContentsBy(int dx, int dy) {
+    QGraphicsView::scrollContentsBy(dx, dy);
+    emit visibleRegionChanged();
+}
+
+
+void Viewport::resizeEvent(QResizeEvent *event) {
+    QGraphicsView::resizeEvent(event);
+    emit visibleRegionChanged();
+}
+
+
+void Viewport::mousePressEvent(QMouseEvent *event) {
+    if (event->button() == Qt::LeftButton && this->pixmap_item && this->wipe_line && this->wipe_line->isVisible()) {
+        // In wipe mode the left button drags the wipe.
+        this->dragging_wipe = true;
+        this->wipe_position = std::clamp(this->mapToPixel(event->position().toPoint()).x(), 0, this->scene_data.width);
+        this->updateCompareItems();
+        return;
+    }
+
+    if (event->button() == Qt::LeftButton && this->pixmap_item) {
+        // Start dragging a region to measure.
+        this->dragging_region = true;
+        this->region_start = this->mapToPixel(event->position().toPoint());
+
+        if (!this->region_item) {
+            this->region_item = new QGraphicsRectItem(this->pixmap_item);
+            QPen pen(QColor(255, 220, 0));
+            pen.setCosmetic(true);
+            this->region_item->setPen(pen);
+            this->region_item->setZValue(1);
+        }
+        this->region_item->setVisible(true);
+
+        this->updateRegion(this->region_start);
+        return;
+    }
+
+    QGraphicsView::mousePressEvent(event);
+}
+
+
+void Viewport::mouseMoveEvent(QMouseEvent *event) {
+    QPoint pixel = this->mapToPixel(event->position().toPoint());
+
+    if (this->dragging_wipe) {
+        this->wipe_position = std::clamp(pixel.x(), 0, this->scene_data.width);
+        this->updateCompareItems();
+    }
+
+    if (this->dragging_region) {
+        this->updateRegion(pixel);
+    }
+
+    const PixelProbe &probe = this->probeAt(pixel);
+    emit pixelProbed(probe.sample(pixel.x(), pixel.y()));
+
+    if (this->cryptomatte) {
+        uint32_t id = this->cryptomatte->objectAt(pixel.x(), pixel.y());
+        if (id != this->hovered_object) {
+            this->hovered_object = id;
+            this->showMatte(this->hover_item, id ? QList<uint32_t>{id} : QList<uint32_t>(), QColor(255, 255, 255, 96));
+            emit objectHovered(id ? this->cryptomatte->name(id) : QString());
+        }
+    }
+
+    QGraphicsView::mouseMoveEvent(event);
+}
+
+
+void Viewport::mouseReleaseEvent(QMouseEvent *event) {
+    if (event->button() == Qt::LeftButton && this->dragging_wipe) {
+        this->dragging_wipe = false;
+        return;
+    }
+
+    if (event->button() == Qt::LeftButton && this->dragging_region) {
+        this->dragging_region = false;
+        QPoint pixel = this->mapToPixel(event->position().toPoint());
+        this->updateRegion(pixel);
+
+        // A click on a Cryptomatte adds the object to the matte, or takes it out again.
+        uint32_t id = this->cryptomatte && pixel == this->region_start ? this->cryptomatte->objectAt(pixel.x(), pixel.y()) : 0;
+        if (id) {
+            if (!this->matte_objects.removeOne(id)) {
+                this->matte_objects.append(id);
+            }
+            this->showMatte(this->matte_item, this->matte_objects, QColor(255, 220, 0, 128));
+        }
+        return;
+    }
+
+    QGraphicsView::mouseReleaseEvent(event);
+}
+
+
+void Viewport::updateRegion(const QPoint &pixel) {
+    // Both corners are inclusive, so a click measures a single pixel.
+    QRect rect = QRect(this->region_start, pixel).normalized();
+
+    if (this->region_item) {
+        this->region_item->setRect(rect);
+    }
+
+    // Measure on the side the region was started on.
+    QPoint start = this->region_start;
+    const PixelProbe &probe = this->probeAt(start);
+    rect.translate(start - this->region_start);
+
+    emit regionProbed(probe.region(rect));
+}
+
+
+void Viewport::updateCryptomatte() {
+    std::shared_ptr<const Cryptomatte> cryptomatte = this->image ? this->image->cryptomatte(this->current_layer) : nullptr;
+
+    // The matte stays for the same layer, of this file or the next one.
+    if (!cryptomatte || !this->cryptomatte || cryptomatte->layerName() != this->cryptomatte->layerName()) {
+        this->matte_objects.clear();
+    }
+
+    this->cryptomatte = cryptomatte;
+    this->hovered_object = 0;
+    this->showMatte(this->hover_item, {}, QColor());
+    this->showMatte(this->matte_item, this->matte_objects, QColor(255, 220, 0, 128));
+    emit objectHovered(QString());
+}
+
+
+void Viewport::showMatte(QGraphicsPixmapItem *&item, const QList<uint32_t> &ids, const QColor &color) {
+    Cryptomatte::Matte matte = this->cryptomatte ? this->cryptomatte->matte(ids) : Cryptomatte::Matte();
+    if (matte.coverage.empty()) {
+        if (item) {
+            item->setVisible(false);
+        }
+        return;
+    }
+
+    if (!item) {
+        item = new QGraphicsPixmapItem(this->pixmap_item);
+        item->setZValue(2);
+    }
+
+    // Only the rectangle around the objects, tinted by their coverage.
+    QImage image(matte.roi.width(), matte.roi.height(), QImage::Format_ARGB32);
+    for (int y = 0; y < image.height(); ++y) {
+        QRgb *line = reinterpret_cast<QRgb *>(image.scanLine(y));
+        const float *coverage = matte.coverage.data() + size_t(y) * image.width();
+        for (int x = 0; x < image.width(); ++x) {
+            line[x] = qRgba(color.red(), color.green(), color.blue(), int(color.alpha() * coverage[x] + 0.5f));
+        }
+    }
+
+    item->setPixmap(QPixmap::fromImage(image));
+    item->setPos(matte.roi.xbegin, matte.roi.ybegin);
+    item->setVisible(true);
+}
+
+
+QStringList Viewport::matteNames() const {
+    QStringList names;
+    for (uint32_t id: this->matte_objects) {
+        names.append(this->cryptomatte->name(id));
+    }
+    return names;
+}
+
+
+void Viewport::clearMatte() {
+    this->matte_objects.clear();
+    this->showMatte(this->matte_item, {}, QColor());
+}
+
+
+void Viewport::keyPressEvent(QKeyEvent *event) {
+    switch (event->key()) {
+        case Qt::Key_A:
+            this->setCompareMode(CompareMode::A);
+            break;
+        case Qt::Key_B:
+            this->setCompareMode(CompareMode::B);
+            break;
+        case Qt::Key_W:
+            this->setCompareMode(CompareMode::Wipe);
+            break;
+        case Qt::Key_S:
+            this->setCompareMode(CompareMode::SideBySide);
+            break;
+        case Qt::Key_O:
+            this->setCompareMode(CompareMode::OnionSkin);
+            break;
+        case Qt::Key_D:
+            this->setCompareMode(CompareMode::Difference);
+            break;
+        default:
+            QGraphicsView::keyPressEvent(event);
+    }
+}
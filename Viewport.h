@@ -15,10 +15,30 @@
 #include <QPointF>
 #include <QList>
 #include <QString>
+#include <QStringList>
 #include <QGraphicsItem>
+#include <QGraphicsRectItem>
+#include <QMouseEvent>
+#include <QResizeEvent>
+#include <QRect>
+#include <QKeyEvent>
+#include <QPixmap>
+#include <QPair>
+#include <QGraphicsLineItem>
+#include <QImage>
+#include <QTimer>
+#include <atomic>
+#include <future>
+#include <memory>
 #include <OpenColorIO/OpenColorIO.h>
 #include "Image.h"
 #include "ColorManager.h"
+#include "DisplayPipeline.h"
+#include "PixelProbe.h"
+#include "Prefetcher.h"
+#include "ImageStats.h"
+#include "Session.h"
+#include "TaskScheduler.h"
 
 namespace OCIO = OCIO_NAMESPACE;
 
@@ -26,18 +46,164 @@ class Viewport : public QGraphicsView {
     Q_OBJECT
 
     public:
-        Viewport(QWidget *parent = nullptr);
+        enum class CompareMode { A, B, Wipe, SideBySide, OnionSkin, Difference };
+        // The B side of a comparison, either another file or another layer of the same file.
+        struct CompareSource {
+            Image* image = nullptr;
+            // The other file, made on a worker, empty for a layer of the open image.
+            QString file;
+            QString layer;
+            bool follow_layer = true;
+            // Switches the viewer over from A once it's made.
+            bool start = false;
+            Image::ChannelData scene_data;
+            Image::ChannelData display_data;
+            PixelProbe probe;
+            QPixmap pixmap;
+        };
+        Viewport(Session *session, QWidget *parent = nullptr);
+        Session* session;
+        Prefetcher* prefetcher;
         OCIO::ConstConfigRcPtr ocio_config;
-        Image* image;
-        ColorManager* color_manager;
-        QGraphicsPixmapItem* createPixmapItem(const Image::ChannelData& channelData);
+        Image* image = nullptr;
+        ColorManager* color_manager = nullptr;
+        QString current_layer;
+        QString current_component;
+        QString input_colorspace = "Linear Rec.709 (sRGB)";
+        QString output_colorspace = "sRGB - Display";
+        float gamma = 1.0f;
+        Image::ChannelData scene_data;
+        Image::ChannelData display_data;
+        PixelProbe probe;
+        ImageStats::Result layer_stats;
+        bool show_invalid_pixels = false;
+        bool show_checkerboard = false;
+        // A single channel in false color, from heatmap_low to heatmap_high.
+        bool show_heatmap = false;
+        float heatmap_low = 0.0f;
+        float heatmap_high = 1.0f;
+        CompareSource compare;
+        CompareMode compare_mode = CompareMode::A;
+        float difference_scale = 1.0f;
+        float difference_threshold = 0.0f;
+        bool show_timing_hud = false;
+        static constexpr int preview_width = 960;
+        static constexpr int preview_height = 540;
+        static QImage createDisplayImage(const Image::ChannelData& channelData, bool checkerboard = false, int x = 0,
+                                         int y = 0);
+        static QGraphicsPixmapItem* createPixmapItem(const Image::ChannelData& channelData);
+        static Image::ChannelData toDisplay(const Image::ChannelData& sceneData, ColorManager* colorManager,
+                                            const QString& inputColorSpace, const QString& outputColorSpace, float gamma);
         QGraphicsPixmapItem* displayChannel(const QString& channelBaseName,
                                              const QString& component,
                                              const QString& inputColorSpace,
                                              const QString& outputColorSpace);
+        void displayLayer(const QString& layer, const QString& component);
+        void openImage(const QString& filename);
+        void updateRegions(const std::vector<Image::Region>& regions);
+        // The layer a file opens on, the one it was last seen with if it still has it.
+        static QString startLayer(Image* image, const QString& lastLayer);
+        // An image made elsewhere, the viewport owns it from here.
+        void showImage(Image* image);
+        // Rectangles whose pixels in the image are already new.
+        void showRegions(const std::vector<ROI>& regions);
+        QPoint mapToPixel(const QPoint& pos) const;
+        QRect visibleImageRect() const;
+        void setShowInvalidPixels(bool show);
+        void setShowCheckerboard(bool show);
+        void setHeatmap(bool show, float low, float high);
+        void loadCompareImage(const QString& filename);
+        void compareLayer(const QString& layer);
+        bool addVirtualLayer(const QString& definition, QString* error = nullptr);
+        QStringList matteNames() const;
+        void clearMatte();
+        void setCompareMode(CompareMode mode);
+        void setDifferenceScale(float scale, float threshold);
+        const Image::ChannelData& shownSceneData() const;
+        const Image::ChannelData& shownDisplayData() const;
+        // The transforms the shown layer is displayed with.
+        DisplayPipeline::Settings displaySettings() const;
+        void setShowTimingHud(bool show);
+
+    signals:
+        void pixelProbed(const PixelProbe::Sample& sample);
+        void regionProbed(const SummedAreaTable::Region& region);
+        void layerDisplayed();
+        void imageOpened();
+        void statsComputed(const ImageStats::Result& stats);
+        void visibleRegionChanged();
+        void objectHovered(const QString& name);
+
+    protected:
+        void mousePressEvent(QMouseEvent *event) override;
+        void mouseMoveEvent(QMouseEvent *event) override;
+        void mouseReleaseEvent(QMouseEvent *event) override;
+        void keyPressEvent(QKeyEvent *event) override;
+        void scrollContentsBy(int dx, int dy) override;
+        void resizeEvent(QResizeEvent *event) override;
+        void drawForeground(QPainter *painter, const QRectF &rect) override;
 
     protected slots:
         void showContextMenu(const QPoint &pos);
+
+    private:
+        // A layer taken all the way to display pixels, made off the GUI thread when opening.
+        struct Frame {
+            QString layer;
+            QString component;
+            Image::ChannelData scene_data;
+            Image::ChannelData display_data;
+            QImage display_image;
+            // The workers as they were when the frame started.
+            TaskScheduler::Snapshot scheduler;
+        };
+        static constexpr int side_by_side_gap = 16;
+        // How long a file written to has to stay put before the whole frame is looked at again.
+        static constexpr int settle_interval = 500;
+        QTimer settle_timer;
+        // Probe table, stats, overlay and Cryptomatte of the whole frame, after regions changed.
+        void settleRegions();
+        std::shared_ptr<std::atomic<bool>> loading;
+        std::shared_ptr<std::atomic<bool>> comparing;
+        QGraphicsPixmapItem* pixmap_item = nullptr;
+        QGraphicsRectItem* region_item = nullptr;
+        QGraphicsPixmapItem* overlay_item = nullptr;
+        QGraphicsRectItem* compare_clip = nullptr;
+        QGraphicsPixmapItem* compare_item = nullptr;
+        QGraphicsLineItem* wipe_line = nullptr;
+        QPixmap pixmap_a;
+        QPixmap pixmap_difference;
+        bool difference_dirty = true;
+        int wipe_position = 0;
+        bool dragging_wipe = false;
+        void updateOverlay();
+        QList<QPair<QString, double>> frame_timings;
+        double frame_time = 0.0;
+        std::vector<double> frame_utilization;
+        QPoint region_start;
+        bool dragging_region = false;
+        void updateRegion(const QPoint& pixel);
+        // Hover and matte of the objects on a Cryptomatte layer.
+        std::shared_ptr<const Cryptomatte> cryptomatte;
+        uint32_t hovered_object = 0;
+        QList<uint32_t> matte_objects;
+        QGraphicsPixmapItem* hover_item = nullptr;
+        QGraphicsPixmapItem* matte_item = nullptr;
+        void updateCryptomatte();
+        void showMatte(QGraphicsPixmapItem*& item, const QList<uint32_t>& ids, const QColor& color);
+        static Frame madeFrame(Prefetcher::Made& made);
+        static Frame renderFrame(Image* image, const QString& layer, const QString& component,
+                                 const DisplayPipeline::Settings& settings);
+        static QImage renderPreview(Image* image, const QString& layer, ColorManager* colorManager,
+                                    const QString& inputColorSpace, const QString& outputColorSpace, float gamma);
+        void showPreview(const QImage& preview, int width, int height, int64_t openStart);
+        void showFrame(Frame& frame, int64_t frameStart, const QList<QPair<QString, double>>& timings);
+        void finishOpen(Image* image, ColorManager* colorManager, Frame& frame, int64_t frameStart,
+                        const QList<QPair<QString, double>>& timings, int64_t openStart);
+        void updateCompareSource();
+        void finishCompare(Image* image, DisplayPipeline::Result& result);
+        void updateCompareItems();
+        const PixelProbe& probeAt(QPoint& pixel) const;
 };
 
 #endif //VIEWPORT_H
@@ -2,7 +2,11 @@
 #include <QPushButton>
 #include <QPalette>
 #include <QColor>
+#include <QDebug>
+#include <QFileInfo>
+#include <QStringList>
 #include "MainWindow.h"
+#include "Trace.h"
 
 // https://www.google.com/search?sca_esv=35e16478e05ded5f&sxsrf=AE3TifPhtCxTGeESfY0hkXJD6DNVRSEl9A:1753341175372&q=qt6+force+dark+palette&sa=X&ved=2ahUKEwjYk7bv-NSOAxVpgP0HHU-SJ4sQ7xYoAHoECAoQAQ&biw=1264&bih=641&dpr=1.25
 
@@ -30,7 +34,17 @@ int main(int argc, char *argv[]) {
 
     app.setPalette(darkPalette);
 
+    // Files to open come from the command line, the test image when there are none.
+    QStringList files = app.arguments().mid(1);
+    if (files.isEmpty() && QFileInfo::exists("../test.exr")) {
+        files.append("../test.exr");
+    }
+
+    // The window comes up empty, the config and image load in the background.
     MainWindow* window = new MainWindow();
     window->show();
+    qDebug().noquote() << QString("Window shown after %1 ms").arg(double(Trace::now()) / 1e6, 0, 'f', 1);
+
+    window->openFiles(files);
     return QApplication::exec();
 }
\ No newline at end of file
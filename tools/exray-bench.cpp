@@ -0,0 +1,945 @@
+#include <QApplication>
+#include <QFile>
+#include <QGraphicsPixmapItem>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QString>
+#include <QStringList>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <iterator>
+#include <new>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/resource.h>
+#include <OpenImageIO/imageio.h>
+#include "../BufferPool.h"
+#include "../ColorManager.h"
+#include "../DecodeCache.h"
+#include "../DisplayPipeline.h"
+#include "../ExrDecode.h"
+#include "../Image.h"
+#include "../PixelOps.h"
+#include "../ShotIndex.h"
+#include "../TaskScheduler.h"
+#include "../Trace.h"
+#include "../Viewport.h"
+
+/*
+ * Times the decode -> transform -> display pipeline on a synthetic EXR and prints JSON.
+ *
+ *   exray-bench [--width N] [--height N] [--channels N] [--type half|float] [--compression NAME]
+ *               [--iterations N] [--gamma G] [--threads N] [--output FILE] [--trace FILE] [--keep]
+ *   exray-bench --decode [--compressions LIST] [--thread-counts LIST] [--iterations N] [--output FILE] [file...]
+ *   exray-bench --verify
+ *   exray-bench --scan [--scan-files N] [--output FILE] [folder]
+ *
+ * Every stage reports its timings, throughput and operator new allocations per run, malloc calls
+ * aren't counted, so two commits can be compared by diffing their output, along with how busy
+ * every worker was end to end. The display chain runs a stage at a time and fused over tiles,
+ * fused_speedup is how much faster fused is. A single channel shown as gray goes through the chain
+ * and through the half table, channel_table_speedup is how much faster the table is, the
+ * mismatches are where the two differ.
+ * A layer switch runs with frame buffers from the pool and fresh from the system, pool_speedup is
+ * how much faster the pooled one is. With --compression none the file is read in place from a
+ * mapping, a file is opened with no other image to share a decode with, in place and decoded,
+ * mapped_speedup is how much faster in place is and mapped_mismatches counts the values where the
+ * two differ.
+ * --verify instead checks every PixelOps instruction set this CPU
+ * has against the scalar reference and exits with 1 when one is off.
+ *
+ * --decode times only the decode, by the library and chunked, of the files given or of a synthetic
+ * image written with every compression in the list, at every thread count. Every run reports MB/s of
+ * the file and of the decoded floats, and how it scales against the fewest threads.
+ *
+ * --scan indexes the EXR headers below the folder given, or below scan_files small synthetic ones,
+ * cold, again with nothing changed, and again with a few files touched, then times loading the
+ * index and a few filters over it.
+ */
+
+#ifndef EXRAY_GIT_COMMIT
+#define EXRAY_GIT_COMMIT ""
+#endif
+
+namespace fs = std::filesystem;
+
+
+// Every operator new in the process goes through here and is counted, plain malloc calls aren't.
+static std::atomic<uint64_t> allocation_count{0};
+static std::atomic<uint64_t> allocation_bytes{0};
+
+
+void* operator new(std::size_t size) {
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    allocation_bytes.fetch_add(size, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+
+void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+
+// The buffer pool asks for aligned memory, counted the same.
+void* operator new(std::size_t size, std::align_val_t alignment) {
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    allocation_bytes.fetch_add(size, std::memory_order_relaxed);
+    const std::size_t align = std::size_t(alignment);
+    if (void* p = std::aligned_alloc(align, (std::max<std::size_t>(size, 1) + align - 1) / align * align)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+
+void operator delete(void* p, std::align_val_t) noexcept {
+    std::free(p);
+}
+
+
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept {
+    std::free(p);
+}
+
+
+struct Options {
+    int width = 3840;
+    int height = 2160;
+    int channels = 4;
+    std::string type = "half";
+    std::string compression = "zip";
+    int iterations = 5;
+    float gamma = 1.0f;
+    // 0 keeps the scheduler's default.
+    int threads = 0;
+    QString output;
+    QString trace;
+    bool keep = false;
+    bool verify = false;
+    bool decode = false;
+    bool scan = false;
+    int scan_files = 2000;
+    std::vector<std::string> compressions = {"none", "rle", "zips", "zip", "piz", "pxr24", "b44", "b44a", "dwaa", "dwab"};
+    // Empty doubles from 1 up to the number of cores.
+    std::vector<int> thread_counts;
+    QStringList files;
+};
+
+
+// Writes ViewLayer.Combined RGBA followed by single channel AOVs, filled with a smooth HDR gradient.
+static bool writeSyntheticImage(const std::string& filename, const Options& options) {
+    ImageSpec spec(options.width, options.height, options.channels,
+                   options.type == "float" ? TypeDesc::FLOAT : TypeDesc::HALF);
+    spec.attribute("compression", options.compression);
+
+    const char* combined[4] = {"ViewLayer.Combined.R", "ViewLayer.Combined.G", "ViewLayer.Combined.B",
+                               "ViewLayer.Combined.A"};
+    spec.channelnames.clear();
+    for (int c = 0; c < options.channels; ++c) {
+        spec.channelnames.push_back(c < 4 ? combined[c] : "ViewLayer.AOV" + std::to_string(c - 4) + ".V");
+    }
+    spec.alpha_channel = options.channels >= 4 ? 3 : -1;
+
+    std::vector<float> pixels(size_t(options.width) * options.height * options.channels);
+    for (int y = 0; y < options.height; ++y) {
+        for (int x = 0; x < options.width; ++x) {
+            float* pixel = &pixels[(size_t(y) * options.width + x) * options.channels];
+            float u = float(x) / float(options.width);
+            float v = float(y) / float(options.height);
+            for (int c = 0; c < options.channels; ++c) {
+                pixel[c] = c == 3 ? 1.0f : (u * 4.0f + 0.01f) * (0.25f + v) * (1.0f + 0.1f * c);
+            }
+        }
+    }
+
+    auto out = ImageOutput::create(filename);
+    if (!out || !out->open(filename, spec)) {
+        std::fprintf(stderr, "exray-bench: could not create %s\n", filename.c_str());
+        return false;
+    }
+
+    bool ok = out->write_image(TypeDesc::FLOAT, pixels.data());
+    ok = out->close() && ok;
+    return ok;
+}
+
+
+// Random HDR values with the awkward ones mixed in, an odd count so the scalar tails run too.
+static std::vector<float> verificationPixels(size_t count, int channels) {
+    std::mt19937 random(7);
+    std::uniform_real_distribution<float> values(-4.0f, 64.0f);
+    std::uniform_real_distribution<float> alphas(0.0f, 1.0f);
+
+    std::vector<float> pixels(count * channels);
+    for (size_t i = 0; i < pixels.size(); ++i) {
+        pixels[i] = channels == 4 && i % 4 == 3 ? alphas(random) : values(random);
+    }
+
+    const float specials[] = {0.0f, -0.0f, NAN, INFINITY, -INFINITY, 1e-40f, 1e-30f, 1e30f, 3e38f, 1.0f, 0.5f};
+    for (size_t i = 0; i < std::size(specials); ++i) {
+        pixels[i * 5 % pixels.size()] = specials[i];
+    }
+    pixels[channels * 9 + channels - 1] = 0.0f;
+
+    return pixels;
+}
+
+
+// Largest relative error, where both agree on NaN and Inf and inputs below the normal range are skipped.
+static double relativeError(const std::vector<float>& input, const std::vector<float>& reference,
+                            const std::vector<float>& result, bool& mismatch) {
+    double worst = 0.0;
+
+    for (size_t i = 0; i < reference.size(); ++i) {
+        float a = reference[i];
+        float b = result[i];
+        if (std::isnan(a) || std::isnan(b) || std::isinf(a) || std::isinf(b)) {
+            mismatch = mismatch || (!(std::isnan(a) && std::isnan(b)) && a != b);
+            continue;
+        }
+        if (std::fabs(input[i]) < 1.17549435e-38f || a == b) {
+            continue;
+        }
+        worst = std::max(worst, std::fabs(double(a) - double(b)) / std::max(std::fabs(double(a)), 1e-30));
+    }
+
+    return worst;
+}
+
+
+static int verifyPixelOps() {
+    const size_t count = 4099;
+    const double gamma_tolerance = 1e-5;
+    bool failed = false;
+    QJsonArray results;
+
+    std::vector<PixelOps::Isa> isas;
+    for (PixelOps::Isa isa: {PixelOps::Isa::SSE42, PixelOps::Isa::AVX2, PixelOps::Isa::AVX512}) {
+        if (isa <= PixelOps::supportedIsa()) {
+            isas.push_back(isa);
+        }
+    }
+
+    // Runs an operation on a copy with the scalar reference and with the instruction set.
+    auto compare = [](PixelOps::Isa isa, auto&& input, auto&& operation) {
+        auto reference = input;
+        auto result = input;
+        PixelOps::setIsa(PixelOps::Isa::Scalar);
+        operation(reference);
+        PixelOps::setIsa(isa);
+        operation(result);
+        return std::make_pair(reference, result);
+    };
+
+    for (PixelOps::Isa isa: isas) {
+        for (int channels = 1; channels <= 4; ++channels) {
+            std::vector<float> input = verificationPixels(count, channels);
+
+            for (float gamma: {2.2f, 0.3f}) {
+                auto [reference, result] = compare(isa, input, [&](std::vector<float>& pixels) {
+                    PixelOps::gamma(pixels.data(), count, channels, gamma);
+                });
+                bool mismatch = false;
+                double error = relativeError(input, reference, result, mismatch);
+                bool ok = !mismatch && error <= gamma_tolerance;
+                failed = failed || !ok;
+
+                QJsonObject entry;
+                entry["isa"] = PixelOps::isaName(isa);
+                entry["op"] = QString("gamma %1").arg(gamma);
+                entry["channels"] = channels;
+                entry["max_relative_error"] = error;
+                entry["ok"] = ok;
+                results.append(entry);
+            }
+
+            // Everything else has to match the reference bit for bit.
+            auto [reference, result] = compare(isa, input, [&](std::vector<float>& pixels) {
+                PixelOps::exposure(pixels.data(), count, channels, 1.5f);
+                PixelOps::clamp(pixels.data(), count, channels, 0.0f, 1.0f);
+                if (channels == 4) {
+                    PixelOps::premultiply(pixels.data(), count);
+                    PixelOps::unpremultiply(pixels.data(), count);
+                }
+            });
+            bool ok = std::memcmp(reference.data(), result.data(), reference.size() * sizeof(float)) == 0;
+
+            for (bool checkerboard: {false, true}) {
+                auto [reference_bytes, result_bytes] = compare(isa, std::vector<uint8_t>(count * 4),
+                                                               [&](std::vector<uint8_t>& bytes) {
+                    if (checkerboard) {
+                        PixelOps::toRgba8OverCheckerboard(input.data(), count, channels, bytes.data(), 3, 5);
+                    } else {
+                        PixelOps::toRgba8(input.data(), count, channels, bytes.data());
+                    }
+                });
+                ok = ok && reference_bytes == result_bytes;
+            }
+            failed = failed || !ok;
+
+            QJsonObject entry;
+            entry["isa"] = PixelOps::isaName(isa);
+            entry["op"] = "exposure clamp premultiply quantize";
+            entry["channels"] = channels;
+            entry["ok"] = ok;
+            results.append(entry);
+        }
+    }
+
+    PixelOps::setIsa(PixelOps::supportedIsa());
+
+    QJsonObject report;
+    report["supported"] = PixelOps::isaName(PixelOps::supportedIsa());
+    report["results"] = results;
+    report["ok"] = !failed;
+
+    QByteArray json = QJsonDocument(report).toJson();
+    std::fwrite(json.constData(), 1, json.size(), stdout);
+    return failed ? 1 : 0;
+}
+
+
+static long peakRssKilobytes() {
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+
+// Runs a stage the requested number of times and summarizes it.
+static QJsonObject runStage(const QString& name, int iterations, double pixels, double bytes,
+                            const std::function<void()>& stage) {
+    std::vector<double> times;
+    uint64_t allocations = 0;
+    uint64_t allocated = 0;
+    const BufferPool::Stats pool_before = BufferPool::instance().stats();
+
+    for (int i = 0; i < iterations; ++i) {
+        uint64_t count_before = allocation_count.load();
+        uint64_t bytes_before = allocation_bytes.load();
+        auto start = std::chrono::steady_clock::now();
+
+        stage();
+
+        auto end = std::chrono::steady_clock::now();
+        times.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+        allocations += allocation_count.load() - count_before;
+        allocated += allocation_bytes.load() - bytes_before;
+    }
+
+    std::vector<double> sorted = times;
+    std::sort(sorted.begin(), sorted.end());
+    double mean = 0.0;
+    for (double t: times) {
+        mean += t;
+    }
+    mean /= times.size();
+    double median = sorted[sorted.size() / 2];
+
+    QJsonObject result;
+    result["stage"] = name;
+    result["min_ms"] = sorted.front();
+    result["median_ms"] = median;
+    result["mean_ms"] = mean;
+    result["mpixels_per_s"] = pixels / 1e6 / (median / 1000.0);
+    result["mb_per_s"] = bytes / 1e6 / (median / 1000.0);
+    result["new_allocations"] = double(allocations) / iterations;
+    result["new_allocated_bytes"] = double(allocated) / iterations;
+    // Frame buffers taken from the pool instead of the system.
+    const BufferPool::Stats pool_after = BufferPool::instance().stats();
+    result["pool_reuses"] = double(pool_after.reuses - pool_before.reuses) / iterations;
+    result["pool_allocations"] = double(pool_after.allocations - pool_before.allocations) / iterations;
+
+    std::fprintf(stderr, "%-18s %9.2f ms  %9.1f Mpix/s\n", name.toUtf8().constData(), median,
+                 pixels / 1e6 / (median / 1000.0));
+    return result;
+}
+
+
+// Decode throughput by compression, mode and thread count.
+static int benchDecode(Options options) {
+    std::vector<std::string> files;
+    std::vector<std::string> written;
+    for (const QString& file: options.files) {
+        files.push_back(file.toStdString());
+    }
+    if (files.empty()) {
+        for (const std::string& compression: options.compressions) {
+            options.compression = compression;
+            std::string filename = (fs::temp_directory_path() / ("exray-bench-decode-" + compression + ".exr")).string();
+            if (!writeSyntheticImage(filename, options)) {
+                return 2;
+            }
+            files.push_back(filename);
+            written.push_back(filename);
+        }
+    }
+
+    std::vector<int> thread_counts = options.thread_counts;
+    if (thread_counts.empty()) {
+        const int cores = std::max(1, int(std::thread::hardware_concurrency()));
+        for (int count = 1; count < cores; count *= 2) {
+            thread_counts.push_back(count);
+        }
+        thread_counts.push_back(cores);
+    }
+
+    QJsonArray runs;
+    for (const std::string& filename: files) {
+        auto input = ImageInput::open(filename);
+        if (!input) {
+            std::fprintf(stderr, "exray-bench: could not open %s\n", filename.c_str());
+            return 2;
+        }
+        const ImageSpec spec = input->spec();
+        const std::string compression = spec.get_string_attribute("compression", "none");
+        const double pixels = double(spec.width) * spec.height;
+        const double file_bytes = double(fs::file_size(filename));
+        const double decoded_bytes = pixels * spec.nchannels * sizeof(float);
+        std::vector<float> buffer(size_t(spec.width) * spec.height * spec.nchannels);
+
+        for (ExrDecode::Mode mode: {ExrDecode::Mode::Library, ExrDecode::Mode::Chunked}) {
+            double baseline = 0.0;
+
+            for (int threads: thread_counts) {
+                TaskScheduler::instance().setThreadCount(threads);
+                // The library decodes on OpenEXR's pool, as big as the run says for a fair comparison.
+                if (mode == ExrDecode::Mode::Library) {
+                    OIIO::attribute("exr_threads", threads);
+                }
+                const ExrDecode::Options decode = {mode, threads};
+                const QString name = QString("%1 %2 %3").arg(QString::fromStdString(compression),
+                                                             QString(ExrDecode::modeName(mode))).arg(threads);
+
+                bool ok = true;
+                QJsonObject run = runStage(name, options.iterations, pixels, decoded_bytes, [&]() {
+                    ok = ExrDecode::read(filename, input.get(), buffer.data(), decode) && ok;
+                });
+                OIIO::attribute("exr_threads", TaskScheduler::library_threads);
+                if (!ok) {
+                    std::fprintf(stderr, "exray-bench: could not decode %s\n", filename.c_str());
+                    return 2;
+                }
+
+                // Against the fewest threads of the same mode, 1 is perfect scaling.
+                const double median = run["median_ms"].toDouble();
+                if (baseline == 0.0) {
+                    baseline = median * thread_counts.front();
+                }
+                run["file"] = QString::fromStdString(fs::path(filename).filename().string());
+                run["compression"] = QString::fromStdString(compression);
+                run["mode"] = ExrDecode::modeName(mode);
+                run["threads"] = threads;
+                run["chunk_rows"] = ExrDecode::chunkRows(input.get());
+                run["file_mb_per_s"] = file_bytes / 1e6 / (median / 1000.0);
+                run["speedup"] = baseline / thread_counts.front() / median;
+                run["efficiency"] = baseline / (median * threads);
+                runs.append(run);
+            }
+        }
+    }
+
+    QJsonObject report;
+    report["commit"] = QString(EXRAY_GIT_COMMIT);
+    report["iterations"] = options.iterations;
+    report["decode"] = runs;
+    report["peak_rss_kb"] = double(peakRssKilobytes());
+
+    QByteArray json = QJsonDocument(report).toJson();
+    if (options.output.isEmpty()) {
+        std::fwrite(json.constData(), 1, json.size(), stdout);
+    } else {
+        QFile file(options.output);
+        if (!file.open(QIODevice::WriteOnly)) {
+            std::fprintf(stderr, "exray-bench: could not write %s\n", options.output.toUtf8().constData());
+            return 2;
+        }
+        file.write(json);
+    }
+
+    if (!options.keep) {
+        for (const std::string& filename: written) {
+            fs::remove(filename);
+        }
+    }
+    return 0;
+}
+
+
+// Small files in a folder, some cropped, some with a Cryptomatte, all with a shot name.
+static bool writeScanFolder(const fs::path& folder, int count) {
+    fs::create_directories(folder);
+    std::vector<float> pixels(64 * 36 * 4, 0.5f);
+
+    for (int i = 0; i < count; ++i) {
+        ImageSpec spec(64, 36, 4, TypeDesc::HALF);
+        spec.attribute("compression", i % 2 ? "zip" : "dwaa");
+        spec.attribute("shot", "sh" + std::to_string(i / 100 * 10));
+        if (i % 4 == 0) {
+            spec.full_width = 128;
+            spec.full_height = 72;
+            spec.x = 16;
+            spec.y = 8;
+        }
+        if (i % 8 == 0) {
+            spec.attribute("cryptomatte/0a1b2c3/name", "CryptoObject");
+        }
+
+        const std::string filename = (folder / ("frame." + std::to_string(1000 + i) + ".exr")).string();
+        auto out = ImageOutput::create(filename);
+        if (!out || !out->open(filename, spec) || !out->write_image(TypeDesc::FLOAT, pixels.data()) || !out->close()) {
+            std::fprintf(stderr, "exray-bench: could not create %s\n", filename.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+
+// Header scan of a folder, cold, unchanged and with a few files changed, and filters over the index.
+static int benchScan(const Options& options) {
+    fs::path folder = options.files.isEmpty() ? fs::temp_directory_path() / "exray-bench-scan"
+                                              : fs::path(options.files.front().toStdString());
+    const bool synthetic = options.files.isEmpty();
+    if (synthetic && !writeScanFolder(folder, options.scan_files)) {
+        return 2;
+    }
+    const QString root = QString::fromStdString(folder.string());
+    const QString index_file = QString::fromStdString((fs::temp_directory_path() / "exray-bench-scan.index").string());
+
+    QJsonObject report;
+    report["commit"] = QString(EXRAY_GIT_COMMIT);
+    report["threads"] = TaskScheduler::instance().threadCount();
+
+    auto describe = [](const ShotIndex::Scan& scan) {
+        QJsonObject run;
+        run["files"] = int(scan.entries.size());
+        run["opened"] = scan.opened;
+        run["reused"] = scan.reused;
+        run["failed"] = scan.failed;
+        run["ms"] = scan.ms;
+        run["files_per_s"] = scan.entries.size() / (scan.ms / 1000.0);
+        return run;
+    };
+
+    const ShotIndex::Scan cold = ShotIndex::scanFolder(root, {});
+    report["cold"] = describe(cold);
+    std::fprintf(stderr, "%-18s %9.2f ms  %9zu files\n", "scan cold", cold.ms, cold.entries.size());
+
+    const int64_t save_start = Trace::now();
+    if (!ShotIndex::save(index_file, root, cold.entries)) {
+        return 2;
+    }
+    report["save_ms"] = double(Trace::now() - save_start) / 1e6;
+    report["index_bytes"] = double(fs::file_size(index_file.toStdString()));
+
+    std::vector<ShotIndex::Entry> loaded;
+    const int64_t load_start = Trace::now();
+    if (!ShotIndex::load(index_file, root, loaded)) {
+        std::fprintf(stderr, "exray-bench: could not load %s\n", index_file.toUtf8().constData());
+        return 2;
+    }
+    report["load_ms"] = double(Trace::now() - load_start) / 1e6;
+
+    const ShotIndex::Scan unchanged = ShotIndex::scanFolder(root, loaded);
+    report["unchanged"] = describe(unchanged);
+    std::fprintf(stderr, "%-18s %9.2f ms  %9d opened\n", "scan unchanged", unchanged.ms, unchanged.opened);
+
+    // Only the synthetic files are ours to touch.
+    if (synthetic) {
+        for (size_t i = 0; i < loaded.size(); i += 100) {
+            fs::last_write_time(loaded[i].path.toStdString(), fs::file_time_type::clock::now());
+        }
+        const ShotIndex::Scan touched = ShotIndex::scanFolder(root, loaded);
+        report["touched"] = describe(touched);
+        std::fprintf(stderr, "%-18s %9.2f ms  %9d opened\n", "scan touched", touched.ms, touched.opened);
+    }
+
+    QJsonArray filters;
+    for (const QString& text: {"has:cryptomatte", "has:crop", "compression:dwaa meta:shot=sh10", "-has:crop frame.1"}) {
+        const ShotIndex::Filter filter = ShotIndex::parseFilter(text);
+        int matches = 0;
+        const int64_t start = Trace::now();
+        for (const ShotIndex::Entry& entry: cold.entries) {
+            matches += filter.matches(entry);
+        }
+
+        QJsonObject run;
+        run["filter"] = text;
+        run["matches"] = matches;
+        run["ms"] = double(Trace::now() - start) / 1e6;
+        filters.append(run);
+    }
+    report["filters"] = filters;
+    report["peak_rss_kb"] = double(peakRssKilobytes());
+
+    QByteArray json = QJsonDocument(report).toJson();
+    if (options.output.isEmpty()) {
+        std::fwrite(json.constData(), 1, json.size(), stdout);
+    } else {
+        QFile file(options.output);
+        if (!file.open(QIODevice::WriteOnly)) {
+            std::fprintf(stderr, "exray-bench: could not write %s\n", options.output.toUtf8().constData());
+            return 2;
+        }
+        file.write(json);
+    }
+
+    fs::remove(index_file.toStdString());
+    if (synthetic && !options.keep) {
+        fs::remove_all(folder);
+    }
+    return 0;
+}
+
+
+int main(int argc, char *argv[]) {
+    // Pixmaps need a QGuiApplication, but nothing is ever shown.
+    qputenv("QT_QPA_PLATFORM", "offscreen");
+    QApplication app(argc, argv);
+
+    Options options;
+    QStringList arguments = app.arguments().mid(1);
+
+    for (int i = 0; i < arguments.size(); ++i) {
+        const QString& argument = arguments[i];
+        QString value = i + 1 < arguments.size() ? arguments[i + 1] : QString();
+
+        if (argument == "--width") {
+            options.width = value.toInt(); i++;
+        } else if (argument == "--height") {
+            options.height = value.toInt(); i++;
+        } else if (argument == "--channels") {
+            options.channels = value.toInt(); i++;
+        } else if (argument == "--type") {
+            options.type = value.toStdString(); i++;
+        } else if (argument == "--compression") {
+            options.compression = value.toStdString(); i++;
+        } else if (argument == "--iterations") {
+            options.iterations = value.toInt(); i++;
+        } else if (argument == "--gamma") {
+            options.gamma = value.toFloat(); i++;
+        } else if (argument == "--threads") {
+            options.threads = value.toInt(); i++;
+        } else if (argument == "--output") {
+            options.output = value; i++;
+        } else if (argument == "--trace") {
+            options.trace = value; i++;
+        } else if (argument == "--keep") {
+            options.keep = true;
+        } else if (argument == "--verify") {
+            options.verify = true;
+        } else if (argument == "--decode") {
+            options.decode = true;
+        } else if (argument == "--scan") {
+            options.scan = true;
+        } else if (argument == "--scan-files") {
+            options.scan_files = value.toInt(); i++;
+        } else if (argument == "--compressions") {
+            options.compressions.clear();
+            for (const QString& compression: value.split(',')) {
+                options.compressions.push_back(compression.trimmed().toStdString());
+            }
+            i++;
+        } else if (argument == "--thread-counts") {
+            options.thread_counts.clear();
+            for (const QString& count: value.split(',')) {
+                options.thread_counts.push_back(std::max(1, count.toInt()));
+            }
+            i++;
+        } else if (!argument.startsWith("--")) {
+            options.files.append(argument);
+        } else {
+            std::fprintf(stderr, "usage: exray-bench [--width N] [--height N] [--channels N] [--type half|float]\n"
+                                 "                   [--compression NAME] [--iterations N] [--gamma G] [--threads N]\n"
+                                 "                   [--output FILE] [--trace FILE] [--keep]\n"
+                                 "       exray-bench --decode [--compressions LIST] [--thread-counts LIST] [--iterations N]\n"
+                                 "                   [--output FILE] [file...]\n"
+                                 "       exray-bench --verify\n"
+                                 "       exray-bench --scan [--scan-files N] [--output FILE] [folder]\n");
+            return 2;
+        }
+    }
+
+    if (options.verify) {
+        return verifyPixelOps();
+    }
+
+    if (options.threads > 0) {
+        TaskScheduler::instance().setThreadCount(options.threads);
+    }
+
+    if (options.decode) {
+        return benchDecode(options);
+    }
+
+    if (options.scan) {
+        return benchScan(options);
+    }
+
+    if (!options.files.isEmpty()) {
+        std::fprintf(stderr, "exray-bench: files are only read with --decode or --scan\n");
+        return 2;
+    }
+
+    if (options.width <= 0 || options.height <= 0 || options.channels < 3 || options.iterations <= 0) {
+        std::fprintf(stderr, "exray-bench: need a positive size, at least 3 channels and 1 iteration\n");
+        return 2;
+    }
+
+    std::string filename = (fs::temp_directory_path() / ("exray-bench-" + std::to_string(options.width) + "x"
+                            + std::to_string(options.height) + "-" + options.compression + ".exr")).string();
+    if (!writeSyntheticImage(filename, options)) {
+        return 2;
+    }
+    // Aged past the settle time, a file just written isn't read in place.
+    fs::last_write_time(filename, fs::file_time_type::clock::now()
+                                  - std::chrono::seconds(ExrMapping::settle_seconds + 1));
+
+    const QString layer = "ViewLayer.Combined";
+    const QString component = "all";
+    const QString input_colorspace = "Linear Rec.709 (sRGB)";
+    const QString output_colorspace = "sRGB - Display";
+
+    const double pixels = double(options.width) * options.height;
+    const double file_bytes = double(fs::file_size(filename));
+    const double layer_bytes = pixels * std::min(options.channels, 4) * sizeof(float);
+    const int n = options.iterations;
+
+    ColorManager color_manager;
+    // Build the processors up front, the cache would otherwise bill the first run.
+    color_manager.getProcessor(input_colorspace, "ACEScg");
+    color_manager.getProcessor("ACEScg", output_colorspace);
+
+    QJsonArray stages;
+
+    // A fresh Image each time, and a cache that only holds on while someone uses the buffer.
+    DecodeCache::instance().setBudget(0);
+    stages.append(runStage("decode", n, pixels, file_bytes, [&]() {
+        Image image(filename.c_str());
+        image.loadPixels();
+    }));
+
+    Image image(filename.c_str());
+    image.loadPixels();
+    if (!image.pixels) {
+        std::fprintf(stderr, "exray-bench: could not decode %s\n", filename.c_str());
+        return 2;
+    }
+
+    Image::ChannelData scene;
+    stages.append(runStage("extract", n, pixels, layer_bytes, [&]() {
+        scene = image.getChannelDataForOCIO(layer, component);
+    }));
+
+    Image::ChannelData working;
+    stages.append(runStage("transform_input", n, pixels, layer_bytes, [&]() {
+        working = color_manager.transform(scene, input_colorspace, "ACEScg");
+    }));
+
+    Image::ChannelData graded;
+    stages.append(runStage("gamma", n, pixels, layer_bytes, [&]() {
+        graded = Image::applyGammaCorrection(working, options.gamma);
+    }));
+
+    Image::ChannelData display;
+    stages.append(runStage("transform_output", n, pixels, layer_bytes, [&]() {
+        display = color_manager.transform(graded, "ACEScg", output_colorspace);
+    }));
+
+    stages.append(runStage("pixmap", n, pixels, layer_bytes, [&]() {
+        delete Viewport::createPixmapItem(display);
+    }));
+
+    // The display chain a stage at a time against fused over tiles, from the decoded pixels to the 8 bit image.
+    const DisplayPipeline::Settings settings = {&color_manager, input_colorspace, output_colorspace, options.gamma, false};
+    const QJsonObject staged = runStage("display_staged", n, pixels, layer_bytes, [&]() {
+        auto data = image.getChannelDataForOCIO(layer, component);
+        data = Viewport::toDisplay(data, &color_manager, input_colorspace, output_colorspace, options.gamma);
+        Viewport::createDisplayImage(data);
+    });
+    const QJsonObject fused = runStage("display_fused", n, pixels, layer_bytes, [&]() {
+        DisplayPipeline::run(&image, layer, component, settings, DisplayPipeline::KeepImage);
+    });
+    stages.append(staged);
+    stages.append(fused);
+    // What the viewer keeps for the probe and scopes on top, a layer switch. Once more with every
+    // buffer fresh from the system, as it was before the pool.
+    const QJsonObject kept = runStage("display_fused_kept", n, pixels, layer_bytes, [&]() {
+        DisplayPipeline::run(&image, layer, component, settings,
+                             DisplayPipeline::KeepScene | DisplayPipeline::KeepDisplay | DisplayPipeline::KeepImage);
+    });
+    const size_t pool_budget = BufferPool::instance().budget();
+    BufferPool::instance().setBudget(0);
+    const QJsonObject unpooled = runStage("display_fused_kept_unpooled", n, pixels, layer_bytes, [&]() {
+        DisplayPipeline::run(&image, layer, component, settings,
+                             DisplayPipeline::KeepScene | DisplayPipeline::KeepDisplay | DisplayPipeline::KeepImage);
+    });
+    BufferPool::instance().setBudget(pool_budget);
+    stages.append(kept);
+    stages.append(unpooled);
+
+    // One channel as gray, through the chain and looked up in the table of every half, which is made up front.
+    const QString channel = "R";
+    DisplayPipeline::Settings chain_settings = settings;
+    chain_settings.half_table = false;
+    const auto chained = DisplayPipeline::run(&image, layer, channel, chain_settings,
+                                              DisplayPipeline::KeepDisplay | DisplayPipeline::KeepImage);
+    const auto looked_up = DisplayPipeline::run(&image, layer, channel, settings,
+                                                DisplayPipeline::KeepDisplay | DisplayPipeline::KeepImage);
+    const QJsonObject channel_chain = runStage("display_channel_chain", n, pixels, layer_bytes, [&]() {
+        DisplayPipeline::run(&image, layer, channel, chain_settings, DisplayPipeline::KeepImage);
+    });
+    const QJsonObject channel_table = runStage("display_channel", n, pixels, layer_bytes, [&]() {
+        DisplayPipeline::run(&image, layer, channel, settings, DisplayPipeline::KeepImage);
+    });
+    stages.append(channel_chain);
+    stages.append(channel_table);
+
+    // Where the table and the chain disagree, and by how much.
+    int64_t mismatched_pixels = 0;
+    double max_difference = 0.0;
+    for (size_t i = 0; i < chained.display_data.data.size(); ++i) {
+        const float a = chained.display_data.data[i];
+        const float b = looked_up.display_data.data[i];
+        if (std::memcmp(&a, &b, sizeof(float)) != 0 && !(std::isnan(a) && std::isnan(b))) {
+            max_difference = std::max(max_difference, double(std::abs(a - b)));
+        }
+    }
+    const int pixel_bytes = chained.display_image.depth() / 8;
+    for (int y = 0; y < chained.display_image.height(); ++y) {
+        const uchar* a = chained.display_image.constScanLine(y);
+        const uchar* b = looked_up.display_image.constScanLine(y);
+        for (int x = 0; x < chained.display_image.width(); ++x) {
+            mismatched_pixels += std::memcmp(a + x * pixel_bytes, b + x * pixel_bytes, pixel_bytes) != 0;
+        }
+    }
+
+    const TaskScheduler::Snapshot before = TaskScheduler::instance().snapshot();
+    auto open = [&]() {
+        Image source(filename.c_str());
+        source.openPixels();
+        auto result = DisplayPipeline::run(&source, layer, component, settings,
+                                           DisplayPipeline::KeepScene | DisplayPipeline::KeepDisplay
+                                           | DisplayPipeline::KeepImage);
+        QPixmap::fromImage(result.display_image);
+    };
+    stages.append(runStage("end_to_end", n, pixels, file_bytes, open));
+
+    // An uncompressed file is read in place. Opened with nothing decoded to share, once in place
+    // and once decoded, and the values of the two have to agree.
+    QJsonObject open_mapped;
+    QJsonObject open_decoded;
+    int64_t mapped_mismatches = 0;
+    image.pixels.reset();
+    const bool mappable = ExrMapping::open(filename, image.inp->spec()) != nullptr;
+    if (mappable) {
+        Image mapped(filename.c_str());
+        mapped.openPixels();
+        ExrMapping::setEnabled(false);
+        Image decoded(filename.c_str());
+        decoded.openPixels();
+        ExrMapping::setEnabled(true);
+
+        const auto a = DisplayPipeline::run(&mapped, layer, component, settings, DisplayPipeline::KeepScene);
+        const auto b = DisplayPipeline::run(&decoded, layer, component, settings, DisplayPipeline::KeepScene);
+        const FloatBuffer& from_mapping = a.scene_data.data;
+        const FloatBuffer& from_decode = b.scene_data.data;
+        const size_t compared = std::min(from_mapping.size(), from_decode.size());
+        mapped_mismatches = int64_t(std::max(from_mapping.size(), from_decode.size()) - compared);
+        for (size_t i = 0; i < compared; ++i) {
+            mapped_mismatches += std::memcmp(&from_mapping[i], &from_decode[i], sizeof(float)) != 0;
+        }
+    }
+    if (mappable) {
+        open_mapped = runStage("open_mapped", n, pixels, file_bytes, open);
+        ExrMapping::setEnabled(false);
+        open_decoded = runStage("open_decoded", n, pixels, file_bytes, open);
+        ExrMapping::setEnabled(true);
+        stages.append(open_mapped);
+        stages.append(open_decoded);
+    }
+
+    QJsonArray utilization;
+    for (double busy: TaskScheduler::utilization(before, TaskScheduler::instance().snapshot())) {
+        utilization.append(busy);
+    }
+
+    QJsonObject config;
+    config["width"] = options.width;
+    config["height"] = options.height;
+    config["channels"] = options.channels;
+    config["type"] = QString::fromStdString(options.type);
+    config["compression"] = QString::fromStdString(options.compression);
+    config["iterations"] = options.iterations;
+    config["gamma"] = options.gamma;
+    config["threads"] = TaskScheduler::instance().threadCount();
+    config["file_bytes"] = file_bytes;
+    config["simd"] = PixelOps::isaName(PixelOps::isa());
+    config["decode"] = ExrDecode::modeName(ExrDecode::defaults().mode);
+
+    QJsonObject report;
+    report["commit"] = QString(EXRAY_GIT_COMMIT);
+    report["config"] = config;
+    report["stages"] = stages;
+    report["fused_speedup"] = staged["median_ms"].toDouble() / fused["median_ms"].toDouble();
+    report["channel_table_speedup"] = channel_chain["median_ms"].toDouble() / channel_table["median_ms"].toDouble();
+    report["channel_table_mismatched_pixels"] = double(mismatched_pixels);
+    report["channel_table_max_difference"] = max_difference;
+    report["worker_utilization"] = utilization;
+    report["pool_speedup"] = unpooled["median_ms"].toDouble() / kept["median_ms"].toDouble();
+    if (!open_mapped.isEmpty()) {
+        report["mapped_speedup"] = open_decoded["median_ms"].toDouble() / open_mapped["median_ms"].toDouble();
+        report["mapped_mismatches"] = double(mapped_mismatches);
+    }
+    const BufferPool::Stats pool = BufferPool::instance().stats();
+    QJsonObject buffer_pool;
+    buffer_pool["outstanding_bytes"] = double(pool.outstanding_bytes);
+    buffer_pool["pooled_bytes"] = double(pool.pooled_bytes);
+    buffer_pool["allocations"] = double(pool.allocations);
+    buffer_pool["reuses"] = double(pool.reuses);
+    report["buffer_pool"] = buffer_pool;
+    report["peak_rss_kb"] = double(peakRssKilobytes());
+
+    QByteArray json = QJsonDocument(report).toJson();
+
+    if (options.output.isEmpty()) {
+        std::fwrite(json.constData(), 1, json.size(), stdout);
+    } else {
+        QFile file(options.output);
+        if (!file.open(QIODevice::WriteOnly)) {
+            std::fprintf(stderr, "exray-bench: could not write %s\n", options.output.toUtf8().constData());
+            return 2;
+        }
+        file.write(json);
+    }
+
+    if (!options.trace.isEmpty()) {
+        Trace::exportChromeTrace(options.trace);
+    }
+
+    if (!options.keep) {
+        fs::remove(filename);
+    }
+
+    return 0;
+}
@@ -0,0 +1,154 @@
+#include <QCoreApplication>
+#include <QMap>
+#include <QString>
+#include <QStringList>
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+#include "../DecodeCache.h"
+#include "../Image.h"
+#include "../ImageStats.h"
+
+/*
+ * Headless QC gate. Scans files and directories for EXRs with NaN, Inf or negative pixels.
+ *
+ *   exray-qc [--negative] [--quiet] <file or directory>...
+ *
+ * Exits with 1 when any file fails, 2 when a file couldn't be read.
+ */
+
+namespace fs = std::filesystem;
+
+
+static std::vector<std::string> collectFiles(const QStringList& paths) {
+    std::vector<std::string> files;
+
+    for (const QString& path: paths) {
+        fs::path root(path.toStdString());
+
+        if (fs::is_directory(root)) {
+            for (const auto& entry: fs::recursive_directory_iterator(root)) {
+                std::string extension = entry.path().extension().string();
+                if (entry.is_regular_file() && (extension == ".exr" || extension == ".EXR")) {
+                    files.push_back(entry.path().string());
+                }
+            }
+        } else {
+            files.push_back(root.string());
+        }
+    }
+
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+
+static std::unique_ptr<Image> loadFile(const std::string& filename) {
+    auto image = std::make_unique<Image>(filename.c_str());
+    image->loadPixels();
+    return image;
+}
+
+
+int main(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+
+    bool fail_on_negative = false;
+    bool quiet = false;
+    QStringList paths;
+
+    for (const QString& argument: app.arguments().mid(1)) {
+        if (argument == "--negative") {
+            fail_on_negative = true;
+        } else if (argument == "--quiet") {
+            quiet = true;
+        } else {
+            paths.append(argument);
+        }
+    }
+
+    if (paths.isEmpty()) {
+        std::fprintf(stderr, "usage: exray-qc [--negative] [--quiet] <file or directory>...\n");
+        return 2;
+    }
+
+    std::vector<std::string> files = collectFiles(paths);
+    int failed = 0;
+    int unreadable = 0;
+
+    // Every file is read once, there's no point in keeping them around.
+    DecodeCache::instance().setBudget(0);
+
+    // Decode the next file while the current one is analyzed.
+    std::future<std::unique_ptr<Image>> next;
+    if (!files.empty()) {
+        next = std::async(std::launch::async, loadFile, files[0]);
+    }
+
+    for (size_t i = 0; i < files.size(); ++i) {
+        std::unique_ptr<Image> image = next.get();
+        if (i + 1 < files.size()) {
+            next = std::async(std::launch::async, loadFile, files[i + 1]);
+        }
+
+        if (!image->inp || !image->pixels) {
+            std::printf("%s: UNREADABLE\n", files[i].c_str());
+            unreadable++;
+            continue;
+        }
+
+        const ImageSpec& spec = image->inp->spec();
+        ImageStats::Result stats = ImageStats::analyze(image->pixels->data(), spec.width, spec.height,
+                                                       spec.nchannels, spec.channelnames, false);
+
+        bool clean = stats.isClean(!fail_on_negative);
+        if (!clean) {
+            failed++;
+        }
+
+        if (clean && quiet) {
+            continue;
+        }
+
+        std::printf("%s: %s  nan %llu  inf %llu  negative %llu\n", files[i].c_str(), clean ? "OK" : "FAIL",
+                    (unsigned long long) stats.nan_pixels, (unsigned long long) stats.inf_pixels,
+                    (unsigned long long) stats.negative_pixels);
+
+        // Break the problems down per layer.
+        QMap<QString, QList<unsigned long long>> layers;
+        for (int c = 0; c < stats.channels; ++c) {
+            QString layer = QString::fromStdString(stats.channel_names[c]);
+            int pos = layer.lastIndexOf('.');
+            if (pos != -1) {
+                layer = layer.left(pos);
+            }
+
+            QList<unsigned long long>& counts = layers[layer];
+            if (counts.isEmpty()) {
+                counts = {0, 0, 0};
+            }
+            counts[0] += stats.nan_count[c];
+            counts[1] += stats.inf_count[c];
+            counts[2] += stats.negative_count[c];
+        }
+
+        for (auto it = layers.constBegin(); it != layers.constEnd(); ++it) {
+            const QList<unsigned long long>& counts = it.value();
+            if (counts[0] || counts[1] || (fail_on_negative && counts[2])) {
+                std::printf("    %s  nan %llu  inf %llu  negative %llu\n", it.key().toUtf8().constData(),
+                            counts[0], counts[1], counts[2]);
+            }
+        }
+    }
+
+    std::printf("%zu files, %d failed, %d unreadable\n", files.size(), failed, unreadable);
+
+    if (unreadable) {
+        return 2;
+    }
+    return failed ? 1 : 0;
+}
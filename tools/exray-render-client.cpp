@@ -0,0 +1,192 @@
+#include <OpenImageIO/imageio.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "../RenderViewProtocol.h"
+
+/*
+ * Plays a renderer for the render view. Reads an EXR and hands it to the viewer bucket by bucket,
+ * the way a renderer would while it renders.
+ *
+ *   exray-render-client [--socket PATH] [--bucket N] [--delay MS] [--name NAME] <file>
+ *
+ * Only needs POSIX and OpenImageIO, it doubles as the example for hooking up a renderer.
+ */
+
+using namespace OIIO;
+
+
+static std::string defaultSocket() {
+    // Where the viewer listens unless told otherwise, see RenderServer::defaultPath().
+    if (const char *path = std::getenv("EXRAY_RENDER_VIEW")) {
+        return path;
+    }
+    const char *temp = std::getenv("TMPDIR");
+    std::string directory = temp && *temp ? temp : "/tmp";
+    if (directory.back() == '/') {
+        directory.pop_back();
+    }
+    return directory + "/exray-render-view";
+}
+
+
+static bool sendAll(int fd, const void *data, size_t size) {
+    const char *at = static_cast<const char*>(data);
+    while (size > 0) {
+        ssize_t sent = ::send(fd, at, size, MSG_NOSIGNAL);
+        if (sent <= 0) {
+            return false;
+        }
+        at += sent;
+        size -= size_t(sent);
+    }
+    return true;
+}
+
+
+static bool sendMessage(int fd, RenderViewProtocol::Type type, const std::string &payload) {
+    RenderViewProtocol::Header header{RenderViewProtocol::magic, uint32_t(type), uint32_t(payload.size())};
+    return sendAll(fd, &header, sizeof(header)) && sendAll(fd, payload.data(), payload.size());
+}
+
+
+static void appendString(std::string &payload, const std::string &text) {
+    uint32_t length = uint32_t(text.size());
+    payload.append(reinterpret_cast<const char*>(&length), sizeof(length));
+    payload.append(text);
+}
+
+
+int main(int argc, char *argv[]) {
+    std::string socket_path = defaultSocket();
+    std::string filename;
+    std::string name;
+    int bucket_size = 64;
+    int delay = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string argument = argv[i];
+        if (argument == "--socket" && i + 1 < argc) {
+            socket_path = argv[++i];
+        } else if (argument == "--bucket" && i + 1 < argc) {
+            bucket_size = std::max(1, std::atoi(argv[++i]));
+        } else if (argument == "--delay" && i + 1 < argc) {
+            delay = std::max(0, std::atoi(argv[++i]));
+        } else if (argument == "--name" && i + 1 < argc) {
+            name = argv[++i];
+        } else {
+            filename = argument;
+        }
+    }
+
+    if (filename.empty()) {
+        std::fprintf(stderr, "usage: exray-render-client [--socket PATH] [--bucket N] [--delay MS] [--name NAME] <file>\n");
+        return 2;
+    }
+    if (name.empty()) {
+        name = filename.substr(filename.find_last_of('/') + 1);
+    }
+
+    auto input = ImageInput::open(filename);
+    if (!input) {
+        std::fprintf(stderr, "Can't open %s: %s\n", filename.c_str(), OIIO::geterror().c_str());
+        return 2;
+    }
+    const ImageSpec spec = input->spec();
+    const size_t bytes = size_t(spec.width) * spec.height * spec.nchannels * sizeof(float);
+
+    // The frame lives in shared memory, the viewer maps it too.
+    const std::string segment = "/exray-render-" + std::to_string(getpid());
+    int shm = shm_open(segment.c_str(), O_CREAT | O_RDWR | O_EXCL, 0600);
+    if (shm < 0 || ftruncate(shm, off_t(bytes)) != 0) {
+        std::fprintf(stderr, "Can't create shared memory segment %s: %s\n", segment.c_str(), std::strerror(errno));
+        return 2;
+    }
+    void *mapped = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, shm, 0);
+    ::close(shm);
+    if (mapped == MAP_FAILED) {
+        std::fprintf(stderr, "Can't map shared memory segment %s: %s\n", segment.c_str(), std::strerror(errno));
+        shm_unlink(segment.c_str());
+        return 2;
+    }
+    float *frame = static_cast<float*>(mapped);
+
+    std::vector<float> pixels(size_t(spec.width) * spec.height * spec.nchannels);
+    if (!input->read_image(0, 0, 0, spec.nchannels, TypeDesc::FLOAT, pixels.data())) {
+        std::fprintf(stderr, "Can't read %s: %s\n", filename.c_str(), input->geterror().c_str());
+        shm_unlink(segment.c_str());
+        return 2;
+    }
+    input->close();
+
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    std::strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+    if (fd < 0 || ::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        std::fprintf(stderr, "No render view at %s: %s\n", socket_path.c_str(), std::strerror(errno));
+        shm_unlink(segment.c_str());
+        return 2;
+    }
+
+    RenderViewProtocol::Open open{RenderViewProtocol::version, spec.width, spec.height, spec.nchannels};
+    std::string payload(reinterpret_cast<const char*>(&open), sizeof(open));
+    appendString(payload, name);
+    for (int channel = 0; channel < spec.nchannels; ++channel) {
+        appendString(payload, spec.channelnames[channel]);
+    }
+    appendString(payload, segment);
+    bool ok = sendMessage(fd, RenderViewProtocol::Type::Open, payload);
+
+    // "Render" a bucket by writing its pixels into the frame, then say it's done.
+    const size_t row_values = size_t(spec.width) * spec.nchannels;
+    int buckets = 0;
+    const auto start = std::chrono::steady_clock::now();
+    for (int y = 0; ok && y < spec.height; y += bucket_size) {
+        for (int x = 0; ok && x < spec.width; x += bucket_size) {
+            RenderViewProtocol::Bucket bucket{x, std::min(x + bucket_size, spec.width), y,
+                                              std::min(y + bucket_size, spec.height), 0, spec.nchannels};
+            for (int row = bucket.ybegin; row < bucket.yend; ++row) {
+                const size_t offset = size_t(row) * row_values + size_t(bucket.xbegin) * spec.nchannels;
+                std::copy_n(pixels.data() + offset, size_t(bucket.xend - bucket.xbegin) * spec.nchannels, frame + offset);
+            }
+
+            ok = sendMessage(fd, RenderViewProtocol::Type::Bucket,
+                             std::string(reinterpret_cast<const char*>(&bucket), sizeof(bucket)));
+            buckets++;
+            if (delay > 0) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(delay));
+            }
+        }
+    }
+    ok = ok && sendMessage(fd, RenderViewProtocol::Type::Close, std::string());
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // Once the viewer hangs up it has read everything, the segment can go.
+    if (ok) {
+        ::shutdown(fd, SHUT_WR);
+        char rest;
+        while (::recv(fd, &rest, 1, 0) > 0) {
+        }
+    }
+    ::close(fd);
+    munmap(mapped, bytes);
+    shm_unlink(segment.c_str());
+
+    if (!ok) {
+        std::fprintf(stderr, "Render view went away after %d buckets\n", buckets);
+        return 1;
+    }
+    std::printf("%d buckets of %s in %.1f ms\n", buckets, name.c_str(), seconds * 1e3);
+    return 0;
+}